@@ -31,8 +31,23 @@ limitations under the License.
 #include "ILibAsyncServerSocket.h"
 #include "ILibAsyncSocket.h"
 
+#ifdef _POSIX
+#include <netinet/tcp.h>
+#endif
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+#include <linux/filter.h>
+#endif
+
+// On Linux, accept4() returns the new socket already non-blocking and close-on-exec, saving two fcntl() calls per connection
+#if defined(_POSIX) && defined(_GNU_SOURCE) && !defined(__APPLE__) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+#define MICROSTACK_ACCEPT4
+#endif
+
 #define DEBUGSTATEMENT(x)
 
+// Maximum number of connections accepted in one pass of the chain, so a connection storm can't starve the other modules
+#define ILibAsyncServerSocket_DefaultAcceptBudget 64
+
 #define INET_SOCKADDR_LENGTH(x) ((x==AF_INET6?sizeof(struct sockaddr_in6):sizeof(struct sockaddr_in)))
 
 struct ILibAsyncServerSocketModule
@@ -58,6 +73,10 @@ struct ILibAsyncServerSocketModule
 
 	void *Tag;
 	int Tag2;
+
+	int AcceptBudget;
+	ILibAsyncServerSocket_AcceptStats AcceptStats;
+
 	#ifndef MICROSTACK_NOTLS
 	SSL_CTX *ssl_ctx;
 #ifdef MICROSTACK_TLS_DETECT
@@ -69,6 +88,7 @@ struct ILibAsyncServerSocket_Data
 {
 	struct ILibAsyncServerSocketModule *module;
 	ILibAsyncServerSocket_BufferReAllocated Callback;
+	ILibAsyncServerSocket_OnWatermark WatermarkCallback;
 	void *user;
 };
 
@@ -134,7 +154,7 @@ void ILibAsyncServerSocket_OnInterruptSink(ILibAsyncSocket_SocketModule socketMo
 void ILibAsyncServerSocket_PreSelect(void* socketModule, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime)
 {
 	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)socketModule;
-	int flags,i;
+	int i;
 
 	UNREFERENCED_PARAMETER( writeset );
 	UNREFERENCED_PARAMETER( errorset );
@@ -146,25 +166,10 @@ void ILibAsyncServerSocket_PreSelect(void* socketModule, fd_set *readset, fd_set
 	//
 	if (module->listening == 0)
 	{
-		//
-		// Set the socket to non-block mode, so we can play nice and share the thread
-		//
-#ifdef _WIN32_WCE
-		flags = 1;
-		ioctlsocket(module->ListenSocket, FIONBIO, &flags);
-#elif WIN32
-		flags = 1;
-		ioctlsocket(module->ListenSocket, FIONBIO, (u_long *)(&flags));
-#elif _POSIX
-		flags = fcntl(module->ListenSocket, F_GETFL,0);
-		fcntl(module->ListenSocket, F_SETFL, O_NONBLOCK | flags);
-#endif
-
 		//
 		// Put the socket in Listen, and add it to the fdset for the Select loop
 		//
-		module->listening = 1;
-		listen(module->ListenSocket, 4);
+		ILibAsyncServerSocket_Listen(module);
 		#if defined(WIN32)
 		#pragma warning( push, 3 ) // warning C4127: conditional expression is constant
 		#endif
@@ -192,6 +197,37 @@ void ILibAsyncServerSocket_PreSelect(void* socketModule, fd_set *readset, fd_set
 		}
 	}
 }
+/*! \fn ILibAsyncServerSocket_Listen(ILibAsyncServerSocket_ServerModule ServerSocketModule)
+\brief Puts the listening socket in listen mode
+\par
+This is normally done when the chain is started. Servers sharing a port with \a ILibCreateAsyncServerSocketModuleEx
+join the SO_REUSEPORT group in the order they start listening, so call this to fix that order up front.
+\param ServerSocketModule The ILibAsyncServerSocket to put in listen mode
+*/
+void ILibAsyncServerSocket_Listen(ILibAsyncServerSocket_ServerModule ServerSocketModule)
+{
+	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)ServerSocketModule;
+	int flags;
+
+	if (module->listening != 0) return;
+
+	//
+	// Set the socket to non-block mode, so we can play nice and share the thread
+	//
+#ifdef _WIN32_WCE
+	flags = 1;
+	ioctlsocket(module->ListenSocket, FIONBIO, &flags);
+#elif WIN32
+	flags = 1;
+	ioctlsocket(module->ListenSocket, FIONBIO, (u_long *)(&flags));
+#elif _POSIX
+	flags = fcntl(module->ListenSocket, F_GETFL,0);
+	fcntl(module->ListenSocket, F_SETFL, O_NONBLOCK | flags);
+#endif
+
+	module->listening = 1;
+	listen(module->ListenSocket, SOMAXCONN);
+}
 /*! \fn ILibAsyncServerSocket_SetReAllocateNotificationCallback(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, ILibAsyncServerSocket_BufferReAllocated Callback)
 \brief Set the callback handler for when the internal data buffer has been resized
 \param AsyncServerSocketToken The ILibAsyncServerSocket to query
@@ -228,7 +264,12 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 #endif
 
 	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)socketModule;
-	int i,flags;
+	int i;
+	int accepted = 0;
+	int stopped = 0;
+#ifndef MICROSTACK_ACCEPT4
+	int flags;
+#endif
 #ifdef _WIN32_WCE
 	SOCKET NewSocket;
 #elif WIN32
@@ -244,9 +285,9 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 	if (FD_ISSET(module->ListenSocket, readset) != 0)
 	{
 		//
-		// There are pending TCP connection requests
+		// There are pending TCP connection requests, drain the accept queue up to our budget
 		//
-		for(i = 0; i < module->MaxConnection; ++i)
+		for(i = 0; i < module->MaxConnection && accepted < module->AcceptBudget; ++i)
 		{
 			//
 			// Check to see if we have available resources to handle this connection request
@@ -254,7 +295,11 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 			if (ILibAsyncSocket_IsFree(module->AsyncSockets[i]) != 0)
 			{
 				addrlen = sizeof(addr);
+#ifdef MICROSTACK_ACCEPT4
+				NewSocket = accept4(module->ListenSocket, (struct sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
 				NewSocket = accept(module->ListenSocket, (struct sockaddr*)&addr, &addrlen); // Klocwork claims we could lose the resource acquired fom the declaration, but that is not possible in this case
+#endif
 				//printf("Accept NewSocket=%d\r\n", NewSocket);
 
 				// This code rejects connections that are from out-of-scope addresses (Outside the subnet, outside local host...)
@@ -288,6 +333,8 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 				if (NewSocket != ~0)
 				{
 					//printf("Accepting new connection, socket = %d\r\n", NewSocket);
+					++accepted;
+#ifndef MICROSTACK_ACCEPT4
 					//
 					// Set this new socket to non-blocking mode, so we can play nice and share thread
 					//
@@ -300,6 +347,8 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 #elif _POSIX
 					flags = fcntl(NewSocket, F_GETFL,0);
 					fcntl(NewSocket, F_SETFL, O_NONBLOCK|flags);
+					fcntl(NewSocket, F_SETFD, FD_CLOEXEC);
+#endif
 #endif
 					//
 					// Instantiate a module to contain all the data about this connection
@@ -329,9 +378,28 @@ void ILibAsyncServerSocket_PostSelect(void* socketModule, int slct, fd_set *read
 						module->OnConnect(module, module->AsyncSockets[i], &(data->user));
 					}
 				}
-				else {break;}
+				else
+				{
+					// The accept queue is empty, anything else is an error (out of descriptors, connection reset while queued...)
+#if defined(WIN32) || defined(_WIN32_WCE)
+					if (WSAGetLastError() != WSAEWOULDBLOCK) { ++module->AcceptStats.Errors; }
+#else
+					if (errno != EAGAIN && errno != EWOULDBLOCK) { ++module->AcceptStats.Errors; }
+#endif
+					stopped = 1;
+					break;
+				}
 			}
 		}
+
+		++module->AcceptStats.Wakeups;
+		module->AcceptStats.Accepted += (unsigned long long)accepted;
+		if ((unsigned int)accepted > module->AcceptStats.LargestBatch) { module->AcceptStats.LargestBatch = (unsigned int)accepted; }
+		if (stopped == 0)
+		{
+			if (accepted >= module->AcceptBudget) { ++module->AcceptStats.BudgetExhausted; } else { ++module->AcceptStats.PoolExhausted; }
+		}
+		if (accepted > 1) { ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_2, "AsyncServerSocket[%p] accepted %d connections in one pass", (void*)module, accepted); }
 	}
 } // Klocwork claims that we could lose the resource acquired in the declaration, but that is not possible in this case
 //
@@ -420,6 +488,34 @@ void ILibAsyncServerSocket_OnDisconnectSink(ILibAsyncSocket_SocketModule socketM
 	if (ILibIsChainBeingDestroyed(data->module->Chain) == 0) free(data);
 }
 // 
+// Internal method dispatched by the OnWatermark event of the underlying ILibAsyncSocket
+//
+// <param name="socketModule">The ILibAsyncSocket sender</param>
+// <param name="aboveHighWatermark">Non-zero if the high watermark was reached</param>
+// <param name="pendingBytes">The number of bytes pending to be sent</param>
+// <param name="user">The ILibAsyncServerSocket_Data object</param>
+void ILibAsyncServerSocket_OnWatermarkSink(ILibAsyncSocket_SocketModule socketModule, int aboveHighWatermark, unsigned int pendingBytes, void *user)
+{
+	struct ILibAsyncServerSocket_Data *data = (struct ILibAsyncServerSocket_Data*)user;
+	if (data != NULL && data->WatermarkCallback != NULL) data->WatermarkCallback(data->module, socketModule, aboveHighWatermark, pendingBytes, data->user);
+}
+/*! \fn ILibAsyncServerSocket_SetWatermarks(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncServerSocket_OnWatermark Callback)
+\brief Sets the watermarks on the pending data of a connection, see \a ILibAsyncSocket_SetWatermarks
+\param AsyncServerSocketToken The ILibAsyncServerSocket that accepted the connection
+\param ConnectionToken The specific connection to configure
+\param highWatermark Number of pending bytes that triggers the high watermark, zero to disable
+\param lowWatermark Number of pending bytes that triggers the low watermark
+\param Callback The callback handler to set
+*/
+void ILibAsyncServerSocket_SetWatermarks(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncServerSocket_OnWatermark Callback)
+{
+	struct ILibAsyncServerSocket_Data *data = (struct ILibAsyncServerSocket_Data*)ILibAsyncSocket_GetUser(ConnectionToken);
+	UNREFERENCED_PARAMETER( AsyncServerSocketToken );
+	if (data == NULL) return;
+	data->WatermarkCallback = Callback;
+	ILibAsyncSocket_SetWatermarks(ConnectionToken, highWatermark, lowWatermark, Callback != NULL ? &ILibAsyncServerSocket_OnWatermarkSink : NULL);
+}
+
 // Internal method dispatched by the OnSendOK event of the underlying ILibAsyncSocket
 // 
 // <param name="socketModule"></param>
@@ -466,14 +562,34 @@ void ILibAsyncServerSocket_SetSSL_CTX(ILibAsyncServerSocket_ServerModule ILibAsy
 #endif
 	}
 }
+
+/*! \fn ILibAsyncServerSocket_SetKernelTLS(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule, int enable)
+\brief Enables kernel TLS offload on all the connections of an ILibAsyncServerSocket. See \a ILibAsyncSocket_SetKernelTLS
+\param ILibAsyncSocketModule The ILibAsyncServerSocket to configure
+\param enable Non-zero to enable
+\returns Non-zero if this build supports kTLS
+*/
+int ILibAsyncServerSocket_SetKernelTLS(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule, int enable)
+{
+	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)ILibAsyncSocketModule;
+	int i, retVal = 0;
+
+	for (i = 0; i < module->MaxConnection; ++i)
+	{
+		retVal = ILibAsyncSocket_SetKernelTLS(module->AsyncSockets[i], enable);
+	}
+	return(retVal);
+}
 #endif
 
-/*! \fn ILibCreateAsyncServerSocketModule(void *Chain, int MaxConnections, int PortNumber, int initialBufferSize, ILibAsyncServerSocket_OnConnect OnConnect,ILibAsyncServerSocket_OnDisconnect OnDisconnect,ILibAsyncServerSocket_OnReceive OnReceive,ILibAsyncServerSocket_OnInterrupt OnInterrupt, ILibAsyncServerSocket_OnSendOK OnSendOK)
+/*! \fn ILibCreateAsyncServerSocketModuleEx(void *Chain, int MaxConnections, unsigned short PortNumber, int initialBufferSize, int loopbackFlag, int reusePort, ILibAsyncServerSocket_OnConnect OnConnect,ILibAsyncServerSocket_OnDisconnect OnDisconnect,ILibAsyncServerSocket_OnReceive OnReceive,ILibAsyncServerSocket_OnInterrupt OnInterrupt, ILibAsyncServerSocket_OnSendOK OnSendOK)
 \brief Instantiates a new ILibAsyncServerSocket
 \param Chain The chain to add this module to. (Chain must <B>not</B> be running)
 \param MaxConnections The max number of simultaneous connections that will be allowed
 \param PortNumber The port number to bind to. 0 will select a random port
 \param initialBufferSize The initial size of the receive buffer
+\param loopbackFlag 0 to bind to ANY, 1 to bind to IPv6 loopback first, 2 to bind to IPv4 loopback first
+\param reusePort Non-zero to set SO_REUSEPORT, so other servers created this way can listen on the same port. Creation fails if the platform doesn't support it.
 \param OnConnect Function Pointer that triggers when a connection is established
 \param OnDisconnect Function Pointer that triggers when a connection is closed
 \param OnReceive Function Pointer that triggers when data is received
@@ -481,7 +597,7 @@ void ILibAsyncServerSocket_SetSSL_CTX(ILibAsyncServerSocket_ServerModule ILibAsy
 \param OnSendOK Function Pointer that triggers when pending sends are complete
 \returns An ILibAsyncServerSocket module
 */
-ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModule(void *Chain, int MaxConnections, unsigned short PortNumber, int initialBufferSize, int loopbackFlag, ILibAsyncServerSocket_OnConnect OnConnect, ILibAsyncServerSocket_OnDisconnect OnDisconnect, ILibAsyncServerSocket_OnReceive OnReceive, ILibAsyncServerSocket_OnInterrupt OnInterrupt, ILibAsyncServerSocket_OnSendOK OnSendOK)
+ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModuleEx(void *Chain, int MaxConnections, unsigned short PortNumber, int initialBufferSize, int loopbackFlag, int reusePort, ILibAsyncServerSocket_OnConnect OnConnect, ILibAsyncServerSocket_OnDisconnect OnDisconnect, ILibAsyncServerSocket_OnReceive OnReceive, ILibAsyncServerSocket_OnInterrupt OnInterrupt, ILibAsyncServerSocket_OnSendOK OnSendOK)
 {
 	int i;
 	int ra = 1;
@@ -525,6 +641,7 @@ ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModule(void *Chain
 	RetVal->OnSendOK = OnSendOK;
 	RetVal->OnReceive = OnReceive;
 	RetVal->MaxConnection = MaxConnections;
+	RetVal->AcceptBudget = ILibAsyncServerSocket_DefaultAcceptBudget;
 	RetVal->AsyncSockets = (void**)malloc(MaxConnections * sizeof(void*));
 	if (RetVal->AsyncSockets == NULL) { free(RetVal); ILIBMARKPOSITION(253); return NULL; }
 	RetVal->portNumber = (unsigned short)PortNumber;
@@ -547,6 +664,22 @@ ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModule(void *Chain
 	if (setsockopt(RetVal->ListenSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&ra, sizeof(int)) != 0) ILIBCRITICALERREXIT(253);
 #endif
 
+	if (reusePort != 0)
+	{
+		// Several listening sockets share the port, and the kernel spreads the incoming connections across them
+#ifdef SO_REUSEPORT
+		if (setsockopt(RetVal->ListenSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&ra, sizeof(int)) != 0)
+#endif
+		{
+#if defined(WIN32)
+			closesocket(RetVal->ListenSocket);
+#else
+			close(RetVal->ListenSocket);
+#endif
+			free(RetVal->AsyncSockets); free(RetVal); return 0;
+		}
+	}
+
 	// Bind the socket
 #if defined(WIN32)
 	if (bind(RetVal->ListenSocket, (struct sockaddr*)&localif, INET_SOCKADDR_LENGTH(localif.sin6_family)) != 0) { closesocket(RetVal->ListenSocket); free(RetVal->AsyncSockets); free(RetVal); return 0; }
@@ -586,3 +719,80 @@ unsigned short ILibAsyncServerSocket_GetPortNumber(ILibAsyncServerSocket_ServerM
 	return(((struct ILibAsyncServerSocketModule*)ServerSocketModule)->portNumber);
 }
 
+/*! \fn ILibAsyncServerSocket_SetAcceptBudget(ILibAsyncServerSocket_ServerModule ServerSocketModule, int budget)
+\brief Sets the maximum number of connections accepted each time the listening socket becomes readable
+\par
+Connections left in the accept queue are picked up on the next pass of the chain.
+\param ServerSocketModule The ILibAsyncServerSocket to configure
+\param budget The maximum number of connections per pass (Default is 64)
+*/
+void ILibAsyncServerSocket_SetAcceptBudget(ILibAsyncServerSocket_ServerModule ServerSocketModule, int budget)
+{
+	((struct ILibAsyncServerSocketModule*)ServerSocketModule)->AcceptBudget = budget > 0 ? budget : 1;
+}
+
+/*! \fn ILibAsyncServerSocket_GetAcceptStats(ILibAsyncServerSocket_ServerModule ServerSocketModule, ILibAsyncServerSocket_AcceptStats *stats)
+\brief Fetches the accept counters of the server. The accept rate is the difference of \a Accepted between two calls.
+\param ServerSocketModule The ILibAsyncServerSocket to query
+\param[out] stats The running totals
+*/
+void ILibAsyncServerSocket_GetAcceptStats(ILibAsyncServerSocket_ServerModule ServerSocketModule, ILibAsyncServerSocket_AcceptStats *stats)
+{
+	memcpy(stats, &(((struct ILibAsyncServerSocketModule*)ServerSocketModule)->AcceptStats), sizeof(ILibAsyncServerSocket_AcceptStats));
+}
+
+/*! \fn ILibAsyncServerSocket_SetFastOpen(ILibAsyncServerSocket_ServerModule ServerSocketModule, int queueLength)
+\brief Enables TCP Fast Open (RFC 7413) on the listening socket
+\par
+Clients that have a Fast Open cookie from an earlier connection can send their first request in the SYN,
+saving a round trip. The data is delivered before the handshake completes, so it may be replayed, which is
+fine for TLS ClientHellos and idempotent requests.
+\param ServerSocketModule The ILibAsyncServerSocket to configure
+\param queueLength The maximum number of pending Fast Open requests, zero to disable
+\returns Non-zero if Fast Open was set on the socket
+*/
+int ILibAsyncServerSocket_SetFastOpen(ILibAsyncServerSocket_ServerModule ServerSocketModule, int queueLength)
+{
+#ifdef TCP_FASTOPEN
+	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)ServerSocketModule;
+	return(setsockopt(module->ListenSocket, IPPROTO_TCP, TCP_FASTOPEN, (char*)&queueLength, sizeof(queueLength)) == 0 ? 1 : 0);
+#else
+	UNREFERENCED_PARAMETER(ServerSocketModule);
+	UNREFERENCED_PARAMETER(queueLength);
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncServerSocket_SetReusePortSteering(ILibAsyncServerSocket_ServerModule ServerSocketModule, int groupSize)
+\brief Steers each connection to the SO_REUSEPORT listener matching the CPU that received it
+\par
+Attaches a BPF program to the SO_REUSEPORT group of this server, that picks listener (CPU % groupSize), in the order the
+listeners started listening, instead of the default hash. With one chain per CPU, each pinned to its CPU, a connection is
+then handled on the core where its packets arrive.
+\param ServerSocketModule Any ILibAsyncServerSocket of the group, created with \a ILibCreateAsyncServerSocketModuleEx
+\param groupSize The number of listeners in the group
+\returns Non-zero if the program was attached
+*/
+int ILibAsyncServerSocket_SetReusePortSteering(ILibAsyncServerSocket_ServerModule ServerSocketModule, int groupSize)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	struct ILibAsyncServerSocketModule *module = (struct ILibAsyncServerSocketModule*)ServerSocketModule;
+	struct sock_filter code[] =
+	{
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (unsigned int)(SKF_AD_OFF + SKF_AD_CPU) },	// A = CPU
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, 0 },											// A = A % groupSize
+		{ BPF_RET | BPF_A, 0, 0, 0 }													// Use listener A
+	};
+	struct sock_fprog prog;
+
+	if (groupSize <= 0) return(0);
+	code[1].k = (unsigned int)groupSize;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	return(setsockopt(module->ListenSocket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, (char*)&prog, sizeof(prog)) == 0 ? 1 : 0);
+#else
+	UNREFERENCED_PARAMETER(ServerSocketModule);
+	UNREFERENCED_PARAMETER(groupSize);
+	return(0);
+#endif
+}
@@ -58,6 +58,16 @@ typedef ILibAsyncSocket_SocketModule ILibAsyncServerSocket_ConnectionToken;
 */
 typedef void (*ILibAsyncServerSocket_BufferReAllocated)(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, void *user, ptrdiff_t newOffset);
 void ILibAsyncServerSocket_SetReAllocateNotificationCallback(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, ILibAsyncServerSocket_BufferReAllocated Callback);
+/*! \typedef ILibAsyncServerSocket_OnWatermark
+	\brief Handler for when the pending data of a connection crosses a watermark, see \a ILibAsyncSocket_SetWatermarks
+	\param AsyncServerSocketToken The parent ILibAsyncServerSocket_ServerModule
+	\param ConnectionToken The connection whos pending data crossed a watermark
+	\param aboveHighWatermark Non-zero if the high watermark was reached, zero if the data drained to the low watermark
+	\param pendingBytes The number of bytes pending to be sent
+	\param user The user object associated with the connection
+*/
+typedef void (*ILibAsyncServerSocket_OnWatermark)(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, int aboveHighWatermark, unsigned int pendingBytes, void *user);
+void ILibAsyncServerSocket_SetWatermarks(ILibAsyncServerSocket_ServerModule AsyncServerSocketToken, ILibAsyncServerSocket_ConnectionToken ConnectionToken, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncServerSocket_OnWatermark Callback);
 
 /*! \typedef ILibAsyncServerSocket_OnInterrupt
 	\brief Handler for when a session was interrupted by a call to ILibStopChain
@@ -110,8 +120,24 @@ typedef void (*ILibAsyncServerSocket_OnDisconnect)(ILibAsyncServerSocket_ServerM
 */
 typedef void (*ILibAsyncServerSocket_OnSendOK)(ILibAsyncServerSocket_ServerModule AsyncServerSocketModule, ILibAsyncServerSocket_ConnectionToken ConnectionToken, void *user);
 
+/*! \struct ILibAsyncServerSocket_AcceptStats
+	\brief Running totals of the accept activity of a server
+*/
+typedef struct ILibAsyncServerSocket_AcceptStats
+{
+	unsigned long long Accepted;	//!< Connections accepted
+	unsigned int Wakeups;			//!< Number of times the listening socket was found readable
+	unsigned int LargestBatch;		//!< Most connections accepted in a single pass
+	unsigned int BudgetExhausted;	//!< Passes that stopped at the accept budget, with connections possibly still queued
+	unsigned int PoolExhausted;		//!< Passes that stopped because every socket of the pool was in use
+	unsigned int Errors;			//!< accept() failures, other than the queue being empty
+}ILibAsyncServerSocket_AcceptStats;
+
 // loopbackFlag: 0 to bind to ANY, 1 to bind to IPv6 loopback first, 2 to bind to IPv4 loopback first.
-ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModule(void *Chain, int MaxConnections, unsigned short PortNumber, int initialBufferSize, int loopbackFlag, ILibAsyncServerSocket_OnConnect OnConnect,ILibAsyncServerSocket_OnDisconnect OnDisconnect,ILibAsyncServerSocket_OnReceive OnReceive,ILibAsyncServerSocket_OnInterrupt OnInterrupt,ILibAsyncServerSocket_OnSendOK OnSendOK);
+// reusePort: Non-zero to share the port with other servers created the same way (SO_REUSEPORT)
+ILibAsyncServerSocket_ServerModule ILibCreateAsyncServerSocketModuleEx(void *Chain, int MaxConnections, unsigned short PortNumber, int initialBufferSize, int loopbackFlag, int reusePort, ILibAsyncServerSocket_OnConnect OnConnect,ILibAsyncServerSocket_OnDisconnect OnDisconnect,ILibAsyncServerSocket_OnReceive OnReceive,ILibAsyncServerSocket_OnInterrupt OnInterrupt,ILibAsyncServerSocket_OnSendOK OnSendOK);
+#define ILibCreateAsyncServerSocketModule(Chain, MaxConnections, PortNumber, initialBufferSize, loopbackFlag, OnConnect, OnDisconnect, OnReceive, OnInterrupt, OnSendOK) ILibCreateAsyncServerSocketModuleEx(Chain, MaxConnections, PortNumber, initialBufferSize, loopbackFlag, 0, OnConnect, OnDisconnect, OnReceive, OnInterrupt, OnSendOK)
+void ILibAsyncServerSocket_Listen(ILibAsyncServerSocket_ServerModule ServerSocketModule);
 
 void *ILibAsyncServerSocket_GetTag(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule);
 void ILibAsyncServerSocket_SetTag(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule, void *user);
@@ -123,9 +149,14 @@ void ILibAsyncServerSocket_SetTag2(ILibAsyncServerSocket_ServerModule ILibAsyncS
 	#else
 		void ILibAsyncServerSocket_SetSSL_CTX(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule, void *ssl_ctx);
 	#endif
+	int ILibAsyncServerSocket_SetKernelTLS(ILibAsyncServerSocket_ServerModule ILibAsyncSocketModule, int enable);
 #endif
 
 unsigned short ILibAsyncServerSocket_GetPortNumber(ILibAsyncServerSocket_ServerModule ServerSocketModule);
+void ILibAsyncServerSocket_SetAcceptBudget(ILibAsyncServerSocket_ServerModule ServerSocketModule, int budget);
+void ILibAsyncServerSocket_GetAcceptStats(ILibAsyncServerSocket_ServerModule ServerSocketModule, ILibAsyncServerSocket_AcceptStats *stats);
+int ILibAsyncServerSocket_SetFastOpen(ILibAsyncServerSocket_ServerModule ServerSocketModule, int queueLength);
+int ILibAsyncServerSocket_SetReusePortSteering(ILibAsyncServerSocket_ServerModule ServerSocketModule, int groupSize);
 
 /*! \def ILibAsyncServerSocket_Send
 	\brief Sends data onto the TCP stream
@@ -148,6 +179,13 @@ unsigned short ILibAsyncServerSocket_GetPortNumber(ILibAsyncServerSocket_ServerM
 	\brief Gets the outstanding number of bytes to be sent
 */
 #define ILibAsyncServerSocket_GetPendingBytesToSend(ServerSocketModule, ConnectionToken) ILibAsyncSocket_GetPendingBytesToSend(ConnectionToken)
+/*! \def ILibAsyncServerSocket_SetSendLimit
+	\brief Sets a hard cap on the pending data of a connection, see \a ILibAsyncSocket_SetSendLimit
+	\param ServerSocketModule The parent ILibAsyncServerSocket_ServerModule
+	\param ConnectionToken The connection state for this session
+	\param limit The maximum number of pending bytes, zero for no limit
+*/
+#define ILibAsyncServerSocket_SetSendLimit(ServerSocketModule, ConnectionToken, limit) ILibAsyncSocket_SetSendLimit(ConnectionToken, limit)
 /*! \def ILibAsyncServerSocket_GetTotalBytesSent
 	\brief Gets the total number of bytes that have been sent
 	\param ServerSocketModule The parent ILibAsyncServerSocket_ServerModule
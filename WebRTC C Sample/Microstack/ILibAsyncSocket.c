@@ -14,6 +14,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <stddef.h>	// offsetof()
+
 #ifdef MEMORY_CHECK
 #include <assert.h>
 #define MEMCHECK(x) x
@@ -52,6 +54,62 @@ limitations under the License.
 #include <openssl/ssl.h>
 #endif
 
+#if defined(_POSIX) && !defined(__APPLE__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define MICROSTACK_ZEROCOPY
+#define ILibAsyncSocket_ZeroCopyReapInterval 1000	// Milliseconds between polls for the completions of blocks left behind by a closed socket
+#define ILibAsyncSocket_ZeroCopyReapLimit 300		// Polls before giving up on them
+#include <linux/errqueue.h>
+#endif
+
+#ifdef MICROSTACK_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#ifdef _POSIX
+#include <netinet/tcp.h>
+#endif
+
+// Queued blocks are sent with a single sendmsg(), up to this many at a time
+#if defined(_POSIX)
+#define MICROSTACK_GATHER
+#define ILibAsyncSocket_MaxGather 64
+#include <sys/uio.h>
+#endif
+
+// Datagrams are read with recvmmsg(), several per system call, see ILibAsyncSocket_SetReceiveBatch
+#if defined(_POSIX) && defined(_GNU_SOURCE) && !defined(__APPLE__) && !defined(_VX_CPU) && defined(MSG_WAITFORONE) && !defined(MICROSTACK_NORECVMMSG)
+#define MICROSTACK_RECVMMSG
+#define ILibAsyncSocket_MaxReceiveBatch 256
+#endif
+
+// Datagrams sent from the chain thread are queued, and flushed with sendmmsg() before the chain sleeps, see ILibAsyncSocket_SetTransmitBatch
+#if defined(_POSIX) && defined(_GNU_SOURCE) && !defined(__APPLE__) && !defined(_VX_CPU) && defined(MSG_WAITFORONE) && !defined(MICROSTACK_NOSENDMMSG)
+#define MICROSTACK_SENDMMSG
+#define ILibAsyncSocket_MaxTransmitBatch 64
+#define ILibAsyncSocket_TransmitArenaSize 65536
+#define ILibAsyncSocket_TransmitQueueKey "ILibAsyncSocket_TransmitQueue"
+#endif
+
+// Datagrams of the same size to the same destination are sent as one with UDP_SEGMENT (GSO), and datagrams the kernel coalesced
+// with UDP_GRO are split before they are delivered, see ILibAsyncSocket_SetSegmentationOffload and ILibAsyncSocket_SetReceiveOffload
+#if defined(MICROSTACK_SENDMMSG) && defined(MICROSTACK_RECVMMSG) && !defined(MICROSTACK_NOUDPOFFLOAD)
+#include <netinet/udp.h>
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define MICROSTACK_UDPOFFLOAD
+#define ILibAsyncSocket_MaxSegments 64				// UDP_MAX_SEGMENTS of older kernels
+#define ILibAsyncSocket_MaxSegmentedSize 65000		// A super-buffer must fit in one IP datagram before it is segmented
+#define ILibAsyncSocket_MaxOffloadedSize 65536		// Size of each receive slot when GRO is on
+#define ILibAsyncSocket_MaxOffloadBatch 16			// ... so fewer slots are used
+#endif
+#endif
+
+// The kernel's count of datagrams it dropped on a full receive buffer comes with the datagrams that follow (SO_RXQ_OVFL), it is read
+// from the control messages of the receive batch. Buffer sizes follow the drops and the send backlog, see ILibAsyncSocket_SetBufferAutotune
+#if defined(MICROSTACK_RECVMMSG) && defined(SO_RXQ_OVFL) && !defined(MICROSTACK_NORXQOVFL)
+#define MICROSTACK_RXQOVFL
+#endif
+#define ILibAsyncSocket_AutotuneInterval 1000		// Milliseconds between buffer size checks
+
 //#ifndef WINSOCK2
 //#define SOCKET unsigned int
 //#endif
@@ -106,7 +164,66 @@ struct ILibAsyncSocket_SendData
 
 	int UserFree;
 	struct ILibAsyncSocket_SendData *Next;
+
+#ifdef MICROSTACK_SENDFILE
+	int IsFile;						// Set if this block is a file segment, sent with sendfile() instead of from buffer
+	int FileDescriptor;				// Closed when the block is released, if UserFree is ILibAsyncSocket_MemoryOwnership_CHAIN
+	off_t FileOffset;
+#endif
+
+#ifdef MICROSTACK_ZEROCOPY
+	int ZeroCopy;					// Set if this block is to be sent using MSG_ZEROCOPY
+	unsigned int ZeroCopyLast;		// Last completion id the kernel assigned to this block
+	unsigned int ZeroCopyCount;		// Number of completion ids assigned to this block (one per partial send)
+	unsigned int ZeroCopyDone;		// Number of completion ids the kernel has reported back
+#endif
+};
+
+#ifdef MICROSTACK_RECVMMSG
+// Ring of datagram buffers, filled by a single recvmmsg()
+struct ILibAsyncSocket_ReceiveBatch
+{
+	int Size;					// Number of slots, the most datagrams read per system call
+	int DatagramSize;			// Size of each slot
+	int Next;					// Next datagram to deliver. Datagrams are left in the ring if the socket is paused in the middle of a batch.
+	int Count;					// Number of datagrams the last recvmmsg() returned
+	int Offset;					// Bytes of the next slot that were already delivered, when the kernel coalesced several datagrams in it
+	struct mmsghdr *Headers;
+	struct iovec *Vectors;
+	struct sockaddr_in6 *Addresses;
+	char *Buffers;
+	char *Control;				// Control messages (UDP_GRO, SO_RXQ_OVFL), ControlSize bytes per slot, NULL if none are expected
+	int ControlSize;
+#ifdef MICROSTACK_UDPOFFLOAD
+	int *SegmentSize;			// Size of the datagrams coalesced in each slot, 0 if the slot holds a single datagram
+#endif
+	ILibAsyncSocket_ReceiveBatchStats Stats;
+};
+#endif
+
+#ifdef MICROSTACK_SENDMMSG
+// Per chain queue of outgoing datagrams, shared by every socket that enabled batched transmit
+struct ILibAsyncSocket_TransmitQueue
+{
+	void *Chain;
+	int RefCount;				// Number of sockets using this queue
+	int Flushing;				// Set while the queue is being flushed, sends made from OnSendError go out directly
+	int Count;
+	int ArenaUsed;
+	struct ILibAsyncSocketModule *Sockets[ILibAsyncSocket_MaxTransmitBatch];	// NULL if the socket was destroyed after queueing the datagram
+	char *Owned[ILibAsyncSocket_MaxTransmitBatch];								// CHAIN owned buffers, freed after they are sent
+	struct mmsghdr Headers[ILibAsyncSocket_MaxTransmitBatch];
+	struct iovec Vectors[ILibAsyncSocket_MaxTransmitBatch];
+	struct sockaddr_in6 Addresses[ILibAsyncSocket_MaxTransmitBatch];
+	char Arena[ILibAsyncSocket_TransmitArenaSize];								// USER owned buffers are copied here
+#ifdef MICROSTACK_UDPOFFLOAD
+	struct mmsghdr Segmented[ILibAsyncSocket_MaxTransmitBatch];					// Headers given to sendmmsg(), when datagrams are coalesced
+	int SegmentedCount[ILibAsyncSocket_MaxTransmitBatch];						// Number of datagrams in each of them
+	char SegmentedControl[ILibAsyncSocket_MaxTransmitBatch][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+	ILibAsyncSocket_TransmitBatchStats Stats;
 };
+#endif
 
 struct ILibAsyncSocketModule
 {
@@ -178,6 +295,44 @@ struct ILibAsyncSocketModule
 	int MaxBufferSizeExceeded;
 	void *MaxBufferSizeUserObject;
 
+	int ZeroCopyThreshold;			// Sends of at least this many bytes use MSG_ZEROCOPY, zero to disable
+	int FastOpen;					// Non-zero to carry the first data of outgoing connections in the SYN (TCP Fast Open)
+	int Corked;						// While non-zero, stream sends are queued, and flushed together by ILibAsyncSocket_Uncork
+	int AutoCork;					// Non-zero to cork the socket for the duration of the OnData/OnConnect callbacks
+	unsigned int HighWatermark;		// OnWatermark is triggered when the pending data reaches this many bytes, zero to disable
+	unsigned int LowWatermark;		// ... and again when it drains back down to this many bytes
+	unsigned int SendLimit;			// Sends that would queue more than this many bytes are rejected, zero for no limit
+	int AboveHighWatermark;
+	ILibAsyncSocket_OnWatermark OnWatermark;
+#ifdef MICROSTACK_RECVMMSG
+	struct ILibAsyncSocket_ReceiveBatch *ReceiveBatch;	// Non-NULL if datagrams are read in batches
+#endif
+#ifdef MICROSTACK_SENDMMSG
+	struct ILibAsyncSocket_TransmitQueue *TransmitQueue;	// Non-NULL if datagrams sent from the chain thread are batched
+	ILibAsyncSocket_OnSendError OnSendError;
+#endif
+#ifdef MICROSTACK_UDPOFFLOAD
+	int SegmentationOffload;		// Non-zero if queued datagrams of the same size to the same destination are sent with UDP_SEGMENT
+	int ReceiveOffload;				// Non-zero if UDP_GRO is set, the receive batch then uses 64KB slots
+#endif
+#ifdef MICROSTACK_RXQOVFL
+	int DropCounting;				// Non-zero if SO_RXQ_OVFL is set, the receive batch then always has at least one slot
+	unsigned int KernelDrops;		// Last value of the kernel's drop counter
+#endif
+	int Autotune;					// Non-zero while the periodic buffer check is scheduled
+	int MaxReceiveBuffer;			// Ceiling for SO_RCVBUF growth, zero if the receive buffer is not tuned
+	int MaxSendBuffer;				// Ceiling for SO_SNDBUF growth, zero if the send buffer is not tuned
+	int ReceiveBufferRequest;		// Last size given to SO_RCVBUF / SO_SNDBUF, the kernel reports back double
+	int SendBufferRequest;
+	unsigned long long AutotuneDrops;	// Drops at the last check
+	ILibAsyncSocket_BufferStats BufferStats;
+#ifdef MICROSTACK_ZEROCOPY
+	int ZeroCopyState;				// 0 = Off, 1 = SO_ZEROCOPY is set, 2 = SO_ZEROCOPY is set, but the kernel is copying anyway
+	unsigned int ZeroCopyNextId;	// The kernel numbers MSG_ZEROCOPY sends from zero for every socket
+	struct ILibAsyncSocket_SendData *ZeroCopy_Head;	// Sent blocks, that the kernel has not released yet
+	struct ILibAsyncSocket_SendData *ZeroCopy_Tail;
+#endif
+
 	// Added for TLS support
 	#ifndef MICROSTACK_NOTLS
 	int SSLConnect;
@@ -189,6 +344,9 @@ struct ILibAsyncSocketModule
 #ifdef MICROSTACK_TLS_DETECT
 	int TLSChecked;
 #endif
+	int KernelTLS;	// 0 = Off, 1 = Requested, 2 = The kernel does the record encryption for this connection
+	long long HandshakeStart;
+	int HandshakeTime;	// Milliseconds it took to complete the TLS handshake, -1 until it completes
 	#endif
 };
 
@@ -217,6 +375,215 @@ typedef enum ILibAsyncSocket_TLSHandshakeType
 	ILibAsyncSocket_TLSHandshakeType_finished = 20
 }ILibAsyncSocket_TLSHandshakeType;
 
+#ifdef MICROSTACK_ZEROCOPY
+//
+// Turns on SO_ZEROCOPY for a newly associated socket, if the user asked for it
+//
+void ILibAsyncSocket_ZeroCopy_Init(struct ILibAsyncSocketModule *module)
+{
+	int flags = 1;
+
+	module->ZeroCopyNextId = 0;
+	module->ZeroCopyState = 0;
+	if (module->ZeroCopyThreshold > 0 && setsockopt(module->internalSocket, SOL_SOCKET, SO_ZEROCOPY, (char*)&flags, sizeof(flags)) == 0) { module->ZeroCopyState = 1; }
+}
+
+//
+// Sends the remainder of a block with MSG_ZEROCOPY, keeping track of the completion id the kernel assigned to it
+//
+int ILibAsyncSocket_ZeroCopy_Send(struct ILibAsyncSocketModule *module, struct ILibAsyncSocket_SendData *data)
+{
+	int bytesSent = send(module->internalSocket, data->buffer + data->bytesSent, data->bufferSize - data->bytesSent, MSG_NOSIGNAL | MSG_ZEROCOPY);
+
+	if (bytesSent > 0)
+	{
+		// Every MSG_ZEROCOPY call that sends something gets the next id, failed calls do not consume one
+		data->ZeroCopyLast = module->ZeroCopyNextId++;
+		++data->ZeroCopyCount;
+	}
+	else if (bytesSent < 0 && errno == ENOBUFS)
+	{
+		// Out of option memory for the completion notifications, so just copy this one
+		bytesSent = send(module->internalSocket, data->buffer + data->bytesSent, data->bufferSize - data->bytesSent, MSG_NOSIGNAL);
+	}
+	return(bytesSent);
+}
+
+//
+// Credits the completion range [lo, hi] to the ids owned by this block
+//
+void ILibAsyncSocket_ZeroCopy_Credit(struct ILibAsyncSocket_SendData *data, unsigned int lo, unsigned int hi)
+{
+	unsigned int first = data->ZeroCopyLast - data->ZeroCopyCount + 1;
+
+	if (data->ZeroCopyCount == 0) return;
+	if ((int)(lo - first) < 0) lo = first;
+	if ((int)(hi - data->ZeroCopyLast) > 0) hi = data->ZeroCopyLast;
+	if ((int)(hi - lo) >= 0) data->ZeroCopyDone += hi - lo + 1;
+}
+
+//
+// Releases a block, that the kernel is done with
+//
+void ILibAsyncSocket_ZeroCopy_Free(struct ILibAsyncSocket_SendData *data)
+{
+	if (data->UserFree == 0) free(data->buffer);
+	free(data);
+}
+
+//
+// Called when a MSG_ZEROCOPY block is fully sent. The kernel still references the buffer, so we hold on to it until it tells us it's done
+//
+void ILibAsyncSocket_ZeroCopy_Hold(struct ILibAsyncSocketModule *module, struct ILibAsyncSocket_SendData *data)
+{
+	if (data->ZeroCopyDone == data->ZeroCopyCount) { ILibAsyncSocket_ZeroCopy_Free(data); return; }
+
+	data->Next = NULL;
+	if (module->ZeroCopy_Tail == NULL) { module->ZeroCopy_Head = data; } else { module->ZeroCopy_Tail->Next = data; }
+	module->ZeroCopy_Tail = data;
+}
+
+//
+// Reads the MSG_ZEROCOPY completions off the error queue of fd, and releases the blocks in [head, tail] that are done. partial is a
+// block that is still being sent, and may already own some of the ids. module is NULL for blocks whose socket has been closed
+//
+void ILibAsyncSocket_ZeroCopy_Read(struct ILibAsyncSocketModule *module, int fd, struct ILibAsyncSocket_SendData **head, struct ILibAsyncSocket_SendData **tail, struct ILibAsyncSocket_SendData *partial)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct sock_extended_err *serr;
+	struct ILibAsyncSocket_SendData *data, *prev, *next;
+	char control[128];
+
+	while (*head != NULL || (partial != NULL && partial->ZeroCopyCount != 0))
+	{
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (!((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) continue;
+			serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+			if (module != NULL && (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0 && module->ZeroCopyState == 1)
+			{
+				// The kernel had to copy the data anyway (loopback, or no scatter/gather on the NIC), so stop paying for the notifications
+				module->ZeroCopyState = 2;
+				ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] MSG_ZEROCOPY fell back to copying, disabled", (void*)module);
+			}
+
+			if (partial != NULL) ILibAsyncSocket_ZeroCopy_Credit(partial, serr->ee_info, serr->ee_data);
+
+			prev = NULL;
+			data = *head;
+			while (data != NULL)
+			{
+				next = data->Next;
+				ILibAsyncSocket_ZeroCopy_Credit(data, serr->ee_info, serr->ee_data);
+				if (data->ZeroCopyDone == data->ZeroCopyCount)
+				{
+					if (prev == NULL) { *head = next; } else { prev->Next = next; }
+					if (*tail == data) { *tail = prev; }
+					ILibAsyncSocket_ZeroCopy_Free(data);
+				}
+				else
+				{
+					prev = data;
+				}
+				data = next;
+			}
+		}
+	}
+}
+
+//
+// Reads the MSG_ZEROCOPY completions off the socket error queue, and releases the blocks that are done. Must be called with SendLock held.
+//
+void ILibAsyncSocket_ZeroCopy_Complete(struct ILibAsyncSocketModule *module)
+{
+	// The block at the head of the send queue may be partially sent, and already own some of the ids
+	ILibAsyncSocket_ZeroCopy_Read(module, (int)module->internalSocket, &(module->ZeroCopy_Head), &(module->ZeroCopy_Tail), module->PendingSend_Head);
+}
+
+//
+// Blocks the kernel was still reading when their socket went away. A dup of the socket is kept, so the completions can still be collected
+//
+struct ILibAsyncSocket_ZeroCopy_Orphans
+{
+	int fd;
+	int polls;
+	void *lifetime;
+	struct ILibAsyncSocket_SendData *head;
+	struct ILibAsyncSocket_SendData *tail;
+};
+
+void ILibAsyncSocket_ZeroCopy_Abandon(void *object)
+{
+	struct ILibAsyncSocket_ZeroCopy_Orphans *orphans = (struct ILibAsyncSocket_ZeroCopy_Orphans*)object;
+
+	// Anything still not reported back is leaked on purpose. Freeing it could hand pages the kernel is still reading to someone else
+	close(orphans->fd);
+	free(orphans);
+}
+
+void ILibAsyncSocket_ZeroCopy_Reap(void *object)
+{
+	struct ILibAsyncSocket_ZeroCopy_Orphans *orphans = (struct ILibAsyncSocket_ZeroCopy_Orphans*)object;
+
+	ILibAsyncSocket_ZeroCopy_Read(NULL, orphans->fd, &(orphans->head), &(orphans->tail), NULL);
+	if (orphans->head != NULL && ++orphans->polls < ILibAsyncSocket_ZeroCopyReapLimit)
+	{
+		ILibLifeTime_AddEx(orphans->lifetime, orphans, ILibAsyncSocket_ZeroCopyReapInterval, &ILibAsyncSocket_ZeroCopy_Reap, &ILibAsyncSocket_ZeroCopy_Abandon);
+		return;
+	}
+	ILibAsyncSocket_ZeroCopy_Abandon(orphans);
+}
+
+//
+// Must be called before the socket s is closed, and before the send queue is dropped. Blocks the kernel hasn't released yet
+// can't be freed, so they are handed to a reaper with a dup of the socket, that frees them as their completions arrive
+//
+void ILibAsyncSocket_ZeroCopy_Clear(struct ILibAsyncSocketModule *module, SOCKET s)
+{
+	struct ILibAsyncSocket_SendData *data = module->PendingSend_Head;
+	struct ILibAsyncSocket_ZeroCopy_Orphans *orphans;
+	int fd;
+
+	// A partially sent head block already has ids the kernel holds. The send queue is being dropped anyway, so move it over with the sent blocks
+	if (data != NULL && data->ZeroCopyCount != 0)
+	{
+		module->PendingSend_Head = data->Next;
+		if (module->PendingSend_Head == NULL) { module->PendingSend_Tail = NULL; }
+		ILibAsyncSocket_ZeroCopy_Hold(module, data);
+	}
+	if (module->ZeroCopy_Head == NULL) return;
+
+	if (s != (SOCKET)~0) { ILibAsyncSocket_ZeroCopy_Read(module, (int)s, &(module->ZeroCopy_Head), &(module->ZeroCopy_Tail), NULL); }
+	if (module->ZeroCopy_Head == NULL) return;
+
+	if (s == (SOCKET)~0 || (fd = dup((int)s)) < 0)
+	{
+		// No way to learn when the kernel is done with them, so they can never be safely freed
+		ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] MSG_ZEROCOPY blocks abandoned on close", (void*)module);
+	}
+	else
+	{
+		if ((orphans = (struct ILibAsyncSocket_ZeroCopy_Orphans*)malloc(sizeof(struct ILibAsyncSocket_ZeroCopy_Orphans))) == NULL) ILIBCRITICALEXIT(254);
+		orphans->fd = fd;
+		orphans->polls = 0;
+		orphans->head = module->ZeroCopy_Head;
+		orphans->tail = module->ZeroCopy_Tail;
+		orphans->lifetime = module->LifeTime;
+		ILibLifeTime_AddEx(module->LifeTime, orphans, ILibAsyncSocket_ZeroCopyReapInterval, &ILibAsyncSocket_ZeroCopy_Reap, &ILibAsyncSocket_ZeroCopy_Abandon);
+	}
+	module->ZeroCopy_Head = NULL;
+	module->ZeroCopy_Tail = NULL;
+}
+#endif
+
 #ifndef MICROSTACK_NOTLS
 int ILibAsyncSocket_TLSDetect(char* buffer, int offset, int endPointer)
 {
@@ -272,6 +639,9 @@ void ILibAsyncSocket_Destroy(void *socketModule)
 	// Close socket if necessary
 	if (module->internalSocket != ~0)
 	{
+#ifdef MICROSTACK_ZEROCOPY
+		ILibAsyncSocket_ZeroCopy_Clear(module, module->internalSocket);
+#endif
 #if defined(_WIN32_WCE) || defined(WIN32)
 #if defined(WINSOCK2)
 		shutdown(module->internalSocket, SD_BOTH);
@@ -292,12 +662,29 @@ void ILibAsyncSocket_Destroy(void *socketModule)
 		module->MallocSize = 0;
 	}
 
+	if (module->Autotune != 0) { ILibLifeTime_Remove(module->LifeTime, &(module->BufferStats)); module->Autotune = 0; }
+#ifdef MICROSTACK_RXQOVFL
+	module->DropCounting = 0;
+#endif
+#ifdef MICROSTACK_UDPOFFLOAD
+	module->ReceiveOffload = 0;
+#endif
+#ifdef MICROSTACK_RECVMMSG
+	ILibAsyncSocket_SetReceiveBatch(module, 0);
+#endif
+#ifdef MICROSTACK_SENDMMSG
+	ILibAsyncSocket_SetTransmitBatch(module, 0, NULL);
+#endif
+
 	// Clear all the data that is pending to be sent
 	temp = current = module->PendingSend_Head;
 	while (current != NULL)
 	{
 		temp = current->Next;
 		if (current->UserFree == 0) free(current->buffer);
+#ifdef MICROSTACK_SENDFILE
+		if (current->IsFile != 0 && current->UserFree == 0) close(current->FileDescriptor);
+#endif
 		free(current);
 		current = temp;
 	}
@@ -377,6 +764,27 @@ ILibAsyncSocket_SocketModule ILibCreateAsyncSocketModule(void *Chain, int initia
 	return((void*)RetVal);
 }
 
+//
+// Internal method that checks if the pending data crossed a watermark. SendLock must be held.
+//
+// <param name="module">The ILibAsyncSocket to check</param>
+// <returns>1 if the high watermark was reached, -1 if the data drained to the low watermark, 0 otherwise</returns>
+int ILibAsyncSocket_CheckWatermark(struct ILibAsyncSocketModule *module)
+{
+	if (module->OnWatermark == NULL || module->HighWatermark == 0) return(0);
+	if (module->AboveHighWatermark == 0 && module->PendingBytesToSend >= module->HighWatermark)
+	{
+		module->AboveHighWatermark = 1;
+		return(1);
+	}
+	if (module->AboveHighWatermark != 0 && module->PendingBytesToSend <= module->LowWatermark)
+	{
+		module->AboveHighWatermark = 0;
+		return(-1);
+	}
+	return(0);
+}
+
 /*! \fn ILibAsyncSocket_ClearPendingSend(ILibAsyncSocket_SocketModule socketModule)
 \brief Clears all the pending data to be sent for an AsyncSocket
 \param socketModule The ILibAsyncSocket to clear
@@ -386,121 +794,542 @@ void ILibAsyncSocket_ClearPendingSend(ILibAsyncSocket_SocketModule socketModule)
 	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
 	struct ILibAsyncSocket_SendData *data, *temp;
 
+#ifdef MICROSTACK_ZEROCOPY
+	// Blocks the kernel is still reading are handed off, not freed. Must happen while the socket is still open
+	ILibAsyncSocket_ZeroCopy_Clear(module, module->internalSocket);
+#endif
+
 	data = module->PendingSend_Head;
 	module->PendingSend_Tail = NULL;
 	module->PendingSend_Head = NULL;
 	module->PendingBytesToSend = 0;
+	module->AboveHighWatermark = 0;
 	while (data != NULL)
 	{
 		temp = data->Next;
 		// We only need to free this if we have ownership of this memory
 		if (data->UserFree == 0) free(data->buffer);
+#ifdef MICROSTACK_SENDFILE
+		if (data->IsFile != 0 && data->UserFree == 0) close(data->FileDescriptor);
+#endif
 		free(data);
 		data = temp;
 	}
 }
 
-/*! \fn ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketModule socketModule, char* buffer, int length, int remoteAddress, unsigned short remotePort, enum ILibAsyncSocket_MemoryOwnership UserFree)
-\brief Sends data on an AsyncSocket module to a specific destination. (Valid only for <B>UDP</B>)
-\param socketModule The ILibAsyncSocket module to send data on
-\param buffer The buffer to send
-\param length The length of the buffer to send
-\param remoteAddress The IPAddress of the destination 
-\param remotePort The Port number of the destination
-\param UserFree Flag indicating memory ownership. 
-\returns \a ILibAsyncSocket_SendStatus indicating the send status
-*/
-enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketModule socketModule, char* buffer, int length, struct sockaddr *remoteAddress, enum ILibAsyncSocket_MemoryOwnership UserFree)
+#ifdef MICROSTACK_SENDMMSG
+//
+// Internal method that moves a queued datagram to the send queue of its socket, because the kernel buffer is full
+//
+// <param name="q">The transmit queue</param>
+// <param name="i">The datagram to move</param>
+void ILibAsyncSocket_TransmitQueue_Defer(struct ILibAsyncSocket_TransmitQueue *q, int i)
 {
-	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	struct ILibAsyncSocketModule *module = q->Sockets[i];
 	struct ILibAsyncSocket_SendData *data;
-	int bytesSent = 0;
-	enum ILibAsyncSocket_SendStatus retVal = ILibAsyncSocket_ALL_DATA_SENT;
-
-	// If the socket is empty, return now.
-	if (socketModule == NULL) return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
+	unsigned int pendingBytes;
+	int watermark;
 
-	// Setup a new send data structure
 	if ((data = (struct ILibAsyncSocket_SendData*)malloc(sizeof(struct ILibAsyncSocket_SendData))) == NULL) ILIBCRITICALEXIT(254);
 	memset(data, 0, sizeof(struct ILibAsyncSocket_SendData));
-	data->buffer = buffer;
-	data->bufferSize = length;
-	data->bytesSent = 0;
-	data->UserFree = UserFree;
-	data->Next = NULL;
-
-	// Copy the address to the send data structure
-	memset(&(data->remoteAddress), 0, sizeof(struct sockaddr_in6));
-	if (remoteAddress != NULL) memcpy(&(data->remoteAddress), remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family));
+	data->bufferSize = (int)q->Vectors[i].iov_len;
+	data->UserFree = ILibAsyncSocket_MemoryOwnership_CHAIN;
+	memcpy(&(data->remoteAddress), &(q->Addresses[i]), sizeof(struct sockaddr_in6));
+	if (q->Owned[i] != NULL)
+	{
+		// We already own this buffer, so it is handed over as is
+		data->buffer = q->Owned[i];
+		q->Owned[i] = NULL;
+	}
+	else
+	{
+		if ((data->buffer = (char*)malloc(data->bufferSize)) == NULL) ILIBCRITICALEXIT(254);
+		memcpy(data->buffer, q->Vectors[i].iov_base, data->bufferSize);
+	}
 
-	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_Send", 1, module);)
+	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_TransmitQueue_Defer", 1, module);)
 	sem_wait(&(module->SendLock));
-
-	if (module->internalSocket == ~0)
+	module->PendingBytesToSend += data->bufferSize;
+	if (module->PendingSend_Tail == NULL)
 	{
-		// Too Bad, the socket closed
-		if (UserFree == 0) free(buffer);
-		free(data);
-		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_Send", 2, module);)
-		sem_post(&(module->SendLock));
-		return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
+		module->PendingSend_Head = data;
+		module->PendingSend_Tail = data;
+	}
+	else
+	{
+		module->PendingSend_Tail->Next = data;
+		module->PendingSend_Tail = data;
 	}
+	watermark = ILibAsyncSocket_CheckWatermark(module);
+	pendingBytes = module->PendingBytesToSend;
+	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_TransmitQueue_Defer", 2, module);)
+	sem_post(&(module->SendLock));
+	++q->Stats.Deferred;
+	if (watermark != 0) module->OnWatermark(module, watermark > 0, pendingBytes, module->user);
+}
 
-	module->PendingBytesToSend += length;
-	if (module->PendingSend_Tail != NULL || module->FinConnect == 0)
+#ifdef MICROSTACK_UDPOFFLOAD
+//
+// Internal method that coalesces the queued datagrams [i, j) of a socket into UDP_SEGMENT super-buffers.
+// Consecutive datagrams to the same destination, of the same size, are sent as one. Only the last of them can be shorter.
+// The iovecs of the queue are in order, so the super-buffers just point to them.
+//
+// <returns>The number of headers in q->Segmented</returns>
+int ILibAsyncSocket_TransmitQueue_Segment(struct ILibAsyncSocket_TransmitQueue *q, int i, int j)
+{
+	struct msghdr *hdr;
+	struct cmsghdr *cmsg;
+	int count = 0, n, size, len, total;
+
+	while (i < j)
 	{
-		// There are still bytes that are pending to be sent, or pending connection, so we need to queue this up
-		if (module->PendingSend_Tail == NULL)
-		{
-			module->PendingSend_Tail = data;
-			module->PendingSend_Head = data;
-		}
-		else
+		size = total = (int)q->Vectors[i].iov_len;
+		for (n = 1; i + n < j && n < ILibAsyncSocket_MaxSegments; ++n)
 		{
-			module->PendingSend_Tail->Next = data;
-			module->PendingSend_Tail = data;
+			len = (int)q->Vectors[i + n].iov_len;
+			if (len > size || total + len > ILibAsyncSocket_MaxSegmentedSize) break;
+			if (ILibInetCompare((struct sockaddr*)&(q->Addresses[i]), (struct sockaddr*)&(q->Addresses[i + n]), 3) == 0) break;
+			total += len;
+			if (len < size) { ++n; break; }
 		}
-		
-		retVal = ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
 
-		if (UserFree == ILibAsyncSocket_MemoryOwnership_USER)
+		memset(&(q->Segmented[count]), 0, sizeof(struct mmsghdr));
+		hdr = &(q->Segmented[count].msg_hdr);
+		hdr->msg_name = &(q->Addresses[i]);
+		hdr->msg_namelen = q->Headers[i].msg_hdr.msg_namelen;
+		hdr->msg_iov = &(q->Vectors[i]);
+		hdr->msg_iovlen = n;
+		if (n > 1)
 		{
-			// If we don't own this memory, we need to copy the buffer,
-			// because the user may free this memory before we have a chance to send it
-			if ((data->buffer = (char*)malloc(data->bufferSize)) == NULL) ILIBCRITICALEXIT(254);
-			memcpy(data->buffer, buffer, length);
-			MEMCHECK(assert(length <= data->bufferSize);)
-			data->UserFree = ILibAsyncSocket_MemoryOwnership_CHAIN;
+			hdr->msg_control = q->SegmentedControl[count];
+			hdr->msg_controllen = sizeof(q->SegmentedControl[count]);
+			cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*((uint16_t*)CMSG_DATA(cmsg)) = (uint16_t)size;
 		}
+		q->SegmentedCount[count++] = n;
+		i += n;
 	}
-	else
-	{
-		// There is no data pending to be sent, so lets go ahead and try to send this data
-		module->PendingSend_Tail = data;
-		module->PendingSend_Head = data;
+	return(count);
+}
+#endif
 
-		#ifndef MICROSTACK_NOTLS
-		if (module->ssl != NULL || remoteAddress == NULL)
+//
+// Internal method that sends every queued datagram, with one sendmmsg() per run of datagrams on the same socket.
+// This is registered as a pre-sleep handler, so the queue is always empty when the chain blocks.
+//
+// <param name="chain">The chain the queue belongs to</param>
+// <param name="object">The transmit queue</param>
+void ILibAsyncSocket_TransmitQueue_Flush(void *chain, void *object)
+{
+	struct ILibAsyncSocket_TransmitQueue *q = (struct ILibAsyncSocket_TransmitQueue*)object;
+	struct ILibAsyncSocketModule *module;
+	int i = 0, j, sent, failed, error, deferred = 0;
+#ifdef MICROSTACK_UDPOFFLOAD
+	int k, segmented;
+#endif
+
+	if (q->Count == 0 || q->Flushing != 0) return;
+	q->Flushing = 1;
+	while (i < q->Count)
+	{
+		// Datagrams are sent in the order they were queued, so only consecutive datagrams of the same socket go in one call
+		module = q->Sockets[i];
+		for (j = i + 1; j < q->Count && q->Sockets[j] == module; ++j);
+		while (i < j)
 		{
-			if (module->ssl == NULL)
+			if (module == NULL || module->internalSocket == ~0) { i = j; break; }
+			failed = 1;
+#ifdef MICROSTACK_UDPOFFLOAD
+			if (module->SegmentationOffload != 0)
 			{
-				// Send on non-SSL socket, set MSG_NOSIGNAL since we don't want to get Broken Pipe signals in Linux, ignored if Windows.
-				bytesSent = send(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent, MSG_NOSIGNAL); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+				k = ILibAsyncSocket_TransmitQueue_Segment(q, i, j);
+				sent = sendmmsg(module->internalSocket, q->Segmented, k, MSG_NOSIGNAL | MSG_DONTWAIT);
+				error = errno;
+				failed = q->SegmentedCount[0];
+				if (sent > 0)
+				{
+					// Count the datagrams, not the super-buffers
+					for (k = 0, segmented = 0; k < sent; ++k) { segmented += q->SegmentedCount[k]; if (q->SegmentedCount[k] > 1) { q->Stats.Segmented += q->SegmentedCount[k]; } }
+					sent = segmented;
+				}
+				else if (failed > 1 && (error == EIO || error == EINVAL))
+				{
+					// The kernel or the NIC can't segment this, stop trying, and send these again one by one
+					ILibRemoteLogging_printf(ILibChainGetLogger(chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] UDP_SEGMENT failed (%d), segmentation offload disabled", (void*)module, error);
+					module->SegmentationOffload = 0;
+					++q->Stats.Syscalls;
+					continue;
+				}
 			}
 			else
+#endif
 			{
-				// Send on SSL socket, set MSG_NOSIGNAL since we don't want to get Broken Pipe signals in Linux, ignored if Windows.
-				bytesSent = SSL_write(module->ssl, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent);
+				sent = sendmmsg(module->internalSocket, &(q->Headers[i]), j - i, MSG_NOSIGNAL | MSG_DONTWAIT);
+				error = errno;
 			}
-		}
-		else
-		{
-			bytesSent = sendto(module->internalSocket, module->PendingSend_Head->buffer+module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent, MSG_NOSIGNAL, (struct sockaddr*)remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family)); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+			++q->Stats.Syscalls;
+			if (sent > 0)
+			{
+				q->Stats.Datagrams += sent;
+				if ((unsigned int)sent > q->Stats.LargestBatch) { q->Stats.LargestBatch = (unsigned int)sent; }
+				i += sent;
+			}
+			else if (error == EWOULDBLOCK || error == EAGAIN)
+			{
+				// The socket buffer is full, the rest goes on the socket's own send queue, to go out when the socket is writable
+				while (i < j) { ILibAsyncSocket_TransmitQueue_Defer(q, i++); }
+				deferred = 1;
+			}
+			else if (error != EINTR)
+			{
+				// These datagrams failed (most likely their destination is unreachable). Report it, and carry on with the next ones.
+				ILibRemoteLogging_printf(ILibChainGetLogger(chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] sendmmsg error %d", (void*)module, error);
+				q->Stats.Errors += failed;
+				if (module->OnSendError != NULL) { module->OnSendError(module, (struct sockaddr*)&(q->Addresses[i]), error, module->user); }
+				i += failed;
+			}
+		}
+	}
+
+	for (i = 0; i < q->Count; ++i)
+	{
+		if (q->Owned[i] != NULL) { free(q->Owned[i]); q->Owned[i] = NULL; }
+	}
+	q->Count = 0;
+	q->ArenaUsed = 0;
+	q->Flushing = 0;
+
+	// The sockets already ran their PreSelect, so the chain must go around once more to wait for them to be writable
+	if (deferred != 0) { ILibForceUnBlockChain(chain); }
+}
+
+//
+// Internal method that queues a datagram to be sent when the chain is about to sleep
+//
+// <returns>Non-zero if the datagram was queued, zero if it must be sent right away</returns>
+int ILibAsyncSocket_TransmitQueue_Add(struct ILibAsyncSocketModule *module, char* buffer, int length, struct sockaddr *remoteAddress, enum ILibAsyncSocket_MemoryOwnership UserFree)
+{
+	struct ILibAsyncSocket_TransmitQueue *q = module->TransmitQueue;
+	int i, queue;
+
+	if (q->Flushing != 0 || ILibIsRunningOnChainThread(module->Chain) == 0) return(0);
+	if (length > ILibAsyncSocket_TransmitArenaSize)
+	{
+		// Too large to be queued, what is already queued has to go first
+		ILibAsyncSocket_TransmitQueue_Flush(module->Chain, q);
+		return(0);
+	}
+
+	if (q->Count == ILibAsyncSocket_MaxTransmitBatch || (UserFree == ILibAsyncSocket_MemoryOwnership_USER && q->ArenaUsed + length > ILibAsyncSocket_TransmitArenaSize))
+	{
+		ILibAsyncSocket_TransmitQueue_Flush(module->Chain, q);
+	}
+
+	// Datagrams that would wait behind a backlog take the normal path, so they stay in order. The flush above may have just made one
+	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_TransmitQueue_Add", 1, module);)
+	sem_wait(&(module->SendLock));
+	queue = (module->internalSocket != ~0 && module->PendingSend_Head == NULL) ? 1 : 0;
+	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_TransmitQueue_Add", 2, module);)
+	sem_post(&(module->SendLock));
+	if (queue == 0) return(0);
+
+	i = q->Count++;
+	q->Sockets[i] = module;
+	q->Owned[i] = UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN ? buffer : NULL;
+	if (UserFree == ILibAsyncSocket_MemoryOwnership_USER)
+	{
+		// The caller may reuse this buffer as soon as we return
+		memcpy(q->Arena + q->ArenaUsed, buffer, length);
+		buffer = q->Arena + q->ArenaUsed;
+		q->ArenaUsed += length;
+	}
+	memcpy(&(q->Addresses[i]), remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family));
+	q->Vectors[i].iov_base = buffer;
+	q->Vectors[i].iov_len = length;
+	memset(&(q->Headers[i]), 0, sizeof(struct mmsghdr));
+	q->Headers[i].msg_hdr.msg_name = &(q->Addresses[i]);
+	q->Headers[i].msg_hdr.msg_namelen = INET_SOCKADDR_LENGTH(remoteAddress->sa_family);
+	q->Headers[i].msg_hdr.msg_iov = &(q->Vectors[i]);
+	q->Headers[i].msg_hdr.msg_iovlen = 1;
+	return(1);
+}
+#endif
+
+/*! \fn ILibAsyncSocket_SetSegmentationOffload(ILibAsyncSocket_SocketModule socketModule, int enable)
+\brief Sends the batched datagrams of a UDP socket with UDP_SEGMENT (GSO)
+\par
+Queued datagrams of the same size to the same destination (see \a ILibAsyncSocket_SetTransmitBatch) are handed to the kernel as one
+super-buffer, which is only split into datagrams at the bottom of the stack, or by the NIC. If the kernel or the NIC refuses it later,
+the datagrams are sent one by one, and the offload is turned off for this socket.
+\param socketModule The ILibAsyncSocket to configure. Transmit batching must be enabled.
+\param enable Non-zero to coalesce datagrams
+\returns Non-zero if the kernel supports UDP segmentation offload
+*/
+int ILibAsyncSocket_SetSegmentationOffload(ILibAsyncSocket_SocketModule socketModule, int enable)
+{
+#ifdef MICROSTACK_UDPOFFLOAD
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	int size = 0;
+
+	if (enable == 0) { module->SegmentationOffload = 0; return(1); }
+	if (module->TransmitQueue == NULL) return(0);
+
+	// Setting a segment size of zero doesn't change anything, but fails on kernels without UDP_SEGMENT
+	if (setsockopt(module->internalSocket, SOL_UDP, UDP_SEGMENT, (char*)&size, sizeof(size)) != 0) return(0);
+	module->SegmentationOffload = 1;
+	return(1);
+#else
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(enable);
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_SetReceiveOffload(ILibAsyncSocket_SocketModule socketModule, int enable)
+\brief Lets the kernel coalesce the datagrams a UDP socket receives (UDP_GRO)
+\par
+Datagrams of a flow that arrive together are handed up the stack as one, and are split back into the original datagrams before
+they are delivered to OnData. The receive batch is rebuilt with 64KB slots, and at most 16 of them.
+<B>Note:</B> This must only be called on a datagram socket, from the chain thread, or before the chain is started.
+\param socketModule The ILibAsyncSocket to configure. If receive batching is off, it is turned on.
+\param enable Non-zero to let the kernel coalesce datagrams
+\returns Non-zero if the kernel supports UDP receive offload
+*/
+int ILibAsyncSocket_SetReceiveOffload(ILibAsyncSocket_SocketModule socketModule, int enable)
+{
+#ifdef MICROSTACK_UDPOFFLOAD
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	int size = module->ReceiveBatch != NULL ? module->ReceiveBatch->Size : ILibAsyncSocket_MaxOffloadBatch;
+
+	enable = enable != 0 ? 1 : 0;
+	if (enable == module->ReceiveOffload) return(1);
+	if (setsockopt(module->internalSocket, SOL_UDP, UDP_GRO, (char*)&enable, sizeof(enable)) != 0) return(0);
+	module->ReceiveOffload = enable;
+	return(ILibAsyncSocket_SetReceiveBatch(module, size));
+#else
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(enable);
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_SetTransmitBatch(ILibAsyncSocket_SocketModule socketModule, int enable, ILibAsyncSocket_OnSendError OnSendError)
+\brief Batches the datagrams sent on a UDP socket, into a single sendmmsg() when the chain is about to sleep
+\par
+Datagrams sent with \a ILibAsyncSocket_SendTo from the chain thread are queued on a per chain transmit queue, shared by all the
+sockets of the chain that enabled it, and go out in the order they were sent. Since the datagrams are sent later, \a ILibAsyncSocket_SendTo
+returns ILibAsyncSocket_ALL_DATA_SENT for them, and a datagram that fails is reported to \a OnSendError instead.
+A failed datagram doesn't close the socket, only its destination is affected.
+<br>Sends from other threads, and sends made from \a OnSendError, are not batched.
+\param socketModule The ILibAsyncSocket to configure
+\param enable Non-zero to batch, zero to send every datagram right away
+\param OnSendError Handler for datagrams the kernel refused, can be NULL
+\returns Non-zero if batched transmit is supported on this platform
+*/
+int ILibAsyncSocket_SetTransmitBatch(ILibAsyncSocket_SocketModule socketModule, int enable, ILibAsyncSocket_OnSendError OnSendError)
+{
+#ifdef MICROSTACK_SENDMMSG
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	struct ILibAsyncSocket_TransmitQueue *q = module->TransmitQueue;
+	ILibHashtable stash;
+	int i;
+
+	module->OnSendError = OnSendError;
+	if ((enable != 0) == (q != NULL)) return(1);
+	stash = ILibChain_GetBaseHashtable(module->Chain);
+	if (enable != 0)
+	{
+		if ((q = (struct ILibAsyncSocket_TransmitQueue*)ILibHashtable_Get(stash, NULL, ILibAsyncSocket_TransmitQueueKey, sizeof(ILibAsyncSocket_TransmitQueueKey) - 1)) == NULL)
+		{
+			if ((q = (struct ILibAsyncSocket_TransmitQueue*)malloc(sizeof(struct ILibAsyncSocket_TransmitQueue))) == NULL) ILIBCRITICALEXIT(254);
+			memset(q, 0, sizeof(struct ILibAsyncSocket_TransmitQueue));
+			q->Chain = module->Chain;
+			ILibHashtable_Put(stash, NULL, ILibAsyncSocket_TransmitQueueKey, sizeof(ILibAsyncSocket_TransmitQueueKey) - 1, q);
+			ILibChain_AddPreSleepHandler(module->Chain, &ILibAsyncSocket_TransmitQueue_Flush, q);
+		}
+		++q->RefCount;
+		module->TransmitQueue = q;
+	}
+	else
+	{
+		// Whatever this socket still has queued is dropped
+		module->TransmitQueue = NULL;
+		for (i = 0; i < q->Count; ++i)
+		{
+			if (q->Sockets[i] != module) continue;
+			q->Sockets[i] = NULL;
+			if (q->Owned[i] != NULL) { free(q->Owned[i]); q->Owned[i] = NULL; }
+		}
+		if (--q->RefCount == 0)
+		{
+			ILibChain_RemovePreSleepHandler(module->Chain, &ILibAsyncSocket_TransmitQueue_Flush, q);
+			ILibHashtable_Remove(stash, NULL, ILibAsyncSocket_TransmitQueueKey, sizeof(ILibAsyncSocket_TransmitQueueKey) - 1);
+			free(q);
+		}
+	}
+	return(1);
+#else
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(enable);
+	UNREFERENCED_PARAMETER(OnSendError);
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_GetTransmitBatchStats(void *chain, ILibAsyncSocket_TransmitBatchStats *stats)
+\brief Fetches the counters of the transmit queue of a chain, see \a ILibAsyncSocket_SetTransmitBatch
+\param chain The chain to query
+\param[out] stats The running totals, all zero if no socket of the chain batches its sends
+*/
+void ILibAsyncSocket_GetTransmitBatchStats(void *chain, ILibAsyncSocket_TransmitBatchStats *stats)
+{
+#ifdef MICROSTACK_SENDMMSG
+	struct ILibAsyncSocket_TransmitQueue *q = (struct ILibAsyncSocket_TransmitQueue*)ILibHashtable_Get(ILibChain_GetBaseHashtable(chain), NULL, ILibAsyncSocket_TransmitQueueKey, sizeof(ILibAsyncSocket_TransmitQueueKey) - 1);
+	if (q != NULL) { memcpy(stats, &(q->Stats), sizeof(ILibAsyncSocket_TransmitBatchStats)); return; }
+#else
+	UNREFERENCED_PARAMETER(chain);
+#endif
+	memset(stats, 0, sizeof(ILibAsyncSocket_TransmitBatchStats));
+}
+
+/*! \fn ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketModule socketModule, char* buffer, int length, int remoteAddress, unsigned short remotePort, enum ILibAsyncSocket_MemoryOwnership UserFree)
+\brief Sends data on an AsyncSocket module to a specific destination. (Valid only for <B>UDP</B>)
+\param socketModule The ILibAsyncSocket module to send data on
+\param buffer The buffer to send
+\param length The length of the buffer to send
+\param remoteAddress The IPAddress of the destination 
+\param remotePort The Port number of the destination
+\param UserFree Flag indicating memory ownership. 
+\returns \a ILibAsyncSocket_SendStatus indicating the send status
+*/
+enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketModule socketModule, char* buffer, int length, struct sockaddr *remoteAddress, enum ILibAsyncSocket_MemoryOwnership UserFree)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	struct ILibAsyncSocket_SendData *data;
+	int bytesSent = 0;
+	int watermark;
+	int corked = 0;
+	unsigned int pendingBytes;
+	enum ILibAsyncSocket_SendStatus retVal = ILibAsyncSocket_ALL_DATA_SENT;
+
+	// If the socket is empty, return now.
+	if (socketModule == NULL) return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
+
+#ifdef MICROSTACK_SENDMMSG
+	// Datagrams sent from the chain thread go out together, when the chain is about to sleep
+	if (remoteAddress != NULL && module->TransmitQueue != NULL && ILibAsyncSocket_TransmitQueue_Add(module, buffer, length, remoteAddress, UserFree) != 0) return ILibAsyncSocket_ALL_DATA_SENT;
+#endif
+
+	// Setup a new send data structure
+	if ((data = (struct ILibAsyncSocket_SendData*)malloc(sizeof(struct ILibAsyncSocket_SendData))) == NULL) ILIBCRITICALEXIT(254);
+	memset(data, 0, sizeof(struct ILibAsyncSocket_SendData));
+	data->buffer = buffer;
+	data->bufferSize = length;
+	data->bytesSent = 0;
+	data->UserFree = UserFree;
+	data->Next = NULL;
+
+	// Copy the address to the send data structure
+	memset(&(data->remoteAddress), 0, sizeof(struct sockaddr_in6));
+	if (remoteAddress != NULL) memcpy(&(data->remoteAddress), remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family));
+
+	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_Send", 1, module);)
+	sem_wait(&(module->SendLock));
+
+	if (module->internalSocket == ~0)
+	{
+		// Too Bad, the socket closed
+		if (UserFree == 0) free(buffer);
+		free(data);
+		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_Send", 2, module);)
+		sem_post(&(module->SendLock));
+		return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
+	}
+	if (module->SendLimit > 0 && module->PendingBytesToSend > 0 && module->PendingBytesToSend + (unsigned int)length > module->SendLimit)
+	{
+		// The hard cap was hit. A single block is always accepted on an empty queue, so a large send can't be rejected forever.
+		if (UserFree == 0) free(buffer);
+		free(data);
+		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_Send", 2, module);)
+		sem_post(&(module->SendLock));
+		return ILibAsyncSocket_SEND_LIMIT_EXCEEDED;
+	}
+
+#ifdef MICROSTACK_ZEROCOPY
+	if (module->ZeroCopy_Head != NULL) ILibAsyncSocket_ZeroCopy_Complete(module);
+
+	// Large blocks we don't have to copy are handed to the kernel with MSG_ZEROCOPY. USER memory has to be copied anyway, so it stays on the normal path.
+	#ifndef MICROSTACK_NOTLS
+	if (module->ssl == NULL)
+	#endif
+	data->ZeroCopy = (module->ZeroCopyState == 1 && module->ZeroCopyThreshold > 0 && remoteAddress == NULL && UserFree != ILibAsyncSocket_MemoryOwnership_USER && length >= module->ZeroCopyThreshold) ? 1 : 0;
+#endif
+
+	module->PendingBytesToSend += length;
+	corked = (module->Corked != 0 && remoteAddress == NULL) ? 1 : 0;
+	if (module->PendingSend_Tail != NULL || module->FinConnect == 0 || corked != 0)
+	{
+		// There are still bytes that are pending to be sent, or pending connection, or the socket is corked, so we need to queue this up
+		if (module->PendingSend_Tail == NULL)
+		{
+			module->PendingSend_Tail = data;
+			module->PendingSend_Head = data;
+		}
+		else
+		{
+			module->PendingSend_Tail->Next = data;
+			module->PendingSend_Tail = data;
+		}
+		
+		retVal = ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
+
+		if (UserFree == ILibAsyncSocket_MemoryOwnership_USER)
+		{
+			// If we don't own this memory, we need to copy the buffer,
+			// because the user may free this memory before we have a chance to send it
+			if ((data->buffer = (char*)malloc(data->bufferSize)) == NULL) ILIBCRITICALEXIT(254);
+			memcpy(data->buffer, buffer, length);
+			MEMCHECK(assert(length <= data->bufferSize);)
+			data->UserFree = ILibAsyncSocket_MemoryOwnership_CHAIN;
+		}
+	}
+	else
+	{
+		// There is no data pending to be sent, so lets go ahead and try to send this data
+		module->PendingSend_Tail = data;
+		module->PendingSend_Head = data;
+
+		#ifndef MICROSTACK_NOTLS
+		if (module->ssl != NULL || remoteAddress == NULL)
+		{
+			if (module->ssl == NULL)
+			{
+				// Send on non-SSL socket, set MSG_NOSIGNAL since we don't want to get Broken Pipe signals in Linux, ignored if Windows.
+#ifdef MICROSTACK_ZEROCOPY
+				if (data->ZeroCopy != 0) { bytesSent = ILibAsyncSocket_ZeroCopy_Send(module, data); } else
+#endif
+				bytesSent = send(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent, MSG_NOSIGNAL); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+			}
+			else
+			{
+				// Send on SSL socket, set MSG_NOSIGNAL since we don't want to get Broken Pipe signals in Linux, ignored if Windows.
+				bytesSent = SSL_write(module->ssl, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent);
+			}
+		}
+		else
+		{
+			bytesSent = sendto(module->internalSocket, module->PendingSend_Head->buffer+module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent, MSG_NOSIGNAL, (struct sockaddr*)remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family)); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
 		}
 		#else
 		if (remoteAddress == NULL)
 		{
 			// Set MSG_NOSIGNAL since we don't want to get Broken Pipe signals in Linux, ignored if Windows.
+#ifdef MICROSTACK_ZEROCOPY
+			if (data->ZeroCopy != 0) { bytesSent = ILibAsyncSocket_ZeroCopy_Send(module, data); } else
+#endif
 			bytesSent = send(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize-module->PendingSend_Head->bytesSent, MSG_NOSIGNAL);
 		}
 		else
@@ -576,10 +1405,19 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 		if (module->PendingSend_Head->bytesSent == module->PendingSend_Head->bufferSize)
 		{
 			// All of the data has been sent
-			if (UserFree == 0) free(module->PendingSend_Head->buffer);
 			module->PendingSend_Tail = NULL;
-			free(module->PendingSend_Head);
 			module->PendingSend_Head = NULL;
+#ifdef MICROSTACK_ZEROCOPY
+			if (data->ZeroCopyCount != 0)
+			{
+				ILibAsyncSocket_ZeroCopy_Hold(module, data);
+			}
+			else
+#endif
+			{
+				if (UserFree == 0) free(data->buffer);
+				free(data);
+			}
 		}
 		else
 		{
@@ -597,12 +1435,93 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 		}
 
 	}
+	watermark = ILibAsyncSocket_CheckWatermark(module);
+	pendingBytes = module->PendingBytesToSend;
 	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_Send", 4, module);)
 	sem_post(&(module->SendLock));
-	if (retVal != ILibAsyncSocket_ALL_DATA_SENT) ILibForceUnBlockChain(module->Chain);
+	// Corked data sent from the chain thread waits for ILibAsyncSocket_Uncork, there is no need to wake the chain up for it
+	if (retVal != ILibAsyncSocket_ALL_DATA_SENT && (corked == 0 || ILibIsRunningOnChainThread(module->Chain) == 0)) ILibForceUnBlockChain(module->Chain);
+	if (watermark != 0) module->OnWatermark(module, watermark > 0, pendingBytes, module->user);
 	return (retVal);
 }
 
+#ifdef MICROSTACK_SENDFILE
+/*! \fn ILibAsyncSocket_SendFile(ILibAsyncSocket_SocketModule socketModule, int fd, off_t offset, int length, enum ILibAsyncSocket_MemoryOwnership UserFree)
+\brief Queues a segment of a file to be sent on a non-TLS (or kernel TLS) TCP connection, using sendfile()
+\par
+The segment is ordered with the other sends on this socket, and is written by the kernel directly from the page cache
+whenever the socket is writable. \a OnSendOK is triggered as usual, once everything pending has been sent.
+\param socketModule The ILibAsyncSocket module to send data on
+\param fd The file descriptor to read from. The file position is not used, nor changed.
+\param offset Offset in the file, of the first byte to send
+\param length Number of bytes to send
+\param UserFree \a ILibAsyncSocket_MemoryOwnership_CHAIN to have the descriptor closed when the segment is sent or discarded. Any other value leaves it open.
+\returns \a ILibAsyncSocket_SendStatus indicating the send status
+*/
+enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendFile(ILibAsyncSocket_SocketModule socketModule, int fd, off_t offset, int length, enum ILibAsyncSocket_MemoryOwnership UserFree)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	struct ILibAsyncSocket_SendData *data;
+	int watermark;
+	unsigned int pendingBytes;
+
+	if (socketModule == NULL) { if (UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN) close(fd); return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR; }
+
+	if ((data = (struct ILibAsyncSocket_SendData*)malloc(sizeof(struct ILibAsyncSocket_SendData))) == NULL) ILIBCRITICALEXIT(254);
+	memset(data, 0, sizeof(struct ILibAsyncSocket_SendData));
+	data->IsFile = 1;
+	data->FileDescriptor = fd;
+	data->FileOffset = offset;
+	data->bufferSize = length;
+	data->UserFree = UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN ? ILibAsyncSocket_MemoryOwnership_CHAIN : ILibAsyncSocket_MemoryOwnership_STATIC;
+
+	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_SendFile", 1, module);)
+	sem_wait(&(module->SendLock));
+
+	#ifndef MICROSTACK_NOTLS
+	if (module->internalSocket == ~0 || (module->ssl != NULL && module->KernelTLS != 2))
+	#else
+	if (module->internalSocket == ~0)
+	#endif
+	{
+		// The socket closed, or this is TLS without kTLS, which has to go through SSL_write
+		if (UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN) close(fd);
+		free(data);
+		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_SendFile", 2, module);)
+		sem_post(&(module->SendLock));
+		return ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR;
+	}
+	if (module->SendLimit > 0 && module->PendingBytesToSend > 0 && module->PendingBytesToSend + (unsigned int)length > module->SendLimit)
+	{
+		if (UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN) close(fd);
+		free(data);
+		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_SendFile", 2, module);)
+		sem_post(&(module->SendLock));
+		return ILibAsyncSocket_SEND_LIMIT_EXCEEDED;
+	}
+
+	// File segments are always queued, PostSelect sends them as soon as the socket is writable
+	module->PendingBytesToSend += length;
+	if (module->PendingSend_Tail == NULL)
+	{
+		module->PendingSend_Head = data;
+	}
+	else
+	{
+		module->PendingSend_Tail->Next = data;
+	}
+	module->PendingSend_Tail = data;
+	watermark = ILibAsyncSocket_CheckWatermark(module);
+	pendingBytes = module->PendingBytesToSend;
+
+	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_SendFile", 3, module);)
+	sem_post(&(module->SendLock));
+	ILibForceUnBlockChain(module->Chain);
+	if (watermark != 0) module->OnWatermark(module, watermark > 0, pendingBytes, module->user);
+	return ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
+}
+#endif
+
 /*! \fn ILibAsyncSocket_Disconnect(ILibAsyncSocket_SocketModule socketModule)
 \brief Disconnects an ILibAsyncSocket
 \param socketModule The ILibAsyncSocket to disconnect
@@ -647,6 +1566,9 @@ void ILibAsyncSocket_Disconnect(ILibAsyncSocket_SocketModule socketModule)
 		module->internalSocket = (SOCKET)~0;
 		if (s != -1)
 		{
+#ifdef MICROSTACK_ZEROCOPY
+			ILibAsyncSocket_ZeroCopy_Clear(module, s);
+#endif
 #if defined(_WIN32_WCE) || defined(WIN32)
 #if defined(WINSOCK2)
 			shutdown(s, SD_BOTH);
@@ -710,6 +1632,7 @@ void ILibAsyncSocket_Callback(ILibAsyncSocket_SocketModule socketModule, int con
 			if (module->ssl != NULL)
 			{
 				// If SSL enabled, we need to complete the SSL handshake before we tell the application we are connected.
+				module->HandshakeStart = ILibGetUptime();
 				SSL_connect(module->ssl);
 			}
 			else
@@ -741,6 +1664,7 @@ void ILibAsyncSocket_Callback(ILibAsyncSocket_SocketModule socketModule, int con
 void ILibAsyncSocket_ConnectTo(void* socketModule, struct sockaddr *localInterface, struct sockaddr *remoteAddress, ILibAsyncSocket_OnInterrupt InterruptPtr, void *user)
 {
 	int flags = 1;
+	int fastOpen = 0;
 	char *tmp;
 	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
 	struct sockaddr_in6 any;
@@ -759,6 +1683,7 @@ void ILibAsyncSocket_ConnectTo(void* socketModule, struct sockaddr *localInterfa
 	// Setup
 	memcpy(&(module->RemoteAddress), remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family));
 	module->PendingBytesToSend = 0;
+	module->AboveHighWatermark = 0;
 	module->TotalBytesSent = 0;
 	module->PAUSE = 0;
 	module->user = user;
@@ -799,6 +1724,9 @@ void ILibAsyncSocket_ConnectTo(void* socketModule, struct sockaddr *localInterfa
 
 	// Turn on keep-alives for the socket
 	if (setsockopt(module->internalSocket, SOL_SOCKET, SO_KEEPALIVE, (char*)&flags, sizeof(flags)) != 0) ILIBCRITICALERREXIT(253);
+#ifdef MICROSTACK_ZEROCOPY
+	ILibAsyncSocket_ZeroCopy_Init(module);
+#endif
 
 	// Set the socket to non-blocking mode, because we need to play nice and share the MicroStack thread
 #if defined(_WIN32_WCE) || defined(WIN32)
@@ -808,6 +1736,20 @@ void ILibAsyncSocket_ConnectTo(void* socketModule, struct sockaddr *localInterfa
 	fcntl(module->internalSocket, F_SETFL, O_NONBLOCK | flags);
 #endif
 
+#ifdef TCP_FASTOPEN_CONNECT
+	// With Fast Open, connect() returns right away if we have a cookie for this server, and the SYN leaves with the first send.
+	// Only for direct connections, a proxy has to complete its own handshake before anything is sent
+	fastOpen = module->FastOpen;
+	#ifdef MICROSTACK_PROXY
+	if (module->ProxyAddress.sin6_family != 0) { fastOpen = 0; }
+	#endif
+	if (fastOpen != 0)
+	{
+		flags = 1;
+		if (setsockopt(module->internalSocket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (char*)&flags, sizeof(flags)) != 0) { fastOpen = 0; }
+	}
+#endif
+
 	// Connect the socket, and force the chain to unblock, since the select statement doesn't have us in the fdset yet.
 #ifdef MICROSTACK_PROXY
 	if (module->ProxyAddress.sin6_family != 0)
@@ -824,6 +1766,13 @@ void ILibAsyncSocket_ConnectTo(void* socketModule, struct sockaddr *localInterfa
 #endif
 	if (connect(module->internalSocket, (struct sockaddr*)remoteAddress, INET_SOCKADDR_LENGTH(remoteAddress->sa_family)) != -1)
 	{
+		if (fastOpen != 0)
+		{
+			// Fast Open deferred the connection, the socket is writable right away and will be handled as connected
+			ILibForceUnBlockChain(module->Chain);
+			return;
+		}
+
 		// Connect failed. Set a short time and call disconnect.
 		module->FinConnect = -1;
 		ILibLifeTime_Add(module->LifeTime, socketModule, 0, &ILibAsyncSocket_Disconnect, NULL);
@@ -871,20 +1820,119 @@ void ILibAsyncSocket_ConnectToProxy(void* socketModule, struct sockaddr *localIn
 }
 #endif
 
+#ifdef MICROSTACK_RECVMMSG
 //
-// Internal method called when data is ready to be processed on an ILibAsyncSocket
+// Internal method that delivers the datagrams of the receive ring, until they run out, or the socket is paused or closed
 //
-// <param name="Reader">The ILibAsyncSocket with pending data</param>
-void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRead)
+// <param name="Reader">The ILibAsyncSocket that received the datagrams</param>
+void ILibAsyncSocket_DeliverBatch(struct ILibAsyncSocketModule *Reader)
 {
-	#ifndef MICROSTACK_NOTLS
-	int ssllen;
-	int sslstate;
-	int sslerror;
-	SSL *wasssl;
-	#endif
-	int iBeginPointer = 0;
-	int iEndPointer = 0;
+	struct ILibAsyncSocket_ReceiveBatch *batch = Reader->ReceiveBatch;
+	int i, iPointer, offset, len;
+
+	while (batch->Next < batch->Count && Reader->internalSocket != ~0 && Reader->PAUSE <= 0)
+	{
+		i = batch->Next;
+		offset = batch->Offset;
+		len = (int)batch->Headers[i].msg_len - offset;
+#ifdef MICROSTACK_UDPOFFLOAD
+		// A slot the kernel coalesced with GRO is split back into the datagrams that were sent
+		if (batch->SegmentSize != NULL && batch->SegmentSize[i] > 0 && batch->SegmentSize[i] < len) { len = batch->SegmentSize[i]; }
+#endif
+		if (offset + len >= (int)batch->Headers[i].msg_len) { ++batch->Next; batch->Offset = 0; } else { batch->Offset += len; }
+
+		memcpy(&(Reader->SourceAddress), &(batch->Addresses[i]), sizeof(struct sockaddr_in6));
+		ILib6to4((struct sockaddr*)&(Reader->SourceAddress));
+		iPointer = 0;
+		if (Reader->OnData != NULL) Reader->OnData(Reader, batch->Buffers + (i * batch->DatagramSize) + offset, &iPointer, len, &(Reader->OnInterrupt), &(Reader->user), &(Reader->PAUSE));
+		if (Reader->ReceiveBatch != batch) return; // The batch was turned off from the callback
+	}
+}
+
+//
+// Internal method that reads as many datagrams as the ring can hold, with a single recvmmsg(), and delivers them
+//
+// <param name="Reader">The ILibAsyncSocket to read from</param>
+// <returns>The number of datagrams read, or -1 if the socket failed</returns>
+int ILibAsyncSocket_ReceiveBatch(struct ILibAsyncSocketModule *Reader)
+{
+	struct ILibAsyncSocket_ReceiveBatch *batch = Reader->ReceiveBatch;
+	int i, count, datagrams;
+	struct cmsghdr *cmsg;
+
+	for (i = 0; i < batch->Size; ++i)
+	{
+		batch->Headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+		batch->Headers[i].msg_hdr.msg_flags = 0;
+		if (batch->Control != NULL) { batch->Headers[i].msg_hdr.msg_controllen = batch->ControlSize; }
+	}
+	count = recvmmsg(Reader->internalSocket, batch->Headers, batch->Size, MSG_DONTWAIT, NULL);
+	ILibRemoteLogging_printf(ILibChainGetLogger(Reader->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_2, "AsyncSocket[%p] recvmmsg returned %d", (void*)Reader, count);
+	if (count < 0)
+	{
+		// ICMP errors from a previous send are reported here, those don't close a datagram socket
+		if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR || errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH) return(0);
+		return(-1);
+	}
+
+	batch->Next = 0;
+	batch->Offset = 0;
+	batch->Count = count;
+	++batch->Stats.Syscalls;
+	if ((unsigned int)count > batch->Stats.LargestBatch) { batch->Stats.LargestBatch = (unsigned int)count; }
+	if (count == batch->Size) { ++batch->Stats.FullBatches; }
+	for (i = 0; i < count; ++i)
+	{
+		if ((batch->Headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0) { ++batch->Stats.Truncated; }
+		datagrams = 1;
+		if (batch->Control == NULL) { batch->Stats.Datagrams += datagrams; continue; }
+#ifdef MICROSTACK_UDPOFFLOAD
+		if (batch->SegmentSize != NULL) { batch->SegmentSize[i] = 0; }
+#endif
+		for (cmsg = CMSG_FIRSTHDR(&(batch->Headers[i].msg_hdr)); cmsg != NULL; cmsg = CMSG_NXTHDR(&(batch->Headers[i].msg_hdr), cmsg))
+		{
+#ifdef MICROSTACK_UDPOFFLOAD
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO && batch->SegmentSize != NULL) { batch->SegmentSize[i] = *((int*)CMSG_DATA(cmsg)); }
+#endif
+#ifdef MICROSTACK_RXQOVFL
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+			{
+				// The counter is a running total for the socket, that wraps at 32 bits
+				unsigned int drops = *((unsigned int*)CMSG_DATA(cmsg));
+				Reader->BufferStats.Drops += (unsigned int)(drops - Reader->KernelDrops);
+				Reader->KernelDrops = drops;
+			}
+#endif
+		}
+#ifdef MICROSTACK_UDPOFFLOAD
+		if (batch->SegmentSize != NULL && batch->SegmentSize[i] > 0 && (int)batch->Headers[i].msg_len > batch->SegmentSize[i])
+		{
+			datagrams = ((int)batch->Headers[i].msg_len + batch->SegmentSize[i] - 1) / batch->SegmentSize[i];
+			batch->Stats.Coalesced += datagrams;
+		}
+#endif
+		batch->Stats.Datagrams += datagrams;
+	}
+
+	ILibAsyncSocket_DeliverBatch(Reader);
+	return(count);
+}
+#endif
+
+//
+// Internal method called when data is ready to be processed on an ILibAsyncSocket
+//
+// <param name="Reader">The ILibAsyncSocket with pending data</param>
+void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRead)
+{
+	#ifndef MICROSTACK_NOTLS
+	int ssllen;
+	int sslstate;
+	int sslerror;
+	SSL *wasssl;
+	#endif
+	int iBeginPointer = 0;
+	int iEndPointer = 0;
 	int iPointer = 0;
 	int bytesReceived = 0;
 	int len;
@@ -931,6 +1979,10 @@ void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRea
 	{
 		ILibRemoteLogging_printf(ILibChainGetLogger(Reader->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_2, "AsyncSocket[%p] is PAUSED", (void*)Reader);
 	}
+#ifdef MICROSTACK_RECVMMSG
+	// Datagrams left over from a batch that was paused are delivered before reading more
+	if (Reader->ReceiveBatch != NULL && Reader->PAUSE <= 0 && Reader->ReceiveBatch->Next < Reader->ReceiveBatch->Count) { ILibAsyncSocket_DeliverBatch(Reader); }
+#endif
 	if (!pendingRead || Reader->PAUSE > 0) return;
 
 	//
@@ -1074,6 +2126,15 @@ void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRea
 		{
 			// If the SSL state changed to connected, we need to tell the application about the connection.
 			Reader->sslstate = 3;
+			Reader->HandshakeTime = (int)(ILibGetUptime() - Reader->HandshakeStart);
+#ifdef SSL_OP_ENABLE_KTLS
+			// If the kernel TLS module is available and the suite is supported, OpenSSL handed the record layer to the kernel during the handshake
+			if (Reader->KernelTLS != 0 && BIO_get_ktls_send(SSL_get_wbio(Reader->ssl)))
+			{
+				Reader->KernelTLS = 2;
+				ILibRemoteLogging_printf(ILibChainGetLogger(Reader->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] using kernel TLS", (void*)Reader);
+			}
+#endif
 			if (Reader->SSLConnect == 0) // This is still a mistery, but if this check is not present, it's possible to signal connect more than once.
 			{
 				Reader->SSLConnect = 1;
@@ -1102,6 +2163,14 @@ void ILibProcessAsyncSocket(struct ILibAsyncSocketModule *Reader, int pendingRea
 	}
 	else
 	#endif
+#ifdef MICROSTACK_RECVMMSG
+	if (Reader->ReceiveBatch != NULL)
+	{
+		// Read a batch of datagrams, and deliver them one by one. Only fatal errors fall through to the close logic below.
+		if ((bytesReceived = ILibAsyncSocket_ReceiveBatch(Reader)) >= 0) return;
+	}
+	else
+#endif
 	{
 		// Read data off the non-SSL, generic socket.
 		// Set the receive address buffer size and read from the socket.
@@ -1380,6 +2449,9 @@ void ILibAsyncSocket_PrivateShutdown(void* socketModule)
 	#endif
 
 	// Now shutdown the socket and set it to zero
+	#ifdef MICROSTACK_ZEROCOPY
+	ILibAsyncSocket_ZeroCopy_Clear(module, module->internalSocket);
+	#endif
 	#if defined(_WIN32_WCE) || defined(WIN32)
 	#if defined(WINSOCK2)
 		shutdown(module->internalSocket, SD_BOTH);
@@ -1412,6 +2484,224 @@ void ILibAsyncSocket_PrivateShutdown(void* socketModule)
 	module->FinConnect = 0;
 }
 
+#ifdef MICROSTACK_GATHER
+// Blocks that go out with a plain send(), as opposed to sendfile(), MSG_ZEROCOPY, sendto() or SSL_write()
+#ifdef MICROSTACK_ZEROCOPY
+#define ILibAsyncSocket_IsGatherable(data) ((data) != NULL && (data)->IsFile == 0 && (data)->ZeroCopy == 0 && (data)->remoteAddress.sin6_family == 0)
+#elif defined(MICROSTACK_SENDFILE)
+#define ILibAsyncSocket_IsGatherable(data) ((data) != NULL && (data)->IsFile == 0 && (data)->remoteAddress.sin6_family == 0)
+#else
+#define ILibAsyncSocket_IsGatherable(data) ((data) != NULL && (data)->remoteAddress.sin6_family == 0)
+#endif
+
+//
+// Internal method to determine if the head of the send queue is worth sending with a single gathering call. SendLock must be held.
+//
+int ILibAsyncSocket_CanGather(struct ILibAsyncSocketModule *module)
+{
+#ifndef MICROSTACK_NOTLS
+	if (module->ssl != NULL) return(0);
+#endif
+	return((ILibAsyncSocket_IsGatherable(module->PendingSend_Head) && ILibAsyncSocket_IsGatherable(module->PendingSend_Head->Next)) ? 1 : 0);
+}
+
+//
+// Internal method that sends the leading plain blocks of the send queue with one sendmsg(), and releases the blocks that were fully sent. SendLock must be held.
+//
+// <param name="module">The ILibAsyncSocket to send on</param>
+// <returns>The number of bytes sent, 0 if nothing was written, or -1 on error</returns>
+int ILibAsyncSocket_SendGather(struct ILibAsyncSocketModule *module)
+{
+	struct iovec iov[ILibAsyncSocket_MaxGather];
+	struct msghdr msg;
+	struct ILibAsyncSocket_SendData *data = module->PendingSend_Head;
+	int count = 0, bytesSent, remaining, n;
+
+	while (count < ILibAsyncSocket_MaxGather && ILibAsyncSocket_IsGatherable(data))
+	{
+		iov[count].iov_base = data->buffer + data->bytesSent;
+		iov[count].iov_len = (size_t)(data->bufferSize - data->bytesSent);
+		++count;
+		data = data->Next;
+	}
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	if ((bytesSent = (int)sendmsg(module->internalSocket, &msg, MSG_NOSIGNAL)) <= 0) return(bytesSent < 0 ? -1 : 0); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+
+	module->PendingBytesToSend -= bytesSent;
+	module->TotalBytesSent += bytesSent;
+	for (remaining = bytesSent; remaining > 0;)
+	{
+		data = module->PendingSend_Head;
+		n = data->bufferSize - data->bytesSent;
+		if (remaining < n) { data->bytesSent += remaining; break; }
+
+		// Finished sending this block
+		remaining -= n;
+		module->PendingSend_Head = data->Next;
+		if (module->PendingSend_Tail == data) { module->PendingSend_Tail = NULL; }
+		if (data->UserFree == 0) { free(data->buffer); }
+		free(data);
+	}
+	return(bytesSent);
+}
+#endif
+
+//
+// Internal method that sends as much of the pending data as the socket will take. SendLock must be held.
+//
+// <param name="module">The ILibAsyncSocket to flush</param>
+// <returns>Non-zero if all the pending data was sent, and OnSendOK should be triggered</returns>
+int ILibAsyncSocket_SendPending(struct ILibAsyncSocketModule *module)
+{
+	struct ILibAsyncSocket_SendData *temp;
+	int bytesSent = 0;
+	int TRY_TO_SEND = 1;
+
+	//
+	// Keep trying to send data, until we are told we can't
+	//
+	while (TRY_TO_SEND != 0)
+	{
+		if (module->PendingSend_Head == NULL) break;
+#ifdef MICROSTACK_GATHER
+		if (ILibAsyncSocket_CanGather(module) != 0)
+		{
+			// Several blocks are queued, hand them to the kernel in a single call
+			if ((bytesSent = ILibAsyncSocket_SendGather(module)) > 0)
+			{
+				if (module->PendingSend_Head == NULL) { TRY_TO_SEND = 0; }
+				continue;
+			}
+			if (bytesSent == 0)
+			{
+				// Nothing was written, so not all the data is sent. Wait for the socket to be writable again.
+				TRY_TO_SEND = 0;
+				continue;
+			}
+		}
+		else
+#endif
+#ifdef MICROSTACK_SENDFILE
+		if (module->PendingSend_Head->IsFile != 0)
+		{
+			// Let the kernel move the file segment straight to the socket
+			off_t offset = module->PendingSend_Head->FileOffset + module->PendingSend_Head->bytesSent;
+#if !defined(MICROSTACK_NOTLS) && defined(SSL_OP_ENABLE_KTLS)
+			if (module->ssl != NULL)
+			{
+				// Only queued when kTLS is active, the kernel encrypts the records
+				bytesSent = (int)SSL_sendfile(module->ssl, module->PendingSend_Head->FileDescriptor, offset, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, 0);
+			}
+			else
+#endif
+			bytesSent = (int)sendfile(module->internalSocket, module->PendingSend_Head->FileDescriptor, &offset, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent);
+			if (bytesSent == 0) { bytesSent = -1; errno = EIO; } // The file is shorter than it was when the segment was queued
+		}
+		else
+#endif
+		#ifndef MICROSTACK_NOTLS
+		if (module->ssl != NULL)
+		{
+			// Send on SSL socket
+			bytesSent = SSL_write(module->ssl, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent);
+		}
+		else
+		#endif
+#ifdef MICROSTACK_ZEROCOPY
+		if (module->PendingSend_Head->ZeroCopy != 0)
+		{
+			bytesSent = ILibAsyncSocket_ZeroCopy_Send(module, module->PendingSend_Head);
+		}
+		else
+#endif
+		if (module->PendingSend_Head->remoteAddress.sin6_family == 0)
+		{
+			bytesSent = send(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, MSG_NOSIGNAL); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+		}
+		else
+		{
+			bytesSent = sendto(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, MSG_NOSIGNAL, (struct sockaddr*)&module->PendingSend_Head->remoteAddress, INET_SOCKADDR_LENGTH(module->PendingSend_Head->remoteAddress.sin6_family)); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
+		}
+
+		if (bytesSent > 0)
+		{
+			module->PendingBytesToSend -= bytesSent;
+			module->TotalBytesSent += bytesSent;
+			module->PendingSend_Head->bytesSent += bytesSent;
+			if (module->PendingSend_Head->bytesSent == module->PendingSend_Head->bufferSize)
+			{
+				// Finished Sending this block
+				if (module->PendingSend_Head == module->PendingSend_Tail)
+				{
+					module->PendingSend_Tail = NULL;
+				}
+				temp = module->PendingSend_Head->Next;
+#ifdef MICROSTACK_ZEROCOPY
+				if (module->PendingSend_Head->ZeroCopyCount != 0)
+				{
+					ILibAsyncSocket_ZeroCopy_Hold(module, module->PendingSend_Head);
+				}
+				else
+#endif
+				{
+					if (module->PendingSend_Head->UserFree == 0)
+					{
+						free(module->PendingSend_Head->buffer);
+#ifdef MICROSTACK_SENDFILE
+						if (module->PendingSend_Head->IsFile != 0) close(module->PendingSend_Head->FileDescriptor);
+#endif
+					}
+					free(module->PendingSend_Head);
+				}
+				module->PendingSend_Head = temp;
+				if (module->PendingSend_Head == NULL) { TRY_TO_SEND = 0; }
+			}
+			else
+			{
+				// We sent data, but not everything that needs to get sent was sent, try again
+				TRY_TO_SEND = 1;
+			}
+		}
+		#ifndef MICROSTACK_NOTLS
+		if (bytesSent == -1 && module->ssl == NULL)
+		#else
+		if (bytesSent == -1)
+		#endif
+		{
+			// Error, clean up everything
+			TRY_TO_SEND = 0;
+#if defined(_WIN32_WCE) || defined(WIN32)
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+#elif defined(_POSIX)
+			if (errno != EWOULDBLOCK)
+#endif
+			{
+				// There was an error sending
+				ILibAsyncSocket_ClearPendingSend(module);
+				ILibLifeTime_Add(module->LifeTime, module, 0, &ILibAsyncSocket_Disconnect, NULL);
+			}
+		}
+		#ifndef MICROSTACK_NOTLS
+		else if (bytesSent == -1 && module->ssl != NULL)
+		{
+			// OpenSSL returned an error
+			TRY_TO_SEND = 0;
+			bytesSent = SSL_get_error(module->ssl, bytesSent);
+			if (bytesSent != SSL_ERROR_WANT_WRITE)
+			{
+				// There was an error sending
+				ILibAsyncSocket_ClearPendingSend(module);
+				ILibLifeTime_Add(module->LifeTime, module, 0, &ILibAsyncSocket_Disconnect, NULL);
+			}
+		}
+		#endif
+	}
+	return((module->PendingSend_Head == NULL && bytesSent != -1) ? 1 : 0);
+}
+
 //
 // Chained PostSelect handler for ILibAsyncSocket
 //
@@ -1423,10 +2713,10 @@ void ILibAsyncSocket_PrivateShutdown(void* socketModule)
 void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, fd_set *writeset, fd_set *errorset)
 {
 	int TriggerSendOK = 0;
-	struct ILibAsyncSocket_SendData *temp;
-	int bytesSent = 0;
+	int watermark = 0;
+	unsigned int pendingBytes = 0;
 	int flags, len;
-	int TRY_TO_SEND = 1;
+	int autoCork;
 	int triggerReadSet = 0;
 	int triggerResume = 0;
 	int triggerWriteSet = 0;
@@ -1475,6 +2765,16 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 #endif
 	}
 
+#ifdef MICROSTACK_ZEROCOPY
+	if (module->ZeroCopyState != 0)
+	{
+		// MSG_ZEROCOPY completions are signaled with POLLERR, which select() reports as readable. Drain them, and make sure there is
+		// really something to read, otherwise the read path would take the empty socket for a closed one.
+		ILibAsyncSocket_ZeroCopy_Complete(module);
+		if (fd_read != 0 && module->FinConnect > 0 && recv(module->internalSocket, ILibScratchPad, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EWOULDBLOCK) { fd_read = 0; }
+	}
+#endif
+
 	#ifdef MICROSTACK_PROXY
 	// Handle proxy, we need to read the proxy response, all of it and not a byte more.
 	if (module->FinConnect == 1 && module->ProxyState == 1 && serr == 0 && fd_read != 0)
@@ -1585,6 +2885,7 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 					ILibAsyncSocket_SetSSLContext(module, module->ssl_ctx, ILibAsyncSocket_TLS_Mode_Client);
 
 					// If this is an SSL socket, launch the SSL connection process
+					module->HandshakeStart = ILibGetUptime();
 					if ((serr = SSL_connect(module->ssl)) != 1 && SSL_get_error(module->ssl, serr) != SSL_ERROR_WANT_READ)
 					{
 						ILibAsyncSocket_PrivateShutdown(module); // On Linux it's possible to get BROKEN PIPE on SSL_connect()
@@ -1594,7 +2895,10 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 				#endif
 				{
 					// If this is a normal socket, event the connection now.
+					autoCork = module->AutoCork;
+					if (autoCork != 0) { ILibAsyncSocket_Cork(module); }
 					if (module->OnConnect != NULL) module->OnConnect(module, -1, module->user);
+					if (autoCork != 0) { ILibAsyncSocket_Uncork(module); }
 				}
 			}
 		}
@@ -1617,7 +2921,14 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 			SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_PostSelect", 4, module);)
 			sem_post(&(module->SendLock));
 
-			if (triggerReadSet != 0 || triggerResume != 0) ILibProcessAsyncSocket(module, triggerReadSet);
+			if (triggerReadSet != 0 || triggerResume != 0)
+			{
+				// With auto cork, everything the application sends while processing this data goes out together once it returns
+				autoCork = module->AutoCork;
+				if (autoCork != 0) { ILibAsyncSocket_Cork(module); }
+				ILibProcessAsyncSocket(module, triggerReadSet);
+				if (autoCork != 0) { ILibAsyncSocket_Uncork(module); }
+			}
 		}
 	}
 	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_PostSelect", 4, module);)
@@ -1628,94 +2939,13 @@ void ILibAsyncSocket_PostSelect(void* socketModule, int slct, fd_set *readset, f
 	// Write Handling
 	if (module->FinConnect > 0 && module->internalSocket != ~0 && fd_write != 0 && module->PendingSend_Head != NULL)
 	{
-		//
-		// Keep trying to send data, until we are told we can't
-		//
-		while (TRY_TO_SEND != 0)
-		{
-			if (module->PendingSend_Head == NULL) break;
-			#ifndef MICROSTACK_NOTLS
-			if (module->ssl != NULL)
-			{
-				// Send on SSL socket
-				bytesSent = SSL_write(module->ssl, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent);
-			}
-			else
-			#endif
-			if (module->PendingSend_Head->remoteAddress.sin6_family == 0)
-			{
-				bytesSent = send(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, MSG_NOSIGNAL); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
-			}
-			else
-			{
-				bytesSent = sendto(module->internalSocket, module->PendingSend_Head->buffer + module->PendingSend_Head->bytesSent, module->PendingSend_Head->bufferSize - module->PendingSend_Head->bytesSent, MSG_NOSIGNAL, (struct sockaddr*)&module->PendingSend_Head->remoteAddress, INET_SOCKADDR_LENGTH(module->PendingSend_Head->remoteAddress.sin6_family)); // Klocwork reports that this could block while holding a lock... This socket has been set to O_NONBLOCK, so that will never happen
-			}
-
-			if (bytesSent > 0)
-			{
-				module->PendingBytesToSend -= bytesSent;
-				module->TotalBytesSent += bytesSent;
-				module->PendingSend_Head->bytesSent += bytesSent;
-				if (module->PendingSend_Head->bytesSent == module->PendingSend_Head->bufferSize)
-				{
-					// Finished Sending this block
-					if (module->PendingSend_Head == module->PendingSend_Tail)
-					{
-						module->PendingSend_Tail = NULL;
-					}
-					if (module->PendingSend_Head->UserFree == 0)
-					{
-						free(module->PendingSend_Head->buffer);
-					}
-					temp = module->PendingSend_Head->Next;
-					free(module->PendingSend_Head);
-					module->PendingSend_Head = temp;
-					if (module->PendingSend_Head == NULL) { TRY_TO_SEND = 0; }
-				}
-				else
-				{
-					// We sent data, but not everything that needs to get sent was sent, try again
-					TRY_TO_SEND = 1;
-				}
-			}
-			#ifndef MICROSTACK_NOTLS
-			if (bytesSent == -1 && module->ssl == NULL)
-			#else
-			if (bytesSent == -1)
-			#endif
-			{
-				// Error, clean up everything
-				TRY_TO_SEND = 0;
-#if defined(_WIN32_WCE) || defined(WIN32)
-				if (WSAGetLastError() != WSAEWOULDBLOCK)
-#elif defined(_POSIX)
-				if (errno != EWOULDBLOCK)
-#endif
-				{
-					// There was an error sending
-					ILibAsyncSocket_ClearPendingSend(socketModule);
-					ILibLifeTime_Add(module->LifeTime, socketModule, 0, &ILibAsyncSocket_Disconnect, NULL);
-				}
-			}
-			#ifndef MICROSTACK_NOTLS
-			else if (bytesSent == -1 && module->ssl != NULL)
-			{
-				// OpenSSL returned an error
-				TRY_TO_SEND = 0;
-				bytesSent = SSL_get_error(module->ssl, bytesSent);
-				if (bytesSent != SSL_ERROR_WANT_WRITE)
-				{
-					// There was an error sending
-					ILibAsyncSocket_ClearPendingSend(socketModule);
-					ILibLifeTime_Add(module->LifeTime, socketModule, 0, &ILibAsyncSocket_Disconnect, NULL);
-				}
-			}
-			#endif
-		}
-		// This triggers OnSendOK, if all the pending data has been sent.
-		if (module->PendingSend_Head == NULL && bytesSent != -1) { TriggerSendOK = 1; }
+		// Keep trying to send data, until we are told we can't. This triggers OnSendOK, if all the pending data has been sent.
+		TriggerSendOK = ILibAsyncSocket_SendPending(module);
+		watermark = ILibAsyncSocket_CheckWatermark(module);
+		pendingBytes = module->PendingBytesToSend;
 		SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_PostSelect", 2, module);)
 		sem_post(&(module->SendLock));
+		if (watermark != 0) module->OnWatermark(module, watermark > 0, pendingBytes, module->user);
 		if (TriggerSendOK != 0) module->OnSendOK(module, module->user);
 	}
 	else
@@ -1830,6 +3060,11 @@ void ILibAsyncSocket_SetSSLContext(ILibAsyncSocket_SocketModule socketModule, SS
 			//BIO_set_nbio(module->sslbio, 1); // Set BIO to non-blocking
 			//SSL_CTX_set_mode(module->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
 			SSL_set_bio(module->ssl, module->sslbio, module->sslbio);
+#ifdef SSL_OP_ENABLE_KTLS
+			if (module->KernelTLS != 0) { module->KernelTLS = 1; SSL_set_options(module->ssl, SSL_OP_ENABLE_KTLS); }
+#endif
+			module->HandshakeStart = ILibGetUptime();
+			module->HandshakeTime = -1;
 
 			if (server != 0) SSL_set_accept_state(module->ssl); // Setup server SSL state
 			else SSL_set_connect_state(module->ssl); // Setup client SSL state
@@ -1842,6 +3077,113 @@ SSL_CTX *ILibAsyncSocket_GetSSLContext(ILibAsyncSocket_SocketModule socketModule
 	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
 	return module->ssl_ctx;
 }
+
+/*! \fn ILibAsyncSocket_SetKernelTLS(ILibAsyncSocket_SocketModule socketModule, int enable)
+\brief Asks OpenSSL to hand the TLS record encryption over to the kernel (kTLS), once the handshake is done
+\par
+Only AES-GCM and ChaCha20-Poly1305 suites can be offloaded. If the kernel TLS module is not loaded, or the negotiated
+suite is not supported, the connection silently keeps using OpenSSL. Applies to the TLS connections set up after this call.
+When kTLS is active, \a ILibAsyncSocket_SendFile can be used on the TLS connection.
+\param socketModule The ILibAsyncSocket to configure
+\param enable Non-zero to enable
+\returns Non-zero if this build supports kTLS
+*/
+int ILibAsyncSocket_SetKernelTLS(ILibAsyncSocket_SocketModule socketModule, int enable)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+#ifdef SSL_OP_ENABLE_KTLS
+	module->KernelTLS = enable != 0 ? 1 : 0;
+	return(1);
+#else
+	UNREFERENCED_PARAMETER(enable);
+	module->KernelTLS = 0;
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_IsKernelTLS(ILibAsyncSocket_SocketModule socketModule)
+\brief Determines if the kernel is doing the TLS record encryption for the current connection
+\param socketModule The ILibAsyncSocket to query
+\returns Non-zero if kTLS is active
+*/
+int ILibAsyncSocket_IsKernelTLS(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+	return((module->ssl != NULL && module->KernelTLS == 2) ? 1 : 0);
+}
+
+/*! \fn ILibAsyncSocket_SetTLSSession(ILibAsyncSocket_SocketModule socketModule, SSL_SESSION *session)
+\brief Offers a previously negotiated TLS session to the server, so the handshake can be abbreviated
+\par
+Must be called on a client connection, after \a ILibAsyncSocket_SetSSLContext and before the handshake starts.
+If the server does not accept the session, a full handshake is done. The session is reference counted by OpenSSL,
+so the caller keeps its own reference.
+\param socketModule The ILibAsyncSocket to configure
+\param session The session returned by \a ILibAsyncSocket_GetTLSSession on an earlier connection
+\returns Non-zero if the session was set
+*/
+int ILibAsyncSocket_SetTLSSession(ILibAsyncSocket_SocketModule socketModule, SSL_SESSION *session)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+	if (module == NULL || module->ssl == NULL || module->sslstate == 3 || session == NULL) return(0);
+	return(SSL_set_session(module->ssl, session));
+}
+
+/*! \fn ILibAsyncSocket_GetTLSSession(ILibAsyncSocket_SocketModule socketModule)
+\brief Fetches the TLS session of a connected socket, so it can be resumed later
+\param socketModule The ILibAsyncSocket to query
+\returns A new reference to the session, that must be released with SSL_SESSION_free. NULL if the handshake is not complete.
+*/
+SSL_SESSION *ILibAsyncSocket_GetTLSSession(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+	if (module == NULL || module->ssl == NULL || module->sslstate != 3) return(NULL);
+	return(SSL_get1_session(module->ssl));
+}
+
+/*! \fn ILibAsyncSocket_IsTLSSessionReused(ILibAsyncSocket_SocketModule socketModule)
+\brief Determines if the TLS handshake of this connection resumed a previous session
+\param socketModule The ILibAsyncSocket to query
+\returns Non-zero if the session was resumed
+*/
+int ILibAsyncSocket_IsTLSSessionReused(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+	if (module == NULL || module->ssl == NULL || module->sslstate != 3) return(0);
+	return(SSL_session_reused(module->ssl) != 0 ? 1 : 0);
+}
+
+/*! \fn ILibAsyncSocket_GetTLSHandshakeTime(ILibAsyncSocket_SocketModule socketModule)
+\brief Returns how long the TLS handshake of this connection took
+\par
+For client connections, this is measured from the TCP connection being established.
+\param socketModule The ILibAsyncSocket to query
+\returns The handshake duration in milliseconds, or -1 if no TLS handshake was completed
+*/
+int ILibAsyncSocket_GetTLSHandshakeTime(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule* module = (struct ILibAsyncSocketModule*)socketModule;
+	if (module == NULL || module->ssl == NULL || module->sslstate != 3) return(-1);
+	return(module->HandshakeTime);
+}
+
+// Adds the handshake of a connected socket to a set of running totals. Plain text connections are ignored.
+void ILibAsyncSocket_TLSHandshakeStats_Add(ILibAsyncSocket_TLSHandshakeStats *stats, ILibAsyncSocket_SocketModule socketModule)
+{
+	int t = ILibAsyncSocket_GetTLSHandshakeTime(socketModule);
+	if (stats == NULL || t < 0) return;
+
+	if (ILibAsyncSocket_IsTLSSessionReused(socketModule) != 0)
+	{
+		++stats->ResumedHandshakes;
+		stats->ResumedHandshakeTime += (unsigned long long)t;
+	}
+	else
+	{
+		++stats->FullHandshakes;
+		stats->FullHandshakeTime += (unsigned long long)t;
+	}
+}
 #endif
 
 //
@@ -1882,6 +3224,10 @@ void ILibAsyncSocket_UseThisSocket(ILibAsyncSocket_SocketModule socketModule, in
 	module->PendingBytesToSend = 0;
 	module->TotalBytesSent = 0;
 	module->internalSocket = UseThisSocket;
+	// Watermarks and the send limit are per connection, the accepting side sets them again if it wants them
+	module->HighWatermark = module->LowWatermark = module->SendLimit = 0;
+	module->AboveHighWatermark = 0;
+	module->OnWatermark = NULL;
 	module->OnInterrupt = InterruptPtr;
 	module->user = user;
 	module->FinConnect = 1;
@@ -1903,6 +3249,9 @@ void ILibAsyncSocket_UseThisSocket(ILibAsyncSocket_SocketModule socketModule, in
 	}
 	module->BeginPointer = 0;
 	module->EndPointer = 0;
+#ifdef MICROSTACK_ZEROCOPY
+	ILibAsyncSocket_ZeroCopy_Init(module);
+#endif
 
 	#ifndef MICROSTACK_NOTLS
 	if (module->ssl_ctx != NULL)
@@ -1916,6 +3265,11 @@ void ILibAsyncSocket_UseThisSocket(ILibAsyncSocket_SocketModule socketModule, in
 		//BIO_set_nbio(module->sslbio, 1); // Set BIO to non-blocking
 		//SSL_CTX_set_mode(module->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
 		SSL_set_bio(module->ssl, module->sslbio, module->sslbio);
+#ifdef SSL_OP_ENABLE_KTLS
+		if (module->KernelTLS != 0) { module->KernelTLS = 1; SSL_set_options(module->ssl, SSL_OP_ENABLE_KTLS); }
+#endif
+		module->HandshakeStart = ILibGetUptime();
+		module->HandshakeTime = -1;
 		SSL_set_accept_state(module->ssl); // Setup server SSL state
 	}
 	#endif
@@ -2043,6 +3397,437 @@ void ILibAsyncSocket_SetSendOK(ILibAsyncSocket_SocketModule module, ILibAsyncSoc
 	sm->OnSendOK = OnSendOK;
 }
 
+/*! \fn ILibAsyncSocket_SetZeroCopy(ILibAsyncSocket_SocketModule module, int threshold)
+\brief Enables MSG_ZEROCOPY transmits for large sends on a non-TLS TCP connection
+\par
+Sends of at least \a threshold bytes, with \a ILibAsyncSocket_MemoryOwnership_CHAIN or \a ILibAsyncSocket_MemoryOwnership_STATIC
+memory, are handed to the kernel without being copied. CHAIN memory is freed only after the kernel reports the transmit complete,
+and STATIC memory must not be modified until then. Smaller sends, and \a ILibAsyncSocket_MemoryOwnership_USER memory, use the normal path.
+The setting applies to the current connection, and all the following ones on this module.
+\param module The ILibAsyncSocket to configure
+\param threshold The minimum send size in bytes, or 0 to disable
+\returns Non-zero if zero copy is supported on this platform
+*/
+int ILibAsyncSocket_SetZeroCopy(ILibAsyncSocket_SocketModule module, int threshold)
+{
+	struct ILibAsyncSocketModule *sm = (struct ILibAsyncSocketModule*)module;
+	sm->ZeroCopyThreshold = threshold < 0 ? 0 : threshold;
+#ifdef MICROSTACK_ZEROCOPY
+	sem_wait(&(sm->SendLock));
+	if (sm->internalSocket != ~0 && sm->ZeroCopyState == 0 && sm->ZeroCopyThreshold > 0) { ILibAsyncSocket_ZeroCopy_Init(sm); }
+	sem_post(&(sm->SendLock));
+	return(1);
+#else
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_SetFastOpen(ILibAsyncSocket_SocketModule module, int enable)
+\brief Enables TCP Fast Open (RFC 7413) on the connections made with \a ILibAsyncSocket_ConnectTo
+\par
+Once the server has handed us a Fast Open cookie, the first data sent on the following connections to that server
+(for example the TLS ClientHello, or the first request) goes out in the SYN, saving a round trip. Without a cookie,
+the connection is made as usual. Connections made through a proxy don't use Fast Open.
+\param module The ILibAsyncSocket to configure
+\param enable Non-zero to enable
+\returns Non-zero if Fast Open is supported on this platform
+*/
+int ILibAsyncSocket_SetFastOpen(ILibAsyncSocket_SocketModule module, int enable)
+{
+	struct ILibAsyncSocketModule *sm = (struct ILibAsyncSocketModule*)module;
+#ifdef TCP_FASTOPEN_CONNECT
+	sm->FastOpen = enable != 0 ? 1 : 0;
+	return(1);
+#else
+	UNREFERENCED_PARAMETER(enable);
+	sm->FastOpen = 0;
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_Cork(ILibAsyncSocket_SocketModule socketModule)
+\brief Holds back the data sent on a TCP connection, until \a ILibAsyncSocket_Uncork is called
+\par
+Use this around a burst of small sends, such as a header followed by a body, so they leave in as few
+segments and system calls as possible, without relying on Nagle. While corked, \a ILibAsyncSocket_Send
+returns \a ILibAsyncSocket_NOT_ALL_DATA_SENT_YET, and OnSendOK is triggered once the data is sent.
+Calls can be nested, the data is flushed by the outermost \a ILibAsyncSocket_Uncork.
+\param socketModule The ILibAsyncSocket to cork
+*/
+void ILibAsyncSocket_Cork(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	sem_wait(&(module->SendLock));
+	++module->Corked;
+	sem_post(&(module->SendLock));
+}
+
+/*! \fn ILibAsyncSocket_Uncork(ILibAsyncSocket_SocketModule socketModule)
+\brief Sends the data held back by \a ILibAsyncSocket_Cork
+\par
+On the chain thread the data is sent right away. From other threads, the chain is woken up to send it.
+\param socketModule The ILibAsyncSocket to uncork
+*/
+void ILibAsyncSocket_Uncork(ILibAsyncSocket_SocketModule socketModule)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	int TriggerSendOK = 0;
+	int watermark;
+	unsigned int pendingBytes;
+
+	sem_wait(&(module->SendLock));
+	if (module->Corked > 0) { --module->Corked; }
+	if (module->Corked != 0 || module->PendingSend_Head == NULL || module->FinConnect <= 0 || module->internalSocket == ~0)
+	{
+		sem_post(&(module->SendLock));
+		return;
+	}
+	if (ILibIsRunningOnChainThread(module->Chain) == 0)
+	{
+		// OnSendOK has to be dispatched on the chain thread, so let PostSelect do the sending
+		sem_post(&(module->SendLock));
+		ILibForceUnBlockChain(module->Chain);
+		return;
+	}
+	TriggerSendOK = ILibAsyncSocket_SendPending(module);
+	watermark = ILibAsyncSocket_CheckWatermark(module);
+	pendingBytes = module->PendingBytesToSend;
+	sem_post(&(module->SendLock));
+
+	if (watermark != 0) module->OnWatermark(module, watermark > 0, pendingBytes, module->user);
+	if (TriggerSendOK != 0 && module->OnSendOK != NULL) module->OnSendOK(module, module->user);
+}
+
+/*! \fn ILibAsyncSocket_SetAutoCork(ILibAsyncSocket_SocketModule socketModule, int enable)
+\brief Corks the socket while the OnData and OnConnect handlers run, see \a ILibAsyncSocket_Cork
+\param socketModule The ILibAsyncSocket to configure
+\param enable Non-zero to enable
+*/
+void ILibAsyncSocket_SetAutoCork(ILibAsyncSocket_SocketModule socketModule, int enable)
+{
+	((struct ILibAsyncSocketModule*)socketModule)->AutoCork = enable != 0 ? 1 : 0;
+}
+
+/*! \fn ILibAsyncSocket_SetWatermarks(ILibAsyncSocket_SocketModule socketModule, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncSocket_OnWatermark OnWatermark)
+\brief Sets the watermarks on the pending data, so that a producer can throttle before the socket stops taking data
+\par
+\a OnWatermark is triggered when the pending data reaches \a highWatermark, and again when it drains back down to \a lowWatermark.
+It is called on the thread that queued or sent the data, after the send lock is released, so it is safe to send from it.
+\param socketModule The ILibAsyncSocket to configure
+\param highWatermark Number of pending bytes that triggers the high watermark, zero to disable
+\param lowWatermark Number of pending bytes that triggers the low watermark. Must be less than \a highWatermark.
+\param OnWatermark The handler to trigger
+*/
+void ILibAsyncSocket_SetWatermarks(ILibAsyncSocket_SocketModule socketModule, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncSocket_OnWatermark OnWatermark)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+
+	sem_wait(&(module->SendLock));
+	module->HighWatermark = highWatermark;
+	module->LowWatermark = lowWatermark < highWatermark ? lowWatermark : (highWatermark > 0 ? highWatermark - 1 : 0);
+	module->OnWatermark = OnWatermark;
+	module->AboveHighWatermark = 0;
+	sem_post(&(module->SendLock));
+}
+
+/*! \fn ILibAsyncSocket_SetSendLimit(ILibAsyncSocket_SocketModule socketModule, unsigned int limit)
+\brief Sets a hard cap on the pending data
+\par
+A send that would take the pending data past \a limit is rejected with \a ILibAsyncSocket_SEND_LIMIT_EXCEEDED, and the
+buffer is freed if it is owned by the chain. A send on an empty queue is always accepted, regardless of its size.
+\param socketModule The ILibAsyncSocket to configure
+\param limit The maximum number of pending bytes, zero for no limit
+*/
+void ILibAsyncSocket_SetSendLimit(ILibAsyncSocket_SocketModule socketModule, unsigned int limit)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+
+	sem_wait(&(module->SendLock));
+	module->SendLimit = limit;
+	sem_post(&(module->SendLock));
+}
+
+/*! \fn ILibAsyncSocket_SetReceiveBatch(ILibAsyncSocket_SocketModule socketModule, int batchSize)
+\brief Reads the datagrams of a UDP socket in batches, with a single recvmmsg() per batch
+\par
+The datagrams of a batch are delivered to OnData one after the other, without polling the socket in between.
+Each datagram is read into its own buffer of the receive buffer size given when the socket was created.
+While drop counting or receive offload is on, a single slot batch is kept in place of reading them one at a time.
+<B>Note:</B> This must only be called on a datagram socket, from the chain thread, or before the chain is started.
+\param socketModule The ILibAsyncSocket to configure
+\param batchSize The number of datagrams to read per system call, 0 or 1 to read them one at a time
+\returns Non-zero if batched receive is supported on this platform
+*/
+int ILibAsyncSocket_SetReceiveBatch(ILibAsyncSocket_SocketModule socketModule, int batchSize)
+{
+#ifdef MICROSTACK_RECVMMSG
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	struct ILibAsyncSocket_ReceiveBatch *batch = module->ReceiveBatch;
+	int datagramSize = module->InitialSize;
+	int controlSize = 0;
+	int i;
+
+	if (batchSize > ILibAsyncSocket_MaxReceiveBatch) batchSize = ILibAsyncSocket_MaxReceiveBatch;
+#ifdef MICROSTACK_RXQOVFL
+	// The drop counter only comes as a control message, so a single slot batch stands in for recvfrom()
+	if (module->DropCounting != 0)
+	{
+		if (batchSize < 1) batchSize = 1;
+		controlSize += CMSG_SPACE(sizeof(unsigned int));
+	}
+#endif
+#ifdef MICROSTACK_UDPOFFLOAD
+	if (module->ReceiveOffload != 0)
+	{
+		// Each slot must hold a full GRO super-buffer, and the segment size only comes as a control message
+		datagramSize = ILibAsyncSocket_MaxOffloadedSize;
+		if (batchSize < 1) batchSize = 1;
+		if (batchSize > ILibAsyncSocket_MaxOffloadBatch) batchSize = ILibAsyncSocket_MaxOffloadBatch;
+		controlSize += CMSG_SPACE(sizeof(int));
+	}
+#endif
+	if (batch != NULL && batch->Size == batchSize && batch->DatagramSize == datagramSize && batch->ControlSize == controlSize) return(1);
+	if (batch != NULL)
+	{
+		module->ReceiveBatch = NULL;
+		free(batch->Headers);
+		free(batch->Vectors);
+		free(batch->Addresses);
+		free(batch->Buffers);
+		if (batch->Control != NULL) { free(batch->Control); }
+#ifdef MICROSTACK_UDPOFFLOAD
+		if (batch->SegmentSize != NULL) { free(batch->SegmentSize); }
+#endif
+		free(batch);
+	}
+	if (batchSize <= 1 && controlSize == 0) return(1);
+
+	if ((batch = (struct ILibAsyncSocket_ReceiveBatch*)malloc(sizeof(struct ILibAsyncSocket_ReceiveBatch))) == NULL) ILIBCRITICALEXIT(254);
+	memset(batch, 0, sizeof(struct ILibAsyncSocket_ReceiveBatch));
+	batch->Size = batchSize;
+	batch->DatagramSize = datagramSize;
+	if ((batch->Headers = (struct mmsghdr*)malloc(batchSize * sizeof(struct mmsghdr))) == NULL) ILIBCRITICALEXIT(254);
+	if ((batch->Vectors = (struct iovec*)malloc(batchSize * sizeof(struct iovec))) == NULL) ILIBCRITICALEXIT(254);
+	if ((batch->Addresses = (struct sockaddr_in6*)malloc(batchSize * sizeof(struct sockaddr_in6))) == NULL) ILIBCRITICALEXIT(254);
+	if ((batch->Buffers = (char*)malloc(batchSize * batch->DatagramSize)) == NULL) ILIBCRITICALEXIT(254);
+	memset(batch->Headers, 0, batchSize * sizeof(struct mmsghdr));
+	for (i = 0; i < batchSize; ++i)
+	{
+		batch->Vectors[i].iov_base = batch->Buffers + (i * batch->DatagramSize);
+		batch->Vectors[i].iov_len = batch->DatagramSize;
+		batch->Headers[i].msg_hdr.msg_iov = &(batch->Vectors[i]);
+		batch->Headers[i].msg_hdr.msg_iovlen = 1;
+		batch->Headers[i].msg_hdr.msg_name = &(batch->Addresses[i]);
+	}
+	if (controlSize > 0)
+	{
+		batch->ControlSize = controlSize;
+		if ((batch->Control = (char*)malloc(batchSize * controlSize)) == NULL) ILIBCRITICALEXIT(254);
+		for (i = 0; i < batchSize; ++i) { batch->Headers[i].msg_hdr.msg_control = batch->Control + (i * controlSize); }
+	}
+#ifdef MICROSTACK_UDPOFFLOAD
+	if (module->ReceiveOffload != 0)
+	{
+		if ((batch->SegmentSize = (int*)malloc(batchSize * sizeof(int))) == NULL) ILIBCRITICALEXIT(254);
+		memset(batch->SegmentSize, 0, batchSize * sizeof(int));
+	}
+#endif
+	module->ReceiveBatch = batch;
+	return(1);
+#else
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(batchSize);
+	return(0);
+#endif
+}
+
+/*! \fn ILibAsyncSocket_GetReceiveBatchStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_ReceiveBatchStats *stats)
+\brief Fetches the batched receive counters of a socket, see \a ILibAsyncSocket_SetReceiveBatch
+\par
+Datagrams / Syscalls is the average number of packets read per system call.
+\param socketModule The ILibAsyncSocket to query
+\param[out] stats The running totals, all zero if batched receive is off
+*/
+void ILibAsyncSocket_GetReceiveBatchStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_ReceiveBatchStats *stats)
+{
+#ifdef MICROSTACK_RECVMMSG
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	if (module->ReceiveBatch != NULL) { memcpy(stats, &(module->ReceiveBatch->Stats), sizeof(ILibAsyncSocket_ReceiveBatchStats)); return; }
+#else
+	UNREFERENCED_PARAMETER(socketModule);
+#endif
+	memset(stats, 0, sizeof(ILibAsyncSocket_ReceiveBatchStats));
+}
+
+//
+// Internal method, doubles a socket buffer, up to its ceiling
+//
+// <returns>The new size asked for, or the current one if it is at the ceiling</returns>
+int ILibAsyncSocket_GrowBuffer(struct ILibAsyncSocketModule *module, int option, int current, int ceiling)
+{
+	int size = current * 2;
+
+	if (current >= ceiling) return(current);
+	if (size > ceiling) size = ceiling;
+	if (setsockopt(module->internalSocket, SOL_SOCKET, option, (char*)&size, sizeof(size)) != 0) return(current);
+	return(size);
+}
+
+//
+// Internal method that reads back the buffer sizes the kernel actually granted
+//
+void ILibAsyncSocket_ReadBufferSizes(struct ILibAsyncSocketModule *module)
+{
+	int size;
+	socklen_t len = sizeof(size);
+
+	if (getsockopt(module->internalSocket, SOL_SOCKET, SO_RCVBUF, (char*)&size, &len) == 0) { module->BufferStats.ReceiveBufferSize = size; }
+	len = sizeof(size);
+	if (getsockopt(module->internalSocket, SOL_SOCKET, SO_SNDBUF, (char*)&size, &len) == 0) { module->BufferStats.SendBufferSize = size; }
+}
+
+//
+// Internal method called periodically on the chain thread, while buffer autotuning is on
+//
+// Drops since the last check mean the receive buffer overflowed, data still queued for the kernel means the send buffer was full.
+// Either one grows the matching buffer. Changes are reported to the remote logger, so they show on the logging page.
+//
+void ILibAsyncSocket_Autotune(void *object)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)((char*)object - offsetof(struct ILibAsyncSocketModule, BufferStats));
+	unsigned long long drops;
+	unsigned int pendingBytes;
+	int size;
+
+	if (module->internalSocket == ~0) { module->Autotune = 0; return; }
+
+	drops = module->BufferStats.Drops - module->AutotuneDrops;
+	module->AutotuneDrops = module->BufferStats.Drops;
+	if (drops > 0)
+	{
+		size = module->MaxReceiveBuffer > 0 ? ILibAsyncSocket_GrowBuffer(module, SO_RCVBUF, module->ReceiveBufferRequest, module->MaxReceiveBuffer) : module->ReceiveBufferRequest;
+		if (size != module->ReceiveBufferRequest)
+		{
+			++module->BufferStats.ReceiveBufferGrowths;
+			ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] kernel dropped %llu datagrams (%llu total), SO_RCVBUF %d -> %d", (void*)module, drops, module->BufferStats.Drops, module->ReceiveBufferRequest, size);
+			module->ReceiveBufferRequest = size;
+		}
+		else
+		{
+			ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] kernel dropped %llu datagrams (%llu total), SO_RCVBUF at %d", (void*)module, drops, module->BufferStats.Drops, size);
+		}
+	}
+
+	// Other threads append to the send queue under SendLock, so sample it there
+	SEM_TRACK(AsyncSocket_TrackLock("ILibAsyncSocket_Autotune", 1, module);)
+	sem_wait(&(module->SendLock));
+	pendingBytes = module->PendingSend_Head != NULL ? module->PendingBytesToSend : 0;
+	SEM_TRACK(AsyncSocket_TrackUnLock("ILibAsyncSocket_Autotune", 2, module);)
+	sem_post(&(module->SendLock));
+
+	if (pendingBytes > 0)
+	{
+		++module->BufferStats.SendBacklogs;
+		size = module->MaxSendBuffer > 0 ? ILibAsyncSocket_GrowBuffer(module, SO_SNDBUF, module->SendBufferRequest, module->MaxSendBuffer) : module->SendBufferRequest;
+		if (size != module->SendBufferRequest)
+		{
+			++module->BufferStats.SendBufferGrowths;
+			ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_AsyncSocket, ILibRemoteLogging_Flags_VerbosityLevel_1, "AsyncSocket[%p] send backlog of %u bytes, SO_SNDBUF %d -> %d", (void*)module, pendingBytes, module->SendBufferRequest, size);
+			module->SendBufferRequest = size;
+		}
+	}
+
+	ILibAsyncSocket_ReadBufferSizes(module);
+	ILibLifeTime_AddEx(module->LifeTime, &(module->BufferStats), ILibAsyncSocket_AutotuneInterval, &ILibAsyncSocket_Autotune, NULL);
+}
+
+/*! \fn ILibAsyncSocket_SetBufferAutotune(ILibAsyncSocket_SocketModule socketModule, int maxReceiveBuffer, int maxSendBuffer)
+\brief Counts the datagrams the kernel drops on a full receive buffer, and grows the socket buffers when they overflow
+\par
+Drops are counted with SO_RXQ_OVFL, which the kernel reports with the datagrams received after a drop, so the count lags until
+traffic resumes. Once a second, drops since the previous check double SO_RCVBUF, and data queued because the kernel send buffer
+was full doubles SO_SNDBUF, up to the given ceilings. Buffers never shrink. Every change, and drops at the ceiling, are
+logged to the remote logger. The kernel caps both sizes at net.core.rmem_max / wmem_max.
+<br>Counting drops keeps a receive batch of at least one slot, see \a ILibAsyncSocket_SetReceiveBatch.
+<B>Note:</B> This must only be called from the chain thread, or before the chain is started, on a socket that is already open.
+\param socketModule The ILibAsyncSocket to configure
+\param maxReceiveBuffer Ceiling for SO_RCVBUF, zero to only count drops, negative to turn everything off
+\param maxSendBuffer Ceiling for SO_SNDBUF, zero to leave the send buffer alone
+\returns Non-zero if drop counting is supported on this platform and socket
+*/
+int ILibAsyncSocket_SetBufferAutotune(ILibAsyncSocket_SocketModule socketModule, int maxReceiveBuffer, int maxSendBuffer)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	int enable = maxReceiveBuffer >= 0 ? 1 : 0;
+	int retVal = 0;
+
+	if (module->internalSocket == ~0) return(0);
+	if (module->Autotune != 0) { ILibLifeTime_Remove(module->LifeTime, &(module->BufferStats)); module->Autotune = 0; }
+
+#ifdef MICROSTACK_RXQOVFL
+	if (module->DropCounting != enable && setsockopt(module->internalSocket, SOL_SOCKET, SO_RXQ_OVFL, (char*)&enable, sizeof(enable)) == 0)
+	{
+		module->DropCounting = enable;
+		ILibAsyncSocket_SetReceiveBatch(module, module->ReceiveBatch != NULL ? module->ReceiveBatch->Size : 0);
+	}
+	retVal = module->DropCounting;
+#endif
+	if (enable == 0) { module->MaxReceiveBuffer = module->MaxSendBuffer = 0; return(retVal); }
+
+	// Start from what the kernel gave us, it reports double the size that was asked for
+	ILibAsyncSocket_ReadBufferSizes(module);
+	module->ReceiveBufferRequest = module->BufferStats.ReceiveBufferSize / 2;
+	module->SendBufferRequest = module->BufferStats.SendBufferSize / 2;
+	module->MaxReceiveBuffer = maxReceiveBuffer;
+	module->MaxSendBuffer = maxSendBuffer > 0 ? maxSendBuffer : 0;
+	module->AutotuneDrops = module->BufferStats.Drops;
+
+	// The checks run even without ceilings, drops are still logged
+	module->Autotune = 1;
+	ILibLifeTime_AddEx(module->LifeTime, &(module->BufferStats), ILibAsyncSocket_AutotuneInterval, &ILibAsyncSocket_Autotune, NULL);
+	return(retVal);
+}
+
+/*! \fn ILibAsyncSocket_GetBufferStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_BufferStats *stats)
+\brief Fetches the drop counter and buffer sizes of a socket, see \a ILibAsyncSocket_SetBufferAutotune
+\param socketModule The ILibAsyncSocket to query
+\param[out] stats The running totals, and the buffer sizes as of the last check
+*/
+void ILibAsyncSocket_GetBufferStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_BufferStats *stats)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	memcpy(stats, &(module->BufferStats), sizeof(ILibAsyncSocket_BufferStats));
+}
+
+/*! \fn ILibAsyncSocket_WouldExceedSendLimit(ILibAsyncSocket_SocketModule socketModule, int length)
+\brief Determines if sending \a length more bytes would be rejected because of \a ILibAsyncSocket_SetSendLimit
+\par
+Use this before a sequence of sends that must be queued as a whole, such as a framing header followed by its payload.
+\param socketModule The ILibAsyncSocket to query
+\param length The number of bytes about to be sent
+\returns Non-zero if the sends would exceed the limit
+*/
+int ILibAsyncSocket_WouldExceedSendLimit(ILibAsyncSocket_SocketModule socketModule, int length)
+{
+	struct ILibAsyncSocketModule *module = (struct ILibAsyncSocketModule*)socketModule;
+	int RetVal;
+
+	sem_wait(&(module->SendLock));
+	RetVal = (module->SendLimit > 0 && module->PendingBytesToSend > 0 && module->PendingBytesToSend + (unsigned int)length > module->SendLimit) ? 1 : 0;
+	sem_post(&(module->SendLock));
+	return(RetVal);
+}
+
+/*! \fn ILibAsyncSocket_IsAboveHighWatermark(ILibAsyncSocket_SocketModule socketModule)
+\brief Determines if the pending data reached the high watermark, and has not yet drained to the low watermark
+\param socketModule The ILibAsyncSocket to query
+\returns Non-zero if above the high watermark
+*/
+int ILibAsyncSocket_IsAboveHighWatermark(ILibAsyncSocket_SocketModule socketModule)
+{
+	return(((struct ILibAsyncSocketModule*)socketModule)->AboveHighWatermark);
+}
+
 int ILibAsyncSocket_IsIPv6LinkLocal(struct sockaddr *LocalAddress)
 {
 	struct sockaddr_in6 *x = (struct sockaddr_in6*)LocalAddress;
@@ -56,11 +56,19 @@ extern "C" {
 
 #define ILibTransports_AsyncSocket 0x40
 
+/*! \def MICROSTACK_SENDFILE
+\brief Defined when \a ILibAsyncSocket_SendFile is available. Define MICROSTACK_NOSENDFILE to disable.
+*/
+#if defined(_POSIX) && !defined(__APPLE__) && !defined(_VX_CPU) && !defined(MICROSTACK_NOSENDFILE)
+#define MICROSTACK_SENDFILE
+#endif
+
 enum ILibAsyncSocket_SendStatus
 {
 	ILibAsyncSocket_ALL_DATA_SENT = 1, /*!< All of the data has already been sent */
 	ILibAsyncSocket_NOT_ALL_DATA_SENT_YET = 0, /*!< Not all of the data could be sent, but is queued to be sent as soon as possible */
-	ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR	= -4 /*!< A send operation was attmepted on a closed socket */
+	ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR	= -4, /*!< A send operation was attmepted on a closed socket */
+	ILibAsyncSocket_SEND_LIMIT_EXCEEDED = -5 /*!< The data was not queued, because the pending data would exceed the limit set with \a ILibAsyncSocket_SetSendLimit */
 };
 
 /*! \enum ILibAsyncSocket_MemoryOwnership
@@ -135,12 +143,28 @@ typedef void(*ILibAsyncSocket_OnSendOK)(ILibAsyncSocket_SocketModule socketModul
 \param newOffset The new offset differential. Simply add this value to your existing pointers, to obtain the correct pointer into the resized buffer.
 */
 typedef void(*ILibAsyncSocket_OnBufferReAllocated)(ILibAsyncSocket_SocketModule AsyncSocketToken, void *user, ptrdiff_t newOffset);
+/*! \typedef ILibAsyncSocket_OnWatermark
+\brief Handler for when the pending data crosses one of the watermarks set with \a ILibAsyncSocket_SetWatermarks
+\par
+This is triggered once when the pending data reaches the high watermark, and once more when it drains back down to the low watermark.
+\param socketModule The \a ILibAsyncSocket_SocketModule whos pending data crossed a watermark
+\param aboveHighWatermark Non-zero if the high watermark was reached, zero if the data drained to the low watermark
+\param pendingBytes The number of bytes pending to be sent
+\param user The user object that was associated with this connection
+*/
+typedef void(*ILibAsyncSocket_OnWatermark)(ILibAsyncSocket_SocketModule socketModule, int aboveHighWatermark, unsigned int pendingBytes, void *user);
+/*! \typedef ILibAsyncSocket_OnSendError
+\brief Handler for a batched datagram that the kernel refused, see \a ILibAsyncSocket_SetTransmitBatch
+\param socketModule The \a ILibAsyncSocket_SocketModule the datagram was sent on
+\param remoteAddress The destination of the datagram
+\param error The errno of the failure
+\param user The user object that was associated with this socket
+*/
+typedef void(*ILibAsyncSocket_OnSendError)(ILibAsyncSocket_SocketModule socketModule, struct sockaddr *remoteAddress, int error, void *user);
 
 #ifndef MICROSTACK_NOTLS
-#ifdef MICROSTACK_TLS_DETECT
 int ILibAsyncSocket_IsUsingTls(ILibAsyncSocket_SocketModule AsyncSocketToken);
 #endif
-#endif
 
 void ILibAsyncSocket_SetReAllocateNotificationCallback(ILibAsyncSocket_SocketModule AsyncSocketToken, ILibAsyncSocket_OnBufferReAllocated Callback);
 void *ILibAsyncSocket_GetUser(ILibAsyncSocket_SocketModule socketModule);
@@ -175,6 +199,9 @@ enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendTo(ILibAsyncSocket_SocketMod
 \returns \a ILibAsyncSocket_SendStatus indicating the send status
 */
 #define ILibAsyncSocket_Send(socketModule, buffer, length, UserFree) ILibAsyncSocket_SendTo(socketModule, buffer, length, NULL, UserFree)
+#ifdef MICROSTACK_SENDFILE
+enum ILibAsyncSocket_SendStatus ILibAsyncSocket_SendFile(ILibAsyncSocket_SocketModule socketModule, int fd, off_t offset, int length, enum ILibAsyncSocket_MemoryOwnership UserFree);
+#endif
 void ILibAsyncSocket_Disconnect(ILibAsyncSocket_SocketModule socketModule);
 void ILibAsyncSocket_GetBuffer(ILibAsyncSocket_SocketModule socketModule, char **buffer, int *BeginPointer, int *EndPointer);
 
@@ -197,6 +224,25 @@ typedef enum
 
 void ILibAsyncSocket_SetSSLContext(ILibAsyncSocket_SocketModule socketModule, SSL_CTX *ssl_ctx, ILibAsyncSocket_TLS_Mode server);
 SSL_CTX *ILibAsyncSocket_GetSSLContext(ILibAsyncSocket_SocketModule socketModule);
+int ILibAsyncSocket_SetKernelTLS(ILibAsyncSocket_SocketModule socketModule, int enable);
+int ILibAsyncSocket_IsKernelTLS(ILibAsyncSocket_SocketModule socketModule);
+
+/*! \struct ILibAsyncSocket_TLSHandshakeStats
+\brief Running totals of the TLS handshakes done by a module, split between full and resumed handshakes
+*/
+typedef struct ILibAsyncSocket_TLSHandshakeStats
+{
+	unsigned int FullHandshakes;				//!< Number of full handshakes
+	unsigned int ResumedHandshakes;				//!< Number of handshakes that resumed a previous session (session ID or ticket)
+	unsigned long long FullHandshakeTime;		//!< Total time spent in full handshakes, in milliseconds
+	unsigned long long ResumedHandshakeTime;	//!< Total time spent in resumed handshakes, in milliseconds
+}ILibAsyncSocket_TLSHandshakeStats;
+
+int ILibAsyncSocket_SetTLSSession(ILibAsyncSocket_SocketModule socketModule, SSL_SESSION *session);
+SSL_SESSION *ILibAsyncSocket_GetTLSSession(ILibAsyncSocket_SocketModule socketModule);
+int ILibAsyncSocket_IsTLSSessionReused(ILibAsyncSocket_SocketModule socketModule);
+int ILibAsyncSocket_GetTLSHandshakeTime(ILibAsyncSocket_SocketModule socketModule);
+void ILibAsyncSocket_TLSHandshakeStats_Add(ILibAsyncSocket_TLSHandshakeStats *stats, ILibAsyncSocket_SocketModule socketModule);
 #endif
 
 void ILibAsyncSocket_SetRemoteAddress(ILibAsyncSocket_SocketModule socketModule, struct sockaddr *remoteAddress);
@@ -212,6 +258,62 @@ void ILibAsyncSocket_Resume(ILibAsyncSocket_SocketModule socketModule);
 int ILibAsyncSocket_WasClosedBecauseBufferSizeExceeded(ILibAsyncSocket_SocketModule socketModule);
 void ILibAsyncSocket_SetMaximumBufferSize(ILibAsyncSocket_SocketModule module, int maxSize, ILibAsyncSocket_OnBufferSizeExceeded OnBufferSizeExceededCallback, void *user);
 void ILibAsyncSocket_SetSendOK(ILibAsyncSocket_SocketModule module, ILibAsyncSocket_OnSendOK OnSendOK);
+int ILibAsyncSocket_SetZeroCopy(ILibAsyncSocket_SocketModule module, int threshold);
+int ILibAsyncSocket_SetFastOpen(ILibAsyncSocket_SocketModule module, int enable);
+void ILibAsyncSocket_Cork(ILibAsyncSocket_SocketModule socketModule);
+void ILibAsyncSocket_Uncork(ILibAsyncSocket_SocketModule socketModule);
+void ILibAsyncSocket_SetAutoCork(ILibAsyncSocket_SocketModule socketModule, int enable);
+void ILibAsyncSocket_SetWatermarks(ILibAsyncSocket_SocketModule socketModule, unsigned int highWatermark, unsigned int lowWatermark, ILibAsyncSocket_OnWatermark OnWatermark);
+void ILibAsyncSocket_SetSendLimit(ILibAsyncSocket_SocketModule socketModule, unsigned int limit);
+int ILibAsyncSocket_WouldExceedSendLimit(ILibAsyncSocket_SocketModule socketModule, int length);
+int ILibAsyncSocket_IsAboveHighWatermark(ILibAsyncSocket_SocketModule socketModule);
+
+/*! \struct ILibAsyncSocket_ReceiveBatchStats
+\brief Running totals of the batched receive of a datagram socket, see \a ILibAsyncSocket_SetReceiveBatch
+*/
+typedef struct ILibAsyncSocket_ReceiveBatchStats
+{
+	unsigned long long Datagrams;	//!< Datagrams received
+	unsigned long long Syscalls;	//!< recvmmsg() calls that returned data
+	unsigned int LargestBatch;		//!< Most datagrams returned by a single call
+	unsigned int FullBatches;		//!< Calls that filled every slot, with datagrams possibly still queued
+	unsigned int Truncated;			//!< Datagrams larger than a slot, that were cut short
+	unsigned long long Coalesced;	//!< Datagrams that arrived coalesced by UDP_GRO, see \a ILibAsyncSocket_SetReceiveOffload
+}ILibAsyncSocket_ReceiveBatchStats;
+int ILibAsyncSocket_SetReceiveBatch(ILibAsyncSocket_SocketModule socketModule, int batchSize);
+void ILibAsyncSocket_GetReceiveBatchStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_ReceiveBatchStats *stats);
+
+/*! \struct ILibAsyncSocket_TransmitBatchStats
+\brief Running totals of the transmit queue of a chain, see \a ILibAsyncSocket_SetTransmitBatch
+*/
+typedef struct ILibAsyncSocket_TransmitBatchStats
+{
+	unsigned long long Datagrams;	//!< Datagrams sent
+	unsigned long long Syscalls;	//!< sendmmsg() calls
+	unsigned int LargestBatch;		//!< Most datagrams sent by a single call
+	unsigned int Errors;			//!< Datagrams that failed, and were reported to OnSendError
+	unsigned int Deferred;			//!< Datagrams moved to the send queue of their socket, because the kernel buffer was full
+	unsigned long long Segmented;	//!< Datagrams sent coalesced with UDP_SEGMENT, see \a ILibAsyncSocket_SetSegmentationOffload
+}ILibAsyncSocket_TransmitBatchStats;
+int ILibAsyncSocket_SetTransmitBatch(ILibAsyncSocket_SocketModule socketModule, int enable, ILibAsyncSocket_OnSendError OnSendError);
+void ILibAsyncSocket_GetTransmitBatchStats(void *chain, ILibAsyncSocket_TransmitBatchStats *stats);
+int ILibAsyncSocket_SetSegmentationOffload(ILibAsyncSocket_SocketModule socketModule, int enable);
+int ILibAsyncSocket_SetReceiveOffload(ILibAsyncSocket_SocketModule socketModule, int enable);
+
+/*! \struct ILibAsyncSocket_BufferStats
+\brief Kernel drop counter and buffer sizes of a socket, see \a ILibAsyncSocket_SetBufferAutotune
+*/
+typedef struct ILibAsyncSocket_BufferStats
+{
+	unsigned long long Drops;			//!< Datagrams the kernel dropped because the receive buffer was full
+	int ReceiveBufferSize;				//!< SO_RCVBUF, as reported by the kernel at the last check
+	int SendBufferSize;					//!< SO_SNDBUF, as reported by the kernel at the last check
+	unsigned int ReceiveBufferGrowths;	//!< Times SO_RCVBUF was grown because of drops
+	unsigned int SendBufferGrowths;		//!< Times SO_SNDBUF was grown because of a send backlog
+	unsigned int SendBacklogs;			//!< Checks that found data queued because the kernel send buffer was full
+}ILibAsyncSocket_BufferStats;
+int ILibAsyncSocket_SetBufferAutotune(ILibAsyncSocket_SocketModule socketModule, int maxReceiveBuffer, int maxSendBuffer);
+void ILibAsyncSocket_GetBufferStats(ILibAsyncSocket_SocketModule socketModule, ILibAsyncSocket_BufferStats *stats);
 int ILibAsyncSocket_IsIPv6LinkLocal(struct sockaddr *LocalAddress);
 int ILibAsyncSocket_IsModuleIPv6LinkLocal(ILibAsyncSocket_SocketModule module);
 
@@ -51,6 +51,7 @@ struct ILibAsyncUDPSocket_Data
 
 	ILibAsyncUDPSocket_OnData OnData;
 	ILibAsyncUDPSocket_OnSendOK OnSendOK;
+	ILibAsyncUDPSocket_OnSendError OnSendError;
 };
 
 void ILibAsyncUDPSocket_OnDataSink(ILibAsyncSocket_SocketModule socketModule, char* buffer, int *p_beginPointer, int endPointer, ILibAsyncSocket_OnInterrupt* OnInterrupt, void **user, int *PAUSE)
@@ -84,6 +85,15 @@ void ILibAsyncUDPSocket_OnSendOKSink(ILibAsyncSocket_SocketModule socketModule,
 	}
 }
 
+void ILibAsyncUDPSocket_OnSendErrorSink(ILibAsyncSocket_SocketModule socketModule, struct sockaddr *remoteAddress, int error, void *user)
+{
+	struct ILibAsyncUDPSocket_Data *data = (struct ILibAsyncUDPSocket_Data*)user;
+	if (data->OnSendError != NULL)
+	{
+		data->OnSendError(socketModule, remoteAddress, error, data->user1, data->user2);
+	}
+}
+
 void ILibAsyncUDPSocket_OnDisconnect(ILibAsyncSocket_SocketModule socketModule, void *user)
 {
 	UNREFERENCED_PARAMETER( socketModule );
@@ -127,6 +137,10 @@ ILibAsyncUDPSocket_SocketModule ILibAsyncUDPSocket_CreateEx(void *Chain, int Buf
 	if (reuse == ILibAsyncUDPSocket_Reuse_SHARED) if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&ra, sizeof(ra)) != 0) ILIBCRITICALERREXIT(253);
 #ifdef __APPLE__
 	if (reuse == ILibAsyncUDPSocket_Reuse_SHARED) if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char*)&ra, sizeof(ra)) != 0) ILIBCRITICALERREXIT(253);
+#endif
+#if defined(SO_REUSEPORT) && !defined(__APPLE__)
+	// Every socket bound to the port with this option is a member of the same group, a given remote address/port always lands on the same member
+	if (reuse == ILibAsyncUDPSocket_Reuse_BALANCED) if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char*)&ra, sizeof(ra)) != 0) { close(sock); free(data); return NULL; }
 #endif
 	if (localInterface->sa_family == AF_INET6) if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&off, sizeof(off)) != 0) ILIBCRITICALERREXIT(253);
 
@@ -264,3 +278,20 @@ void ILibAsyncUDPSocket_SetMulticastLoopback(ILibAsyncUDPSocket_SocketModule mod
 	if (setsockopt(s, localAddress.sin6_family == PF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP, localAddress.sin6_family == PF_INET6 ? IPV6_MULTICAST_LOOP : IP_MULTICAST_LOOP, (char*)&loopback, sizeof(loopback)) != 0) ILIBCRITICALERREXIT(253);
 }
 
+/*! \fn int ILibAsyncUDPSocket_SetTransmitBatch(ILibAsyncUDPSocket_SocketModule module, int enable, ILibAsyncUDPSocket_OnSendError OnSendError)
+	\brief Queues the datagrams sent from the chain thread, and sends them together with sendmmsg() before the chain sleeps
+	\par
+	Ordering is preserved. A datagram that can't be sent is reported to \a OnSendError, and doesn't close the socket.
+	See \a ILibAsyncSocket_SetTransmitBatch for details.
+	\param module The ILibAsyncUDPSocket_SocketModule to configure
+	\param enable Non-zero to batch, zero to send every datagram right away
+	\param OnSendError Handler for datagrams that could not be sent, can be NULL
+	\returns Non-zero if batched transmit is supported on this platform
+*/
+int ILibAsyncUDPSocket_SetTransmitBatch(ILibAsyncUDPSocket_SocketModule module, int enable, ILibAsyncUDPSocket_OnSendError OnSendError)
+{
+	struct ILibAsyncUDPSocket_Data *data = (struct ILibAsyncUDPSocket_Data*)ILibAsyncSocket_GetUser(module);
+	data->OnSendError = OnSendError;
+	return(ILibAsyncSocket_SetTransmitBatch(module, enable, &ILibAsyncUDPSocket_OnSendErrorSink));
+}
+
@@ -42,7 +42,8 @@ extern "C" {
 enum ILibAsyncUDPSocket_Reuse
 {
 	ILibAsyncUDPSocket_Reuse_EXCLUSIVE = 0,	/*!< A socket is to be bound for exclusive access */
-	ILibAsyncUDPSocket_Reuse_SHARED = 1		/*!< A socket is to be bound for shared access */
+	ILibAsyncUDPSocket_Reuse_SHARED = 1,	/*!< A socket is to be bound for shared access */
+	ILibAsyncUDPSocket_Reuse_BALANCED = 2	/*!< A socket shares its port with sibling sockets, and the kernel spreads inbound flows across them (SO_REUSEPORT) */
 };
 
 /*! \typedef ILibAsyncUDPSocket_SocketModule
@@ -73,6 +74,15 @@ typedef void(*ILibAsyncUDPSocket_OnData)(ILibAsyncUDPSocket_SocketModule socketM
 	\param user2 User2 object that was associated with this connection
 */
 typedef void(*ILibAsyncUDPSocket_OnSendOK)(ILibAsyncUDPSocket_SocketModule socketModule, void *user1, void *user2);
+/*! \typedef ILibAsyncUDPSocket_OnSendError
+	\brief Handler for a batched datagram that could not be sent, see \a ILibAsyncUDPSocket_SetTransmitBatch
+	\param socketModule The \a ILibAsyncUDPSocket_SocketModule the datagram was sent on
+	\param remoteInterface The destination of the datagram
+	\param error The errno of the failure
+	\param user1 User object that was associated with this connection
+	\param user2 User2 object that was associated with this connection
+*/
+typedef void(*ILibAsyncUDPSocket_OnSendError)(ILibAsyncUDPSocket_SocketModule socketModule, struct sockaddr *remoteInterface, int error, void *user1, void *user2);
 
 ILibAsyncUDPSocket_SocketModule ILibAsyncUDPSocket_CreateEx(void *Chain, int BufferSize, struct sockaddr *localInterface, enum ILibAsyncUDPSocket_Reuse reuse, ILibAsyncUDPSocket_OnData OnData, ILibAsyncUDPSocket_OnSendOK OnSendOK, void *user);
 
@@ -95,6 +105,7 @@ void ILibAsyncUDPSocket_JoinMulticastGroupV6(ILibAsyncUDPSocket_SocketModule mod
 void ILibAsyncUDPSocket_SetMulticastInterface(ILibAsyncUDPSocket_SocketModule module, struct sockaddr *localInterface);
 void ILibAsyncUDPSocket_SetMulticastTTL(ILibAsyncUDPSocket_SocketModule module, int TTL);
 void ILibAsyncUDPSocket_SetMulticastLoopback(ILibAsyncUDPSocket_SocketModule module, int loopback);
+int ILibAsyncUDPSocket_SetTransmitBatch(ILibAsyncUDPSocket_SocketModule module, int enable, ILibAsyncUDPSocket_OnSendError OnSendError);
 
 /*! \def ILibAsyncUDPSocket_GetPendingBytesToSend
 	\brief Returns the number of bytes that are pending to be sent
@@ -144,6 +155,48 @@ void ILibAsyncUDPSocket_SetMulticastLoopback(ILibAsyncUDPSocket_SocketModule mod
 
 #define ILibAsyncUDPSocket_Resume(socketModule) ILibAsyncSocket_Resume(socketModule)  
 
+/*! \def ILibAsyncUDPSocket_SetReceiveBatch
+	\brief Reads up to \a batchSize datagrams per system call, see \a ILibAsyncSocket_SetReceiveBatch
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to configure
+	\param batchSize The number of datagrams to read per system call, 0 or 1 to read them one at a time
+	\returns Non-zero if batched receive is supported on this platform
+*/
+#define ILibAsyncUDPSocket_SetReceiveBatch(socketModule, batchSize) ILibAsyncSocket_SetReceiveBatch(socketModule, batchSize)
+/*! \def ILibAsyncUDPSocket_GetReceiveBatchStats
+	\brief Fetches the datagrams and system call counters of the batched receive
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to query
+	\param stats The \a ILibAsyncSocket_ReceiveBatchStats to fill in
+*/
+#define ILibAsyncUDPSocket_GetReceiveBatchStats(socketModule, stats) ILibAsyncSocket_GetReceiveBatchStats(socketModule, stats)
+/*! \def ILibAsyncUDPSocket_SetSegmentationOffload
+	\brief Sends batched datagrams of the same size to the same destination as one, with UDP_SEGMENT, see \a ILibAsyncSocket_SetSegmentationOffload
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to configure
+	\param enable Non-zero to coalesce datagrams
+	\returns Non-zero if the kernel supports it
+*/
+#define ILibAsyncUDPSocket_SetSegmentationOffload(socketModule, enable) ILibAsyncSocket_SetSegmentationOffload(socketModule, enable)
+/*! \def ILibAsyncUDPSocket_SetReceiveOffload
+	\brief Lets the kernel coalesce received datagrams with UDP_GRO, see \a ILibAsyncSocket_SetReceiveOffload
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to configure
+	\param enable Non-zero to let the kernel coalesce datagrams
+	\returns Non-zero if the kernel supports it
+*/
+#define ILibAsyncUDPSocket_SetReceiveOffload(socketModule, enable) ILibAsyncSocket_SetReceiveOffload(socketModule, enable)
+/*! \def ILibAsyncUDPSocket_SetBufferAutotune
+	\brief Counts kernel drops (SO_RXQ_OVFL), and grows the socket buffers when they overflow, see \a ILibAsyncSocket_SetBufferAutotune
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to configure
+	\param maxReceiveBuffer Ceiling for SO_RCVBUF, zero to only count drops, negative to turn everything off
+	\param maxSendBuffer Ceiling for SO_SNDBUF, zero to leave the send buffer alone
+	\returns Non-zero if drop counting is supported
+*/
+#define ILibAsyncUDPSocket_SetBufferAutotune(socketModule, maxReceiveBuffer, maxSendBuffer) ILibAsyncSocket_SetBufferAutotune(socketModule, maxReceiveBuffer, maxSendBuffer)
+/*! \def ILibAsyncUDPSocket_GetBufferStats
+	\brief Fetches the kernel drop counter and buffer sizes
+	\param socketModule The ILibAsyncUDPSocket_SocketModule to query
+	\param stats The \a ILibAsyncSocket_BufferStats to fill in
+*/
+#define ILibAsyncUDPSocket_GetBufferStats(socketModule, stats) ILibAsyncSocket_GetBufferStats(socketModule, stats)
+
 SOCKET ILibAsyncUDPSocket_GetSocket(ILibAsyncUDPSocket_SocketModule module);
 
 #ifdef __cplusplus
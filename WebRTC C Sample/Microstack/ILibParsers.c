@@ -1066,6 +1066,12 @@ struct ILibBaseChain_SafeData
 	void *Object;
 };
 
+struct ILibBaseChain_PreSleepData
+{
+	ILibChain_PreSleepHandler Handler;
+	void *Object;
+};
+
 typedef struct ILibBaseChain
 {
 	int TerminateFlag;
@@ -1100,6 +1106,7 @@ typedef struct ILibBaseChain
 	ILibLinkedList Links;
 	ILibLinkedList LinksPendingDelete;
 	ILibHashtable ChainStash;
+	ILibLinkedList PreSleepHandlers;
 }ILibBaseChain;
 
 ILibHashtable ILibChain_GetBaseHashtable(void* chain)
@@ -1155,6 +1162,8 @@ void ILibChain_OnStartEvent_AddHandler(void *chain, ILibChain_StartEvent sink, v
 }
 
 #if defined(_REMOTELOGGING) && defined(_REMOTELOGGINGSERVER)
+#define ILibDefaultLogger_SendLimit 262144	// Log bytes held for a viewer that can't keep up, further lines are dropped for that viewer
+
 unsigned char ILibDefaultLogger_HTML[3902] =
 {
 	0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0xC5, 0x5A, 0x7B, 0x93, 0xDA, 0x38, 0x12, 0xFF, 0x2A, 0x8E, 0x52, 0xD9, 0xB1, 0x17, 0x63, 0x30, 0xAF, 0x01, 0x83, 0x27, 0x35, 0x03,
@@ -1344,6 +1353,8 @@ void ILibDefaultLogger_Session_OnReceive(struct ILibWebServer_Session *sender, i
 		{
 			sender->OnReceive = &ILibDefaultLogger_WebSocket_OnReceive;
 			ILibWebServer_UpgradeWebSocket(sender, 8192);
+			// A slow viewer loses log lines, rather than holding an unbounded backlog of them
+			ILibWebServer_Session_SetSendLimit(sender, ILibDefaultLogger_SendLimit);
 		}
 		else
 		{
@@ -1573,6 +1584,73 @@ void ILibForceUnBlockChain(void *Chain)
 	sem_post(&ILibChainLock);
 }
 
+/*! \fn void ILibChain_AddPreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object)
+\brief Registers a handler that is called every time the chain is about to sleep in select
+\par
+The handlers run on the chain thread, after every link's PreSelect, so work that was deferred while the chain was busy
+(such as datagrams queued for a single system call) can be flushed before the chain blocks.
+<br><B>Note:</B> This must be called from the chain thread, or before the chain is started.
+\param chain The chain to add the handler to
+\param handler The handler to call
+\param object The object to pass to the handler
+*/
+void ILibChain_AddPreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object)
+{
+	struct ILibBaseChain *baseChain = (struct ILibBaseChain*)chain;
+	struct ILibBaseChain_PreSleepData *data;
+
+	if ((data = (struct ILibBaseChain_PreSleepData*)malloc(sizeof(struct ILibBaseChain_PreSleepData))) == NULL) ILIBCRITICALEXIT(254);
+	data->Handler = handler;
+	data->Object = object;
+	if (baseChain->PreSleepHandlers == NULL) { baseChain->PreSleepHandlers = ILibLinkedList_Create(); }
+	ILibLinkedList_AddTail(baseChain->PreSleepHandlers, data);
+}
+
+/*! \fn void ILibChain_RemovePreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object)
+\brief Removes a handler that was added with \a ILibChain_AddPreSleepHandler
+\param chain The chain to remove the handler from
+\param handler The handler that was added
+\param object The object that was added with the handler
+*/
+void ILibChain_RemovePreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object)
+{
+	struct ILibBaseChain *baseChain = (struct ILibBaseChain*)chain;
+	struct ILibBaseChain_PreSleepData *data;
+	void *node;
+
+	if (baseChain->PreSleepHandlers == NULL) return;
+	node = ILibLinkedList_GetNode_Head(baseChain->PreSleepHandlers);
+	while (node != NULL)
+	{
+		data = (struct ILibBaseChain_PreSleepData*)ILibLinkedList_GetDataFromNode(node);
+		if (data->Handler == handler && data->Object == object)
+		{
+			ILibLinkedList_Remove(node);
+			free(data);
+			return;
+		}
+		node = ILibLinkedList_GetNextNode(node);
+	}
+}
+
+//
+// Internal method that frees the pre-sleep handlers, once every link of the chain was destroyed
+//
+void ILibChain_DestroyPreSleepHandlers(struct ILibBaseChain *baseChain)
+{
+	void *node;
+
+	if (baseChain->PreSleepHandlers == NULL) return;
+	node = ILibLinkedList_GetNode_Head(baseChain->PreSleepHandlers);
+	while (node != NULL)
+	{
+		free(ILibLinkedList_GetDataFromNode(node));
+		node = ILibLinkedList_GetNextNode(node);
+	}
+	ILibLinkedList_Destroy(baseChain->PreSleepHandlers);
+	baseChain->PreSleepHandlers = NULL;
+}
+
 /*! \fn void ILibChain_DestroyEx(void *subChain)
 \brief Destroys a chain or subchain that was never started.
 \par
@@ -1596,6 +1674,7 @@ void ILibChain_DestroyEx(void *subChain)
 	}
 	ILibLinkedList_Destroy(((ILibBaseChain*)subChain)->Links);
 	ILibLinkedList_Destroy(((ILibBaseChain*)subChain)->LinksPendingDelete);
+	ILibChain_DestroyPreSleepHandlers((ILibBaseChain*)subChain);
 	free(subChain);
 }
 /*! \fn ILibStartChain(void *Chain)
@@ -1689,6 +1768,20 @@ void ILibStartChain(void *Chain)
 		tv.tv_sec =  v / 1000;
 		tv.tv_usec = 1000 * (v % 1000);
 
+		//
+		// Let everyone flush what they deferred, before we go to sleep
+		//
+		if (((ILibBaseChain*)Chain)->PreSleepHandlers != NULL)
+		{
+			node = ILibLinkedList_GetNode_Head(((ILibBaseChain*)Chain)->PreSleepHandlers);
+			while (node != NULL)
+			{
+				struct ILibBaseChain_PreSleepData *data = (struct ILibBaseChain_PreSleepData*)ILibLinkedList_GetDataFromNode(node);
+				node = ILibLinkedList_GetNextNode(node);
+				data->Handler(Chain, data->Object);
+			}
+		}
+
 		sem_wait(&ILibChainLock);
 #if defined(WIN32) || defined(_WIN32_WCE)
 		//
@@ -1835,6 +1928,7 @@ void ILibStartChain(void *Chain)
 		node = ILibLinkedList_GetNextNode(node);
 	}
 	ILibLinkedList_Destroy(((ILibBaseChain*)Chain)->LinksPendingDelete);
+	ILibChain_DestroyPreSleepHandlers((ILibBaseChain*)Chain);
 
 #ifdef _REMOTELOGGINGSERVER
 	if (((ILibBaseChain*)Chain)->LoggingWebServer != NULL && ((ILibBaseChain*)Chain)->ChainLogger != NULL) { ILibRemoteLogging_Destroy(((ILibBaseChain*)Chain)->ChainLogger); }
@@ -4935,7 +5029,7 @@ void ILibLifeTime_AddEx(void *LifetimeMonitorObject,void *data, int ms, ILibLife
 	}
 
 	// If this notification is sooner than the existing one, replace it.
-	if (LifeTimeMonitor->NextTriggerTick > ltms->ExpirationTick) LifeTimeMonitor->NextTriggerTick = ltms->ExpirationTick;
+	if (LifeTimeMonitor->NextTriggerTick == -1 || LifeTimeMonitor->NextTriggerTick > ltms->ExpirationTick) LifeTimeMonitor->NextTriggerTick = ltms->ExpirationTick;
 
 	ILibLinkedList_UnLock(LifeTimeMonitor->ObjectList);
 }
@@ -5038,7 +5132,7 @@ void ILibLifeTime_Check(void *LifeTimeMonitorObject, fd_set *readset, fd_set *wr
 	if (LifeTimeMonitor->NextTriggerTick != -1 && *blocktime > (int)(LifeTimeMonitor->NextTriggerTick - CurrentTick))
 	{
 		int delta = (int)(LifeTimeMonitor->NextTriggerTick - CurrentTick);
-		if (delta < 1000) *blocktime = 1000; else *blocktime = delta;
+		*blocktime = delta < 1 ? 1 : delta;		// Sub second timers (ie: ICE check pacing) must fire on time, only avoid spinning on a tick that is due now
 	}
 }
 
@@ -6537,7 +6631,7 @@ long long ILibGetUptime()
 	struct timespec ts; 
 	memset(&ts, 0, sizeof ts);
 	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return (((long long)ts.tv_sec) * 1000) + ((((long long)ts.tv_nsec) / 1000) % 1000);
+	return (((long long)ts.tv_sec) * 1000) + (((long long)ts.tv_nsec) / 1000000);
 }
 #endif
 
@@ -209,6 +209,7 @@ extern char* ILibCriticalLogFilename;
 	typedef	void(*ILibChain_Destroy)(void* object);
 	typedef void(*ILibChain_DestroyEvent)(void *chain, void *user);
 	typedef void(*ILibChain_StartEvent)(void *chain, void *user);
+	typedef void(*ILibChain_PreSleepHandler)(void *chain, void *object);
 
 #ifdef _REMOTELOGGING
 	#define ILibChainSetLogger(chain, logger) ((void**)&((int*)chain)[2])[0] = logger
@@ -719,6 +720,8 @@ extern char* ILibCriticalLogFilename;
 	void ILibChain_SafeAdd(void *chain, void *object);
 	void ILibChain_SafeRemove(void *chain, void *object);
 	void ILibChain_DestroyEx(void *chain);
+	void ILibChain_AddPreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object);
+	void ILibChain_RemovePreSleepHandler(void *chain, ILibChain_PreSleepHandler handler, void *object);
 	void ILibStartChain(void *chain);
 	void ILibStopChain(void *chain);
 
@@ -102,6 +102,12 @@ void ILibWebClient_SessionTrack(void *RequestToken, void *Session, char *msg)
 //
 #define MAX_IDLE_SESSIONS 20
 
+//
+// This is the default number of destinations (IP address + Port) that we keep a TLS session for,
+// so that reconnecting to the same server can use an abbreviated handshake
+//
+#define ILibWebClient_TLSSessionCache_DefaultSize 16
+
 
 //{{{ REMOVE_THIS_FOR_HTTP/1.0_ONLY_SUPPORT--> }}}
 //
@@ -169,6 +175,10 @@ struct ILibWebClientManager
 	#ifndef MICROSTACK_NOTLS
 	SSL_CTX *ssl_ctx;
 	ILibWebClient_OnSslConnection OnSslConnection;
+	void *TLSSessionTable;		// Destination (IP address + Port) -> SSL_SESSION*
+	int TLSSessionTableCount;
+	int TLSSessionTableMax;
+	ILibAsyncSocket_TLSHandshakeStats TLSStats;
 	#endif
 
 	//typedef void(*ILibWebClient_OnSslConnection)(ILibWebClient_StateObject sender, X509 *x509, void *user1, void *user2);
@@ -218,6 +228,7 @@ struct ILibWebClientDataObject
 	struct sockaddr_in6 source;
 
 	int InitialRequestAnswered;
+	int TLSSessionCached;	// Set once the TLS session of this connection has been remembered for resumption
 	void* RequestQueue;
 	void* SOCK;
 	struct sockaddr_in6 LocalIP;
@@ -391,6 +402,85 @@ void ILibWebClient_DestroyWebClientDataObject(ILibWebClient_StateObject token)
 	free(wcdo);
 }
 
+#ifndef MICROSTACK_NOTLS
+//
+// Internal method to release all the TLS sessions we kept for resumption
+//
+// <param name="manager">The ILibWebClient</param>
+void ILibWebClient_TLSSessionCache_Clear(struct ILibWebClientManager *manager)
+{
+	void *en;
+	char *key;
+	int keyLength;
+	void *data;
+
+	if (manager->TLSSessionTable == NULL) return;
+	en = ILibHashTree_GetEnumerator(manager->TLSSessionTable);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, &data);
+		SSL_SESSION_free((SSL_SESSION*)data);
+	}
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(manager->TLSSessionTable);
+	manager->TLSSessionTable = NULL;
+	manager->TLSSessionTableCount = 0;
+}
+
+//
+// Internal method to remember the TLS session of a connection, keyed by destination. QLock must be held.
+//
+// <param name="manager">The ILibWebClient</param>
+// <param name="remote">The destination the session was negotiated with</param>
+// <param name="session">The session to keep. The table takes ownership of this reference. NULL just forgets the destination.</param>
+void ILibWebClient_TLSSessionCache_Set(struct ILibWebClientManager *manager, struct sockaddr *remote, SSL_SESSION *session)
+{
+	char key[sizeof(struct sockaddr_in6)];	// ILibCreateTokenStr writes the token through a sockaddr_in6
+	int keyLength;
+	char *evictKey;
+	int evictKeyLength;
+	void *en;
+	void *data;
+
+	if (manager->TLSSessionTable == NULL)
+	{
+		if (session == NULL) return;
+		manager->TLSSessionTable = ILibInitHashTree();
+	}
+	keyLength = ILibCreateTokenStr(remote, 0, key);
+
+	if ((data = ILibGetEntry(manager->TLSSessionTable, key, keyLength)) != NULL)
+	{
+		// Replace the session we had for this destination
+		SSL_SESSION_free((SSL_SESSION*)data);
+		ILibDeleteEntry(manager->TLSSessionTable, key, keyLength);
+		--manager->TLSSessionTableCount;
+	}
+	if (session == NULL) return;
+
+	if (manager->TLSSessionTableCount >= manager->TLSSessionTableMax)
+	{
+		// The table is full, drop one of the destinations to make room
+		en = ILibHashTree_GetEnumerator(manager->TLSSessionTable);
+		if (ILibHashTree_MoveNext(en) == 0)
+		{
+			ILibHashTree_GetValue(en, &evictKey, &evictKeyLength, &data);
+			ILibHashTree_DestroyEnumerator(en);
+			SSL_SESSION_free((SSL_SESSION*)data);
+			ILibDeleteEntry(manager->TLSSessionTable, evictKey, evictKeyLength);
+			--manager->TLSSessionTableCount;
+		}
+		else
+		{
+			ILibHashTree_DestroyEnumerator(en);
+		}
+	}
+
+	ILibAddEntry(manager->TLSSessionTable, key, keyLength, session);
+	++manager->TLSSessionTableCount;
+}
+#endif
+
 //
 // Internal method to free resources associated with an ILibWebClient object
 //
@@ -427,6 +517,7 @@ void ILibDestroyWebClient(void *object)
 	free(manager->socks);
 	
 	#ifndef MICROSTACK_NOTLS
+	ILibWebClient_TLSSessionCache_Clear(manager);
 	manager->ssl_ctx = NULL;
 	manager->OnSslConnection = NULL;
 	#endif
@@ -1075,6 +1166,9 @@ void ILibWebClient_OnData(ILibAsyncSocket_SocketModule socketModule, char* buffe
 	int i = 0;
 	ILibWebClient_ReceiveStatus Fini;
 	void* tmp;
+	#ifndef MICROSTACK_NOTLS
+	SSL_SESSION *session;
+	#endif
 
 	UNREFERENCED_PARAMETER( InterruptPtr );
 
@@ -1084,6 +1178,22 @@ void ILibWebClient_OnData(ILibAsyncSocket_SocketModule socketModule, char* buffe
 
 	if (wcdo == NULL || wcdo->RequestQueue == NULL) return;
 
+	#ifndef MICROSTACK_NOTLS
+	if (wcdo->Server == 0 && wcdo->TLSSessionCached == 0 && wcdo->Parent->ssl_ctx != NULL)
+	{
+		// By the time the server answers, any session ticket it sent has been read, so remember the session now so the next connection to this server can resume it
+		wcdo->TLSSessionCached = 1;
+		if (wcdo->Parent->TLSSessionTableMax > 0 && (session = ILibAsyncSocket_GetTLSSession(socketModule)) != NULL)
+		{
+			SEM_TRACK(WebClient_TrackLock("ILibWebClient_OnData", 3, wcdo->Parent);)
+			sem_wait(&(wcdo->Parent->QLock));
+			ILibWebClient_TLSSessionCache_Set(wcdo->Parent, (struct sockaddr*)&(wcdo->remote), session);
+			SEM_TRACK(WebClient_TrackUnLock("ILibWebClient_OnData", 4, wcdo->Parent);)
+			sem_post(&(wcdo->Parent->QLock));
+		}
+	}
+	#endif
+
 	if (wcdo->Server == 0)
 	{
 		SEM_TRACK(WebClient_TrackLock("ILibWebClient_OnData", 1, wcdo->Parent);)
@@ -1608,8 +1718,19 @@ void ILibWebClient_OnConnect(ILibAsyncSocket_SocketModule socketModule, int Conn
 
 	if (Connected != 0 && wcdo->DisconnectSent == 0)
 	{
-		// If this is a TLS connection, lets send the session certficate to the app for checking.
 		#ifndef MICROSTACK_NOTLS
+		if (wcdo->Parent->ssl_ctx != NULL)
+		{
+			// Keep track of the handshake. The session is remembered on the first read, as TLS 1.3 tickets arrive after the handshake.
+			sem_wait(&(wcdo->Parent->QLock));
+			ILibAsyncSocket_TLSHandshakeStats_Add(&(wcdo->Parent->TLSStats), socketModule);
+			sem_post(&(wcdo->Parent->QLock));
+			wcdo->TLSSessionCached = 0;
+
+			ILibRemoteLogging_printf(ILibChainGetLogger(wcdo->Parent->Chain), ILibRemoteLogging_Modules_Microstack_Web, ILibRemoteLogging_Flags_VerbosityLevel_2, "WebClient: TLS handshake (%s) in %d ms", ILibAsyncSocket_IsTLSSessionReused(socketModule) != 0 ? "resumed" : "full", ILibAsyncSocket_GetTLSHandshakeTime(socketModule));
+		}
+
+		// If this is a TLS connection, lets send the session certficate to the app for checking.
 		if (wcdo->Parent->ssl_ctx != NULL && wcdo->Parent->OnSslConnection != NULL)
 		{
 			certs = ILibAsyncSocket_SslGetCerts(socketModule);
@@ -1667,6 +1788,10 @@ void ILibWebClient_OnConnect(ILibAsyncSocket_SocketModule socketModule, int Conn
 
 		ILibDeleteEntry(wcdo->Parent->DataTable, key, keyLength);
 		ILibDeleteEntry(wcdo->Parent->idleTable, key, keyLength);
+		#ifndef MICROSTACK_NOTLS
+		// Don't offer the same session again, in case it is the reason the handshake failed
+		ILibWebClient_TLSSessionCache_Set(wcdo->Parent, (struct sockaddr*)&(wcdo->remote), NULL);
+		#endif
 		
 		SEM_TRACK(WebClient_TrackUnLock("ILibWebClient_OnConnect", 4, wcdo->Parent);)
 		sem_post(&(wcdo->Parent->QLock));
@@ -1834,6 +1959,11 @@ void ILibWebClient_PreProcess(void* WebClientModule, fd_set *readset, fd_set *wr
 	struct ILibWebClientDataObject *wcdo;
 	int xOK = 0;
 	int i;
+	#ifndef MICROSTACK_NOTLS
+	char key[sizeof(struct sockaddr_in6)];	// ILibCreateTokenStr writes the token through a sockaddr_in6
+	int keyLength;
+	SSL_SESSION *session;
+	#endif
 
 	UNREFERENCED_PARAMETER( readset );
 	UNREFERENCED_PARAMETER( writeset );
@@ -1873,7 +2003,18 @@ void ILibWebClient_PreProcess(void* WebClientModule, fd_set *readset, fd_set *wr
 					
 					// Addition for TLS purpose
 					#ifndef MICROSTACK_NOTLS
-					if (wcm->ssl_ctx != NULL) ILibAsyncSocket_SetSSLContext(wcdo->SOCK, wcm->ssl_ctx, 0);
+					if (wcm->ssl_ctx != NULL)
+					{
+						ILibAsyncSocket_SetSSLContext(wcdo->SOCK, wcm->ssl_ctx, 0);
+
+						// If we talked to this server before, offer the previous session so the handshake can be abbreviated
+						if (wcm->TLSSessionTable != NULL)
+						{
+							keyLength = ILibCreateTokenStr((struct sockaddr*)&wcdo->remote, 0, key);
+							session = (SSL_SESSION*)ILibGetEntry(wcm->TLSSessionTable, key, keyLength);
+							if (session != NULL) ILibAsyncSocket_SetTLSSession(wcdo->SOCK, session);
+						}
+					}
 					#endif
 				}
 			}
@@ -2019,6 +2160,7 @@ ILibWebClient_RequestManager ILibCreateWebClient(int PoolSize, void *Chain)
 
 	#ifndef MICROSTACK_NOTLS
 	RetVal->ssl_ctx = NULL;
+	RetVal->TLSSessionTableMax = ILibWebClient_TLSSessionCache_DefaultSize;
 	#endif
 
 	// Create our pool of sockets
@@ -2045,6 +2187,20 @@ void ILibWebClient_SetMaxConcurrentSessionsToServer(ILibWebClient_RequestManager
 	wcm->MaxConnectionsToSameServer = maxConnections;
 }
 
+/*! \fn ILibWebClient_SetFastOpen(ILibWebClient_RequestManager WebClient, int enable)
+\brief Enables TCP Fast Open on the connections of this client, see \a ILibAsyncSocket_SetFastOpen
+\param WebClient The ILibWebClient to configure
+\param enable Non-zero to enable
+\returns Non-zero if Fast Open is supported on this platform
+*/
+int ILibWebClient_SetFastOpen(ILibWebClient_RequestManager WebClient, int enable)
+{
+	struct ILibWebClientManager *wcm = (struct ILibWebClientManager*)WebClient;
+	int i, r = 0;
+	for (i = 0; i < wcm->socksLength; ++i) { r = ILibAsyncSocket_SetFastOpen(wcm->socks[i], enable); }
+	return(r);
+}
+
 /*! \fn ILibWebClient_PipelineRequest(ILibWebClient_RequestManager WebClient, struct sockaddr_in *RemoteEndpoint, struct packetheader *packet, ILibWebClient_OnResponse OnResponse, void *user1, void *user2)
 	\brief Queues a new web request
 	\param WebClient The ILibWebClient to queue the requests to
@@ -2915,6 +3071,37 @@ void ILibWebClient_SetTLS(ILibWebClient_RequestManager manager, void *ssl_ctx, I
 	wcm->ssl_ctx = (SSL_CTX*)ssl_ctx;
 	wcm->OnSslConnection = OnSslConnection;
 }
+
+/*! \fn ILibWebClient_SetTLSSessionCache(ILibWebClient_RequestManager manager, int maxDestinations)
+\brief Sets how many servers a TLS session is kept for
+\par
+When reconnecting to a server (IP address + Port) that we have a session for, the session is offered to the server,
+which lets it skip the certificate exchange and key agreement. This is on by default.
+The session is kept once the server first answers, so TLS 1.3 session tickets, which are sent after the handshake, are included.
+\param manager The ILibWebClient to configure
+\param maxDestinations The maximum number of servers to keep a session for. Zero disables session resumption.
+*/
+void ILibWebClient_SetTLSSessionCache(ILibWebClient_RequestManager manager, int maxDestinations)
+{
+	struct ILibWebClientManager *wcm = (struct ILibWebClientManager *)manager;
+	sem_wait(&(wcm->QLock));
+	if (maxDestinations < wcm->TLSSessionTableCount) ILibWebClient_TLSSessionCache_Clear(wcm);
+	wcm->TLSSessionTableMax = maxDestinations < 0 ? 0 : maxDestinations;
+	sem_post(&(wcm->QLock));
+}
+
+/*! \fn ILibWebClient_GetTLSHandshakeStats(ILibWebClient_RequestManager manager, ILibAsyncSocket_TLSHandshakeStats *stats)
+\brief Fetches the number and duration of the full and resumed TLS handshakes done by this client
+\param manager The ILibWebClient to query
+\param[out] stats The running totals
+*/
+void ILibWebClient_GetTLSHandshakeStats(ILibWebClient_RequestManager manager, ILibAsyncSocket_TLSHandshakeStats *stats)
+{
+	struct ILibWebClientManager *wcm = (struct ILibWebClientManager *)manager;
+	sem_wait(&(wcm->QLock));
+	memcpy(stats, &(wcm->TLSStats), sizeof(ILibAsyncSocket_TLSHandshakeStats));
+	sem_post(&(wcm->QLock));
+}
 #endif
 
 int ILibWebClient_GetLocalInterface(void* socketModule, struct sockaddr *localAddress)
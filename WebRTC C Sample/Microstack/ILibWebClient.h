@@ -212,12 +212,15 @@ void ILibWebClient_Parse_ContentRange(char *contentRange, int *Start, int *End,
 enum ILibWebClient_Range_Result ILibWebClient_Parse_Range(char *Range, long *Start, long *Length, long TotalLength);
 
 void ILibWebClient_SetMaxConcurrentSessionsToServer(ILibWebClient_RequestManager WebClient, int maxConnections);
+int ILibWebClient_SetFastOpen(ILibWebClient_RequestManager WebClient, int enable);
 void ILibWebClient_SetUser(ILibWebClient_RequestManager manager, void *user);
 void* ILibWebClient_GetUser(ILibWebClient_RequestManager manager);
 void* ILibWebClient_GetChain(ILibWebClient_RequestManager manager);
 
 #ifndef MICROSTACK_NOTLS
 void ILibWebClient_SetTLS(ILibWebClient_RequestManager manager, void *ssl_ctx, ILibWebClient_OnSslConnection OnSslConnection);
+void ILibWebClient_SetTLSSessionCache(ILibWebClient_RequestManager manager, int maxDestinations);
+void ILibWebClient_GetTLSHandshakeStats(ILibWebClient_RequestManager manager, ILibAsyncSocket_TLSHandshakeStats *stats);
 #endif
 
 // Added methods
@@ -42,12 +42,47 @@ limitations under the License.
 	#define ILibWebRTC_LoggingServerPort 0
 #endif
 
+// Hardware CRC. The code is always compiled in, and only used when the CPU reports support at runtime
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#define ILibStun_CRC_X86
+	#define ILibStun_TARGET_PCLMUL
+	#define ILibStun_TARGET_SSE42
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#include <cpuid.h>
+	#include <wmmintrin.h>
+	#include <nmmintrin.h>
+	#define ILibStun_CRC_X86
+	#define ILibStun_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+	#define ILibStun_TARGET_SSE42 __attribute__((target("sse4.2")))
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+	#include <arm_acle.h>
+	#include <sys/auxv.h>
+	#ifndef HWCAP_CRC32
+		#define HWCAP_CRC32 (1 << 7)
+	#endif
+	#define ILibStun_CRC_ARM64
+	#if defined(__clang__)
+		#define ILibStun_TARGET_ARMCRC __attribute__((target("crc")))
+	#else
+		#define ILibStun_TARGET_ARMCRC __attribute__((target("+crc")))
+	#endif
+#endif
+#define ILibStun_CRC_Feature_PCLMUL 0x01		// x86 carry-less multiply, folds CRC32 16 bytes at a time
+#define ILibStun_CRC_Feature_ARMCRC 0x02		// ARMv8 CRC32 and CRC32C instructions
+#define ILibStun_CRC_Feature_SSE42 0x04			// x86 crc32 instruction (CRC32C polynomial only)
+
 
 #define ILibStunClient_TIMEOUT 2
 #define ILibRUDP_WindowSize 32000
 #define ILibRUDP_StartBufferSize 2048
 #define ILibRUDP_StartMTU 1400
 #define ILibRUDP_MaxMTU 2048
+#define ILibStun_ReceiveBatchSize 32			// Datagrams read per system call, where the platform supports it
+#define ILibStun_MaxSocketBuffer 4194304		// SO_RCVBUF/SO_SNDBUF grow up to this when the kernel drops or backs up
+#define ILibStun_ShardTransactionByte 10		// Byte of every outbound STUN Transaction ID that carries the shard index
+#define ILibStun_ShardInboxLimit 1024			// Packets queued for another shard beyond this are dropped
+#define ILibStun_ShardRouteTimeoutSeconds 30	// A remote address that goes quiet this long is no longer forwarded
 
 #define RTO_MIN 1000
 #define RTO_MAX 6000
@@ -55,11 +90,20 @@ limitations under the License.
 #define RTO_BETA 0.25
 
 #define ILibSCTP_MaxReceiverCredits 100000
+#define ILibTURN_SendQueueDefaultLimit (2 * ILibSCTP_MaxReceiverCredits)	// Bytes held back for a busy TURN TCP socket, about two full SCTP windows
+#define ILibTURN_SocketHighWatermark 65536		// Bytes the TURN TCP socket is given, before relayed packets wait in the send queue
+#define ILibTURN_SocketLowWatermark 16384		// The send queue is fed again once the socket drains to this
 #define ILibSCTP_MaxSenderCredits 0				// When we do real-time traffic, reduce the buffering. In theory, this should never be used, leave to zero
 #define ILibSCTP_Stream_SparseArraySize 16		// Must be a power of 2
 #define ILibSCTP_Stream_MaximumCount 1024		// This is what Chrome/Firefox Support
-#define ILibSTUN_MaxSlots 10					// MUST be less then 128, otherwise IceSlot and dtlsSlot will collide
+#define ILibSTUN_MaxSlots 262144				// Ceiling for the IceState table, the slot is encoded in ILibStun_SlotChars base64 characters of the username
+#define ILibStun_UserAndKeyLength (2 + ILibStun_UsernameLength + 32)	// Length prefixed username, followed by the length prefixed 32 byte password
+#define ILibSTUN_MaxDtlsSlots 65535				// Ceiling for the dTLS session table, the session id doubles as the 16 bit TURN channel number
+#define ILibSTUN_InitialSlots 16				// Both tables start this size, and double whenever they run out of free slots
+#define ILibSTUN_MaxRequeryCount 10				// Don't send more than this many ICE requests back in answer to inbound ones
+#define ILibStun_DemuxBuckets 16384				// Buckets in each demux index, must be a power of 2
 #define ILibSTUN_MaxOfferAgeSeconds 60			// Offers are only valid for this amount of time
+#define ILibStun_BindingResponseLength 64		// Header + XOR-MAPPED-ADDRESS (IPv4) + MESSAGE-INTEGRITY + FINGERPRINT
 #define ILibSCTP_FastRetry_GAP 3
 
 
@@ -74,6 +118,17 @@ limitations under the License.
 // link posted by Google: http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
 //
 #define ILibStun_MaxConsentFreshnessTimeoutSeconds 15		// Must be 15 Seconds or less to be spec compliant
+#define ILibStun_ConsentTickMilliseconds 500				// Resolution of the consent scheduler, and the interval between unanswered probes
+#define ILibStun_ConsentWheelSize 64						// Buckets in the consent scheduler (Must cover ILibStun_MaxConsentFreshnessTimeoutSeconds)
+#define ILibStun_ConsentJitterPercent 20					// The wait before probing is randomly shortened by up to this much, so sessions don't probe in lockstep
+
+//
+// ICE Connectivity Checks (RFC 8445 14). The CONTROLLING agent sends one check every Ta, in pair priority order
+//
+#define ILibStun_ICE_Ta 50									// Milliseconds between two checks of the same ICE agent
+#define ILibStun_ICE_MinRTO 500								// Milliseconds, minimum wait for the answer to a check before sending it again
+#define ILibStun_ICE_MaxTransmissions 2						// A check fails when this many requests went unanswered
+#define ILibStun_ICE_LocalPriority ((126U << 24) | (65535U << 8) | 255U)	// Our one candidate: host type, component 1
 
 #define RCTPDEBUG(x)
 #define RCTPRCVDEBUG(x)
@@ -92,6 +147,14 @@ limitations under the License.
 #define IS_ERR_RESP(msg_type)      (((msg_type) & 0x0110) == 0x0110)
 
 #define NAT_MAPPING_DETECTION(TransactionID) (TransactionID[11])
+
+//
+// First byte of every Transaction ID we generate, so a response can be matched to what the request was for.
+// ICE and Consent requests carry a 24 bit slot number in the next three bytes
+//
+#define ILibStun_TransactionKind_Ice 0x01		// Connectivity check, slot is the IceState slot
+#define ILibStun_TransactionKind_Consent 0x02	// Consent freshness probe, slot is the dTLS session slot
+#define ILibStun_TransactionKind_Nat 0xFF		// NAT behavior discovery
 #define DTLS_PAUSE_FLAG 0x01
 #define DTLS_RESUME_FLAG 0x02
 
@@ -590,6 +653,34 @@ unsigned char ILibWebRTC_LoggingServer_HTML[3368] =
 };
 #endif
 
+// HMAC-SHA1 with the key already run through the pad blocks, see ILibStun_HmacSha1_Init
+typedef struct ILibStun_HmacSha1
+{
+	SHA_CTX inner;		// SHA1 state after absorbing key ^ ipad
+	SHA_CTX outer;		// SHA1 state after absorbing key ^ opad
+}ILibStun_HmacSha1;
+
+// Candidate pair states (RFC 8445 6.1.2.6)
+typedef enum ILibStun_ICE_PairState
+{
+	ILibStun_ICE_PairState_Frozen = 0,
+	ILibStun_ICE_PairState_Waiting = 1,
+	ILibStun_ICE_PairState_InProgress = 2,
+	ILibStun_ICE_PairState_Succeeded = 3,
+	ILibStun_ICE_PairState_Failed = 4
+}ILibStun_ICE_PairState;
+
+// Entry of the checklist. All our checks go out of the same socket, so there is one pair per remote candidate
+struct ILibStun_ICE_CandidatePair
+{
+	unsigned long long priority;
+	long long lastTransmit;				// Uptime of the last request sent for this pair
+	unsigned char candidate;			// Index in hostcandidates
+	unsigned char state;				// ILibStun_ICE_PairState
+	unsigned char transmissions;		// Requests sent since the check started
+	unsigned char triggered;			// The peer checked this pair, so it goes ahead of the other checks
+};
+
 struct ILibStun_IceState
 {
 	// These 2 fields must be the first 2 fields of this structure
@@ -603,7 +694,7 @@ struct ILibStun_IceState
 	char* offerblock;
 	unsigned short blockversion;
 	unsigned int blockflags;
-	char userAndKey[43];
+	char userAndKey[ILibStun_UserAndKeyLength + 1];
 	char tieBreaker[8];
 	char* dtlscerthash;
 	int dtlscerthashlen;
@@ -618,6 +709,14 @@ struct ILibStun_IceState
 	long long creationTime;
 	int useTurn;
 	void *userObject;
+	int slot;							// Index of this object in IceStates
+	ILibStun_HmacSha1 rkeyIntegrity;	// Keyed with rkey, signs our requests and checks their responses
+	ILibStun_HmacSha1 localIntegrity;	// Keyed with our key for this username, checks their requests and signs our responses
+	int localIntegritySet;				// localIntegrity is computed on the first request (Microstack thread only)
+	struct ILibStun_ICE_CandidatePair *checklist;	// Sorted by pair priority, only while we are CONTROLLING, see ILibStun_ICE_BuildChecklist
+	int checklistCount;
+	struct ILibStun_IceState *checksNext, *checksPrev;	// Links in the module's list of agents running checks, see ILibStun_ICE_OnChecksTimer
+	int checksListed;
 };
 
 struct ILibStun_dTlsSession
@@ -684,7 +783,10 @@ struct ILibStun_dTlsSession
 	int rpacketptr;
 	int rpacketsize;
 
-	long freshnessTimestampStart;
+	long freshnessTimestampStart;			// When the current round of consent probes started, 0 if we aren't probing
+	long long consentDue;					// Uptime when the consent scheduler next acts on this session
+	int consentScheduled;					// Non-zero while this session is in the consent scheduler
+	struct ILibStun_dTlsSession *consentNext, *consentPrev;
 	
 	void* User2;
 	int User3;
@@ -714,12 +816,49 @@ struct ILibStun_dTlsSession
 	int RTTVAR;
 	int RTO;
 	unsigned int T3RTXTIME;
+	unsigned long long turnSendMark;	// TURN send position after the last record this session queued, see ILibTURN_GetSendPositions
 };
 
 
 #define ILibWebRTC_DTLS_TO_TIMER_OBJECT(d) ((char*)d+16)
 #define ILibWebRTC_DTLS_FROM_TIMER_OBJECT(d) ((struct ILibStun_dTlsSession*)((char*)d-16))
 
+struct ILibStun_Module;
+
+// Packet handed from the shard that received it to the shard that owns the remote peer, data follows the header
+struct ILibStun_ShardPacket
+{
+	struct ILibStun_ShardPacket *Next;
+	struct sockaddr_in6 Remote;
+	int Length;
+};
+
+struct ILibStun_ShardInbox
+{
+	struct ILibStun_Module *Owner;
+	struct ILibStun_ShardPacket *Head;
+	struct ILibStun_ShardPacket *Tail;
+	int Count;
+};
+
+// Shared by every STUN module bound to the same SO_REUSEPORT port, Lock protects the inboxes
+struct ILibStun_ShardGroup
+{
+	sem_t Lock;
+	int Count;
+	int RefCount;
+	struct ILibStun_ShardInbox Inbox[ILibStun_MaxShards];
+};
+
+// Remote address that belongs to another shard
+struct ILibStun_ShardRoute
+{
+	int Shard;
+	long long LastSeen;
+	int KeyLength;
+	char Key[18];
+};
+
 struct ILibStun_Module
 {
 	ILibChain_PreSelect PreSelect;
@@ -754,12 +893,28 @@ struct ILibStun_Module
 	ILibSCTP_OnData OnData;
 	ILibSCTP_OnSendOK OnSendOK;
 
-	int IceStatesNextSlot;
-	struct ILibStun_IceState* IceStates[ILibSTUN_MaxSlots];
-	int dTlsAllowedNextSlot;
-	struct sockaddr_in6 dTlsAllowed[ILibSTUN_MaxSlots];
+	// Slot tables grow on demand. Each keeps a stack of slots believed free, which is refilled by a sweep when it runs dry
+	struct ILibStun_IceState** IceStates;
+	int IceStatesSize;
+	int* IceStatesFree;
+	int IceStatesFreeCount;
 	SSL_CTX* SecurityContext;
-	struct ILibStun_dTlsSession* dTlsSessions[ILibSTUN_MaxSlots];
+	struct ILibStun_dTlsSession** dTlsSessions;
+	int dTlsSessionsSize;
+	int* dTlsSessionsFree;
+	int dTlsSessionsFreeCount;
+
+	// Demux indexes, so a datagram finds its session without a table scan
+	ILibHashtable SessionIndex;			// Remote address -> dTLS session
+	ILibHashtable CandidateIndex;		// Remote host candidate address -> IceState
+
+	// Consent freshness scheduler, one timer for all sessions. Sessions are bucketed by the tick they are due on
+	struct ILibStun_dTlsSession *ConsentWheel[ILibStun_ConsentWheelSize];
+	long long ConsentTick;				// Last tick that was processed
+	int ConsentScheduled;				// Sessions in the wheel
+	int ConsentTimerSet;				// The sweep timer is pending
+	int IceChecksTimerSet;				// The connectivity check pacing timer is pending
+	struct ILibStun_IceState *IceChecks;	// IceStates that started connectivity checks, so the pacing timer doesn't walk the whole table
 	char* CertThumbprint;
 	int CertThumbprintLength;
 
@@ -781,6 +936,14 @@ struct ILibStun_Module
 	int alwaysUseTurn;
 	int alwaysConnectTurn;
 	int consentFreshnessDisabled;
+	int iceLite;						// ICE-lite, we never send connectivity checks or consent probes and are always CONTROLLED
+
+	// SO_REUSEPORT Sharding
+	int ReusePort;
+	int ShardIndex;
+	struct ILibStun_ShardGroup *Shards;
+	ILibHashtable ShardRoutes;
+	ILibLinkedList ShardRouteList;
 
 #ifdef _WEBRTCDEBUG
 	int lossPercentage;
@@ -789,14 +952,182 @@ struct ILibStun_Module
 #endif
 };
 
+static int ILibStun_CRC_Features = -1;				// ILibStun_CRC_Feature_* flags, -1 until ILibStun_CRC_Init has run
+static unsigned int ILibStun_CRC32_slice[8][256];	// Slicing-by-8 tables for the software path, [0] is ILibStun_CRC32_table
+void crc32c_init_sw(void);
+#if defined(ILibStun_CRC_X86) || defined(ILibStun_CRC_ARM64)
+void crc32c_init_hw(void);
+#endif
+
+// Builds the CRC32 and CRC32C tables, and detects the hardware CRC support. Called when a STUN module or a TURN client is created,
+// before its chain runs, so the CRC functions never have to initialise anything themselves. Running it again is harmless, it always
+// computes the same values
+void ILibStun_CRC_Init()
+{
+	int n, k, features = 0;
+#if defined(ILibStun_CRC_X86) && defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	if ((regs[2] & (1 << 1)) != 0) { features |= ILibStun_CRC_Feature_PCLMUL; }
+	if ((regs[2] & (1 << 20)) != 0) { features |= ILibStun_CRC_Feature_SSE42; }
+#elif defined(ILibStun_CRC_X86)
+	unsigned int a, b, c, d;
+	if (__get_cpuid(1, &a, &b, &c, &d) != 0)
+	{
+		if ((c & bit_PCLMUL) != 0 && (d & bit_SSE2) != 0) { features |= ILibStun_CRC_Feature_PCLMUL; }
+		if ((c & bit_SSE4_2) != 0) { features |= ILibStun_CRC_Feature_SSE42; }
+	}
+#elif defined(ILibStun_CRC_ARM64)
+	if ((getauxval(AT_HWCAP) & HWCAP_CRC32) != 0) { features |= ILibStun_CRC_Feature_ARMCRC; }
+#endif
+
+	for (n = 0; n < 256; ++n)
+	{
+		ILibStun_CRC32_slice[0][n] = ILibStun_CRC32_table[n];
+		for (k = 1; k < 8; ++k) { ILibStun_CRC32_slice[k][n] = UPDC32(0, ILibStun_CRC32_slice[k - 1][n]); }
+	}
+	crc32c_init_sw();
+#if defined(ILibStun_CRC_X86) || defined(ILibStun_CRC_ARM64)
+	if ((features & (ILibStun_CRC_Feature_SSE42 | ILibStun_CRC_Feature_ARMCRC)) != 0) { crc32c_init_hw(); }
+#endif
+	ILibStun_CRC_Features = features;
+}
+
+// Slicing-by-8, c is the running (non inverted) CRC. Byte order independent, the words are assembled from bytes
+unsigned int ILibStun_CRC32_Software(unsigned int c, const unsigned char *next, int len)
+{
+	unsigned int one, two;
+
+	while (len >= 8)
+	{
+		one = c ^ ((unsigned int)next[0] | ((unsigned int)next[1] << 8) | ((unsigned int)next[2] << 16) | ((unsigned int)next[3] << 24));
+		two = (unsigned int)next[4] | ((unsigned int)next[5] << 8) | ((unsigned int)next[6] << 16) | ((unsigned int)next[7] << 24);
+		c = ILibStun_CRC32_slice[7][one & 0xff] ^ ILibStun_CRC32_slice[6][(one >> 8) & 0xff] ^ ILibStun_CRC32_slice[5][(one >> 16) & 0xff] ^ ILibStun_CRC32_slice[4][one >> 24] ^
+			ILibStun_CRC32_slice[3][two & 0xff] ^ ILibStun_CRC32_slice[2][(two >> 8) & 0xff] ^ ILibStun_CRC32_slice[1][(two >> 16) & 0xff] ^ ILibStun_CRC32_slice[0][two >> 24];
+		next += 8;
+		len -= 8;
+	}
+	for (; len; --len, ++next) { c = UPDC32(*next, c); }
+	return c;
+}
+
+#ifdef ILibStun_CRC_X86
+//
+// Folds 64 bytes at a time with carry-less multiplies, then Barrett reduces to 32 bits.
+// Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction". The constants are
+// for the bit reflected 0xedb88320 polynomial. len must be at least 64 and a multiple of 16
+//
+ILibStun_TARGET_PCLMUL unsigned int ILibStun_CRC32_Pclmul(unsigned int c, const unsigned char *next, int len)
+{
+	static const unsigned long long k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const unsigned long long k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const unsigned long long k5k0[2] = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const unsigned long long poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(next + 0x00)), _mm_cvtsi32_si128((int)c));
+	x2 = _mm_loadu_si128((const __m128i*)(next + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(next + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(next + 0x30));
+	x0 = _mm_loadu_si128((const __m128i*)k1k2);
+	next += 64;
+	len -= 64;
+
+	// Four independent folds per 64 bytes
+	while (len >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(next + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(next + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(next + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(next + 0x30)));
+		next += 64;
+		len -= 64;
+	}
+
+	// Fold the four lanes into one
+	x0 = _mm_loadu_si128((const __m128i*)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x4), x5);
+
+	// Remaining 16 byte blocks
+	while (len >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), _mm_loadu_si128((const __m128i*)next)), x5);
+		next += 16;
+		len -= 16;
+	}
+
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x00), x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_loadu_si128((const __m128i*)poly);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, x3), x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+#ifdef ILibStun_CRC_ARM64
+// ARMv8 CRC32 instructions use the same polynomial as STUN, c is the running (non inverted) CRC
+ILibStun_TARGET_ARMCRC unsigned int ILibStun_CRC32_Arm(unsigned int c, const unsigned char *next, int len)
+{
+	unsigned long long v;
+
+	while (len >= 8) { memcpy(&v, next, 8); c = __crc32d(c, v); next += 8; len -= 8; }
+	for (; len; --len, ++next) { c = __crc32b(c, *next); }
+	return c;
+}
+#endif
+
+/*! \fn unsigned int ILibStun_CRC32(char *buf, int len)
+\brief Computes the CRC32 used by the STUN FINGERPRINT attribute
+\par
+Uses PCLMULQDQ on x86 or the CRC32 instructions on ARMv8 when the CPU supports them, and slicing-by-8 otherwise.
+The tables are built when the first STUN module or TURN client is created, so call this only after that.
+\param buf Buffer to checksum
+\param len Length of \a buf
+\returns CRC32 of \a buf (Not yet XOR'ed with the FINGERPRINT constant)
+*/
 unsigned int ILibStun_CRC32(char *buf, int len)
 {
 	unsigned int c = 0xFFFFFFFF;
-	for (; len; --len, ++buf) { c = UPDC32(*buf, c); }
-	return ~c;
+	const unsigned char *next = (const unsigned char*)buf;
+
+#ifdef ILibStun_CRC_X86
+	if (len >= 64 && (ILibStun_CRC_Features & ILibStun_CRC_Feature_PCLMUL) != 0)
+	{
+		c = ILibStun_CRC32_Pclmul(c, next, len & ~15);
+		next += (len & ~15);
+		len &= 15;
+	}
+#elif defined(ILibStun_CRC_ARM64)
+	if ((ILibStun_CRC_Features & ILibStun_CRC_Feature_ARMCRC) != 0) { return ~ILibStun_CRC32_Arm(c, next, len); }
+#endif
+	return ~ILibStun_CRC32_Software(c, next, len);
 }
 
 struct ILibStun_Module *g_stunModule = NULL;
+static int ILibStun_ModuleIndex = -1;	// SSL ex_data slot that points back to the ILibStun_Module owning the dTLS session
 
 // Function prototypes
 ILibTransport_DoneState ILibStun_SendSctpPacket(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength);
@@ -806,13 +1137,19 @@ void ILibStun_SctpDisconnect(struct ILibStun_Module *obj, int session);
 void ILibStun_SendIceRequest(struct ILibStun_IceState *IceState, int SlotNumber, int useCandidate, struct sockaddr_in6* remoteInterface);
 void ILibStun_SendIceRequestEx(struct ILibStun_IceState *IceState, char* TransactionID, int useCandidate, struct sockaddr_in6* remoteInterface);
 void ILibStun_ICE_Start(struct ILibStun_IceState *state, int SelectedSlot);
+void ILibStun_ICE_FinalizeConnectivityChecks(void *object);
+void ILibStun_ICE_TriggerCheck(struct ILibStun_IceState *state, int candidate);
+void ILibStun_ICE_OnCheckSucceeded(struct ILibStun_IceState *state, int slot, int candidate);
+void ILibStun_FreeIceState(struct ILibStun_IceState *ice);
 unsigned int crc32c(unsigned int crci, const void *buf, unsigned int len);
 int ILibStun_GetDtlsSessionSlotForIceState(struct ILibStun_Module *obj, struct ILibStun_IceState* ice);
 void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, struct sockaddr_in6* remoteInterface);
 void ILibStun_PeriodicStunCheck(struct ILibStun_Module* obj);
+void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE);
 int ILibTURN_GenerateStunFormattedPacketHeader(char* rbuffer, STUN_TYPE packetType, char* transactionID);
 int ILibTURN_AddAttributeToStunFormattedPacketHeader(char* rbuffer, int rptr, STUN_ATTRIBUTES attrType, char* data, int dataLen);
 void ILibTURN_DisconnectFromServer(ILibTURN_ClientModule turnModule);
+enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelDataEx(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length, unsigned long long *accepted);
 ILibWebRTC_DataChannel_CloseStatus ILibWebRTC_CloseDataChannelEx2(void *WebRTCModule, unsigned short *streamIds, int streamIdLength);
 void ILibWebRTC_PropagateChannelCloseEx(ILibSparseArray sender, struct ILibStun_dTlsSession* obj);
 ILibSparseArray ILibWebRTC_PropagateChannelClose(struct ILibStun_dTlsSession* obj, char* packet);
@@ -984,15 +1321,15 @@ char* SCTP_ERROR_CAUSE_TO_STRING(ILibSCTP_ErrorCause_Header *cause)
 void ILibWebRTC_SetUserObject(void *stunModule, char* localUsername, void *userObject)
 {
 	struct ILibStun_Module* obj = (struct ILibStun_Module*) stunModule;
-	int SlotNumber = ILibStun_CharToSlot(localUsername[0]);
-	if (SlotNumber >= 0 && SlotNumber < ILibSTUN_MaxSlots && obj->IceStates[SlotNumber] != NULL) { obj->IceStates[SlotNumber]->userObject = userObject; }
+	int SlotNumber = ILibStun_UsernameToSlot(localUsername);
+	if (SlotNumber >= 0 && SlotNumber < obj->IceStatesSize && obj->IceStates[SlotNumber] != NULL) { obj->IceStates[SlotNumber]->userObject = userObject; }
 }
 
 void* ILibWebRTC_GetUserObject(void *stunModule, char* localUsername)
 {
 	struct ILibStun_Module* obj = (struct ILibStun_Module*) stunModule;
-	int SlotNumber = ILibStun_CharToSlot(localUsername[0]);
-	if (SlotNumber >= 0 && SlotNumber < ILibSTUN_MaxSlots && obj->IceStates[SlotNumber] != NULL) { return(obj->IceStates[SlotNumber]->userObject); }
+	int SlotNumber = ILibStun_UsernameToSlot(localUsername);
+	if (SlotNumber >= 0 && SlotNumber < obj->IceStatesSize && obj->IceStates[SlotNumber] != NULL) { return(obj->IceStates[SlotNumber]->userObject); }
 	return NULL;
 }
 
@@ -1014,13 +1351,268 @@ void ILibStun_OnCompleted(void *object)
 	obj->State = STUN_STATUS_COMPLETE;
 }
 
+//
+// SO_REUSEPORT Sharding
+//
+// Every STUN module in a shard group owns its own socket on the same port, and the kernel picks the socket by
+// hashing the remote address/port. A peer's first packets may therefore land on a shard that doesn't hold its
+// IceState. STUN requests name the owning shard in the ICE username, STUN responses in the Transaction ID. The
+// receiving shard remembers the remote address, and hands the packet (and the DTLS/SCTP traffic that follows)
+// to the owning shard's inbox, which is drained on the owning shard's chain.
+//
+
+// Packs the remote address and port into key (18 bytes), returns the key length
+int ILibStun_AddressKey(struct sockaddr_in6 *remoteInterface, char *key)
+{
+	if (remoteInterface->sin6_family == AF_INET6)
+	{
+		memcpy(key, &(remoteInterface->sin6_addr), 16);
+		memcpy(key + 16, &(remoteInterface->sin6_port), 2);
+		return 18;
+	}
+	memcpy(key, &(((struct sockaddr_in*)remoteInterface)->sin_addr), 4);
+	memcpy(key + 4, &(((struct sockaddr_in*)remoteInterface)->sin_port), 2);
+	return 6;
+}
+
+// Returns the shard named in a STUN packet, or -1 if it doesn't name one
+int ILibStun_Shard_FromStunPacket(struct ILibStun_Module *obj, char *buffer, int bufferLength)
+{
+	unsigned short messageType, attrType, attrLength;
+	int ptr = 20, shard = -1;
+
+	if (bufferLength < 20 || (buffer[0] & 0xC0) != 0 || ntohl(((unsigned int*)buffer)[1]) != 0x2112A442) return -1;
+	messageType = ntohs(((unsigned short*)buffer)[0]);
+
+	if (IS_SUCCESS_RESP(messageType) || IS_ERR_RESP(messageType))
+	{
+		// Response to a request we sent, the sending shard tagged the Transaction ID
+		shard = (unsigned char)buffer[8 + ILibStun_ShardTransactionByte];
+	}
+	else if (messageType == STUN_BINDING_REQUEST)
+	{
+		// Request from a peer, the character following the slot in the username is the shard that generated it
+		while (ptr + 4 <= bufferLength)
+		{
+			attrType = ntohs(((unsigned short*)(buffer + ptr))[0]);
+			attrLength = ntohs(((unsigned short*)(buffer + ptr))[1]);
+			if (ptr + 4 + attrLength > bufferLength) break;
+			if (attrType == STUN_ATTRIB_USERNAME)
+			{
+				if (attrLength > ILibStun_SlotChars && buffer[ptr + 4 + ILibStun_SlotChars] >= 'A' && buffer[ptr + 4 + ILibStun_SlotChars] <= 'Z') { shard = ILibStun_CharToSlot(buffer[ptr + 4 + ILibStun_SlotChars]); }
+				break;
+			}
+			ptr += 4 + attrLength;
+			if ((attrLength % 4) != 0) ptr += (4 - (attrLength % 4));
+		}
+	}
+	return (shard >= 0 && shard < obj->Shards->Count) ? shard : -1;
+}
+
+void ILibStun_Shard_OnRouteTimeout(void *object)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)ILibLinkedList_GetTag(object);
+	struct ILibStun_ShardRoute *route;
+	long long now = ILibGetUptime();
+	void *node = ILibLinkedList_GetNode_Head(obj->ShardRouteList);
+
+	while (node != NULL)
+	{
+		route = (struct ILibStun_ShardRoute*)ILibLinkedList_GetDataFromNode(node);
+		if (now - route->LastSeen >= ILibStun_ShardRouteTimeoutSeconds * 1000)
+		{
+			ILibHashtable_Remove(obj->ShardRoutes, NULL, route->Key, route->KeyLength);
+			free(route);
+			node = ILibLinkedList_Remove(node);
+		}
+		else
+		{
+			node = ILibLinkedList_GetNextNode(node);
+		}
+	}
+	if (ILibLinkedList_GetCount(obj->ShardRouteList) > 0) { ILibLifeTime_Add(obj->Timer, obj->ShardRouteList, ILibStun_ShardRouteTimeoutSeconds, ILibStun_Shard_OnRouteTimeout, NULL); }
+}
+
+// Returns the shard that owns the remote peer
+int ILibStun_Shard_Route(struct ILibStun_Module *obj, char *buffer, int bufferLength, struct sockaddr_in6 *remoteInterface)
+{
+	char key[18];
+	int keyLength = ILibStun_AddressKey(remoteInterface, key);
+	int shard = ILibStun_Shard_FromStunPacket(obj, buffer, bufferLength);
+	struct ILibStun_ShardRoute *route = (struct ILibStun_ShardRoute*)ILibHashtable_Get(obj->ShardRoutes, NULL, key, keyLength);
+
+	if (shard < 0)
+	{
+		// DTLS/SCTP, or STUN that doesn't say, goes wherever the last STUN packet from this peer went
+		if (route == NULL) return obj->ShardIndex;
+		route->LastSeen = ILibGetUptime();
+		return route->Shard;
+	}
+
+	if (shard == obj->ShardIndex)
+	{
+		if (route != NULL)
+		{
+			ILibHashtable_Remove(obj->ShardRoutes, NULL, key, keyLength);
+			ILibLinkedList_Remove_ByData(obj->ShardRouteList, route);
+			free(route);
+		}
+		return shard;
+	}
+
+	if (route == NULL)
+	{
+		if ((route = (struct ILibStun_ShardRoute*)malloc(sizeof(struct ILibStun_ShardRoute))) == NULL) ILIBCRITICALEXIT(254);
+		memcpy(route->Key, key, keyLength);
+		route->KeyLength = keyLength;
+		ILibHashtable_Put(obj->ShardRoutes, NULL, key, keyLength, route);
+		if (ILibLinkedList_GetCount(obj->ShardRouteList) == 0)
+		{
+			// The sweep stops when the list runs dry, restart it (a sweep may still be pending if the list was emptied by a route moving back here)
+			ILibLifeTime_Remove(obj->Timer, obj->ShardRouteList);
+			ILibLifeTime_Add(obj->Timer, obj->ShardRouteList, ILibStun_ShardRouteTimeoutSeconds, ILibStun_Shard_OnRouteTimeout, NULL);
+		}
+		ILibLinkedList_AddTail(obj->ShardRouteList, route);
+	}
+	route->Shard = shard;
+	route->LastSeen = ILibGetUptime();
+	return shard;
+}
+
+// Runs on the owning shard's chain, and processes everything other shards have forwarded to it
+void ILibStun_Shard_OnInbox(void *object)
+{
+	struct ILibStun_ShardInbox *inbox = (struct ILibStun_ShardInbox*)object;
+	struct ILibStun_Module *obj = inbox->Owner;
+	struct ILibStun_ShardPacket *packet, *next;
+	int pause = 0;
+
+	sem_wait(&(obj->Shards->Lock));
+	packet = inbox->Head;
+	inbox->Head = inbox->Tail = NULL;
+	inbox->Count = 0;
+	sem_post(&(obj->Shards->Lock));
+
+	while (packet != NULL)
+	{
+		next = packet->Next;
+		ILibStun_OnUDP(obj->UDP, (char*)(packet + 1), packet->Length, &(packet->Remote), obj, NULL, &pause);
+		free(packet);
+		packet = next;
+	}
+}
+
+// Returns 0 if the packet was queued for the other shard, non-zero if it must be processed here
+int ILibStun_Shard_Forward(struct ILibStun_Module *obj, int shard, char *buffer, int bufferLength, struct sockaddr_in6 *remoteInterface)
+{
+	struct ILibStun_ShardInbox *inbox = &(obj->Shards->Inbox[shard]);
+	struct ILibStun_ShardPacket *packet;
+	int retVal = 0;
+
+	if ((packet = (struct ILibStun_ShardPacket*)malloc(sizeof(struct ILibStun_ShardPacket) + bufferLength)) == NULL) ILIBCRITICALEXIT(254);
+	packet->Next = NULL;
+	packet->Length = bufferLength;
+	memcpy(&(packet->Remote), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
+	memcpy(packet + 1, buffer, bufferLength);
+
+	sem_wait(&(obj->Shards->Lock));
+	if (inbox->Owner == NULL)
+	{
+		retVal = 1;						// Owner is shutting down
+	}
+	else if (inbox->Count >= ILibStun_ShardInboxLimit)
+	{
+		retVal = -1;					// Owner isn't keeping up, drop it like the socket buffer would
+	}
+	else
+	{
+		if (inbox->Tail == NULL) { inbox->Head = packet; } else { inbox->Tail->Next = packet; }
+		inbox->Tail = packet;
+		// Only the first packet needs to wake the owning chain, it will drain everything that arrives until then. The owner always has
+		// other timers pending, so adding ours doesn't unblock its select by itself
+		if (inbox->Count++ == 0)
+		{
+			ILibLifeTime_AddEx(inbox->Owner->Timer, inbox, 0, ILibStun_Shard_OnInbox, NULL);
+			ILibForceUnBlockChain(inbox->Owner->Chain);
+		}
+	}
+	sem_post(&(obj->Shards->Lock));
+
+	if (retVal != 0) { free(packet); }
+	return (retVal > 0 ? 1 : 0);
+}
+
+void ILibStun_OnShardUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)user;
+	int shard;
+
+	if (obj->Shards != NULL && (shard = ILibStun_Shard_Route(obj, buffer, bufferLength, remoteInterface)) != obj->ShardIndex)
+	{
+		if (ILibStun_Shard_Forward(obj, shard, buffer, bufferLength, remoteInterface) == 0) return;
+	}
+	ILibStun_OnUDP(socketModule, buffer, bufferLength, remoteInterface, user, user2, PAUSE);
+}
+
+// Called from the module's Destroy, the last module out frees the group
+void ILibStun_Shard_Leave(struct ILibStun_Module *obj)
+{
+	struct ILibStun_ShardInbox *inbox;
+	struct ILibStun_ShardPacket *packet, *next;
+	struct ILibStun_ShardRoute *route;
+	void *node;
+	int refCount;
+
+	if (obj->ShardRoutes != NULL)
+	{
+		ILibLifeTime_Remove(obj->Timer, obj->ShardRouteList);
+		node = ILibLinkedList_GetNode_Head(obj->ShardRouteList);
+		while (node != NULL)
+		{
+			route = (struct ILibStun_ShardRoute*)ILibLinkedList_GetDataFromNode(node);
+			free(route);
+			node = ILibLinkedList_GetNextNode(node);
+		}
+		ILibLinkedList_Destroy(obj->ShardRouteList);
+		ILibHashtable_Destroy(obj->ShardRoutes);
+		obj->ShardRouteList = NULL;
+		obj->ShardRoutes = NULL;
+	}
+	if (obj->Shards == NULL) return;
+
+	inbox = &(obj->Shards->Inbox[obj->ShardIndex]);
+	sem_wait(&(obj->Shards->Lock));
+	inbox->Owner = NULL;
+	packet = inbox->Head;
+	inbox->Head = inbox->Tail = NULL;
+	inbox->Count = 0;
+	refCount = --obj->Shards->RefCount;
+	ILibLifeTime_Remove(obj->Timer, inbox);
+	sem_post(&(obj->Shards->Lock));
+
+	while (packet != NULL)
+	{
+		next = packet->Next;
+		free(packet);
+		packet = next;
+	}
+	if (refCount == 0)
+	{
+		sem_destroy(&(obj->Shards->Lock));
+		free(obj->Shards);
+	}
+	obj->Shards = NULL;
+}
+
 void ILibStun_OnDestroy(void *object)
 {
 	int i, extraClean = 0;
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)object;
 
-	// Clean up all reliable UDP state && all ICE offers (Use the same loop since both tables are ILibSTUN_MaxSlots long)
-	for (i = 0; i < ILibSTUN_MaxSlots; i++)
+	ILibStun_Shard_Leave(obj);
+
+	// Clean up all reliable UDP state
+	for (i = 0; i < obj->dTlsSessionsSize; i++)
 	{
 		// Clean up OpenSSL dTLS session
 		if (obj->dTlsSessions[i] != NULL)
@@ -1028,43 +1620,265 @@ void ILibStun_OnDestroy(void *object)
 			if (obj->dTlsSessions[i]->state != 0) extraClean = 1;
 			ILibStun_SctpDisconnect(obj, i);
 		}
+	}
 
+	// Clean up all ICE offers
+	obj->IceChecks = NULL;
+	for (i = 0; i < obj->IceStatesSize; i++)
+	{
 		if (obj->IceStates[i] != NULL)
 		{
 			// Clean up ICE state
-			free(obj->IceStates[i]->offerblock);
-			free(obj->IceStates[i]);
+			ILibStun_FreeIceState(obj->IceStates[i]);
 			obj->IceStates[i] = NULL;
 		}
 	}
 
-	if (extraClean == 0) return;
-
+	if (extraClean != 0)
+	{
 #ifdef WIN32
-	Sleep(500);
+		Sleep(500);
 #else
-	sleep(1);
+		sleep(1);
 #endif
 
-	for (i = 0; i < ILibSTUN_MaxSlots; i++)
+		for (i = 0; i < obj->dTlsSessionsSize; i++)
+		{
+			// Clean up OpenSSL dTLS session
+			if (obj->dTlsSessions[i] != NULL)
+			{
+				free(obj->dTlsSessions[i]);
+				obj->dTlsSessions[i] = NULL;
+			}
+		}
+	}
+
+	// Free the slot tables
+	if (obj->IceStates != NULL) { free(obj->IceStates); obj->IceStates = NULL; }
+	if (obj->IceStatesFree != NULL) { free(obj->IceStatesFree); obj->IceStatesFree = NULL; }
+	if (obj->dTlsSessions != NULL) { free(obj->dTlsSessions); obj->dTlsSessions = NULL; }
+	if (obj->dTlsSessionsFree != NULL) { free(obj->dTlsSessionsFree); obj->dTlsSessionsFree = NULL; }
+	obj->IceStatesSize = obj->IceStatesFreeCount = 0;
+	obj->dTlsSessionsSize = obj->dTlsSessionsFreeCount = 0;
+
+	if (obj->SessionIndex != NULL) { ILibHashtable_Destroy(obj->SessionIndex); obj->SessionIndex = NULL; }
+	if (obj->CandidateIndex != NULL) { ILibHashtable_Destroy(obj->CandidateIndex); obj->CandidateIndex = NULL; }
+}
+
+//
+// Demux Indexes
+//
+// A datagram that isn't STUN is matched to its DTLS session by remote address, or failing that, to the IceState
+// that listed the remote address as a host candidate. (STUN requests don't need an index, the IceState slot is
+// encoded in the username.) Both lookups are hashtable hits, kept in step as IceStates are put into and taken out of
+// their slots, and as sessions are created, switch candidates, and are torn down.
+//
+
+// FNV-1a over the whole address key, the default hash only samples 4 bytes of it
+int ILibStun_Demux_Hash(void* Key1, char* Key2, int Key2Len)
+{
+	unsigned int h = 2166136261U;
+	int i;
+
+	UNREFERENCED_PARAMETER(Key1);
+	for (i = 0; i < Key2Len; ++i) { h = (h ^ (unsigned char)Key2[i]) * 16777619U; }
+	return (int)(h & 0x7FFFFFFF);
+}
+
+int ILibStun_Demux_Bucketizer(int value)
+{
+	return (value & (ILibStun_DemuxBuckets - 1));
+}
+
+ILibHashtable ILibStun_Demux_CreateIndex()
+{
+	ILibHashtable table = ILibHashtable_Create();
+	ILibHashtable_ChangeHashFunc(table, &ILibStun_Demux_Hash);
+	ILibHashtable_ChangeBucketizer(table, ILibStun_DemuxBuckets, &ILibStun_Demux_Bucketizer);
+	return table;
+}
+
+// Adds the session under its remote address, or (remove != 0) drops the entry if it still refers to this session
+void ILibStun_Demux_IndexSession(struct ILibStun_Module *obj, struct ILibStun_dTlsSession *session, int remove)
+{
+	char key[18];
+	int keyLength;
+
+	if (obj->SessionIndex == NULL || session == NULL || session->remoteInterface.sin6_family == 0) { return; }
+	keyLength = ILibStun_AddressKey(&(session->remoteInterface), key);
+
+	if (remove == 0)
 	{
-		// Clean up OpenSSL dTLS session
-		if (obj->dTlsSessions[i] != NULL)
+		ILibHashtable_Put(obj->SessionIndex, NULL, key, keyLength, session);
+	}
+	else if (ILibHashtable_Get(obj->SessionIndex, NULL, key, keyLength) == session)
+	{
+		ILibHashtable_Remove(obj->SessionIndex, NULL, key, keyLength);
+	}
+}
+
+// Adds the IceState under each of its host candidates, or (remove != 0) drops the entries that still refer to it.
+// If two offers list the same candidate, the most recent one wins
+void ILibStun_Demux_IndexCandidates(struct ILibStun_Module *obj, struct ILibStun_IceState *ice, int remove)
+{
+	char key[6];
+	int i;
+
+	if (obj->CandidateIndex == NULL || ice == NULL || ice->hostcandidates == NULL) { return; }
+	for (i = 0; i < ice->hostcandidatecount; ++i)
+	{
+		memcpy(key, &(ice->hostcandidates[i].addr), 4);
+		memcpy(key + 4, &(ice->hostcandidates[i].port), 2);
+		if (remove == 0)
+		{
+			ILibHashtable_Put(obj->CandidateIndex, NULL, key, 6, ice);
+		}
+		else if (ILibHashtable_Get(obj->CandidateIndex, NULL, key, 6) == ice)
 		{
-			free(obj->dTlsSessions[i]);
-			obj->dTlsSessions[i] = NULL;
+			ILibHashtable_Remove(obj->CandidateIndex, NULL, key, 6);
 		}
 	}
 }
 
+// Returns the DTLS session established with remoteInterface, or -1
+int ILibStun_Demux_FindSession(struct ILibStun_Module *obj, struct sockaddr_in6 *remoteInterface)
+{
+	char key[18];
+	int keyLength = ILibStun_AddressKey(remoteInterface, key);
+	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)ILibHashtable_Get(obj->SessionIndex, NULL, key, keyLength);
+
+	// Only count it if the session is still in its slot, and its IceState still refers to it
+	if (session == NULL || session->sessionId >= obj->dTlsSessionsSize || obj->dTlsSessions[session->sessionId] != session) { return -1; }
+	if (session->iceStateSlot < 0 || session->iceStateSlot >= obj->IceStatesSize || obj->IceStates[session->iceStateSlot] == NULL || obj->IceStates[session->iceStateSlot]->dtlsSession != session->sessionId) { return -1; }
+	return session->sessionId;
+}
+
+// Returns the IceState slot that listed remoteInterface as a host candidate, and the candidate's index in candidate, or -1
+int ILibStun_Demux_FindCandidate(struct ILibStun_Module *obj, struct sockaddr_in6 *remoteInterface, int *candidate)
+{
+	char key[18];
+	int i;
+	struct ILibStun_IceState *ice;
+
+	if (remoteInterface->sin6_family != AF_INET) { return -1; } // Host candidates are IPv4 only
+	ILibStun_AddressKey(remoteInterface, key);
+	if ((ice = (struct ILibStun_IceState*)ILibHashtable_Get(obj->CandidateIndex, NULL, key, 6)) == NULL) { return -1; }
+
+	for (i = 0; i < ice->hostcandidatecount; ++i)
+	{
+		if (ice->hostcandidates[i].port == remoteInterface->sin6_port && ice->hostcandidates[i].addr == ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr)
+		{
+			*candidate = i;
+			return ice->slot;
+		}
+	}
+	return -1;
+}
+
+// Takes ice off the list the connectivity check pacing timer walks
+void ILibStun_ICE_UnlistChecks(struct ILibStun_Module *obj, struct ILibStun_IceState *ice)
+{
+	if (ice->checksListed == 0) { return; }
+	if (ice->checksPrev != NULL) { ice->checksPrev->checksNext = ice->checksNext; } else { obj->IceChecks = ice->checksNext; }
+	if (ice->checksNext != NULL) { ice->checksNext->checksPrev = ice->checksPrev; }
+	ice->checksNext = ice->checksPrev = NULL;
+	ice->checksListed = 0;
+}
+
+// Puts ice (which may be NULL) into an IceState slot, keeping the candidate index in step. Returns what was in the slot
+struct ILibStun_IceState* ILibStun_SetIceStateSlot(struct ILibStun_Module *obj, int slot, struct ILibStun_IceState *ice)
+{
+	struct ILibStun_IceState *old = obj->IceStates[slot];
+
+	ILibStun_Demux_IndexCandidates(obj, old, 1);
+	if (old != NULL) { ILibStun_ICE_UnlistChecks(obj, old); }
+	obj->IceStates[slot] = ice;
+	if (ice != NULL)
+	{
+		ice->slot = slot;
+		ILibStun_Demux_IndexCandidates(obj, ice, 0);
+	}
+	return old;
+}
+
+// Doubles a slot table (up to ceiling), and pushes the new slots onto its free stack. Returns the number of slots added
+int ILibStun_GrowSlotTable(void ***table, int *tableSize, int **freeStack, int *freeCount, int ceiling)
+{
+	int i, newSize = *tableSize == 0 ? ILibSTUN_InitialSlots : *tableSize * 2;
+
+	if (newSize > ceiling) { newSize = ceiling; }
+	if (newSize <= *tableSize) { return 0; }
+
+	if ((*table = (void**)realloc(*table, newSize * sizeof(void*))) == NULL) { ILIBCRITICALEXIT(254); }
+	if ((*freeStack = (int*)realloc(*freeStack, newSize * sizeof(int))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(*table + *tableSize, 0, (newSize - *tableSize) * sizeof(void*));
+
+	// Push in reverse, so the lowest slots are handed out first
+	for (i = newSize - 1; i >= *tableSize; --i) { (*freeStack)[(*freeCount)++] = i; }
+
+	i = newSize - *tableSize;
+	*tableSize = newSize;
+	return i;
+}
+
+#define ILibStun_IsSessionSlotFree(obj, slot) ((obj)->dTlsSessions[slot] == NULL || (obj)->dTlsSessions[slot]->state == 0)
+#define ILibStun_IsIceStateSlotFree(obj, slot) ((obj)->IceStates[slot] == NULL || ((obj)->IceStates[slot]->dtlsSession < 0 && ((ILibGetUptime() - (obj)->IceStates[slot]->creationTime) > (ILibSTUN_MaxOfferAgeSeconds * 1000))))
+
 int ILibStun_GetFreeSessionSlot(void *StunModule)
 {
-	int i, j = -1;
+	int i, found;
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)StunModule;
 
-	// Find a free dTLS session slot
-	for (i = 0; i < ILibSTUN_MaxSlots; i++) { if (obj->dTlsSessions[i] == NULL || obj->dTlsSessions[i]->state == 0) { j = i; break; } }
-	return j;
+	while (1)
+	{
+		// Pop free dTLS session slots, a slot may have been taken since it was pushed
+		while (obj->dTlsSessionsFreeCount > 0)
+		{
+			i = obj->dTlsSessionsFree[--obj->dTlsSessionsFreeCount];
+			if (ILibStun_IsSessionSlotFree(obj, i)) { return i; }
+		}
+
+		// Stack ran dry, so sweep the table for sessions that have since closed. Grow the table too, if that doesn't free up a quarter of it
+		found = 0;
+		for (i = obj->dTlsSessionsSize - 1; i >= 0; --i)
+		{
+			if (ILibStun_IsSessionSlotFree(obj, i)) { obj->dTlsSessionsFree[obj->dTlsSessionsFreeCount++] = i; ++found; }
+		}
+		if (found * 4 < obj->dTlsSessionsSize || obj->dTlsSessionsSize == 0)
+		{
+			found += ILibStun_GrowSlotTable((void***)&(obj->dTlsSessions), &(obj->dTlsSessionsSize), &(obj->dTlsSessionsFree), &(obj->dTlsSessionsFreeCount), ILibSTUN_MaxDtlsSlots);
+		}
+		if (found == 0) { return -1; } // No free slots
+	}
+}
+
+// Returns a slot that the caller may put an IceState into, or -1 if the table is full
+int ILibStun_GetFreeIceStateSlotEx(struct ILibStun_Module *stunModule)
+{
+	int i, found;
+
+	while (1)
+	{
+		while (stunModule->IceStatesFreeCount > 0)
+		{
+			i = stunModule->IceStatesFree[--stunModule->IceStatesFreeCount];
+			if (ILibStun_IsIceStateSlotFree(stunModule, i)) { return i; }
+			ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Slot Busy[%d]: Dtls: %d, Age: %d", i, stunModule->IceStates[i]->dtlsSession, ILibGetUptime() - stunModule->IceStates[i]->creationTime);
+		}
+
+		// Stack ran dry, so sweep the table for empty slots and offers that have expired without a DTLS session
+		found = 0;
+		for (i = stunModule->IceStatesSize - 1; i >= 0; --i)
+		{
+			if (ILibStun_IsIceStateSlotFree(stunModule, i)) { stunModule->IceStatesFree[stunModule->IceStatesFreeCount++] = i; ++found; }
+		}
+		if (found * 4 < stunModule->IceStatesSize || stunModule->IceStatesSize == 0)
+		{
+			found += ILibStun_GrowSlotTable((void***)&(stunModule->IceStates), &(stunModule->IceStatesSize), &(stunModule->IceStatesFree), &(stunModule->IceStatesFreeCount), ILibSTUN_MaxSlots);
+			ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: Table Size = %d", stunModule->IceStatesSize);
+		}
+		if (found == 0) { return -1; }
+	}
 }
 
 // Returns slot number that was used... -1 on Error
@@ -1075,11 +1889,11 @@ int ILibStun_GetFreeIceStateSlot(struct ILibStun_Module *stunModule, struct ILib
 	if (newIceState->userAndKey[0] != 0)
 	{
 		// If this is nonzero, it's because we generated the original offer. Thus, the slotnumber is encoded in the username
-		slot = ILibStun_CharToSlot(newIceState->userAndKey[1]);
-		if (slot < ILibSTUN_MaxSlots)
+		slot = ILibStun_UsernameToSlot(newIceState->userAndKey + 1);
+		if (slot >= 0 && slot < stunModule->IceStatesSize)
 		{
 			if (oldIceState != NULL) { *oldIceState = stunModule->IceStates[slot]; }
-			stunModule->IceStates[slot] = newIceState;
+			ILibStun_SetIceStateSlot(stunModule, slot, newIceState);
 			ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: Encoded Slot = %d", slot);
 			return slot;
 		}
@@ -1088,7 +1902,7 @@ int ILibStun_GetFreeIceStateSlot(struct ILibStun_Module *stunModule, struct ILib
 	if (checkUpdateFirst != 0)
 	{
 		// Check to see if this iceState is an update to an existing one... Keying by remote username/password
-		for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+		for (i = 0; i < stunModule->IceStatesSize; ++i)
 		{
 			if (stunModule->IceStates[i] != NULL)
 			{
@@ -1099,7 +1913,7 @@ int ILibStun_GetFreeIceStateSlot(struct ILibStun_Module *stunModule, struct ILib
 					if (stunModule->IceStates[i]->dtlsSession < 0)
 					{
 						if (oldIceState != NULL) { *oldIceState = stunModule->IceStates[i]; }
-						stunModule->IceStates[i] = newIceState;
+						ILibStun_SetIceStateSlot(stunModule, i, newIceState);
 						ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: Update Slot = %d", i);
 						return i;
 					}
@@ -1113,25 +1927,22 @@ int ILibStun_GetFreeIceStateSlot(struct ILibStun_Module *stunModule, struct ILib
 		}
 	}
 
-	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+	if ((slot = ILibStun_GetFreeIceStateSlotEx(stunModule)) >= 0)
 	{
-		slot = (stunModule->IceStatesNextSlot + i) % ILibSTUN_MaxSlots;
-		ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: NextSlot: %d, i: %d, Slot: %d ", stunModule->IceStatesNextSlot, i, slot);
-		if (stunModule->IceStates[slot] == NULL || (stunModule->IceStates[slot] != NULL && stunModule->IceStates[slot]->dtlsSession < 0 && ((ILibGetUptime() - stunModule->IceStates[slot]->creationTime) > (ILibSTUN_MaxOfferAgeSeconds * 1000))))
-		{
-			// This slot is either empty, or contains an offer with no DTLS session, and is older than what is allowed
-			if (oldIceState != NULL) { *oldIceState = stunModule->IceStates[slot]; }
-			stunModule->IceStates[slot] = newIceState;
-			stunModule->IceStatesNextSlot = slot + 1;
-			ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: Free Slot = %d", slot);
-			return slot;
-		}
-		else
-		{
-			ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Slot Busy[%d]: Dtls: %d, Age: %d", slot, stunModule->IceStates[slot]->dtlsSession, ILibGetUptime() - stunModule->IceStates[slot]->creationTime);
-		}
+		// This slot is either empty, or contains an offer with no DTLS session, and is older than what is allowed
+		struct ILibStun_IceState *old = ILibStun_SetIceStateSlot(stunModule, slot, newIceState);
+		if (oldIceState != NULL) { *oldIceState = old; }
+		else if (old != NULL) { ILibStun_FreeIceState(old); }
+		ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: Free Slot = %d", slot);
 	}
-	return -1;
+	return slot;
+}
+
+void ILibStun_FreeIceState(struct ILibStun_IceState *ice)
+{
+	if (ice->offerblock != NULL) { free(ice->offerblock); }
+	if (ice->checklist != NULL) { free(ice->checklist); }
+	free(ice);
 }
 
 void ILibStun_ClearIceState(void *stunModule, int iceSlot)
@@ -1139,15 +1950,12 @@ void ILibStun_ClearIceState(void *stunModule, int iceSlot)
 	struct ILibStun_IceState* ice;
 	struct ILibStun_Module* module = (struct ILibStun_Module*)stunModule;
 
+	if (iceSlot < 0 || iceSlot >= module->IceStatesSize) { return; }
+
 	// Start by removing the IceState Object
-	ice = module->IceStates[iceSlot];
-	module->IceStates[iceSlot] = NULL;
+	ice = ILibStun_SetIceStateSlot(module, iceSlot, NULL);
 
-	if (ice != NULL)
-	{
-		if (ice->offerblock != NULL) { free(ice->offerblock); }
-		free(ice);
-	}
+	if (ice != NULL) { ILibStun_FreeIceState(ice); }
 }
 
 int ILibStun_GetNextPeriodicInterval(int minVal, int maxVal)
@@ -1174,12 +1982,20 @@ int ILibSCTP_GetUser4(void* module) { return ((struct ILibStun_dTlsSession*)modu
 
 int ILibSCTP_GetPendingBytesToSend(void* module)
 {
+	struct ILibStun_Module *obj;
 	int r;
 	sem_wait(&(((struct ILibStun_dTlsSession*)module)->Lock));
 	r = ((struct ILibStun_dTlsSession*)module)->holdingByteCount;
 	sem_post(&(((struct ILibStun_dTlsSession*)module)->Lock));
-	if (r < 0) return 0 - r;
-	return 0;
+	if (r < 0) r = 0;
+
+	// A relayed session also waits on whatever the TURN client has backed up. That backlog is shared, so each relayed session reports all of it
+	obj = ((struct ILibStun_dTlsSession*)module)->parent;
+	if (obj->IceStates[((struct ILibStun_dTlsSession*)module)->iceStateSlot] != NULL && obj->IceStates[((struct ILibStun_dTlsSession*)module)->iceStateSlot]->useTurn != 0)
+	{
+		r += (int)ILibTURN_GetPendingBytesToSend(obj->mTurnClientModule);
+	}
+	return r;
 }
 
 void ILibSCTP_SetCallbacks(void* StunModule, ILibSCTP_OnConnect onconnect, ILibSCTP_OnData ondata, ILibSCTP_OnSendOK onsendok)
@@ -1208,47 +2024,131 @@ void ILibWebRTC_SetCallbacks(void *StunModule, ILibWebRTC_OnDataChannel OnDataCh
 // user must be 8 byte buffer, secret must be 32 byte buffer, key must be 32 byte buffer
 void ILibStun_ComputeIntegrityKey(char* user, char* secret, char* key)
 {
-	char buf[40];
+	char buf[ILibStun_UsernameLength + 32];
 	char result[32];
-	memcpy(buf, user, 8);
-	memcpy(buf + 8, secret, 32);
-	util_sha256(buf, 40, result);
+	memcpy(buf, user, ILibStun_UsernameLength);
+	memcpy(buf + ILibStun_UsernameLength, secret, 32);
+	util_sha256(buf, ILibStun_UsernameLength + 32, result);
 	util_tohex(result, 16, key);
 }
 
-// result must be 42 byte buffer. Result will contrain user length (8), 8 byte username, password length (32), 32 byte password
-void ILibStun_GenerateUserAndKey(int iceSlot, char* secret, char* result)
+const char ILibStun_SlotAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*! \fn int ILibStun_UsernameToSlot(char* username)
+\brief Decodes the IceState slot from an ICE username generated by this module
+\par
+The slot is stored in the first ILibStun_SlotChars characters, 6 bits per character, using the base64 alphabet which is a subset of the ICE ufrag characters
+\param username ICE username (At least ILibStun_SlotChars characters)
+\returns Slot number, or -1 if the username does not carry one
+*/
+int ILibStun_UsernameToSlot(char* username)
 {
-	char rand[4];
-	util_random(4, rand);
-	result[0] = 8;
-	util_tohex(rand, 4, result + 1);
-	// 1st byte of username will be encoded with IceState slot number
+	int i, v, slot = 0;
+	char c;
+
+	for (i = 0; i < ILibStun_SlotChars; ++i)
+	{
+		c = username[i];
+		if (c >= 'A' && c <= 'Z') { v = c - 'A'; }
+		else if (c >= 'a' && c <= 'z') { v = c - 'a' + 26; }
+		else if (c >= '0' && c <= '9') { v = c - '0' + 52; }
+		else if (c == '+') { v = 62; }
+		else if (c == '/') { v = 63; }
+		else { return -1; }
+		slot = (slot << 6) | v;
+	}
+	return slot < ILibSTUN_MaxSlots ? slot : -1;
+}
+
+// Tags a Transaction ID with what it is for, and the slot its response should be routed to
+void ILibStun_SetTransactionSlot(char* TransactionID, unsigned char kind, int slot)
+{
+	TransactionID[0] = (char)kind;
+	TransactionID[1] = (char)((slot >> 16) & 0xFF);
+	TransactionID[2] = (char)((slot >> 8) & 0xFF);
+	TransactionID[3] = (char)(slot & 0xFF);
+}
+
+// Returns the slot a Transaction ID was tagged with, or -1 if it was not tagged as kind
+int ILibStun_GetTransactionSlot(char* TransactionID, unsigned char kind)
+{
+	if ((unsigned char)TransactionID[0] != kind) { return -1; }
+	return (((unsigned char)TransactionID[1]) << 16) | (((unsigned char)TransactionID[2]) << 8) | ((unsigned char)TransactionID[3]);
+}
+
+// result must be ILibStun_UserAndKeyLength byte buffer. Result will contrain user length (ILibStun_UsernameLength), the username, password length (32), 32 byte password
+// shard is the SO_REUSEPORT shard index, or -1 when the module is not part of a shard group
+void ILibStun_GenerateUserAndKey(int iceSlot, int shard, char* secret, char* result)
+{
+	char rand[ILibStun_UsernameLength / 2];
+	int i;
+	util_random(ILibStun_UsernameLength / 2, rand);
+	result[0] = ILibStun_UsernameLength;
+	util_tohex(rand, ILibStun_UsernameLength / 2, result + 1);
+	// First ILibStun_SlotChars bytes of username will be encoded with IceState slot number
 	// So when we receive an ICE request, we'll know which offer the request is for, so if the peer
 	// elects a candidate we can mark it in the IceState object.
-	result[1] = (char)ILibStun_SlotToChar(iceSlot);
-	result[9] = 32;
-	ILibStun_ComputeIntegrityKey(result + 1, secret, result + 10);
+	for (i = 0; i < ILibStun_SlotChars; ++i) { result[ILibStun_SlotChars - i] = ILibStun_SlotAlphabet[(iceSlot >> (6 * i)) & 0x3F]; }
+	// Next byte carries the shard, so whichever shard the kernel hands the request to can pass it to the one holding the IceState
+	if (shard >= 0) { result[1 + ILibStun_SlotChars] = (char)ILibStun_SlotToChar(shard); }
+	result[1 + ILibStun_UsernameLength] = 32;
+	ILibStun_ComputeIntegrityKey(result + 1, secret, result + 2 + ILibStun_UsernameLength);
 }
 
-int ILibStun_AddMessageIntegrityAttr(char* rbuffer, int ptr, char* integritykey, int integritykeylen)
+// Runs the key through the ipad/opad blocks once, so every packet signed or checked with it only pays for its own SHA1 blocks
+void ILibStun_HmacSha1_Init(ILibStun_HmacSha1 *hmac, char* key, int keyLen)
 {
-	HMAC_CTX hmac;
-	unsigned int hmaclen = 20;
+	unsigned char k[SHA_CBLOCK];
+	unsigned char pad[SHA_CBLOCK];
+	int i;
+
+	// Keys longer than a block are hashed first (RFC 2104)
+	memset(k, 0, SHA_CBLOCK);
+	if (keyLen > SHA_CBLOCK) { SHA1((unsigned char*)key, keyLen, k); } else { memcpy(k, key, keyLen); }
+
+	for (i = 0; i < SHA_CBLOCK; ++i) { pad[i] = k[i] ^ 0x36; }
+	SHA1_Init(&(hmac->inner));
+	SHA1_Update(&(hmac->inner), pad, SHA_CBLOCK);
+
+	for (i = 0; i < SHA_CBLOCK; ++i) { pad[i] = k[i] ^ 0x5C; }
+	SHA1_Init(&(hmac->outer));
+	SHA1_Update(&(hmac->outer), pad, SHA_CBLOCK);
+}
+
+// result must be at least 20 in size. hmac is only read, so it can be shared across threads once initialized
+void ILibStun_HmacSha1_Compute(ILibStun_HmacSha1 *hmac, char* buffer, int length, char* result)
+{
+	SHA_CTX sha;
+	unsigned char digest[SHA_DIGEST_LENGTH];
+
+	memcpy(&sha, &(hmac->inner), sizeof(SHA_CTX));
+	SHA1_Update(&sha, buffer, length);
+	SHA1_Final(digest, &sha);
+
+	memcpy(&sha, &(hmac->outer), sizeof(SHA_CTX));
+	SHA1_Update(&sha, digest, SHA_DIGEST_LENGTH);
+	SHA1_Final((unsigned char*)result, &sha);
+}
 
+int ILibStun_AddMessageIntegrityAttrEx(char* rbuffer, int ptr, ILibStun_HmacSha1 *hmac)
+{
 	((unsigned short*)(rbuffer))[1] = htons((unsigned short)(ptr + 24 - 20));						// Set the length
 	((unsigned short*)(rbuffer + ptr))[0] = htons((unsigned short)STUN_ATTRIB_MESSAGE_INTEGRITY);	// Attribute header
 	((unsigned short*)(rbuffer + ptr))[1] = htons(20);												// Attribute length
 
-	// Setup and perform HMAC-SHA1
-	HMAC_CTX_init(&hmac);
-	HMAC_Init_ex(&hmac, integritykey, integritykeylen, EVP_sha1(), NULL);
-	HMAC_Update(&hmac, (unsigned char*)rbuffer, ptr);
-	HMAC_Final(&hmac, (unsigned char*)(rbuffer + ptr + 4), &hmaclen); // Put the HMAC in the outgoing result location
-	HMAC_CTX_cleanup(&hmac);
+	// Perform HMAC-SHA1, and put the HMAC in the outgoing result location
+	ILibStun_HmacSha1_Compute(hmac, rbuffer, ptr, rbuffer + ptr + 4);
 	return 24;
 }
 
+int ILibStun_AddMessageIntegrityAttr(char* rbuffer, int ptr, char* integritykey, int integritykeylen)
+{
+	ILibStun_HmacSha1 hmac;
+
+	ILibStun_HmacSha1_Init(&hmac, integritykey, integritykeylen);
+	return(ILibStun_AddMessageIntegrityAttrEx(rbuffer, ptr, &hmac));
+}
+
 int ILibStun_AddFingerprint(char* rbuffer, int ptr)
 {
 	((unsigned short*)rbuffer)[1] = htons((unsigned short)(ptr + 8 - 20));						// Set the length
@@ -1267,7 +2167,7 @@ int ILib_Stun_GetAttributeChangeRequestPacket(int flags, char* TransactionId, ch
 	((unsigned int*)rbuffer)[1] = htonl(0x2112A442);											// Set the magic string
 	util_random(12, TransactionId);																// Random used for transaction id
 
-	TransactionId[0] = 255;																		// Set the first byte to 255, so it doesn't collide with IceStateSlot
+	TransactionId[0] = (char)ILibStun_TransactionKind_Nat;										// Set the first byte, so it doesn't collide with ICE/Consent requests
 	memcpy(rbuffer + 8, TransactionId, 12);
 
 	((unsigned short*)(rbuffer + rptr))[0] = htons(STUN_ATTRIB_CHANGE_REQUEST);					// Attribute header
@@ -1289,8 +2189,9 @@ void ILib_Stun_SendAttributeChangeRequest(void* module, struct sockaddr* StunSer
 	((unsigned int*)rbuffer)[1] = htonl(0x2112A442);											// Set the magic string
 	util_random(12, StunModule->TransactionId);													// Random used for transaction id
 
-	StunModule->TransactionId[0] = 255;															// Set the first byte to 255, so it doesn't collide with IceStateSlot
+	StunModule->TransactionId[0] = (char)ILibStun_TransactionKind_Nat;							// Set the first byte, so it doesn't collide with ICE/Consent requests
 	NAT_MAPPING_DETECTION(StunModule->TransactionId) = ((flags & 0x8000)==0x8000)?255:0;		// Mapping Detection vs Public Interface Only Detection
+	if (StunModule->Shards != NULL) { StunModule->TransactionId[ILibStun_ShardTransactionByte] = (char)StunModule->ShardIndex; }
 	memcpy(rbuffer + 8, StunModule->TransactionId, 12);
 
 	((unsigned short*)(rbuffer + rptr))[0] = htons(STUN_ATTRIB_CHANGE_REQUEST);					// Attribute header
@@ -1313,6 +2214,7 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 
 	if (iceState->useTurn != 0) { turnRecordSize = 1 + sizeof(struct sockaddr_in6); }
 	if (iceState->dtlsInitiator == 0) { BlockFlags |= ILibWebRTC_SDP_Flags_DTLS_SERVER; }
+	if (iceState->parentStunModule->iceLite != 0) { BlockFlags |= ILibWebRTC_SDP_Flags_ICE_LITE; }
 
 	// Generate an return answer
 	LocalInterfaceListV4Len = ILibGetLocalIPv4AddressList(&LocalInterfaceListV4, 0);
@@ -1320,20 +2222,20 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 
 	if (iceState->parentStunModule->alwaysUseTurn != 0) { LocalInterfaceListV4Len = 0; }
 
-	rlen = (6 + 42 + 1 + 32 + 1 + (LocalInterfaceListV4Len * 6));
+	rlen = (6 + ILibStun_UserAndKeyLength + 1 + 32 + 1 + (LocalInterfaceListV4Len * 6));
 
 	if ((*answer = (char*)malloc(rlen + turnRecordSize)) == NULL) ILIBCRITICALEXIT(254);
 	((unsigned short*)(*answer))[0] = 1; // Block version number
 	((unsigned int*)(*answer + 2))[0] = htonl(BlockFlags); // Block flags
-	memcpy(*answer + 6, iceState->userAndKey, 42);
+	memcpy(*answer + 6, iceState->userAndKey, ILibStun_UserAndKeyLength);
 
-	(*answer)[48] = (char)(iceState->parentStunModule->CertThumbprintLength);
-	memcpy(*answer + 49, iceState->parentStunModule->CertThumbprint, iceState->parentStunModule->CertThumbprintLength); // Set DTLS fingerprint here 
-	(*answer)[49 + 32] = (char)LocalInterfaceListV4Len;
+	(*answer)[6 + ILibStun_UserAndKeyLength] = (char)(iceState->parentStunModule->CertThumbprintLength);
+	memcpy(*answer + 7 + ILibStun_UserAndKeyLength, iceState->parentStunModule->CertThumbprint, iceState->parentStunModule->CertThumbprintLength); // Set DTLS fingerprint here 
+	(*answer)[7 + ILibStun_UserAndKeyLength + 32] = (char)LocalInterfaceListV4Len;
 	for (i = 0; i < LocalInterfaceListV4Len; i++)
 	{
-		((int*)(*answer + 49 + 33 + (i * 6)))[0] = LocalInterfaceListV4[i].sin_addr.s_addr;
-		((short*)(*answer + 49 + 33 + (i * 6) + 4))[0] = ((struct sockaddr_in*)(&(iceState->parentStunModule->LocalIf)))->sin_port;
+		((int*)(*answer + 7 + ILibStun_UserAndKeyLength + 33 + (i * 6)))[0] = LocalInterfaceListV4[i].sin_addr.s_addr;
+		((short*)(*answer + 7 + ILibStun_UserAndKeyLength + 33 + (i * 6) + 4))[0] = ((struct sockaddr_in*)(&(iceState->parentStunModule->LocalIf)))->sin_port;
 	}
 	if (LocalInterfaceListV4 != NULL) free(LocalInterfaceListV4);
 	if (turnRecordSize > 0)
@@ -1344,57 +2246,149 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 	return (rlen + turnRecordSize);
 }
 
-void ILibStun_WebRTC_ConsentFreshness_Continue(void *object)
+//
+// Consent Freshness Scheduler
+//
+// Every established session is probed once its consent gets old, and disconnected if no probe is answered within
+// ILibStun_MaxConsentFreshnessTimeoutSeconds. Rather than a timer per session, the sessions sit in a timing wheel
+// of ILibStun_ConsentTickMilliseconds buckets that one module timer sweeps. All the probes that fall due on a tick are sent
+// from the same sweep, so the UDP layer flushes them together, and the random jitter spreads sessions that were
+// established together across different ticks.
+//
+void ILibStun_Consent_Tick(void *object);
+
+// Bucket a due time goes in. Rounded up, so everything in a bucket is due by the time the sweep reaches it
+#define ILibStun_Consent_Bucket(due) ((int)((((due) + ILibStun_ConsentTickMilliseconds - 1) / ILibStun_ConsentTickMilliseconds) % ILibStun_ConsentWheelSize))
+
+void ILibStun_Consent_Unschedule(struct ILibStun_Module *obj, struct ILibStun_dTlsSession *session)
+{
+	int bucket;
+
+	if (session->consentScheduled == 0) { return; }
+	bucket = ILibStun_Consent_Bucket(session->consentDue);
+	if (session->consentPrev != NULL) { session->consentPrev->consentNext = session->consentNext; } else { obj->ConsentWheel[bucket] = session->consentNext; }
+	if (session->consentNext != NULL) { session->consentNext->consentPrev = session->consentPrev; }
+	session->consentNext = session->consentPrev = NULL;
+	session->consentScheduled = 0;
+
+	if (--obj->ConsentScheduled == 0 && obj->ConsentTimerSet != 0)
+	{
+		ILibLifeTime_Remove(obj->Timer, obj + 2);
+		obj->ConsentTimerSet = 0;
+	}
+}
+
+// Queue the session to be looked at in delay milliseconds
+void ILibStun_Consent_Schedule(struct ILibStun_Module *obj, struct ILibStun_dTlsSession *session, int delay)
+{
+	int bucket;
+	long long now = ILibGetUptime();
+
+	ILibStun_Consent_Unschedule(obj, session);
+	if (delay < ILibStun_ConsentTickMilliseconds) { delay = ILibStun_ConsentTickMilliseconds; }
+
+	session->consentDue = now + delay;
+	bucket = ILibStun_Consent_Bucket(session->consentDue);
+	session->consentPrev = NULL;
+	session->consentNext = obj->ConsentWheel[bucket];
+	if (session->consentNext != NULL) { session->consentNext->consentPrev = session; }
+	obj->ConsentWheel[bucket] = session;
+	session->consentScheduled = 1;
+
+	if (obj->ConsentScheduled++ == 0) { obj->ConsentTick = now / ILibStun_ConsentTickMilliseconds; }
+	if (obj->ConsentTimerSet == 0)
+	{
+		ILibLifeTime_AddEx(obj->Timer, obj + 2, ILibStun_ConsentTickMilliseconds, ILibStun_Consent_Tick, NULL);
+		obj->ConsentTimerSet = 1;
+	}
+}
+
+// Wait until consent needs to be refreshed again, shortened by up to ILibStun_ConsentJitterPercent
+void ILibStun_Consent_ScheduleRefresh(struct ILibStun_Module *obj, struct ILibStun_dTlsSession *session)
+{
+	unsigned short r;
+	int interval = ILibStun_MaxConsentFreshnessTimeoutSeconds * 1000;
+
+	util_random(sizeof(r), (char*)&r);
+	session->freshnessTimestampStart = 0;
+	ILibStun_Consent_Schedule(obj, session, interval - (int)((long long)interval * ILibStun_ConsentJitterPercent * r / (100 * 65535)));
+}
+
+// Sends a probe on the session's candidate pair, or disconnects the session if it has gone unanswered too long. Called by the scheduler
+void ILibStun_Consent_Probe(struct ILibStun_Module *obj, struct ILibStun_dTlsSession *session)
 {
-	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)object - 1;
 	struct timeval tv;
 	char TransactionID[12];
-	int SessionSlot;
 
-	gettimeofday(&tv, NULL);
+	if (obj->IceStates[session->iceStateSlot] == NULL) { return; }
 
-	// If this was triggered, it means we haven't received a STUN/Response yet
-	// Based on http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
-	if (tv.tv_sec - session->freshnessTimestampStart >= ILibStun_MaxConsentFreshnessTimeoutSeconds)
+	gettimeofday(&tv, NULL);
+	if (session->freshnessTimestampStart == 0)
 	{
-		// We need to disconnect DTLS
-		ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Consent Freshness Timeout, Closing Session: %d", session->sessionId);
-		ILibStun_SctpDisconnect(session->parent, session->sessionId);
+		// Start a new round of probes
+		session->freshnessTimestampStart = tv.tv_sec;
 	}
-	else
+	else if (tv.tv_sec - session->freshnessTimestampStart >= ILibStun_MaxConsentFreshnessTimeoutSeconds)
 	{
-		// Keep sending a Probe and wait 500ms for a response, using the same TransactionID
-		SessionSlot = session->sessionId;
-		memset(TransactionID, 0, 12);
-		TransactionID[0] = (char)(SessionSlot ^ 0x80);
-		memcpy(TransactionID + 1, &(session->freshnessTimestampStart), sizeof(long) < 11 ? sizeof(long) : 11);
+		// If we get here, we haven't received a STUN/Response yet
+		// Based on http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Consent Freshness Timeout, Closing Session: %d", session->sessionId);
+		ILibStun_SctpDisconnect(obj, session->sessionId);
+		return;
+	}
+
+	// Keep sending a Probe every tick until we get a response, using the same TransactionID
+	memset(TransactionID, 0, 12);
+	ILibStun_SetTransactionSlot(TransactionID, ILibStun_TransactionKind_Consent, session->sessionId);
+	memcpy(TransactionID + 4, &(session->freshnessTimestampStart), sizeof(long) < 6 ? sizeof(long) : 6);
 
-		ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
+	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
 
-		ILibLifeTime_AddEx(session->parent->Timer, session + 1, 500, ILibStun_WebRTC_ConsentFreshness_Continue, NULL);
-		ILibStun_SendIceRequestEx(session->parent->IceStates[session->iceStateSlot], TransactionID, 0, &(session->remoteInterface));
-	}
+	ILibStun_Consent_Schedule(obj, session, ILibStun_ConsentTickMilliseconds);
+	ILibStun_SendIceRequestEx(obj->IceStates[session->iceStateSlot], TransactionID, 0, &(session->remoteInterface));
 }
-void ILibStun_WebRTC_ConsentFreshness_Start(void *object)
+
+void ILibStun_Consent_Tick(void *object)
 {
-	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)object - 1;
-	struct timeval tv;
-	char TransactionID[12];
-	int SessionSlot = session->sessionId;
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)object - 2;
+	struct ILibStun_dTlsSession *session, *next, *due = NULL;
+	long long now = ILibGetUptime();
+	long long tick = now / ILibStun_ConsentTickMilliseconds;
+	int bucket;
 
-	if (session->parent->IceStates[session->iceStateSlot] == NULL) { return; }
+	obj->ConsentTimerSet = 0;
 
-	memset(TransactionID, 0, 12);
-	gettimeofday(&tv, NULL);
-	session->freshnessTimestampStart = tv.tv_sec;
+	// Catch up on every tick since the last sweep (The chain may have been busy), but never more than once around the wheel
+	if (tick - obj->ConsentTick > ILibStun_ConsentWheelSize) { obj->ConsentTick = tick - ILibStun_ConsentWheelSize; }
 
-	TransactionID[0] = ((unsigned char)SessionSlot ^ 0x80);
-	memcpy(TransactionID + 1, &(session->freshnessTimestampStart), sizeof(long) < 11 ? sizeof(long) : 11);
+	// Pull everything that is due out of the wheel first, because probing reschedules (and disconnecting unschedules) sessions
+	while (obj->ConsentTick < tick)
+	{
+		bucket = (int)(++obj->ConsentTick % ILibStun_ConsentWheelSize);
+		for (session = obj->ConsentWheel[bucket]; session != NULL; session = next)
+		{
+			next = session->consentNext;
+			if (session->consentDue <= now)
+			{
+				ILibStun_Consent_Unschedule(obj, session);
+				session->consentNext = due;
+				due = session;
+			}
+		}
+	}
 
-	ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
+	for (session = due; session != NULL; session = next)
+	{
+		next = session->consentNext;
+		session->consentNext = NULL;
+		ILibStun_Consent_Probe(obj, session);
+	}
 
-	ILibLifeTime_AddEx(session->parent->Timer, session + 1, 500, ILibStun_WebRTC_ConsentFreshness_Continue, NULL);	// Wait 500ms for a response
-	ILibStun_SendIceRequestEx(session->parent->IceStates[session->iceStateSlot], TransactionID, 0, &(session->remoteInterface));
+	if (obj->ConsentScheduled > 0 && obj->ConsentTimerSet == 0)
+	{
+		ILibLifeTime_AddEx(obj->Timer, obj + 2, ILibStun_ConsentTickMilliseconds, ILibStun_Consent_Tick, NULL);
+		obj->ConsentTimerSet = 1;
+	}
 }
 
 enum ILibAsyncSocket_SendStatus ILibStun_SendPacketEx(struct ILibStun_Module *stunModule, int useTurn, char* buffer, int offset, int length, struct sockaddr_in6* remoteInterface, enum ILibAsyncSocket_MemoryOwnership memoryOwnership)
@@ -1455,6 +2449,94 @@ void ILibWebRTC_CloseDataChannel_Timeout(void *obj)
 	}
 }
 
+// Success response to a binding request: XOR-MAPPED-ADDRESS, MESSAGE-INTEGRITY, FINGERPRINT. The length is set to cover up to MESSAGE-INTEGRITY,
+// which is what gets signed. Transaction ID, mapped address, HMAC, CRC and the final length are patched in per request.
+static const unsigned char ILibStun_BindingResponseTemplate[ILibStun_BindingResponseLength] =
+{
+	0x01, 0x01, 0x00, 0x24, 0x21, 0x12, 0xA4, 0x42,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,						// Transaction ID
+	0x00, 0x20, 0x00, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,						// XOR-MAPPED-ADDRESS (IPv4)
+	0x00, 0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,			// MESSAGE-INTEGRITY
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x80, 0x28, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00												// FINGERPRINT
+};
+
+//
+// Answers consent and keepalive binding requests on an established DTLS session without going through ILibStun_ProcessStunPacket.
+// The request has to come from the session's remote address, end in MESSAGE-INTEGRITY + FINGERPRINT, carry our username, and agree with
+// our ICE role. Anything else (including failed checks) returns 0, and is left to the full parser, so it is logged and handled as before.
+// Nothing is logged here, ILibRemoteLogging_printf formats its message even when no one is listening.
+//
+int ILibStun_ProcessBindingRequestFast(struct ILibStun_Module *obj, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface)
+{
+	struct ILibStun_dTlsSession *session;
+	struct ILibStun_IceState *ice;
+	char rbuffer[ILibStun_BindingResponseLength];
+	char hmacresult[20];
+	int integrityPtr = bufferLength - 32;
+	int ptr = 20;
+	int sessionId;
+	int usernameMatch = 0, isControlled = 0, isControlling = 0;
+	unsigned short attrType, attrLength;
+
+	if (integrityPtr < 20 || ntohs(((unsigned short*)(buffer + integrityPtr))[0]) != STUN_ATTRIB_MESSAGE_INTEGRITY || ntohs(((unsigned short*)(buffer + integrityPtr))[1]) != 20 ||
+		ntohs(((unsigned short*)(buffer + bufferLength - 8))[0]) != STUN_ATTRIB_FINGERPRINT || ntohs(((unsigned short*)(buffer + bufferLength - 8))[1]) != 4) { return 0; }
+
+	if ((sessionId = ILibStun_Demux_FindSession(obj, remoteInterface)) < 0) { return 0; }
+	session = obj->dTlsSessions[sessionId];
+	ice = obj->IceStates[session->iceStateSlot];
+	if (session->state != 1 || ice->rkey == NULL || ice->localIntegritySet == 0) { return 0; }
+
+	// Only the attribute headers are looked at. USE-CANDIDATE is ignored, the pair is already nominated.
+	while (ptr < integrityPtr)
+	{
+		if (ptr + 4 > integrityPtr) { return 0; }
+		attrType = ntohs(((unsigned short*)(buffer + ptr))[0]);
+		attrLength = ntohs(((unsigned short*)(buffer + ptr))[1]);
+		if (ptr + 4 + attrLength > integrityPtr) { return 0; }
+
+		switch (attrType)
+		{
+			case STUN_ATTRIB_USERNAME:
+				usernameMatch = attrLength > ILibStun_UsernameLength && buffer[ptr + 4 + ILibStun_UsernameLength] == ':' && memcmp(ice->userAndKey + 1, buffer + ptr + 4, ILibStun_UsernameLength) == 0;
+				break;
+			case STUN_ATTRIB_ICE_CONTROLLED:
+				isControlled = 1;
+				break;
+			case STUN_ATTRIB_ICE_CONTROLLING:
+				isControlling = 1;
+				break;
+			case STUN_ATTRIB_MESSAGE_INTEGRITY:
+			case STUN_ATTRIB_FINGERPRINT:
+				return 0;
+		}
+		ptr += (4 + FOURBYTEBOUNDARY(attrLength));
+	}
+	if (ptr != integrityPtr || usernameMatch == 0) { return 0; }
+
+	// Role conflicts are resolved by the full parser
+	if (obj->iceLite == 0 && !((ice->peerHasActiveOffer == 1 && isControlling != 0) || (ice->peerHasActiveOffer == 0 && isControlled != 0))) { return 0; }
+
+	// Check the fingerprint, then the integrity. The length has to cover only up to MESSAGE-INTEGRITY while signing.
+	if ((ILibStun_CRC32(buffer, bufferLength - 8) ^ 0x5354554e) != ntohl(((unsigned int*)(buffer + bufferLength - 4))[0])) { return 0; }
+	((unsigned short*)buffer)[1] = htons((unsigned short)(integrityPtr + 4));
+	ILibStun_HmacSha1_Compute(&(ice->localIntegrity), buffer, integrityPtr, hmacresult);
+	((unsigned short*)buffer)[1] = htons((unsigned short)(bufferLength - 20));
+	if (memcmp(hmacresult, buffer + integrityPtr + 4, 20) != 0) { return 0; }
+
+	// Build the response from the template
+	memcpy(rbuffer, ILibStun_BindingResponseTemplate, ILibStun_BindingResponseLength);
+	memcpy(rbuffer + 8, buffer + 8, 12);																			// Transaction ID
+	((unsigned short*)(rbuffer + 20))[3] = ((struct sockaddr_in*)remoteInterface)->sin_port ^ 0x1221;				// IPv4 port
+	((unsigned int*)(rbuffer + 20))[2] = ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr ^ 0x42A41221;		// IPv4 address
+	ILibStun_HmacSha1_Compute(&(ice->localIntegrity), rbuffer, 32, rbuffer + 36);
+	((unsigned short*)rbuffer)[1] = htons(ILibStun_BindingResponseLength - 20);
+	((unsigned int*)(rbuffer + 56))[1] = htonl(ILibStun_CRC32(rbuffer, 56) ^ 0x5354554e);
+
+	ILibStun_SendPacket(ice, rbuffer, 0, ILibStun_BindingResponseLength, remoteInterface, ILibAsyncSocket_MemoryOwnership_USER);
+	return 1;
+}
+
 int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface)
 {
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)j;
@@ -1467,10 +2549,13 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 	struct sockaddr_in mappedAddress;
 	struct sockaddr_in changedAddress;
 	char integritykey[33]; // Key is 32, but need 33 to put the terminating null char.
+	ILibStun_HmacSha1 localIntegrity;
 	int integritykeySet = 0;
 	int processed = 0;
 	int isControlled = 0;
 	int isControlling = 0;
+	int useCandidate = 0;
+	int TransactionSlot;
 	unsigned long long tiebreakValue = 0;
 
 	// Check the length of the packet & IPv4
@@ -1482,6 +2567,9 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 	// Check the length and magic string
 	if (messageLength != bufferLength || ntohl(((int*)buffer)[1]) != 0x2112A442) { ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_3, "Skipping: Not a STUN Packet (Magic String)"); return 0; }
 
+	// Consent/keepalive requests on an established session are answered without the full attribute walk
+	if (messageType == STUN_BINDING_REQUEST && ILibStun_ProcessBindingRequestFast(obj, buffer, bufferLength, remoteInterface) != 0) { return 1; }
+
 	memset(&mappedAddress, 0, sizeof(mappedAddress));
 	memset(&changedAddress, 0, sizeof(changedAddress));
 
@@ -1600,6 +2688,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 
 			case STUN_ATTRIB_USE_CANDIDATE:
 			{
+				useCandidate = 1;
 				break;
 			}
 			case STUN_ATTRIB_ICE_CONTROLLED:
@@ -1638,7 +2727,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			case STUN_ATTRIB_USERNAME:
 			{
 				// The username must be at least "xxxxxxxx:x", and our username is always 8 bytes long
-				if (attrLength < 9 || buffer[ptr + 4 + 8] != ':') {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...STUN_ATTRIB_USERNAME/ERROR"); return 0; }
+				if (attrLength <= ILibStun_UsernameLength || buffer[ptr + 4 + ILibStun_UsernameLength] != ':') {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...STUN_ATTRIB_USERNAME/ERROR"); return 0; }
 				username = buffer + ptr + 4;
 				break;
 			}
@@ -1654,38 +2743,48 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			}
 			case STUN_ATTRIB_MESSAGE_INTEGRITY:
 			{
-				HMAC_CTX hmac;
-				unsigned int hmaclen = 20;
-				unsigned char hmacresult[20];
-				char* key = NULL;
-				int keylen = 0;
+				char hmacresult[20];
+				ILibStun_HmacSha1 *integrity = NULL;
 
 				if (attrLength != 20) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...STUN_ATTRIB_MESSAGE_INTEGRITY/LENGTH-ERROR"); return 0; }
 
 				if (username != NULL)
 				{
-					// Compute the secret key
-					ILibStun_ComputeIntegrityKey(username, obj->Secret, integritykey);
-					key = integritykey;
-					keylen = 32;
+					// Our key for this username. The IceState the username was generated for keeps it precomputed
+					int slot = ILibStun_UsernameToSlot(username);
+					if (slot >= 0 && slot < obj->IceStatesSize && obj->IceStates[slot] != NULL && memcmp(obj->IceStates[slot]->userAndKey + 1, username, ILibStun_UsernameLength) == 0)
+					{
+						if (obj->IceStates[slot]->localIntegritySet == 0)
+						{
+							ILibStun_ComputeIntegrityKey(username, obj->Secret, integritykey);
+							ILibStun_HmacSha1_Init(&(obj->IceStates[slot]->localIntegrity), integritykey, 32);
+							obj->IceStates[slot]->localIntegritySet = 1;
+						}
+						memcpy(&localIntegrity, &(obj->IceStates[slot]->localIntegrity), sizeof(ILibStun_HmacSha1));
+					}
+					else
+					{
+						// Compute the secret key
+						ILibStun_ComputeIntegrityKey(username, obj->Secret, integritykey);
+						ILibStun_HmacSha1_Init(&localIntegrity, integritykey, 32);
+					}
+					integrity = &localIntegrity;
 					integritykeySet = 1;
 				}
 				else
 				{
 					// Grab the key from stored state
-					unsigned char slot = buffer[8];
+					int slot;
 
 					// Check to see if this is an IceSlot
-					if (slot < ILibSTUN_MaxSlots && obj->IceStates[slot] != NULL)
+					if ((slot = ILibStun_GetTransactionSlot(buffer + 8, ILibStun_TransactionKind_Ice)) >= 0 && slot < obj->IceStatesSize && obj->IceStates[slot] != NULL && obj->IceStates[slot]->rkey != NULL)
 					{
-						key = obj->IceStates[slot]->rkey;
-						keylen = obj->IceStates[slot]->rkeylen;
+						integrity = &(obj->IceStates[slot]->rkeyIntegrity);
 					}
 					// Check to see if it's a DTLS Session Slot
-					else if ((slot ^ 0x80) < ILibSTUN_MaxSlots && obj->dTlsSessions[slot ^ 0x80] != NULL)
+					else if ((slot = ILibStun_GetTransactionSlot(buffer + 8, ILibStun_TransactionKind_Consent)) >= 0 && slot < obj->dTlsSessionsSize && obj->dTlsSessions[slot] != NULL && obj->IceStates[obj->dTlsSessions[slot]->iceStateSlot] != NULL && obj->IceStates[obj->dTlsSessions[slot]->iceStateSlot]->rkey != NULL)
 					{
-						key = obj->dTlsSessions[slot ^ 0x80]->parent->IceStates[obj->dTlsSessions[slot ^ 0x80]->iceStateSlot]->rkey;
-						keylen = obj->dTlsSessions[slot ^ 0x80]->parent->IceStates[obj->dTlsSessions[slot ^ 0x80]->iceStateSlot]->rkeylen;
+						integrity = &(obj->IceStates[obj->dTlsSessions[slot]->iceStateSlot]->rkeyIntegrity);
 					}
 					else
 					{
@@ -1701,12 +2800,8 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					((unsigned short*)buffer)[1] = htons((unsigned short)(ptr + 4));
 				}
 
-				// Setup and perform HMAC-SHA1
-				HMAC_CTX_init(&hmac);
-				HMAC_Init_ex(&hmac, key, keylen, EVP_sha1(), NULL);
-				HMAC_Update(&hmac, (unsigned char*)buffer, ptr);
-				HMAC_Final(&hmac, hmacresult, &hmaclen); // Put the HMAC in the outgoing result location
-				HMAC_CTX_cleanup(&hmac);
+				// Perform HMAC-SHA1
+				ILibStun_HmacSha1_Compute(integrity, buffer, ptr, hmacresult);
 
 				// Put the length back, if fingerprint was present
 				if (ntohs(((unsigned short*)(buffer + ptr + (4 + FOURBYTEBOUNDARY(attrLength))))[0]) == STUN_ATTRIB_FINGERPRINT)
@@ -1715,7 +2810,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 				}
 
 				// Compare the HMAC result
-				if (hmaclen != 20 || memcmp(hmacresult, buffer + ptr + 4, 20) != 0) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...STUN_ATTRIB_MESSAGE_INTEGRITY/FAILED(2)"); return 0; }
+				if (memcmp(hmacresult, buffer + ptr + 4, 20) != 0) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...STUN_ATTRIB_MESSAGE_INTEGRITY/FAILED(2)"); return 0; }
 				break;
 			}
 		}
@@ -1740,13 +2835,14 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 
 		if (username != NULL)
 		{
-			EncodedSlot = ILibStun_CharToSlot(username[0]);
-			if (EncodedSlot < ILibSTUN_MaxSlots && obj->IceStates[EncodedSlot] != NULL)
+			EncodedSlot = ILibStun_UsernameToSlot(username);
+			if (EncodedSlot >= 0 && EncodedSlot < obj->IceStatesSize && obj->IceStates[EncodedSlot] != NULL)
 			{
 				//
 				// This will be true, if we are CONTROLLED
 				//
 				int i = 0;
+				int candidateMatch = 0;
 				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_3, "...EncodedSlot: %d", EncodedSlot);
 				if (remoteInterface->sin6_family == AF_INET) // We currently only support IPv4 candidates
 				{
@@ -1786,11 +2882,19 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 										ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Ice Slot: %d  Candidate Match [%s:%u]", EncodedSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
 									}
 									obj->IceStates[EncodedSlot]->hostcandidateResponseFlag[i] = 1;
-
+									candidateMatch = 1;
 									break;
 								}
 							}
 						}
+						if (candidateMatch == 0 && obj->iceLite != 0 && obj->IceStates[EncodedSlot]->rkey != NULL && ILibStun_AddIceCandidate(obj, username, remoteInterface) == 0)
+						{
+							// ICE-lite: An authenticated request from an address the peer didn't list is a peer reflexive candidate (RFC 8445 7.3.1.3).
+							// We answer it and can be nominated on it, so DTLS from that address has to be allowed too.
+							i = obj->IceStates[EncodedSlot]->hostcandidatecount - 1;
+							obj->IceStates[EncodedSlot]->hostcandidateResponseFlag[i] = 1;
+							candidateMatch = 1;
+						}
 					}
 				}
 
@@ -1804,7 +2908,8 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					return 1;
 				}
 
-				if ((obj->IceStates[EncodedSlot]->peerHasActiveOffer == 1 && isControlling != 0) || (obj->IceStates[EncodedSlot]->peerHasActiveOffer == 0 && isControlled != 0))
+				// ICE-lite is always CONTROLLED and doesn't resolve role conflicts, the full agent has to take the CONTROLLING role
+				if (obj->iceLite != 0 || (obj->IceStates[EncodedSlot]->peerHasActiveOffer == 1 && isControlling != 0) || (obj->IceStates[EncodedSlot]->peerHasActiveOffer == 0 && isControlled != 0))
 				{
 					// Build the reply packet
 					((unsigned short*)rbuffer)[0] = htons(0x0101);												// Response type, skip setting length for now
@@ -1816,7 +2921,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					((unsigned short*)(rbuffer + 20))[3] = ((struct sockaddr_in*)remoteInterface)->sin_port ^ 0x1221;					// IPv4 port
 					((unsigned int*)(rbuffer + 20))[2] = ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr ^ 0x42A41221;			// IPv4 address														
 
-					rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32);
+					rptr += ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, &localIntegrity);
 					rptr += ILibStun_AddFingerprint(rbuffer, rptr);												// Set the length in this function
 
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_3, "...Sending Response to %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
@@ -1833,7 +2938,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					rptr = ILibTURN_GenerateStunFormattedPacketHeader(rbuffer, STUN_BINDING_ERROR_RESPONSE, buffer + 8);
 					rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, address, addressLen);
 					rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_ERROR_CODE, errorCode, 17);
-					rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32);
+					rptr += ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, &localIntegrity);
 					rptr += ILibStun_AddFingerprint(rbuffer, rptr);												// Set the length in this function
 
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Responding with Role Conflict");
@@ -1855,14 +2960,25 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 				ILibStun_SendPacket(obj->IceStates[EncodedSlot], rbuffer, 0, rptr, remoteInterface, ILibAsyncSocket_MemoryOwnership_USER);
 				//ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)obj)->UDP, (struct sockaddr*)remoteInterface, rbuffer, rptr, ILibAsyncSocket_MemoryOwnership_USER);
 
-				// Send an ICE request back. This is needed to unlock Chrome/Opera inbound port for TLS. Don't do more than ILibSTUN_MaxSlots of these.
-				if (obj->IceStates[EncodedSlot]->hostcandidates != NULL && obj->IceStates[EncodedSlot]->hostcandidatecount > 0)
+				if (obj->iceLite != 0)
+				{
+					// ICE-lite: The CONTROLLING peer nominated this candidate. If we are DTLS client, this is our cue to connect.
+					if (useCandidate != 0 && candidateMatch != 0 && obj->IceStates[EncodedSlot]->dtlsInitiator != 0 && obj->IceStates[EncodedSlot]->dtlsSession < 0)
+					{
+						ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Nominated, Initiating DTLS to: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
+						ILibStun_InitiateDTLS(obj->IceStates[EncodedSlot], EncodedSlot, remoteInterface);
+					}
+				}
+				else if (candidateMatch != 0 && obj->IceStates[EncodedSlot]->isDoingConnectivityChecks != 0 && obj->IceStates[EncodedSlot]->checklist != NULL)
+				{
+					// We are running the checks, so the request back is a triggered check, and goes out with the other checks
+					ILibStun_ICE_TriggerCheck(obj->IceStates[EncodedSlot], i);
+				}
+				// Send an ICE request back. This is needed to unlock Chrome/Opera inbound port for TLS. Don't do more than ILibSTUN_MaxRequeryCount of these.
+				else if (obj->IceStates[EncodedSlot]->hostcandidates != NULL && obj->IceStates[EncodedSlot]->hostcandidatecount > 0)
 				{
-					if (obj->IceStates[EncodedSlot] != NULL && obj->IceStates[EncodedSlot]->requerycount < ILibSTUN_MaxSlots)
+					if (obj->IceStates[EncodedSlot] != NULL && obj->IceStates[EncodedSlot]->requerycount < ILibSTUN_MaxRequeryCount)
 					{
-						char TransactionID[12];
-						util_random(12, TransactionID);
-						TransactionID[0] = (char)EncodedSlot;
 						obj->IceStates[EncodedSlot]->requerycount++;
 						ILibStun_SendIceRequest(obj->IceStates[EncodedSlot], EncodedSlot, 0, (struct sockaddr_in6*)remoteInterface);
 					}
@@ -1873,34 +2989,35 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 		return 1;
 	}
 
-	if (IS_SUCCESS_RESP(messageType) && (unsigned char)buffer[8] <= ILibSTUN_MaxSlots)
+	if (IS_SUCCESS_RESP(messageType) && (TransactionSlot = ILibStun_GetTransactionSlot(buffer + 8, ILibStun_TransactionKind_Ice)) >= 0 && TransactionSlot < obj->IceStatesSize && obj->IceStates[TransactionSlot] != NULL)
 	{
 		int hx;
 		// This is a STUN response for a STUN packet we sent as a result of an Offer
 
-		if(obj->IceStates[(int)buffer[8]]->dtlsSession < 0 || (obj->IceStates[(int)buffer[8]]->dtlsSession >= 0 && obj->dTlsSessions[obj->IceStates[(int)buffer[8]]->dtlsSession]->state != 1))
+		if(obj->IceStates[TransactionSlot]->dtlsSession < 0 || (obj->IceStates[TransactionSlot]->dtlsSession >= 0 && obj->dTlsSessions[obj->IceStates[TransactionSlot]->dtlsSession]->state != 1))
 		{
-			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Received Response to ICE-REQUEST, IceSlot: %d from %s:%u", (int)buffer[8], ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Received Response to ICE-REQUEST, IceSlot: %d from %s:%u", TransactionSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
 		}
 
 		processed = 1;
-		if (obj->IceStates[(int)buffer[8]]->peerHasActiveOffer == 0 && obj->IceStates[(int)buffer[8]]->dtlsSession < 0)		// SlotNumer is encoded as first byte of TransactionID
+		if (obj->IceStates[TransactionSlot]->peerHasActiveOffer == 0 && obj->IceStates[TransactionSlot]->dtlsSession < 0)		// SlotNumer is encoded in the TransactionID
 		{
 			// We'll only enter this section if we are CONTROLLING, and there is no DTLS session established yet
-			for (hx = 0; hx < obj->IceStates[(int)buffer[8]]->hostcandidatecount; hx++)
+			for (hx = 0; hx < obj->IceStates[TransactionSlot]->hostcandidatecount; hx++)
 			{
 				struct sockaddr_in candidateInterface;
 				memset(&candidateInterface, 0, sizeof(struct sockaddr_in));
 				candidateInterface.sin_family = AF_INET;
-				candidateInterface.sin_addr.s_addr = obj->IceStates[(int)buffer[8]]->hostcandidates[hx].addr;
-				candidateInterface.sin_port = obj->IceStates[(int)buffer[8]]->hostcandidates[hx].port;
+				candidateInterface.sin_addr.s_addr = obj->IceStates[TransactionSlot]->hostcandidates[hx].addr;
+				candidateInterface.sin_port = obj->IceStates[TransactionSlot]->hostcandidates[hx].port;
 
 				// Enumerate the Candidates and make sure this STUN Response came from one of them
 				if (candidateInterface.sin_family == remoteInterface->sin6_family && memcmp(remoteInterface, &candidateInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family)) == 0)
 				{
 					// We have a matching ICE Candidate and STUN Response
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Candidate Match [%s:%u]", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
-					obj->IceStates[(int)buffer[8]]->hostcandidateResponseFlag[hx] = 1;
+					obj->IceStates[TransactionSlot]->hostcandidateResponseFlag[hx] = 1;
+					ILibStun_ICE_OnCheckSucceeded(obj->IceStates[TransactionSlot], TransactionSlot, hx);
 					break;
 				}
 			}
@@ -1942,17 +3059,16 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 		//	}
 		//}
 	}
-	if (IS_SUCCESS_RESP(messageType) && (((unsigned char)buffer[8] ^ 0x80) < ILibSTUN_MaxSlots))
+	if (IS_SUCCESS_RESP(messageType) && (TransactionSlot = ILibStun_GetTransactionSlot(buffer + 8, ILibStun_TransactionKind_Consent)) >= 0 && TransactionSlot < obj->dTlsSessionsSize && obj->dTlsSessions[TransactionSlot] != NULL)
 	{
 		// This is an encoded DTLS Session Slot #
-		int SessionSlot = (unsigned char)buffer[8] ^ 0x80;
+		int SessionSlot = TransactionSlot;
 
 		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Consent Freshness Updated on IceSlot: %d", SessionSlot);
 
 		processed = 1;
 		// We got a response, so we can reset the timer for Freshness
-		ILibLifeTime_Remove(obj->Timer, obj->dTlsSessions[SessionSlot] + 1);
-		ILibLifeTime_Add(obj->Timer, obj->dTlsSessions[SessionSlot] + 1, ILibStun_MaxConsentFreshnessTimeoutSeconds, ILibStun_WebRTC_ConsentFreshness_Start, NULL);
+		if (obj->dTlsSessions[SessionSlot]->consentScheduled != 0) { ILibStun_Consent_ScheduleRefresh(obj, obj->dTlsSessions[SessionSlot]); }
 	}
 
 	if (IS_SUCCESS_RESP(messageType) && memcmp(buffer + 8, obj->TransactionId, 12) == 0) // NAT Detection Response
@@ -2118,18 +3234,20 @@ int ILibStun_GenerateIceRequestPacket(struct ILibStun_IceState* module, char* Pa
 	int AddressLen;
 	int Ptr = 0;
 	
+	// The response may be handed to any shard, tag the transaction with ours so it can find its way back
+	if (module->parentStunModule->Shards != NULL) { TransactionID[ILibStun_ShardTransactionByte] = (char)module->parentStunModule->ShardIndex; }
 	AddressLen = ILibTURN_CreateXORMappedAddress(remote, Address, TransactionID);
 
-	if ((stunUsername = (char*)malloc(10 + module->rusernamelen)) == NULL){ ILIBCRITICALEXIT(254); }
+	if ((stunUsername = (char*)malloc(2 + ILibStun_UsernameLength + module->rusernamelen)) == NULL){ ILIBCRITICALEXIT(254); }
 	memcpy(stunUsername, module->rusername, module->rusernamelen);
 	memcpy(stunUsername + module->rusernamelen, ":", 1);
-	memcpy(stunUsername + module->rusernamelen + 1, module->userAndKey + 1, 8);
-	stunUsername[9 + module->rusernamelen] = 0;
+	memcpy(stunUsername + module->rusernamelen + 1, module->userAndKey + 1, ILibStun_UsernameLength);
+	stunUsername[1 + ILibStun_UsernameLength + module->rusernamelen] = 0;
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(module->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_2, "Generating ICE Request [%s] Credentials[%s]", ILibRemoteLogging_ConvertToHex(TransactionID, 12), stunUsername);
 
 	Ptr = ILibTURN_GenerateStunFormattedPacketHeader(Packet, STUN_BINDING_REQUEST, TransactionID);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_USERNAME, stunUsername, 9 + module->rusernamelen);
+	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_USERNAME, stunUsername, 1 + ILibStun_UsernameLength + module->rusernamelen);
 
 	if (useCandidate != 0)
 	{
@@ -2149,7 +3267,7 @@ int ILibStun_GenerateIceRequestPacket(struct ILibStun_IceState* module, char* Pa
 
 
 	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, Address, AddressLen);
-	Ptr += ILibStun_AddMessageIntegrityAttr(Packet, Ptr, module->rkey, module->rkeylen);
+	Ptr += ILibStun_AddMessageIntegrityAttrEx(Packet, Ptr, &(module->rkeyIntegrity));
 	Ptr += ILibStun_AddFingerprint(Packet, Ptr);
 	free(stunUsername);
 
@@ -2172,12 +3290,13 @@ void ILibStun_SendIceRequestEx(struct ILibStun_IceState *IceState, char* Transac
 void ILibStun_SendIceRequest(struct ILibStun_IceState *IceState, int SlotNumber, int useCandidate, struct sockaddr_in6* remoteInterface)
 {
 	char TransactionID[12];
-	TransactionID[0] = (char)SlotNumber;
-	util_random(11, TransactionID + 1);
+	util_random(12, TransactionID);
+	ILibStun_SetTransactionSlot(TransactionID, ILibStun_TransactionKind_Ice, SlotNumber);
 	ILibStun_SendIceRequestEx(IceState, TransactionID, useCandidate, remoteInterface);
 }
 
-void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selectedSlot, int useCandidate)
+// Queues ICE Requests for the candidates from firstCandidate on, spread over a 100-500ms window
+void ILibStun_DelaySendIceRequestEx(struct ILibStun_IceState* module, int selectedSlot, int useCandidate, int firstCandidate)
 {
 	char TransactionID[12];
 	char *Packet, *Data;
@@ -2187,7 +3306,7 @@ void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selected
 	struct sockaddr_in remote;
 	int delay;
 
-	for (i = 0; i < module->hostcandidatecount; ++i) // Queue an ICE Request for each candidate
+	for (i = firstCandidate; i < module->hostcandidatecount; ++i) // Queue an ICE Request for each candidate
 	{
 		for (ii = 0; ii < 2; ++ii) // Queue TWO requests for each candidate
 		{
@@ -2198,8 +3317,8 @@ void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selected
 			remote.sin_port = module->hostcandidates[i].port;
 			remote.sin_addr.s_addr = module->hostcandidates[i].addr;
 
-			TransactionID[0] = (char)selectedSlot;  // We're going to encode the IceState slot in the Transaction ID, so we can refer to it in the response
-			util_random(11, TransactionID + 1);
+			util_random(12, TransactionID);
+			ILibStun_SetTransactionSlot(TransactionID, ILibStun_TransactionKind_Ice, selectedSlot);  // We're going to encode the IceState slot in the Transaction ID, so we can refer to it in the response
 
 			if ((Packet = (char*)malloc(512)) == NULL){ ILIBCRITICALEXIT(254); }
 			Ptr = ILibStun_GenerateIceRequestPacket(module, Packet, TransactionID, useCandidate, (struct sockaddr_in6*)&remote);
@@ -2220,10 +3339,15 @@ void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selected
 	}
 }
 
+void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selectedSlot, int useCandidate)
+{
+	ILibStun_DelaySendIceRequestEx(module, selectedSlot, useCandidate, 0);
+}
+
 int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, char* password)
 {
 	int slot;
-	char userAndKey[43];
+	char userAndKey[ILibStun_UserAndKeyLength + 1];
 	struct ILibStun_IceState *ice;
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)StunModule;
 
@@ -2234,8 +3358,17 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	ice->parentStunModule = obj;
 	ice->creationTime = ILibGetUptime();
 	if ((ice->offerblock = (char*)malloc(8 * sizeof(struct sockaddr_in6))) == NULL){ ILIBCRITICALEXIT(254); }
-	ice->peerHasActiveOffer = 0;
-	ice->dtlsInitiator = 1;
+	if (obj->iceLite != 0)
+	{
+		// ICE-lite never runs the checks, so the peer has to be CONTROLLING. Offer to be DTLS server, so the peer connects to us
+		ice->peerHasActiveOffer = 1;
+		ice->dtlsInitiator = 0;
+	}
+	else
+	{
+		ice->peerHasActiveOffer = 0;
+		ice->dtlsInitiator = 1;
+	}
 	memset(ice->offerblock, 0, 8 * sizeof(struct sockaddr_in6));
 	slot = ILibStun_GetFreeIceStateSlot(obj, ice, NULL, 0);
 
@@ -2248,8 +3381,8 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	}
 
 	// Encoding the slot number into the user name, so we can do some processing when we receive ICE requests
-	ILibStun_GenerateUserAndKey(slot, obj->Secret, userAndKey);
-	memcpy(ice->userAndKey, userAndKey, 43);
+	ILibStun_GenerateUserAndKey(slot, obj->Shards != NULL ? obj->ShardIndex : -1, obj->Secret, userAndKey);
+	memcpy(ice->userAndKey, userAndKey, sizeof(userAndKey));
 	memcpy(userName, userAndKey + 1, userAndKey[0]);
 	memcpy(password, userAndKey + userAndKey[0] + 2, userAndKey[userAndKey[0] + 1]);
 	userName[(int)userAndKey[0]] = 0;
@@ -2258,50 +3391,342 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	return ILibStun_WebRTC_UpdateOfferResponse(ice, offer);
 }
 
+// Priority of a remote candidate (RFC 8445 5.1.2.1). The offer block doesn't carry the priority from the SDP, so the type preference is
+// inferred from the address (A private address can only be a host candidate), and the order of the candidates is the local preference
+unsigned int ILibStun_ICE_CandidatePriority(struct ILibStun_IceStateCandidate *candidate, int index)
+{
+	unsigned int addr = ntohl(candidate->addr);
+	unsigned int typePreference = 100;
+
+	if ((addr & 0xFF000000) == 0x0A000000 || (addr & 0xFFF00000) == 0xAC100000 || (addr & 0xFFFF0000) == 0xC0A80000 ||
+		(addr & 0xFFFF0000) == 0xA9FE0000 || (addr & 0xFF000000) == 0x7F000000)
+	{
+		typePreference = 126;
+	}
+	return((typePreference << 24) | ((unsigned int)(65535 - index) << 8) | 255U);
+}
+
+// Priority of a candidate pair (RFC 8445 6.1.2.3)
+unsigned long long ILibStun_ICE_PairPriority(unsigned int controlling, unsigned int controlled)
+{
+	unsigned long long g = controlling, d = controlled;
+	return(((g < d ? g : d) << 32) + 2 * (g > d ? g : d) + (g > d ? 1 : 0));
+}
+
+// Candidates sharing an address are treated as having the same foundation, as the peer's foundations aren't in the offer block either
+#define ILibStun_ICE_SameFoundation(state, a, b) ((state)->hostcandidates[(a)->candidate].addr == (state)->hostcandidates[(b)->candidate].addr)
+
+// (Re)builds the checklist, keeping the state of the pairs that were already there. The highest priority pair of each foundation
+// is Waiting, the rest are Frozen until a pair of the same foundation succeeds
+void ILibStun_ICE_BuildChecklist(struct ILibStun_IceState *state)
+{
+	struct ILibStun_ICE_CandidatePair *pairs, tmp;
+	unsigned int remote;
+	int i, j;
+
+	if (state->hostcandidatecount == 0)
+	{
+		if (state->checklist != NULL) { free(state->checklist); }
+		state->checklist = NULL;
+		state->checklistCount = 0;
+		return;
+	}
+
+	if ((pairs = (struct ILibStun_ICE_CandidatePair*)malloc(state->hostcandidatecount * sizeof(struct ILibStun_ICE_CandidatePair))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(pairs, 0, state->hostcandidatecount * sizeof(struct ILibStun_ICE_CandidatePair));
+	for (i = 0; i < state->hostcandidatecount; ++i)
+	{
+		remote = ILibStun_ICE_CandidatePriority(&(state->hostcandidates[i]), i);
+		pairs[i].candidate = (unsigned char)i;
+		pairs[i].priority = state->peerHasActiveOffer == 0 ? ILibStun_ICE_PairPriority(ILibStun_ICE_LocalPriority, remote) : ILibStun_ICE_PairPriority(remote, ILibStun_ICE_LocalPriority);
+	}
+
+	// Candidates are only ever appended, so the old pairs keep their index
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		j = state->checklist[i].candidate;
+		pairs[j].state = state->checklist[i].state;
+		pairs[j].transmissions = state->checklist[i].transmissions;
+		pairs[j].lastTransmit = state->checklist[i].lastTransmit;
+		pairs[j].triggered = state->checklist[i].triggered;
+	}
+	if (state->checklist != NULL) { free(state->checklist); }
+
+	// Highest priority first. There are at most 255 candidates
+	for (i = 1; i < state->hostcandidatecount; ++i)
+	{
+		memcpy(&tmp, &pairs[i], sizeof(struct ILibStun_ICE_CandidatePair));
+		for (j = i - 1; j >= 0 && pairs[j].priority < tmp.priority; --j) { memcpy(&pairs[j + 1], &pairs[j], sizeof(struct ILibStun_ICE_CandidatePair)); }
+		memcpy(&pairs[j + 1], &tmp, sizeof(struct ILibStun_ICE_CandidatePair));
+	}
+
+	for (i = 0; i < state->hostcandidatecount; ++i)
+	{
+		if (pairs[i].state != ILibStun_ICE_PairState_Frozen) { continue; }
+		for (j = 0; j < i && !ILibStun_ICE_SameFoundation(state, &pairs[i], &pairs[j]); ++j);
+		if (j == i || pairs[j].state == ILibStun_ICE_PairState_Succeeded) { pairs[i].state = ILibStun_ICE_PairState_Waiting; }
+	}
+
+	state->checklist = pairs;
+	state->checklistCount = state->hostcandidatecount;
+}
+
+// Sends the USE-CANDIDATE request for the chosen candidate, and starts DTLS if we are the DTLS client
+void ILibStun_ICE_Nominate(struct ILibStun_IceState *state, int slot, int candidate)
+{
+	struct sockaddr_in dest;
+
+	state->isDoingConnectivityChecks = 0;
+
+	memset(&dest, 0, sizeof(struct sockaddr_in));
+	dest.sin_family = AF_INET;
+	dest.sin_port = state->hostcandidates[candidate].port;
+	dest.sin_addr.s_addr = state->hostcandidates[candidate].addr;
+	ILibStun_SendIceRequest(state, slot, 1, (struct sockaddr_in6*)&dest);
+
+	if (state->dtlsInitiator != 0)
+	{
+		// Simultaneously initiate DTLS
+		ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Initiating DTLS to: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
+		ILibStun_InitiateDTLS(state, slot, (struct sockaddr_in6*)&dest);
+	}
+	else
+	{
+		// We are DTLS Server, not Client
+		ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Waiting for DTLS from: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
+	}
+}
+
+// Regular nomination: As soon as the highest priority pair that can still succeed has succeeded, nominate it. Returns non zero if it did
+int ILibStun_ICE_CheckNomination(struct ILibStun_IceState *state, int slot)
+{
+	int i;
+
+	if (state->isDoingConnectivityChecks == 0 || state->peerHasActiveOffer != 0 || state->dtlsSession >= 0) { return 0; }
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].state == ILibStun_ICE_PairState_Succeeded)
+		{
+			ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "IceSlot: %d Nominating pair %d of %d", slot, i, state->checklistCount);
+			ILibStun_ICE_Nominate(state, slot, state->checklist[i].candidate);
+			return 1;
+		}
+		if (state->checklist[i].state != ILibStun_ICE_PairState_Failed) { break; }
+	}
+	return 0;
+}
+
+// Non zero while some pair of the checklist wasn't answered, and hasn't failed yet
+int ILibStun_ICE_ChecksRemaining(struct ILibStun_IceState *state)
+{
+	int i;
+
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].state < ILibStun_ICE_PairState_Succeeded) { return 1; }
+	}
+	return 0;
+}
+
+// Sends the next check of this agent: A triggered check, else the highest priority Waiting pair, else a retransmission that is due, else
+// the highest priority Frozen pair with no Waiting or In-Progress pair of its foundation. Returns non zero while there are checks left
+int ILibStun_ICE_SendNextCheck(struct ILibStun_IceState *state, int slot, long long now)
+{
+	struct ILibStun_ICE_CandidatePair *pair = NULL, *retransmit = NULL, *frozen = NULL;
+	struct sockaddr_in dest;
+	int i, j, active = 0;
+	long long rto;
+
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].state == ILibStun_ICE_PairState_Waiting || state->checklist[i].state == ILibStun_ICE_PairState_InProgress) { ++active; }
+	}
+	rto = MAX(ILibStun_ICE_MinRTO, ILibStun_ICE_Ta * active);
+
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		switch (state->checklist[i].state)
+		{
+			case ILibStun_ICE_PairState_Waiting:
+				if (pair == NULL || (state->checklist[i].triggered != 0 && pair->triggered == 0)) { pair = &(state->checklist[i]); }
+				break;
+			case ILibStun_ICE_PairState_InProgress:
+				if (now - state->checklist[i].lastTransmit < rto) { break; }
+				if (state->checklist[i].transmissions >= ILibStun_ICE_MaxTransmissions)
+				{
+					state->checklist[i].state = ILibStun_ICE_PairState_Failed;
+				}
+				else if (retransmit == NULL)
+				{
+					retransmit = &(state->checklist[i]);
+				}
+				break;
+			case ILibStun_ICE_PairState_Frozen:
+				if (frozen != NULL) { break; }
+				for (j = 0; j < state->checklistCount; ++j)
+				{
+					if ((state->checklist[j].state == ILibStun_ICE_PairState_Waiting || state->checklist[j].state == ILibStun_ICE_PairState_InProgress) && ILibStun_ICE_SameFoundation(state, &(state->checklist[i]), &(state->checklist[j]))) { break; }
+				}
+				if (j == state->checklistCount) { frozen = &(state->checklist[i]); }
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (pair == NULL) { pair = retransmit != NULL ? retransmit : frozen; }
+	if (pair != NULL)
+	{
+		if (pair->state != ILibStun_ICE_PairState_InProgress) { pair->transmissions = 0; }
+		pair->state = ILibStun_ICE_PairState_InProgress;
+		pair->triggered = 0;
+		pair->lastTransmit = now;
+		++pair->transmissions;
+
+		memset(&dest, 0, sizeof(struct sockaddr_in));
+		dest.sin_family = AF_INET;
+		dest.sin_port = state->hostcandidates[pair->candidate].port;
+		dest.sin_addr.s_addr = state->hostcandidates[pair->candidate].addr;
+		ILibStun_SendIceRequest(state, slot, 0, (struct sockaddr_in6*)&dest);
+	}
+
+	// A failed check may have been all that stood in front of a pair that succeeded
+	if (ILibStun_ICE_CheckNomination(state, slot) != 0) { return 0; }
+	return(ILibStun_ICE_ChecksRemaining(state));
+}
+
+void ILibStun_ICE_OnChecksTimer(void *object)
+{
+	struct ILibStun_Module* obj = (struct ILibStun_Module*)object - 4;
+	struct ILibStun_IceState *state, *next;
+	long long now = ILibGetUptime();
+	int pending = 0;
+
+	obj->IceChecksTimerSet = 0;
+	for (state = obj->IceChecks; state != NULL; state = next)
+	{
+		next = state->checksNext;
+		if (state->isDoingConnectivityChecks != 0 && state->checklist != NULL && state->peerHasActiveOffer == 0 && state->dtlsSession < 0)
+		{
+			pending |= ILibStun_ICE_SendNextCheck(state, state->slot, now);
+		}
+		else
+		{
+			// Nominated, connected, or gave up. StartChecks lists it again if candidates are added
+			ILibStun_ICE_UnlistChecks(obj, state);
+		}
+	}
+
+	if (pending != 0)
+	{
+		obj->IceChecksTimerSet = 1;
+		ILibLifeTime_AddEx(obj->Timer, obj + 4, ILibStun_ICE_Ta, ILibStun_ICE_OnChecksTimer, NULL);
+	}
+}
+
+// Makes sure the pacing timer runs. Every ICE agent with checks left sends one each Ta
+void ILibStun_ICE_ScheduleChecks(struct ILibStun_Module *obj)
+{
+	if (obj->IceChecksTimerSet == 0)
+	{
+		obj->IceChecksTimerSet = 1;
+		ILibLifeTime_AddEx(obj->Timer, obj + 4, 0, ILibStun_ICE_OnChecksTimer, NULL);
+	}
+}
+
+// We are CONTROLLING: Start (or resume, when candidates were added) the connectivity checks
+void ILibStun_ICE_StartChecks(struct ILibStun_IceState *state)
+{
+	struct ILibStun_Module *obj = state->parentStunModule;
+
+	state->isDoingConnectivityChecks = 1;
+	ILibStun_ICE_BuildChecklist(state);
+	if (state->checksListed == 0)
+	{
+		state->checksPrev = NULL;
+		state->checksNext = obj->IceChecks;
+		if (state->checksNext != NULL) { state->checksNext->checksPrev = state; }
+		obj->IceChecks = state;
+		state->checksListed = 1;
+	}
+	ILibStun_ICE_ScheduleChecks(obj);
+
+	// Nomination normally happens as soon as the checks tell which pair is best. If that's not settled in 3 seconds,
+	// the best pair that answered by then is nominated. The timer is set on the stunModule, so we don't have a race 
+	// condition if the ice offer is updated/deleted during these 3 seconds.
+	ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
+}
+
+// The peer sent us a check on this pair, so check it back ahead of the others (RFC 8445 7.3.1.4)
+void ILibStun_ICE_TriggerCheck(struct ILibStun_IceState *state, int candidate)
+{
+	int i;
+
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].candidate != candidate) { continue; }
+		if (state->checklist[i].state != ILibStun_ICE_PairState_Succeeded && state->checklist[i].state != ILibStun_ICE_PairState_InProgress)
+		{
+			state->checklist[i].state = ILibStun_ICE_PairState_Waiting;
+			state->checklist[i].triggered = 1;
+			ILibStun_ICE_ScheduleChecks(state->parentStunModule);
+		}
+		break;
+	}
+}
+
+// A check on this candidate was answered: the pair succeeded and its foundation is unfrozen
+void ILibStun_ICE_OnCheckSucceeded(struct ILibStun_IceState *state, int slot, int candidate)
+{
+	struct ILibStun_ICE_CandidatePair *pair = NULL;
+	int i;
+
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].candidate == candidate) { pair = &(state->checklist[i]); break; }
+	}
+	if (pair == NULL || pair->state == ILibStun_ICE_PairState_Succeeded) { return; }
+
+	pair->state = ILibStun_ICE_PairState_Succeeded;
+	pair->triggered = 0;
+	for (i = 0; i < state->checklistCount; ++i)
+	{
+		if (state->checklist[i].state == ILibStun_ICE_PairState_Frozen && ILibStun_ICE_SameFoundation(state, &(state->checklist[i]), pair)) { state->checklist[i].state = ILibStun_ICE_PairState_Waiting; }
+	}
+	ILibStun_ICE_CheckNomination(state, slot);
+}
+
 void ILibStun_ICE_FinalizeConnectivityChecks(void *object)
 {
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)object - 1;
+	struct ILibStun_IceState *state;
 	int i;
-	int x;
+	int x, candidate;
 	
-	// Go through each ICE offer that is saved, and find the ones that were doing ICE Connectivity Checks, and finalize all of them
-	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+	// Go through each ICE offer that is saved, and find the ones that were still doing ICE Connectivity Checks, and finalize all of them
+	for (i = 0; i < obj->IceStatesSize; ++i)
 	{
-		if (obj->IceStates[i] != NULL && obj->IceStates[i]->isDoingConnectivityChecks != 0)
+		state = obj->IceStates[i];
+		if (state != NULL && state->isDoingConnectivityChecks != 0)
 		{
-			obj->IceStates[i]->isDoingConnectivityChecks = 0;
 			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "FINALIZING Connectivity checks on IceSlot: %d", i);
 
-			for (x = 0; x < obj->IceStates[i]->hostcandidatecount; ++x)
+			for (x = 0; x < state->hostcandidatecount; ++x)
 			{
-				if (obj->IceStates[i]->hostcandidateResponseFlag[x] != 0)
+				// Walk the candidates in pair priority order, and nominate the best one that we received a request or a response from
+				candidate = x < state->checklistCount ? state->checklist[x].candidate : x;
+				if (state->hostcandidateResponseFlag[candidate] != 0)
 				{
-					if (obj->IceStates[i]->peerHasActiveOffer == 0)
-					{
-						// Since this list is in priority order, we'll nominate the highest priority candidate that received a response
-						struct sockaddr_in dest;
-
-						memset(&dest, 0, sizeof(struct sockaddr_in));
-						dest.sin_family = AF_INET;
-						dest.sin_port = obj->IceStates[i]->hostcandidates[x].port;
-						dest.sin_addr.s_addr = obj->IceStates[i]->hostcandidates[x].addr;
-						ILibStun_SendIceRequest(obj->IceStates[i], i, 1, (struct sockaddr_in6*)&dest);
-
-						if (obj->IceStates[i]->dtlsInitiator != 0)
-						{
-							// Simultaneously initiate DTLS
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Initiating DTLS to: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
-							ILibStun_InitiateDTLS(obj->IceStates[i], i, (struct sockaddr_in6*)&dest);
-						}
-						else
-						{
-							// We are DTLS Server, not Client
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Waiting for DTLS from: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
-						}
-						break;
-					}
+					if (state->peerHasActiveOffer == 0) { ILibStun_ICE_Nominate(state, i, candidate); }
+					break;
 				}
 			}
+			if (x == state->hostcandidatecount && state->peerHasActiveOffer == 0 && state->dtlsSession < 0 && ILibStun_ICE_ChecksRemaining(state) != 0)
+			{
+				// Nothing answered yet, but some checks are still going. The first pair that succeeds will be nominated
+				continue;
+			}
+			state->isDoingConnectivityChecks = 0;
 		}
 	}
 }
@@ -2318,7 +3743,7 @@ void ILibStun_PeriodicStunCheck(struct ILibStun_Module* obj)
 
 	ILibLifeTime_Remove(obj->Timer, obj + 3);
 
-	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+	for (i = 0; i < obj->IceStatesSize; ++i)
 	{
 		if (obj->IceStates[i] != NULL && obj->IceStates[i]->hostcandidates != NULL && obj->IceStates[i]->dtlsSession < 0 && ((ILibGetUptime() - obj->IceStates[i]->creationTime) < ILibSTUN_MaxOfferAgeSeconds * 1000))
 		{
@@ -2342,19 +3767,17 @@ void ILibStun_PeriodicStunCheck(struct ILibStun_Module* obj)
 void ILibStun_ICE_Start(struct ILibStun_IceState *state, int SelectedSlot)
 {
 	struct ILibStun_Module *obj = state->parentStunModule;
-	if (state->peerHasActiveOffer == 0)
+	if (obj->iceLite != 0)
+	{
+		// ICE-lite: No checks and no timers, we just answer the peer's checks until it nominates
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ICE-lite, waiting for nomination...");
+	}
+	else if (state->peerHasActiveOffer == 0)
 	{
 		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Starting Connectivity Checks...");
 		// Since we're not a STUN-LITE implementation, we need to perform connectivity checks
 		// We'll only do this, if we're the initiator and the peer is passive
-		state->isDoingConnectivityChecks = 1;
-		ILibStun_DelaySendIceRequest(state, SelectedSlot, 0);
-
-		// All of these packets are distributed within a 500ms window. 
-		// We'll set a timer for 3 seconds, to finalize the connectivity check
-		// The timer is set on the stunModule, so we don't have a race condition if the ice offer is updated/deleted during
-		// these 3 seconds.
-		ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
+		ILibStun_ICE_StartChecks(state);
 	}
 	else
 	{
@@ -2370,20 +3793,13 @@ void ILibStun_SetIceOffer2_TURN_CreatePermissionResponse(ILibTURN_ClientModule t
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)ILibTURN_GetTag(turnModule);
 	struct ILibStun_IceState* state = obj->IceStates[SelectedSlot];
 
-	if (success != 0)
+	if (success != 0 && obj->iceLite == 0)
 	{
 		if (state->peerHasActiveOffer == 0)
 		{
 			// Since we're not a STUN-LITE implementation, we need to perform connectivity checks
 			// We'll only do this, if we're the initiator and the peer is passive
-			state->isDoingConnectivityChecks = 1;
-			ILibStun_DelaySendIceRequest(state, SelectedSlot, 0);
-
-			// All of these packets are distributed within a 500ms window. 
-			// We'll set a timer for 3 seconds, to finalize the connectivity check
-			// The timer is set on the stunModule, so we don't have a race condition if the ice offer is updated/deleted during
-			// these 3 seconds.
-			ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
+			ILibStun_ICE_StartChecks(state);
 		}
 		else
 		{
@@ -2433,6 +3849,7 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	state->rusername = state->offerblock + 7;
 	state->rkeylen = state->offerblock[7 + state->rusernamelen];
 	state->rkey = state->offerblock + 7 + state->rusernamelen + 1;
+	ILibStun_HmacSha1_Init(&(state->rkeyIntegrity), state->rkey, state->rkeylen);
 	state->dtlscerthashlen = state->offerblock[7 + state->rusernamelen + 1 + state->rkeylen];
 	state->dtlscerthash = state->offerblock + 7 + state->rusernamelen + 1 + state->rkeylen + 1;
 	state->hostcandidatecount = state->offerblock[7 + state->rusernamelen + 1 + state->rkeylen + 1 + state->dtlscerthashlen];
@@ -2441,6 +3858,16 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	state->requerycount = 0;
 	state->peerHasActiveOffer = ((state->blockflags & ILibWebRTC_SDP_Flags_DTLS_SERVER) == ILibWebRTC_SDP_Flags_DTLS_SERVER ? 0 : 1);
 	state->dtlsInitiator = ((state->blockflags & ILibWebRTC_SDP_Flags_DTLS_SERVER) == ILibWebRTC_SDP_Flags_DTLS_SERVER ? 1 : 0);
+	if (obj->iceLite != 0)
+	{
+		// We are ICE-lite, so we are always CONTROLLED. If we are also DTLS client, we connect when the peer nominates a candidate
+		state->peerHasActiveOffer = 1;
+	}
+	else if ((state->blockflags & ILibWebRTC_SDP_Flags_ICE_LITE) == ILibWebRTC_SDP_Flags_ICE_LITE)
+	{
+		// The peer is ICE-lite, so we have to be CONTROLLING regardless of the DTLS roles
+		state->peerHasActiveOffer = 0;
+	}
 	state->parentStunModule = obj;
 	state->dtlsSession = -1;
 	state->creationTime = ILibGetUptime();
@@ -2453,7 +3880,7 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	// If username/pasword was passed in, use that because we generated the original offer, 
 	// so we have to keep the credentials the same, otherwise the peer will not be able to connect.
 	//
-	if (username != NULL && password != NULL && usernameLength + passwordLength == 40)
+	if (username != NULL && password != NULL && usernameLength == ILibStun_UsernameLength && passwordLength == 32)
 	{
 		state->userAndKey[0] = (char)usernameLength;
 		memcpy(state->userAndKey + 1, username, usernameLength);
@@ -2506,15 +3933,14 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 			// We need to copy UserAndKey, because we will be using the same username and password
 			memcpy(state->userAndKey, oldState->userAndKey, sizeof(state->userAndKey));
 			generateUserAndKey = 0;
-			free(oldState->offerblock);
-			free(oldState);
+			ILibStun_FreeIceState(oldState);
 			oldState = NULL;
 		}
 	}
 
 	if (generateUserAndKey != 0)
 	{
-		ILibStun_GenerateUserAndKey(SelectedSlot, obj->Secret, state->userAndKey); // We are going to encode the slot number in the username
+		ILibStun_GenerateUserAndKey(SelectedSlot, obj->Shards != NULL ? obj->ShardIndex : -1, obj->Secret, state->userAndKey); // We are going to encode the slot number in the username
 	}
 
 	// Generate an return answer
@@ -2567,8 +3993,8 @@ void ILibORTC_SetRemoteParameters(void* stunModule, char *username, int username
 	int slot;
 
 	if(offerLen > sizeof(offer)) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_SetRemoteParameters called, but passed data is > %d bytes", (int)sizeof(offer)); return;}
-	slot = ILibStun_CharToSlot(localUserName[0]);
-	if(slot < 0 || slot >= ILibSTUN_MaxSlots) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_SetRemoteParameters called with invalid local username"); return;}
+	slot = ILibStun_UsernameToSlot(localUserName);
+	if(slot < 0 || slot >= obj->IceStatesSize || obj->IceStates[slot] == NULL) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_SetRemoteParameters called with invalid local username"); return;}
 
 	localUserNameLen = obj->IceStates[slot]->userAndKey[0];
 	localPasswordLen = obj->IceStates[slot]->userAndKey[localUserNameLen+1];
@@ -2589,22 +4015,92 @@ void ILibORTC_SetRemoteParameters(void* stunModule, char *username, int username
 	free(answer);
 }
 
+/*! \fn int ILibStun_AddIceCandidate(void* StunModule, char* localUsername, struct sockaddr_in6 *candidate)
+\brief Adds a remote candidate to an offer that was already set (Trickle ICE)
+\par
+The candidate is appended after the ones that came in the offer, so it has the lowest local preference. If no DTLS session was established yet
+and we are CONTROLLING, it joins the checklist, and a pair nominated earlier stays nominated. If we are CONTROLLED, it's sent a check right away.
+Must be called on the Microstack thread.
+\param StunModule STUN Module
+\param localUsername Local ICE username of the offer (returned when the offer was generated/set)
+\param candidate Remote candidate (Only IPv4 is supported)
+\returns 0 on success, 1 if there is no such offer, the remote offer was not set yet, the candidate is not IPv4 or there are too many, 2 if the candidate is already known
+*/
+int ILibStun_AddIceCandidate(void* StunModule, char* localUsername, struct sockaddr_in6 *candidate)
+{
+	struct ILibStun_Module* obj = (struct ILibStun_Module*)StunModule;
+	struct ILibStun_IceState *state;
+	char *block;
+	int slot = ILibStun_UsernameToSlot(localUsername);
+	int i, candidatesEnd, blockLen;
+
+	if (slot < 0 || slot >= obj->IceStatesSize || (state = obj->IceStates[slot]) == NULL || candidate->sin6_family != AF_INET) { return 1; }
+	if (state->hostcandidatecount >= 255) { return 1; } // The offer block counts candidates in a byte
+	if (state->hostcandidates == NULL || state->rkey == NULL)
+	{
+		// This is still the placeholder for an offer we generated, we can't check anything until the peer's answer is set
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "IceSlot: %d Can't add candidate %s:%u, remote offer was not set", slot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)candidate), ntohs(candidate->sin6_port));
+		return 1;
+	}
+	for (i = 0; i < state->hostcandidatecount; ++i)
+	{
+		if (state->hostcandidates[i].addr == ((struct sockaddr_in*)candidate)->sin_addr.s_addr && state->hostcandidates[i].port == ((struct sockaddr_in*)candidate)->sin_port) { return 2; }
+	}
+
+	// The offer block is [..., candidate count, candidates, anything else the offer carried, response flags]. Rebuild it with room for one more candidate and flag
+	candidatesEnd = (int)((char*)(state->hostcandidates + state->hostcandidatecount) - state->offerblock);
+	blockLen = (int)(state->hostcandidateResponseFlag - state->offerblock);
+	if ((block = (char*)malloc(blockLen + sizeof(struct ILibStun_IceStateCandidate) + state->hostcandidatecount + 2)) == NULL) { ILIBCRITICALEXIT(254); }
+	memcpy(block, state->offerblock, candidatesEnd);
+	((struct ILibStun_IceStateCandidate*)(block + candidatesEnd))->addr = ((struct sockaddr_in*)candidate)->sin_addr.s_addr;
+	((struct ILibStun_IceStateCandidate*)(block + candidatesEnd))->port = ((struct sockaddr_in*)candidate)->sin_port;
+	memcpy(block + candidatesEnd + sizeof(struct ILibStun_IceStateCandidate), state->offerblock + candidatesEnd, blockLen - candidatesEnd);
+	memcpy(block + blockLen + sizeof(struct ILibStun_IceStateCandidate), state->hostcandidateResponseFlag, state->hostcandidatecount);
+	memset(block + blockLen + sizeof(struct ILibStun_IceStateCandidate) + state->hostcandidatecount, 0, 2);
+
+	ILibStun_Demux_IndexCandidates(obj, state, 1);
+	state->rusername = block + (state->rusername - state->offerblock);
+	state->rkey = block + (state->rkey - state->offerblock);
+	state->dtlscerthash = block + (state->dtlscerthash - state->offerblock);
+	state->hostcandidates = (struct ILibStun_IceStateCandidate*)(block + ((char*)state->hostcandidates - state->offerblock));
+	state->hostcandidateResponseFlag = block + blockLen + sizeof(struct ILibStun_IceStateCandidate);
+	((char*)state->hostcandidates)[-1] = (char)(++state->hostcandidatecount);
+	free(state->offerblock);
+	state->offerblock = block;
+	ILibStun_Demux_IndexCandidates(obj, state, 0);
+
+	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "IceSlot: %d Added candidate %s:%u", slot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)candidate), ntohs(candidate->sin6_port));
+
+	// The permission is requested before the checks go out, which are at least 100ms away
+	if (state->useTurn != 0) { ILibTURN_CreatePermission(obj->mTurnClientModule, candidate, 1, NULL, NULL); }
+
+	// ICE-lite only answers, and once DTLS is up the pair is already chosen
+	if (obj->iceLite != 0 || state->dtlsSession >= 0) { return 0; }
+
+	if (state->peerHasActiveOffer == 0)
+	{
+		// We are CONTROLLING, so the candidate joins the checklist, and nomination waits for it if it's better than what answered so far
+		ILibStun_ICE_StartChecks(state);
+	}
+	else
+	{
+		ILibStun_DelaySendIceRequestEx(state, slot, 0, state->hostcandidatecount - 1);
+	}
+	return 0;
+}
+
 void ILibORTC_AddCandidate(void *stunModule, char* localUsername, struct sockaddr_in6 *candidate)
 {
-	int slot = ILibStun_CharToSlot(localUsername[0]);
-
-	if (slot < 0 || slot > ILibSTUN_MaxSlots) { ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate called with invalid local username"); return; }
-	ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate: %s", ILibRemoteLogging_ConvertAddress((struct sockaddr*)candidate));
-	
-
+	ILibStun_AddIceCandidate(stunModule, localUsername, candidate);
 }
 
 ILibTransport_DoneState ILibStun_SendDtls(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength)
 {
 	ILibTransport_DoneState r = ILibTransport_DoneState_ERROR;
 	char exBuffer[4096];
-	int j;
-	if (obj == NULL || session < 0 || session > (ILibSTUN_MaxSlots-1) || obj->dTlsSessions[session] == NULL || SSL_state(obj->dTlsSessions[session]->ssl) != 3) return ILibTransport_DoneState_ERROR;
+	unsigned long long turnSendMark;
+	int j, blocked = 0;
+	if (obj == NULL || session < 0 || session >= obj->dTlsSessionsSize || obj->dTlsSessions[session] == NULL || SSL_state(obj->dTlsSessions[session]->ssl) != 3) return ILibTransport_DoneState_ERROR;
 
 #ifdef _WEBRTCDEBUG
 	// Simulated Inbound Packet Loss
@@ -2618,14 +4114,24 @@ ILibTransport_DoneState ILibStun_SendDtls(struct ILibStun_Module *obj, int sessi
 		j = BIO_read(SSL_get_wbio(obj->dTlsSessions[session]->ssl), exBuffer, 4096);
 		if (obj->IceStates[obj->dTlsSessions[session]->iceStateSlot]->useTurn != 0)
 		{
-			if (ILibTURN_GetPendingBytesToSend(obj->mTurnClientModule) == 0)
-			{
-				r = (ILibTransport_DoneState)ILibTURN_SendChannelData(obj->mTurnClientModule, (unsigned short)session, exBuffer, 0, j);
-			}
-			else
+			// A busy TCP socket queues the record instead of dropping it, so SCTP doesn't see the backlog as loss. Only a full queue drops, and SCTP retries those
+			// The position comes back from the same critical section that accepted the record, so another session's send can't move it
+			switch (ILibTURN_SendChannelDataEx(obj->mTurnClientModule, (unsigned short)session, exBuffer, 0, j, &turnSendMark))
 			{
-				// If the TCP socket is overflowing, just drop the packet... SCTP will take care of retrying this later
-				r = ILibTransport_DoneState_INCOMPLETE; // ToDo: Make Sure SendOK is getting called
+				case ILibAsyncSocket_ALL_DATA_SENT:
+					r = ILibTransport_DoneState_COMPLETE;
+					break;
+				case ILibAsyncSocket_NOT_ALL_DATA_SENT_YET:
+					// Remember where the record sits in the TURN backlog, so T3-RTX can tell if it may still be waiting there
+					obj->dTlsSessions[session]->turnSendMark = turnSendMark;
+					blocked = 1;
+					break;
+				case ILibAsyncSocket_SEND_LIMIT_EXCEEDED:
+					blocked = 1;
+					break;
+				default:
+					r = ILibTransport_DoneState_ERROR;
+					break;
 			}
 		}
 		else
@@ -2633,6 +4139,11 @@ ILibTransport_DoneState ILibStun_SendDtls(struct ILibStun_Module *obj, int sessi
 			r = (ILibTransport_DoneState)ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)obj)->UDP, (struct sockaddr*)&(obj->dTlsSessions[session]->remoteInterface), exBuffer, j, ILibAsyncSocket_MemoryOwnership_USER);
 		}
 	}
+	if (blocked != 0)
+	{
+		// Backpressure for the application, the TURN client owes us OnSendOK when its send queue drains
+		r = ILibTransport_DoneState_INCOMPLETE;
+	}
 	return r;
 }
 
@@ -3186,7 +4697,7 @@ void ILibStun_SctpDisconnect_Continue(void *j)
 	}
 
 	// Lets abort Consent-Freshness Checks
-	ILibLifeTime_Remove(obj->Timer, o + 1);
+	ILibStun_Consent_Unschedule(obj, o);
 
 	// Remove the SCTP Heartbeat timer
 	ILibLifeTime_Remove(o->parent->Timer, o);
@@ -3195,6 +4706,7 @@ void ILibStun_SctpDisconnect_Continue(void *j)
 	ILibStun_ClearIceState(obj, o->iceStateSlot);
 
 	// Follow by clearing the DTLS object
+	ILibStun_Demux_IndexSession(obj, o, 1);
 	obj->dTlsSessions[o->sessionId] = NULL;
 
 	ILibStun_SctpDisconnect_Final(o); // sem_post(&(o->Lock)) done inside this method.
@@ -3241,11 +4753,25 @@ void ILibSCTP_Close(void* module)
 void ILibStun_SctpResent(struct ILibStun_dTlsSession *obj)
 {
 	unsigned int time = (unsigned int)ILibGetUptime();
+	unsigned long long turnSent;
 	char* packet = obj->pendingQueueHead;
 
 	// If T3RTXTIME == 0, it is disabled, otherwise it is the timestamp of when it was enabled
 	if (obj->T3RTXTIME > 0 && time >= (obj->T3RTXTIME + obj->RTO) && packet != NULL)
 	{
+		if (obj->parent->IceStates[obj->iceStateSlot] != NULL && obj->parent->IceStates[obj->iceStateSlot]->useTurn != 0)
+		{
+			ILibTURN_GetSendPositions(obj->parent->mTurnClientModule, NULL, &turnSent);
+			if (turnSent < obj->turnSendMark)
+			{
+				// Our own records are still in the TURN TCP backlog, so they may not have even left yet. That isn't loss, so don't collapse
+				// the congestion window or pile retransmits onto the backlog. Restart T3-RTX instead. Once they're out (or were dropped from
+				// the queue), other sessions' traffic on the shared connection doesn't hold us back.
+				obj->T3RTXTIME = time;
+				return;
+			}
+		}
+
 		obj->T3RTXTIME = 0;
 #ifdef _WEBRTCDEBUG
 		if (obj->onT3RTX != NULL) { obj->onT3RTX(obj, "OnT3RTX", -1); }	// Debug event informing of the T3RTX timer expiration
@@ -4610,6 +6136,8 @@ void ILibStun_CreateDtlsSession(struct ILibStun_Module *obj, int sessionId, int
 	}
 	else
 	{
+		ILibStun_Consent_Unschedule(obj, obj->dTlsSessions[sessionId]);
+		ILibStun_Demux_IndexSession(obj, obj->dTlsSessions[sessionId], 1);
 		sem_destroy(&(obj->dTlsSessions[sessionId]->Lock));
 		ILibWebRTC_DestroySparseArrayTables(obj->dTlsSessions[sessionId]);
 	}
@@ -4628,9 +6156,11 @@ void ILibStun_CreateDtlsSession(struct ILibStun_Module *obj, int sessionId, int
 	sem_init(&(obj->dTlsSessions[sessionId]->Lock), 0, 1);
 	obj->dTlsSessions[sessionId]->parent = obj;
 	memcpy(&(obj->dTlsSessions[sessionId]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
+	ILibStun_Demux_IndexSession(obj, obj->dTlsSessions[sessionId], 0);
 	obj->dTlsSessions[sessionId]->senderCredits = 4 * ILibRUDP_StartMTU;
 	obj->dTlsSessions[sessionId]->congestionWindowSize = 4 * ILibRUDP_StartMTU;
 	obj->dTlsSessions[sessionId]->ssl = SSL_new(obj->SecurityContext);
+	if (ILibStun_ModuleIndex >= 0) { SSL_set_ex_data(obj->dTlsSessions[sessionId]->ssl, ILibStun_ModuleIndex, obj); }
 	if ((obj->dTlsSessions[sessionId]->rpacket = (char*)malloc(4096)) == NULL) ILIBCRITICALEXIT(254);
 	obj->dTlsSessions[sessionId]->rpacketsize = 4096;
 
@@ -4645,13 +6175,12 @@ void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, stru
 	long l;
 	BIO* read;
 	BIO* write;
-	int i, j = -1;
+	int i, j;
 	struct ILibStun_Module *obj = IceState->parentStunModule;
 	char tbuffer[4096];
 
 	// Find a free dTLS session slot
-	for (i = 0; i < ILibSTUN_MaxSlots; i++) { if (obj->dTlsSessions[i] == NULL || obj->dTlsSessions[i]->state == 0) { j = i; break; } }
-	if (j == -1) return; // No free slots
+	if ((j = ILibStun_GetFreeSessionSlot(obj)) < 0) return; // No free slots
 
 	IceState->dtlsSession = j;  // Set the DTLS Session ID in the IceState object this is associated with
 
@@ -4690,22 +6219,17 @@ void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, stru
 
 int ILibStun_GetDtlsSessionSlotForIceState(struct ILibStun_Module *obj, struct ILibStun_IceState* ice)
 {
-	int x, i;
+	char key[6];
+	int i;
 	struct ILibStun_dTlsSession *session;
 
-	for (x = 0; x < ILibSTUN_MaxSlots; ++x)
+	// Look each candidate up in the session index, rather than walking every session
+	for (i = 0; i < ice->hostcandidatecount; ++i)
 	{
-		session = obj->dTlsSessions[x];
-		if (session != NULL)
-		{
-			for (i = 0; i < ice->hostcandidatecount; ++i)
-			{
-				if (ice->hostcandidates[i].addr == ((struct sockaddr_in*)&session->remoteInterface)->sin_addr.s_addr)
-				{
-					if (ice->hostcandidates[i].port == session->remoteInterface.sin6_port) { return x; }
-				}
-			}
-		}
+		memcpy(key, &(ice->hostcandidates[i].addr), 4);
+		memcpy(key + 4, &(ice->hostcandidates[i].port), 2);
+		session = (struct ILibStun_dTlsSession*)ILibHashtable_Get(obj->SessionIndex, NULL, key, 6);
+		if (session != NULL && session->sessionId < obj->dTlsSessionsSize && obj->dTlsSessions[session->sessionId] == session) { return session->sessionId; }
 	}
 	return -1;
 }
@@ -4713,7 +6237,7 @@ int ILibStun_GetDtlsSessionSlotForIceState(struct ILibStun_Module *obj, struct I
 void ILibStun_DTLS_GetIceUserName(void* WebRTCModule, char* username)
 {
 	struct ILibStun_dTlsSession* session = (struct ILibStun_dTlsSession*)WebRTCModule;
-	memcpy(username, session->parent->IceStates[session->iceStateSlot]->userAndKey + 1, 8);
+	memcpy(username, session->parent->IceStates[session->iceStateSlot]->userAndKey + 1, ILibStun_UsernameLength);
 }
 
 void ILibStun_DTLS_Success_OnCreateTURNChannelBinding(ILibTURN_ClientModule turnModule, unsigned short channelNumber, int success, void* user)
@@ -4769,14 +6293,22 @@ void ILibStun_DTLS_Success(struct ILibStun_Module *obj, int session, struct sock
 		// TODO: Bryan: Fix this, Periodic stuns don't work like this anymore
 		ILibLifeTime_Remove(obj->Timer, obj->IceStates[IceSlot]);
 
-		if (obj->consentFreshnessDisabled == 0) // TODO: Bryan: We should really put this after SCTP has been established...
+		if (obj->consentFreshnessDisabled == 0 && obj->iceLite == 0) // TODO: Bryan: We should really put this after SCTP has been established...
 		{
 			// Start Consent Freshness Algorithm. Wait for the Timeout, then send first packet
-			ILibLifeTime_Add(obj->Timer, obj->dTlsSessions[session] + 1, ILibStun_MaxConsentFreshnessTimeoutSeconds, ILibStun_WebRTC_ConsentFreshness_Start, NULL);
+			ILibStun_Consent_ScheduleRefresh(obj, obj->dTlsSessions[session]);
 		}
 	}
 }
 
+// Called when a batched datagram couldn't be sent. Only that destination is affected, ICE and SCTP recover from the loss on their own.
+void ILibStun_OnUDPSendError(ILibAsyncUDPSocket_SocketModule socketModule, struct sockaddr *remoteInterface, int error, void *user, void *user2)
+{
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(user2);
+	ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)user)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "[UDP send to %s:%u failed, error: %d]", ILibRemoteLogging_ConvertAddress(remoteInterface), ntohs(((struct sockaddr_in6*)remoteInterface)->sin6_port), error);
+}
+
 void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
 {
 	BIO* read;
@@ -4796,6 +6328,7 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 	if (socketModule == NULL && remoteInterface->sin6_family == 0)
 	{
 		existingSession = (int)remoteInterface->sin6_port;
+		if (existingSession >= obj->dTlsSessionsSize || obj->dTlsSessions[existingSession] == NULL) return; // Unknown TURN channel
 		remoteInterface = &(obj->dTlsSessions[existingSession]->remoteInterface);
 	}
 
@@ -4805,54 +6338,24 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 	if (obj->SecurityContext == NULL || obj->CertThumbprint == NULL) return; // No dTLS support
 	if (existingSession < 0)
 	{
-		//
-		// Enumerate ICE Offers, and see if any of the associated DTLS sessions is this one
-		//
-		for (i = 0; i < ILibSTUN_MaxSlots; ++i)
-		{
-			if (obj->IceStates[i] != NULL && obj->IceStates[i]->dtlsSession >= 0)
-			{
-				if (obj->dTlsSessions[obj->IceStates[i]->dtlsSession] != NULL)
-				{
-					if (memcmp(&(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family)) == 0)
-					{
-						existingSession = obj->IceStates[i]->dtlsSession;
-						break;
-					}
-				}
-			}
-		}
+		// See if this is from the remote address of an existing DTLS session
+		existingSession = ILibStun_Demux_FindSession(obj, remoteInterface);
 
-		if (existingSession < 0)
+		if (existingSession < 0 && (i = ILibStun_Demux_FindCandidate(obj, remoteInterface, &cx)) >= 0)
 		{
 			//
 			// Check the existing sessions one more time, to see if the remote side switched interfaces on us
 			//
-			for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+			if (obj->IceStates[i]->dtlsSession >= 0 && obj->dTlsSessions[obj->IceStates[i]->dtlsSession] != NULL && obj->IceStates[i]->hostcandidateResponseFlag[cx] == 1)
 			{
-				if (obj->IceStates[i] != NULL && obj->IceStates[i]->dtlsSession >= 0)
-				{
-					if (obj->dTlsSessions[obj->IceStates[i]->dtlsSession] != NULL)
-					{
-						for (cx = 0; cx < obj->IceStates[i]->hostcandidatecount; ++cx)
-						{
-							if (obj->IceStates[i]->hostcandidates[cx].port == remoteInterface->sin6_port && obj->IceStates[i]->hostcandidates[cx].addr == ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr)
-							{
-								if (obj->IceStates[i]->hostcandidateResponseFlag[cx] == 1)
-								{
-									ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "DTLS Session: %d switching candidates from: %s:u", obj->IceStates[i]->dtlsSession, ILibRemoteLogging_ConvertAddress((struct sockaddr*)(&obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface)), ntohs(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface.sin6_port));
-									ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...TO: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
-									
-									// This Candidate was Allowed, let's switch to this candidate
-									memcpy(&(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
-									existingSession = obj->IceStates[i]->dtlsSession;
-									break;
-								}
-							}
-						}
-						if (existingSession >= 0) { break; }
-					}
-				}
+				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "DTLS Session: %d switching candidates from: %s:u", obj->IceStates[i]->dtlsSession, ILibRemoteLogging_ConvertAddress((struct sockaddr*)(&obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface)), ntohs(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface.sin6_port));
+				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...TO: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
+
+				// This Candidate was Allowed, let's switch to this candidate
+				ILibStun_Demux_IndexSession(obj, obj->dTlsSessions[obj->IceStates[i]->dtlsSession], 1);
+				memcpy(&(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
+				ILibStun_Demux_IndexSession(obj, obj->dTlsSessions[obj->IceStates[i]->dtlsSession], 0);
+				existingSession = obj->IceStates[i]->dtlsSession;
 			}
 		}
 	}
@@ -4861,42 +6364,27 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 	if (existingSession == -1) 
 	{
 		// We don't have a session established yet, so just check to see if the candidate is allowed
-		for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+		if ((i = ILibStun_Demux_FindCandidate(obj, remoteInterface, &cx)) >= 0 && obj->IceStates[i]->dtlsSession < 0)
 		{
-			if (obj->IceStates[i] != NULL && obj->IceStates[i]->dtlsSession < 0)
+			if (obj->IceStates[i]->hostcandidateResponseFlag[cx] == 1)
 			{
-				for (cx = 0; cx < obj->IceStates[i]->hostcandidatecount; ++cx)
+				// This Candidate was Allowed, find a free dTLS session slot
+				if ((dtlsSessionId = ILibStun_GetFreeSessionSlot(obj)) >= 0)
 				{
-					if (obj->IceStates[i]->hostcandidates[cx].port == remoteInterface->sin6_port && obj->IceStates[i]->hostcandidates[cx].addr == ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr)
-					{
-						if (obj->IceStates[i]->hostcandidateResponseFlag[cx] == 1)
-						{
-							// This Candidate was Allowed, find a free dTLS session slot
-							for (dtlsSessionId = 0; dtlsSessionId < ILibSTUN_MaxSlots; dtlsSessionId++)
-							{
-								if (obj->dTlsSessions[dtlsSessionId] == NULL || obj->dTlsSessions[dtlsSessionId]->state == 0)
-								{
-									obj->IceStates[i]->dtlsSession = dtlsSessionId;
-									iceSlotId = i;									
-									break;
-								}
-							}
-							if (dtlsSessionId == ILibSTUN_MaxSlots) 
-							{
-								ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, " ABORTING: No free dTLS Session Slots");
-								return; // No free slots
-							}
-						}
-						else
-						{
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...DTLS Packet from: %s:%u was using a disallowed candidate", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
-							return; // This candidate was not allowed
-						}
-						i = ILibSTUN_MaxSlots;
-						break;
-					}
+					obj->IceStates[i]->dtlsSession = dtlsSessionId;
+					iceSlotId = i;
+				}
+				else
+				{
+					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, " ABORTING: No free dTLS Session Slots");
+					return; // No free slots
 				}
 			}
+			else
+			{
+				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...DTLS Packet from: %s:%u was using a disallowed candidate", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
+				return; // This candidate was not allowed
+			}
 		}
 
 		if (dtlsSessionId < 0)
@@ -5062,23 +6550,29 @@ int ILibStunClient_dTLS_verify_callback(int ok, X509_STORE_CTX *ctx)
 {
 	int i, l = 32;
 	char thumbprint[32];
+	SSL *ssl = (SSL*)X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+	struct ILibStun_Module *obj = NULL;
 
 	// Validate the incoming certificate against known allowed fingerprints.
 	UNREFERENCED_PARAMETER(ok);
 
+	// With more than one STUN module running (shards), the session tells us which module's offers to check against
+	if (ssl != NULL && ILibStun_ModuleIndex >= 0) { obj = (struct ILibStun_Module*)SSL_get_ex_data(ssl, ILibStun_ModuleIndex); }
+	if (obj == NULL) { obj = g_stunModule; }
+
 	X509_digest(ctx->current_cert, EVP_get_digestbyname("sha256"), (unsigned char*)thumbprint, (unsigned int*)&l);
-	if (l != 32 || g_stunModule == NULL) return 0;
-	ILibRemoteLogging_printf(ILibChainGetLogger(g_stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "Verifying Inbound Cert: %s", ILibRemoteLogging_ConvertToHex(thumbprint, 32));
+	if (l != 32 || obj == NULL) return 0;
+	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "Verifying Inbound Cert: %s", ILibRemoteLogging_ConvertToHex(thumbprint, 32));
 	
-	for (i = 0; i < ILibSTUN_MaxSlots; i++)
+	for (i = 0; i < obj->IceStatesSize; i++)
 	{
-		if (g_stunModule->IceStates[i] != NULL && g_stunModule->IceStates[i]->dtlscerthashlen == 32 && memcmp(g_stunModule->IceStates[i]->dtlscerthash, thumbprint, 32) == 0)
+		if (obj->IceStates[i] != NULL && obj->IceStates[i]->dtlscerthashlen == 32 && memcmp(obj->IceStates[i]->dtlscerthash, thumbprint, 32) == 0)
 		{
-			ILibRemoteLogging_printf(ILibChainGetLogger(g_stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Matches Slot[%d]", i);
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Matches Slot[%d]", i);
 			return 1;
 		}
 	}
-	ILibRemoteLogging_printf(ILibChainGetLogger(g_stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...FAILED (No Matches)");
+	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...FAILED (No Matches)");
 	return 0;
 }
 
@@ -5102,6 +6596,25 @@ void ILibWebRTC_OnTurnDataIndication(ILibTURN_ClientModule turnModule, struct so
 	ILibStun_OnUDP(NULL, buffer + offset, length, remotePeer, stunModule, NULL, NULL);
 }
 
+void ILibWebRTC_OnTurnSendOK(ILibTURN_ClientModule turnModule)
+{
+	struct ILibStun_Module* stun = (struct ILibStun_Module*)ILibTURN_GetTag(turnModule);
+	struct ILibStun_dTlsSession *session;
+	int i;
+
+	// The TURN send queue drained, so every relayed session that may have been told to hold off can send again
+	for (i = 0; i < stun->dTlsSessionsSize; ++i)
+	{
+		if ((session = stun->dTlsSessions[i]) == NULL || session->state != 2 || stun->IceStates[session->iceStateSlot] == NULL || stun->IceStates[session->iceStateSlot]->useTurn == 0) continue;
+		if (session->holdingCount == 0 && stun->OnSendOK != NULL) { stun->OnSendOK(stun, session, session->User); }
+	}
+}
+
+void ILibWebRTC_SetTurnSendQueue(void* stunModule, int limit, ILibTURN_SendQueuePolicies policy)
+{
+	ILibTURN_SetSendQueue(((struct ILibStun_Module*)stunModule)->mTurnClientModule, limit, policy);
+}
+
 void ILibWebRTC_OnTurnChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length)
 {
 	void* stunModule = ILibTURN_GetTag(turnModule);
@@ -5190,6 +6703,25 @@ void ILibWebRTC_DisableConsentFreshness(void *stunModule)
 	obj->consentFreshnessDisabled = 1;
 }
 
+/*! \fn void ILibWebRTC_SetIceLite(void *stunModule, int enabled)
+\brief Switches the module to ICE-lite (RFC 8445 section 2.5)
+\par
+An ICE-lite module only answers connectivity checks, is always CONTROLLED, and advertises a=ice-lite in its offers. It doesn't run connectivity checks,
+periodic keep-alives or consent freshness probes, so it should only be used on a public address. Set it before any offers are generated or set.
+\param stunModule STUN Module
+\param enabled Non-zero to enable ICE-lite
+*/
+void ILibWebRTC_SetIceLite(void *stunModule, int enabled)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
+	obj->iceLite = enabled != 0 ? 1 : 0;
+}
+
+int ILibWebRTC_IsIceLite(void *stunModule)
+{
+	return(((struct ILibStun_Module*)stunModule)->iceLite);
+}
+
 void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char* certThumbprintSha256)
 {
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)StunModule;
@@ -5207,11 +6739,17 @@ void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char*
 }
 
 void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient_OnResult OnResult)
+{
+	return(ILibStunClient_StartEx(Chain, LocalPort, OnResult, 0));
+}
+
+void* ILibStunClient_StartEx(void *Chain, unsigned short LocalPort, ILibStunClient_OnResult OnResult, int reusePort)
 {
 	struct ILibStun_Module *obj;
 
 	if ((obj = (struct ILibStun_Module*)malloc(sizeof(struct ILibStun_Module))) == NULL) ILIBCRITICALEXIT(254);
 	memset(obj, 0, sizeof(struct ILibStun_Module));
+	ILibStun_CRC_Init();
 
 	ILibAddToChain(Chain, obj);
 
@@ -5222,8 +6760,15 @@ void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient
 	obj->LocalIf6.sin6_port = htons(LocalPort);
 	obj->Chain = Chain;
 	obj->Destroy = &ILibStun_OnDestroy;
-	obj->UDP = ILibAsyncUDPSocket_CreateEx(Chain, ILibRUDP_MaxMTU, (struct sockaddr*)&(obj->LocalIf), ILibAsyncUDPSocket_Reuse_EXCLUSIVE, &ILibStun_OnUDP, NULL, obj);
+	obj->ReusePort = reusePort;
+	obj->UDP = ILibAsyncUDPSocket_CreateEx(Chain, ILibRUDP_MaxMTU, (struct sockaddr*)&(obj->LocalIf), reusePort != 0 ? ILibAsyncUDPSocket_Reuse_BALANCED : ILibAsyncUDPSocket_Reuse_EXCLUSIVE, &ILibStun_OnShardUDP, NULL, obj);
 	if (obj->UDP == NULL) { free(obj); return NULL; }
+	ILibAsyncUDPSocket_SetReceiveBatch(obj->UDP, ILibStun_ReceiveBatchSize);
+	ILibAsyncUDPSocket_SetTransmitBatch(obj->UDP, 1, &ILibStun_OnUDPSendError);
+	// Bulk data channel traffic is a run of same size DTLS records to one peer, let the kernel segment and coalesce them where it can
+	ILibAsyncUDPSocket_SetSegmentationOffload(obj->UDP, 1);
+	ILibAsyncUDPSocket_SetReceiveOffload(obj->UDP, 1);
+	ILibAsyncUDPSocket_SetBufferAutotune(obj->UDP, ILibStun_MaxSocketBuffer, ILibStun_MaxSocketBuffer);
 #ifdef WIN32
 	obj->UDP6 = ILibAsyncUDPSocket_CreateEx(Chain, ILibRUDP_MaxMTU, (struct sockaddr*)&(obj->LocalIf6), ILibAsyncUDPSocket_Reuse_EXCLUSIVE, &ILibStun_OnUDP, NULL, obj);
 #endif
@@ -5239,15 +6784,56 @@ void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient
 	obj->Timer = ILibGetBaseTimer(Chain);
 	obj->State = STUN_STATUS_CHECKING_UDP_CONNECTIVITY;
 	util_random(32, obj->Secret); // Random used to generate integrity keys
+	obj->SessionIndex = ILibStun_Demux_CreateIndex();
+	obj->CandidateIndex = ILibStun_Demux_CreateIndex();
 
 	// Init TURN Client
 	obj->mTurnClientModule = ILibTURN_CreateTurnClient(Chain, ILibWebRTC_OnTurnConnect, ILibWebRTC_OnTurnAllocate, ILibWebRTC_OnTurnDataIndication, ILibWebRTC_OnTurnChannelData);
 	ILibTURN_SetTag(obj->mTurnClientModule, obj);
+	ILibTURN_SetSendOK(obj->mTurnClientModule, ILibWebRTC_OnTurnSendOK);
 
 	g_stunModule = obj;
 	return obj;
 }
 
+// StunModules must all have been started with reusePort on the same port, each on its own chain, and none of the chains started yet
+int ILibStunClient_JoinShards(void **StunModules, int count)
+{
+	struct ILibStun_ShardGroup *group;
+	struct ILibStun_Module *obj;
+	int i;
+
+	if (count < 1 || count > ILibStun_MaxShards) return 1;
+	for (i = 0; i < count; ++i)
+	{
+		obj = (struct ILibStun_Module*)StunModules[i];
+		if (obj == NULL || obj->ReusePort == 0 || obj->Shards != NULL || obj->LocalIf.sin_port != ((struct ILibStun_Module*)StunModules[0])->LocalIf.sin_port) return 1;
+	}
+
+	if ((group = (struct ILibStun_ShardGroup*)malloc(sizeof(struct ILibStun_ShardGroup))) == NULL) ILIBCRITICALEXIT(254);
+	memset(group, 0, sizeof(struct ILibStun_ShardGroup));
+	sem_init(&(group->Lock), 0, 1);
+	group->Count = count;
+	group->RefCount = count;
+
+	// Sessions of a shard group have to tell the certificate check which module they belong to (a lone module is g_stunModule)
+	sem_wait(&(group->Lock));
+	if (ILibStun_ModuleIndex < 0) { ILibStun_ModuleIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL); }
+	sem_post(&(group->Lock));
+
+	for (i = 0; i < count; ++i)
+	{
+		obj = (struct ILibStun_Module*)StunModules[i];
+		obj->Shards = group;
+		obj->ShardIndex = i;
+		obj->ShardRoutes = ILibHashtable_Create();
+		obj->ShardRouteList = ILibLinkedList_Create();
+		ILibLinkedList_SetTag(obj->ShardRouteList, obj);
+		group->Inbox[i].Owner = obj;
+	}
+	return 0;
+}
+
 void ILibStun_OnTimeout(void *object)
 {
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)object;
@@ -5333,12 +6919,44 @@ struct ILibTURN_TurnClientObject
 	int currentNonceLen;
 	char* currentRealm;
 	int currentRealmLen;
+
+	ILibStun_HmacSha1 integrity;	// Keyed with MD5(username:realm:password) whenever the realm changes
+	int integrityKeyed;
+
+	// Framed packets waiting for the TCP socket to drain. Each entry is [next][length][packet], linked through the first pointer
+	sem_t sendQueueLock;
+	char* sendQueueHead;
+	char* sendQueueTail;
+	int sendQueueBytes;
+	int sendQueueLimit;
+	ILibTURN_SendQueuePolicies sendQueuePolicy;
+	unsigned int sendQueueDropped;
+	unsigned long long sendQueueAccepted;	// Running total of the bytes sent or queued, see ILibTURN_GetSendPositions
+	int sendOKOwed;							// A send was queued, refused or only partly written, so OnSendOKCallback is due once the queue drains
+	ILibTURN_OnSendOKHandler OnSendOKCallback;
 };
 
+#define ILibTURN_SendQueueEntryHeader (sizeof(char*) + sizeof(int))
+
+// Frees everything in the send queue. Must be called with sendQueueLock held
+void ILibTURN_FlushSendQueue(struct ILibTURN_TurnClientObject *turn)
+{
+	char *packet;
+	while ((packet = turn->sendQueueHead) != NULL)
+	{
+		turn->sendQueueHead = ((char**)packet)[0];
+		free(packet);
+	}
+	turn->sendQueueTail = NULL;
+	turn->sendQueueBytes = 0;
+}
+
 void ILibTURN_OnDestroy(void* object)
 {
 	struct ILibTURN_TurnClientObject* turn = (struct ILibTURN_TurnClientObject*)object;
 	ILibDestroyHashTree(turn->transactionData);
+	ILibTURN_FlushSendQueue(turn);
+	sem_destroy(&(turn->sendQueueLock));
 }
 
 void ILibTURN_SetTag(ILibTURN_ClientModule clientModule, void *tag)
@@ -5442,23 +7060,27 @@ void ILibTURN_GenerateIntegrityKey(char* username, char* realm, char* password,
 	util_md5(key, keyLen, integrityKey);
 }
 
-// integrity must be at least 20 in size
-void ILibTURN_CalculateMessageIntegrity(char* buffer, int offset, int length, char* key, int keyLen, char* integrity)
+// Returns the precomputed HMAC state for the current credentials, or keys temp if we haven't been challenged for a realm yet
+ILibStun_HmacSha1* ILibTURN_GetIntegrity(struct ILibTURN_TurnClientObject *turn, ILibStun_HmacSha1 *temp)
 {
-	HMAC_CTX hmac;
-	unsigned int hmaclen = 20;
+	char integrityKey[16];
+
+	if (turn->integrityKeyed != 0) { return(&(turn->integrity)); }
 
-	// Setup and perform HMAC-SHA1
-	HMAC_CTX_init(&hmac);
-	HMAC_Init_ex(&hmac, key, keyLen, EVP_sha1(), NULL);
-	HMAC_Update(&hmac, (unsigned char*)buffer + offset, length);
-	HMAC_Final(&hmac, (unsigned char*)integrity, &hmaclen); // Put the HMAC in the outgoing result location
-	HMAC_CTX_cleanup(&hmac);
+	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
+	ILibStun_HmacSha1_Init(temp, integrityKey, 16);
+	return(temp);
+}
+
+// integrity must be at least 20 in size
+void ILibTURN_CalculateMessageIntegrity(char* buffer, int offset, int length, ILibStun_HmacSha1 *hmac, char* integrity)
+{
+	ILibStun_HmacSha1_Compute(hmac, buffer + offset, length, integrity); // Put the HMAC in the outgoing result location
 }
 
 int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
 {
-	char integrityKey[16];
+	ILibStun_HmacSha1 temp;
 	char integrity[20];
 	char* fingerprint;
 	int fingerprintLen;
@@ -5492,8 +7114,7 @@ int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char*
 		((unsigned short*)(buffer + offset))[1] = htons(tempVal - 8);
 	}
 
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
-	ILibTURN_CalculateMessageIntegrity(buffer, offset, MessageIntegrityPtr, integrityKey, 16, integrity);
+	ILibTURN_CalculateMessageIntegrity(buffer, offset, MessageIntegrityPtr, ILibTURN_GetIntegrity(turn, &temp), integrity);
 
 	// Put Length Back if we had to adjust the value due to fingerprint
 	if (fingerprintLen > 0) { ((unsigned short*)(buffer + offset))[1] = htons(tempVal); }
@@ -5632,6 +7253,8 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 					inputKeyLen = snprintf(inputKey, 128, "%s:%s:%s", turn->username, turn->currentRealm, turn->password);
 
 					util_md5(inputKey, inputKeyLen, outputKey);
+					ILibStun_HmacSha1_Init(&(turn->integrity), outputKey, 16);
+					turn->integrityKeyed = 1;
 					util_random(12, NewTransactionID);
 					ILibGetEntryEx(turn->transactionData, TransactionID, 12, &tmp, (int*)(&transport));
 					ILibDeleteEntry(turn->transactionData, TransactionID, 12); // We're going to delete our TransactionID, without adding the new one, so if we fail again, we'll abort
@@ -5644,7 +7267,7 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 					packetPtr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, packetPtr, STUN_ATTRIB_REALM, realm, realmLen);
 					packetPtr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, packetPtr, STUN_ATTRIB_USERNAME, turn->username, turn->usernameLen);
 
-					packetPtr += ILibStun_AddMessageIntegrityAttr(packet, packetPtr, outputKey, 16);
+					packetPtr += ILibStun_AddMessageIntegrityAttrEx(packet, packetPtr, &(turn->integrity));
 					packetPtr += ILibStun_AddFingerprint(packet, packetPtr);
 
 					ILibAsyncSocket_Send(turn->tcpClient, packet, packetPtr, ILibAsyncSocket_MemoryOwnership_USER);
@@ -5745,10 +7368,124 @@ void ILibTURN_TCP_OnConnect(ILibAsyncSocket_SocketModule socketModule, int Conne
 
 void ILibTURN_TCP_OnDisconnect(ILibAsyncSocket_SocketModule socketModule, void *user)
 {
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)user;
+
 	UNREFERENCED_PARAMETER(socketModule);
-	UNREFERENCED_PARAMETER(user);
 
-	// We aren't doing anything here, because when the user goes to send something, the return value will reflect that this disconnected
+	// Nothing else to do here, because when the user goes to send something, the return value will reflect that this disconnected
+	if (turn == NULL) return;
+	sem_wait(&(turn->sendQueueLock));
+	ILibTURN_FlushSendQueue(turn);
+	sem_post(&(turn->sendQueueLock));
+}
+
+// Hands queued packets to the TCP socket until it is back above its high watermark, so the queue drains at the pace the connection actually sends
+void ILibTURN_DrainSendQueue(struct ILibTURN_TurnClientObject *turn)
+{
+	char *packet;
+	int owed;
+
+	sem_wait(&(turn->sendQueueLock));
+	while ((packet = turn->sendQueueHead) != NULL && ILibAsyncSocket_IsAboveHighWatermark(turn->tcpClient) == 0)
+	{
+		turn->sendQueueHead = ((char**)packet)[0];
+		if (turn->sendQueueHead == NULL) { turn->sendQueueTail = NULL; }
+		turn->sendQueueBytes -= ((int*)(packet + sizeof(char*)))[0];
+		ILibAsyncSocket_Send(turn->tcpClient, packet + ILibTURN_SendQueueEntryHeader, ((int*)(packet + sizeof(char*)))[0], ILibAsyncSocket_MemoryOwnership_USER);
+		free(packet);
+	}
+	// Test and clear in the same critical section that queues or refuses packets, so a sender that was just pushed back isn't missed
+	owed = turn->sendQueueHead == NULL ? turn->sendOKOwed : 0;
+	if (owed != 0) { turn->sendOKOwed = 0; }
+	sem_post(&(turn->sendQueueLock));
+
+	if (owed != 0 && turn->OnSendOKCallback != NULL) { turn->OnSendOKCallback(turn); }
+}
+
+void ILibTURN_TCP_OnSendOK(ILibAsyncSocket_SocketModule socketModule, void *user)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)user;
+
+	UNREFERENCED_PARAMETER(socketModule);
+
+	if (turn == NULL) return;
+	ILibTURN_DrainSendQueue(turn);
+}
+
+void ILibTURN_TCP_OnWatermark(ILibAsyncSocket_SocketModule socketModule, int aboveHighWatermark, unsigned int pendingBytes, void *user)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)user;
+
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(pendingBytes);
+
+	// The high watermark can be reached from inside ILibTURN_SendQueued, with sendQueueLock held, and needs nothing anyway.
+	// The low watermark is only reached when the chain thread writes the socket out, so the queue can be fed from here.
+	if (turn == NULL || aboveHighWatermark != 0) return;
+	ILibTURN_DrainSendQueue(turn);
+}
+
+// Allocates a send queue entry with room for a packet of the given length. The packet goes at ILibTURN_SendQueueEntryHeader
+char* ILibTURN_AllocSendQueueEntry(int length)
+{
+	char *packet = (char*)malloc(ILibTURN_SendQueueEntryHeader + length);
+	if (packet == NULL){ ILIBCRITICALEXIT(254); }
+	((char**)packet)[0] = NULL;
+	((int*)(packet + sizeof(char*)))[0] = length;
+	return packet;
+}
+
+// Sends a framed packet, or queues it behind what the TCP socket hasn't written yet. Takes ownership of the entry.
+// If accepted isn't NULL, it gets the send position just after this packet, see ILibTURN_GetSendPositions
+enum ILibAsyncSocket_SendStatus ILibTURN_SendQueued(struct ILibTURN_TurnClientObject *turn, char* packet, unsigned long long *accepted)
+{
+	enum ILibAsyncSocket_SendStatus retVal;
+	int length = ((int*)(packet + sizeof(char*)))[0];
+	char *oldest;
+
+	sem_wait(&(turn->sendQueueLock));
+	if (turn->sendQueueHead == NULL && ILibAsyncSocket_IsAboveHighWatermark(turn->tcpClient) == 0)
+	{
+		retVal = ILibAsyncSocket_Send(turn->tcpClient, packet + ILibTURN_SendQueueEntryHeader, length, ILibAsyncSocket_MemoryOwnership_USER);
+		if (retVal == ILibAsyncSocket_ALL_DATA_SENT || retVal == ILibAsyncSocket_NOT_ALL_DATA_SENT_YET) { turn->sendQueueAccepted += length; }
+		if (retVal == ILibAsyncSocket_NOT_ALL_DATA_SENT_YET || retVal == ILibAsyncSocket_SEND_LIMIT_EXCEEDED) { turn->sendOKOwed = 1; }
+		if (accepted != NULL) { *accepted = turn->sendQueueAccepted; }
+		sem_post(&(turn->sendQueueLock));
+		free(packet);
+		return retVal;
+	}
+
+	if (turn->sendQueuePolicy == ILibTURN_SendQueuePolicy_DROP_OLDEST)
+	{
+		while ((oldest = turn->sendQueueHead) != NULL && turn->sendQueueBytes + length > turn->sendQueueLimit)
+		{
+			turn->sendQueueHead = ((char**)oldest)[0];
+			if (turn->sendQueueHead == NULL) { turn->sendQueueTail = NULL; }
+			turn->sendQueueBytes -= ((int*)(oldest + sizeof(char*)))[0];
+			turn->sendQueueDropped++;
+			free(oldest);
+		}
+	}
+
+	if (turn->sendQueueBytes + length > turn->sendQueueLimit)
+	{
+		// Tail drop (or a single packet larger than the whole queue)
+		turn->sendQueueDropped++;
+		turn->sendOKOwed = 1;
+		sem_post(&(turn->sendQueueLock));
+		free(packet);
+		return ILibAsyncSocket_SEND_LIMIT_EXCEEDED;
+	}
+
+	if (turn->sendQueueTail == NULL) { turn->sendQueueHead = packet; }
+	else { ((char**)(turn->sendQueueTail))[0] = packet; }
+	turn->sendQueueTail = packet;
+	turn->sendQueueBytes += length;
+	turn->sendQueueAccepted += length;
+	turn->sendOKOwed = 1;
+	if (accepted != NULL) { *accepted = turn->sendQueueAccepted; }
+	sem_post(&(turn->sendQueueLock));
+	return ILibAsyncSocket_NOT_ALL_DATA_SENT_YET;
 }
 
 ILibTURN_ClientModule ILibTURN_CreateTurnClient(void* chain, ILibTURN_OnConnectTurnHandler OnConnectTurn, ILibTURN_OnAllocateHandler OnAllocate, ILibTURN_OnDataIndicationHandler OnData, ILibTURN_OnChannelDataHandler OnChannelData)
@@ -5756,13 +7493,19 @@ ILibTURN_ClientModule ILibTURN_CreateTurnClient(void* chain, ILibTURN_OnConnectT
 	struct ILibTURN_TurnClientObject* retVal = (struct ILibTURN_TurnClientObject*)malloc(sizeof(struct ILibTURN_TurnClientObject));
 	if (retVal == NULL){ ILIBCRITICALEXIT(254); }
 	memset(retVal, 0, sizeof(struct ILibTURN_TurnClientObject));
+	ILibStun_CRC_Init();
 	retVal->Destroy = &ILibTURN_OnDestroy;
-	retVal->tcpClient = ILibCreateAsyncSocketModule(chain, 4096, &ILibTURN_TCP_OnData, &ILibTURN_TCP_OnConnect, &ILibTURN_TCP_OnDisconnect, NULL);
+	retVal->tcpClient = ILibCreateAsyncSocketModule(chain, 4096, &ILibTURN_TCP_OnData, &ILibTURN_TCP_OnConnect, &ILibTURN_TCP_OnDisconnect, &ILibTURN_TCP_OnSendOK);
 	retVal->OnConnectTurnCallback = OnConnectTurn;
 	retVal->OnAllocateCallback = OnAllocate;
 	retVal->OnDataIndicationCallback = OnData;
 	retVal->OnChannelDataCallback = OnChannelData;
 	retVal->transactionData = ILibInitHashTree();
+	retVal->sendQueueLimit = ILibTURN_SendQueueDefaultLimit;
+	retVal->sendQueuePolicy = ILibTURN_SendQueuePolicy_TAIL_DROP;
+	sem_init(&(retVal->sendQueueLock), 0, 1);
+	// No send limit on the socket itself: the TURN requests go straight to it and must never be refused, relayed data is capped by the send queue
+	ILibAsyncSocket_SetWatermarks(retVal->tcpClient, ILibTURN_SocketHighWatermark, ILibTURN_SocketLowWatermark, &ILibTURN_TCP_OnWatermark);
 
 	ILibAddToChain(chain, retVal);
 
@@ -5783,6 +7526,7 @@ void ILibTURN_ConnectTurnServer(ILibTURN_ClientModule turnModule, struct sockadd
 	turn->password[passwordLen] = 0;
 	turn->usernameLen = usernameLen;
 	turn->passwordLen = passwordLen;
+	turn->integrityKeyed = 0;
 
 	ILibAsyncSocket_ConnectTo(turn->tcpClient, NULL, (struct sockaddr*)turnServer, NULL, turn);
 }
@@ -5916,10 +7660,9 @@ void ILibTURN_CreatePermission(ILibTURN_ClientModule turnModule, struct sockaddr
 	char TransactionID[12];
 	int rptr, peerLen;
 	int i;
-	char integrityKey[16];
+	ILibStun_HmacSha1 temp;
 
 	util_random(12, TransactionID);																	// Random used for transaction id	
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
 
 	rptr = ILibTURN_GenerateStunFormattedPacketHeader(rbuffer, TURN_CREATE_PERMISSION, TransactionID);
 	for (i = 0; i < permissionsLength; ++i)
@@ -5932,7 +7675,7 @@ void ILibTURN_CreatePermission(ILibTURN_ClientModule turnModule, struct sockaddr
 	rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_REALM, turn->currentRealm, turn->currentRealmLen);
 	rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_NONCE, turn->currentNonce, turn->currentNonceLen);
 
-	rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integrityKey, 16);
+	rptr += ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, ILibTURN_GetIntegrity(turn, &temp));
 	rptr += ILibStun_AddFingerprint(rbuffer, rptr);
 
 	if (result != NULL)
@@ -5959,10 +7702,10 @@ enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule tu
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
 	char Address[20];
 	char TransactionID[12];
-	char *packet = (char*)malloc(50 + length);
+	char *entry = ILibTURN_AllocSendQueueEntry(60 + length);		// Header, XOR-PEER-ADDRESS, padded DATA and FINGERPRINT
+	char *packet = entry + ILibTURN_SendQueueEntryHeader;
 	int ptr, AddressLen;
 
-	if (packet == NULL){ ILIBCRITICALEXIT(254); }
 	util_random(12, TransactionID);
 	ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_SEND, TransactionID);
 	AddressLen = ILibTURN_CreateXORMappedAddress(remotePeer, Address, TransactionID);
@@ -5971,14 +7714,15 @@ enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule tu
 	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_DATA, buffer + offset, length);
 	ptr += ILibStun_AddFingerprint(packet, ptr);
 
-	return ILibAsyncSocket_Send(turn->tcpClient, packet, ptr, ILibAsyncSocket_MemoryOwnership_CHAIN);
+	((int*)(entry + sizeof(char*)))[0] = ptr;
+	return ILibTURN_SendQueued(turn, entry, NULL);
 }
 
 void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned short channelNumber, struct sockaddr_in6* remotePeer, ILibTURN_OnCreateChannelBindingHandler result, void* user)
 {
 	char TransactionID[12];
 	char Peer[20];
-	char IntegrityKey[16];
+	ILibStun_HmacSha1 temp;
 	char Packet[256];
 	char Channel[4];
 	int Ptr, PeerLen;
@@ -5987,7 +7731,6 @@ void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned sh
 
 	util_random(12, TransactionID);
 	PeerLen = ILibTURN_CreateXORMappedAddress(remotePeer, Peer, TransactionID);
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, IntegrityKey);
 	((unsigned short*)Channel)[0] = htons(channelNumber ^ 0x4000);
 	((unsigned short*)Channel)[1] = 0;
 
@@ -5998,7 +7741,7 @@ void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned sh
 	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_REALM, turn->currentRealm, turn->currentRealmLen);
 	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_NONCE, turn->currentNonce, turn->currentNonceLen);
 
-	Ptr += ILibStun_AddMessageIntegrityAttr(Packet, Ptr, IntegrityKey, 16);
+	Ptr += ILibStun_AddMessageIntegrityAttrEx(Packet, Ptr, ILibTURN_GetIntegrity(turn, &temp));
 	Ptr += ILibStun_AddFingerprint(Packet, Ptr);
 
 	if (result != NULL)
@@ -6017,22 +7760,67 @@ void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned sh
 unsigned int ILibTURN_GetPendingBytesToSend(ILibTURN_ClientModule turnModule)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
-	return ILibAsyncSocket_GetPendingBytesToSend(turn->tcpClient);
+	unsigned int retVal;
+
+	sem_wait(&(turn->sendQueueLock));
+	retVal = (unsigned int)turn->sendQueueBytes;
+	sem_post(&(turn->sendQueueLock));
+	return retVal + ILibAsyncSocket_GetPendingBytesToSend(turn->tcpClient);
 }
 
-enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length)
+void ILibTURN_GetSendPositions(ILibTURN_ClientModule turnModule, unsigned long long *accepted, unsigned long long *sent)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
-	char header[4];
-	enum ILibAsyncSocket_SendStatus retVal;
+	unsigned long long backlog;
 
-	((unsigned short*)header)[0] = htons(channelNumber ^ 0x4000);
-	((unsigned short*)header)[1] = htons((unsigned short)length);
+	// Whatever is neither in the queue nor in the socket was written, or dropped from the queue. The socket may also hold our own
+	// TURN requests, which were never counted, so this errs on the side of "not sent yet"
+	sem_wait(&(turn->sendQueueLock));
+	backlog = (unsigned long long)turn->sendQueueBytes + ILibAsyncSocket_GetPendingBytesToSend(turn->tcpClient);
+	if (accepted != NULL) { *accepted = turn->sendQueueAccepted; }
+	if (sent != NULL) { *sent = backlog < turn->sendQueueAccepted ? turn->sendQueueAccepted - backlog : 0; }
+	sem_post(&(turn->sendQueueLock));
+}
 
-	ILibAsyncSocket_Send(turn->tcpClient, header, 4, ILibAsyncSocket_MemoryOwnership_USER);
-	retVal = ILibAsyncSocket_Send(turn->tcpClient, buffer + offset, length, ILibAsyncSocket_MemoryOwnership_USER);
-	if (length % 4 > 0) { retVal = ILibAsyncSocket_Send(turn->tcpClient, header, 4 - (length % 4), ILibAsyncSocket_MemoryOwnership_USER); }
-	return retVal;
+void ILibTURN_SetSendQueue(ILibTURN_ClientModule turnModule, int limit, ILibTURN_SendQueuePolicies policy)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+
+	sem_wait(&(turn->sendQueueLock));
+	turn->sendQueueLimit = limit > 0 ? limit : ILibTURN_SendQueueDefaultLimit;
+	turn->sendQueuePolicy = policy;
+	sem_post(&(turn->sendQueueLock));
+}
+
+void ILibTURN_SetSendOK(ILibTURN_ClientModule turnModule, ILibTURN_OnSendOKHandler OnSendOK)
+{
+	((struct ILibTURN_TurnClientObject*)turnModule)->OnSendOKCallback = OnSendOK;
+}
+
+unsigned int ILibTURN_GetSendQueueDropCount(ILibTURN_ClientModule turnModule)
+{
+	return ((struct ILibTURN_TurnClientObject*)turnModule)->sendQueueDropped;
+}
+
+// Same as ILibTURN_SendChannelData, and if accepted isn't NULL, it gets the send position just after this packet
+enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelDataEx(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length, unsigned long long *accepted)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	char *entry = ILibTURN_AllocSendQueueEntry(4 + FOURBYTEBOUNDARY(length));
+	char *packet = entry + ILibTURN_SendQueueEntryHeader;
+
+	// Header, data and padding go out as one write, so they can't be split up by a send from another thread
+	((unsigned short*)packet)[0] = htons(channelNumber ^ 0x4000);
+	((unsigned short*)packet)[1] = htons((unsigned short)length);
+	memcpy(packet + 4, buffer + offset, length);
+	if (length % 4 > 0) { memset(packet + 4 + length, 0, 4 - (length % 4)); }
+
+	return ILibTURN_SendQueued(turn, entry, accepted);
+}
+
+enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length)
+{
+	return ILibTURN_SendChannelDataEx(turnModule, channelNumber, buffer, offset, length, NULL);
 }
 
 #ifdef _WEBRTCDEBUG
@@ -6128,8 +7916,7 @@ madler@alumni.caltech.edu
 
 // Software only version of CRC32C
 
-// Table for a quadword-at-a-time software crc. 
-int crc32c_once_sw = 0;
+// Table for a quadword-at-a-time software crc, built by ILibStun_CRC_Init
 unsigned int crc32c_table[8][256];
 
 // Construct table for software CRC-32C calculation.
@@ -6141,11 +7928,10 @@ void crc32c_init_sw(void)
 }
 
 // Table-driven software version as a fall-back.  This is about 15 times slower than using the hardware instructions.  This assumes little-endian integers, as is the case on Intel processors that the assembler code here is for.
-unsigned int crc32c(unsigned int crci, const void *buf, unsigned int len)
+unsigned int crc32c_sw(unsigned int crci, const void *buf, unsigned int len)
 {
 	unsigned long long crc;
 	const unsigned char *next = (const unsigned char*)buf;
-	if (crc32c_once_sw == 0) { crc32c_init_sw(); crc32c_once_sw = 1; }
 	crc = crci ^ 0xffffffff;
 	while (len && ((uintptr_t)next & 7) != 0) { crc = (unsigned long long)crc32c_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8); len--; }
 	while (len >= 8) { crc ^= *(unsigned long long *)next; crc = crc32c_table[7][crc & 0xff] ^ crc32c_table[6][(crc >> 8) & 0xff] ^ crc32c_table[5][(crc >> 16) & 0xff] ^ crc32c_table[4][(crc >> 24) & 0xff] ^ crc32c_table[3][(crc >> 32) & 0xff] ^ crc32c_table[2][(crc >> 40) & 0xff] ^ crc32c_table[1][(crc >> 48) & 0xff] ^ crc32c_table[0][crc >> 56]; next += 8; len -= 8; }
@@ -6153,3 +7939,168 @@ unsigned int crc32c(unsigned int crci, const void *buf, unsigned int len)
 	return (unsigned int)crc ^ 0xffffffff;
 }
 
+#if defined(ILibStun_CRC_X86) || defined(ILibStun_CRC_ARM64)
+// Hardware version. The crc32 instruction has a latency of 3 cycles but can start one every cycle, so long buffers are run as three
+// independent streams that are combined at the end by shifting the first two forward over the bytes that followed them.
+
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+// Tables for shifting a crc by CRC32C_LONG and CRC32C_SHORT zero bytes, built by ILibStun_CRC_Init
+unsigned int crc32c_long[4][256];
+unsigned int crc32c_short[4][256];
+
+// Multiply a matrix times a vector over the Galois field of two elements, GF(2)
+unsigned int crc32c_gf2_matrix_times(unsigned int *mat, unsigned int vec)
+{
+	unsigned int sum = 0;
+	while (vec) { if (vec & 1) { sum ^= *mat; } vec >>= 1; mat++; }
+	return sum;
+}
+
+// Multiply a matrix by itself over GF(2)
+void crc32c_gf2_matrix_square(unsigned int *square, unsigned int *mat)
+{
+	int n;
+	for (n = 0; n < 32; n++) { square[n] = crc32c_gf2_matrix_times(mat, mat[n]); }
+}
+
+// Construct an operator to apply len zeros to a crc. len must be a power of two. The result is in even
+void crc32c_zeros_op(unsigned int *even, unsigned int len)
+{
+	int n;
+	unsigned int row;
+	unsigned int odd[32];
+
+	// Put operator for one zero bit in odd
+	odd[0] = 0x82f63b78;
+	row = 1;
+	for (n = 1; n < 32; n++) { odd[n] = row; row <<= 1; }
+
+	// Put operator for two zero bits in even, then four zero bits in odd
+	crc32c_gf2_matrix_square(even, odd);
+	crc32c_gf2_matrix_square(odd, even);
+
+	// First square puts the operator for one zero byte (eight zero bits) in even, then keep squaring until len is consumed
+	do
+	{
+		crc32c_gf2_matrix_square(even, odd);
+		len >>= 1;
+		if (len == 0) { return; }
+		crc32c_gf2_matrix_square(odd, even);
+		len >>= 1;
+	} while (len);
+
+	// Answer ended up in odd
+	for (n = 0; n < 32; n++) { even[n] = odd[n]; }
+}
+
+// Take a length and build four lookup tables for applying the zeros operator for that length, byte-by-byte on the operand
+void crc32c_zeros(unsigned int zeros[][256], unsigned int len)
+{
+	unsigned int n;
+	unsigned int op[32];
+
+	crc32c_zeros_op(op, len);
+	for (n = 0; n < 256; n++)
+	{
+		zeros[0][n] = crc32c_gf2_matrix_times(op, n);
+		zeros[1][n] = crc32c_gf2_matrix_times(op, n << 8);
+		zeros[2][n] = crc32c_gf2_matrix_times(op, n << 16);
+		zeros[3][n] = crc32c_gf2_matrix_times(op, n << 24);
+	}
+}
+
+// Apply the zeros operator table to crc
+unsigned int crc32c_shift(unsigned int zeros[][256], unsigned int crc)
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+void crc32c_init_hw(void)
+{
+	crc32c_zeros(crc32c_long, CRC32C_LONG);
+	crc32c_zeros(crc32c_short, CRC32C_SHORT);
+}
+
+#if defined(ILibStun_CRC_ARM64)
+	#define CRC32C_TARGET ILibStun_TARGET_ARMCRC
+	#define CRC32C_WORD(crc, p) { unsigned long long w; memcpy(&w, (p), 8); crc = __crc32cd(crc, w); }
+	#define CRC32C_BYTE(crc, b) crc = __crc32cb(crc, b)
+#elif defined(_M_X64) || defined(__x86_64__)
+	#define CRC32C_TARGET ILibStun_TARGET_SSE42
+	#define CRC32C_WORD(crc, p) { unsigned long long w; memcpy(&w, (p), 8); crc = (unsigned int)_mm_crc32_u64(crc, w); }
+	#define CRC32C_BYTE(crc, b) crc = _mm_crc32_u8(crc, b)
+#else
+	#define CRC32C_TARGET ILibStun_TARGET_SSE42
+	#define CRC32C_WORD(crc, p) { unsigned int w[2]; memcpy(w, (p), 8); crc = _mm_crc32_u32(crc, w[0]); crc = _mm_crc32_u32(crc, w[1]); }
+	#define CRC32C_BYTE(crc, b) crc = _mm_crc32_u8(crc, b)
+#endif
+
+// Compute CRC-32C using the SSE 4.2 crc32 instruction, or the ARMv8 crc32c instructions
+CRC32C_TARGET unsigned int crc32c_hw(unsigned int crci, const void *buf, unsigned int len)
+{
+	const unsigned char *next = (const unsigned char*)buf;
+	const unsigned char *end;
+	unsigned int crc0, crc1, crc2;
+
+	crc0 = crci ^ 0xffffffff;
+
+	// Compute the crc on sets of CRC32C_LONG*3 bytes, executing three independent crc instructions, each on CRC32C_LONG bytes
+	while (len >= CRC32C_LONG * 3)
+	{
+		crc1 = 0;
+		crc2 = 0;
+		end = next + CRC32C_LONG;
+		do
+		{
+			CRC32C_WORD(crc0, next);
+			CRC32C_WORD(crc1, next + CRC32C_LONG);
+			CRC32C_WORD(crc2, next + CRC32C_LONG + CRC32C_LONG);
+			next += 8;
+		} while (next < end);
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+		next += CRC32C_LONG * 2;
+		len -= CRC32C_LONG * 3;
+	}
+
+	// Do the same thing, but now on CRC32C_SHORT*3 blocks for the remaining data less than a CRC32C_LONG*3 block
+	while (len >= CRC32C_SHORT * 3)
+	{
+		crc1 = 0;
+		crc2 = 0;
+		end = next + CRC32C_SHORT;
+		do
+		{
+			CRC32C_WORD(crc0, next);
+			CRC32C_WORD(crc1, next + CRC32C_SHORT);
+			CRC32C_WORD(crc2, next + CRC32C_SHORT + CRC32C_SHORT);
+			next += 8;
+		} while (next < end);
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+		next += CRC32C_SHORT * 2;
+		len -= CRC32C_SHORT * 3;
+	}
+
+	// Compute the crc on the remaining eight-byte units less than a CRC32C_SHORT*3 block
+	while (len >= 8) { CRC32C_WORD(crc0, next); next += 8; len -= 8; }
+
+	// Compute the crc for up to seven leftover bytes
+	while (len) { CRC32C_BYTE(crc0, *next); next++; len--; }
+
+	return crc0 ^ 0xffffffff;
+}
+#endif
+
+// Compute CRC-32C (RFC4960 SCTP checksum) using the hardware instructions if the CPU has them, otherwise the software version
+unsigned int crc32c(unsigned int crci, const void *buf, unsigned int len)
+{
+#if defined(ILibStun_CRC_X86)
+	if ((ILibStun_CRC_Features & ILibStun_CRC_Feature_SSE42) != 0) { return crc32c_hw(crci, buf, len); }
+#elif defined(ILibStun_CRC_ARM64)
+	if ((ILibStun_CRC_Features & ILibStun_CRC_Feature_ARMCRC) != 0) { return crc32c_hw(crci, buf, len); }
+#endif
+	return crc32c_sw(crci, buf, len);
+}
@@ -20,7 +20,8 @@ limitations under the License.
 
 typedef enum
 {
-	ILibWebRTC_SDP_Flags_DTLS_SERVER = 0x2
+	ILibWebRTC_SDP_Flags_DTLS_SERVER = 0x2,
+	ILibWebRTC_SDP_Flags_ICE_LITE = 0x4		// Sender only answers connectivity checks (a=ice-lite), the other side must be controlling
 } ILibWebRTC_SDP_Flags;
 
 typedef enum
@@ -54,21 +55,32 @@ typedef enum
 
 #define ILibStun_SlotToChar(val) (val>26?(val+97):(val+65))
 #define ILibStun_CharToSlot(val) (val>=97?(val-97):(val-65))
+#define ILibStun_MaxShards 16	// Shard index is encoded as an upper case letter in the ICE username
+#define ILibStun_SlotChars 4	// Leading characters of a generated ICE username that carry the IceState slot
+#define ILibStun_UsernameLength 12	// Generated ICE username: the slot, the shard and at least 28 random bits
 
 // STUN & ICE related methods
 typedef void(*ILibStunClient_OnResult)(void* StunModule, ILibStun_Results Result, struct sockaddr_in* PublicIP, void *user);
 void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char* certThumbprintSha256);
 void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient_OnResult OnResult);
+// reusePort binds with SO_REUSEPORT, so several modules on different chains can share LocalPort, see ILibStunClient_JoinShards
+void* ILibStunClient_StartEx(void *Chain, unsigned short LocalPort, ILibStunClient_OnResult OnResult, int reusePort);
+// Ties modules sharing a port into one group, so each peer is served by the module that created its offer. Call before starting the chains. Returns 0 on success
+int ILibStunClient_JoinShards(void **StunModules, int count);
 void ILibStunClient_PerformNATBehaviorDiscovery(void* StunModule, struct sockaddr_in* StunServer, void *user);
 void ILibStunClient_PerformStun(void* StunModule, struct sockaddr_in* StunServer, void *user);
 void ILibStunClient_SendData(void* StunModule, struct sockaddr* target, char* data, int datalen, enum ILibAsyncSocket_MemoryOwnership UserFree);
 int ILibStun_SetIceOffer(void* StunModule, char* iceOffer, int iceOfferLen, char** answer);
 int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, char *username, int usernameLength, char* password, int passwordLength, char** answer);
 int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, char* password);
+// Trickle ICE: adds a remote candidate to the offer localUsername was generated for, and starts checking it. Returns 0 on success
+int ILibStun_AddIceCandidate(void* StunModule, char* localUsername, struct sockaddr_in6 *candidate);
 unsigned int ILibStun_CRC32(char *buf, int len);
 int ILib_Stun_GetAttributeChangeRequestPacket(int flags, char* TransactionId, char* rbuffer);
 int ILibStun_ProcessStunPacket(void* obj, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface);
 void ILibStun_ClearIceState(void* stunModule, int iceSlot);
+// Returns the IceState slot encoded in a username generated by this module, or -1 if it doesn't carry one
+int ILibStun_UsernameToSlot(char* username);
 
 
 // WebRTC Related Methods
@@ -91,9 +103,13 @@ typedef void(*ILibWebRTC_OnDataChannelClosed)(void *StunModule, void* WebRTCModu
 typedef void(*ILibWebRTC_OnDataChannelAck)(void *StunModule, void* WebRTCModule, unsigned short StreamId);
 typedef void(*ILibWebRTC_OnOfferUpdated)(void* stunModule, char* iceOffer, int iceOfferLen);
 void ILibWebRTC_SetCallbacks(void *StunModule, ILibWebRTC_OnDataChannel OnDataChannel, ILibWebRTC_OnDataChannelClosed OnDataChannelClosed, ILibWebRTC_OnDataChannelAck OnDataChannelAck, ILibWebRTC_OnOfferUpdated OnOfferUpdated);
+// username must hold ILibStun_UsernameLength characters, it is not null terminated
 void ILibStun_DTLS_GetIceUserName(void* WebRTCModule, char* username);
 void ILibWebRTC_SetTurnServer(void* stunModule, struct sockaddr_in6* turnServer, char* username, int usernameLength, char* password, int passwordLength, ILibWebRTC_TURN_ConnectFlags turnFlags);
 void ILibWebRTC_DisableConsentFreshness(void *stunModule);
+// ICE-lite (RFC 8445 section 2.5), for endpoints on a public address. Only answers connectivity checks and waits for the peer to nominate. Set before generating or setting offers
+void ILibWebRTC_SetIceLite(void *stunModule, int enabled);
+int ILibWebRTC_IsIceLite(void *stunModule);
 
 void ILibWebRTC_SetUserObject(void *stunModule, char* localUsername, void *userObject);
 void* ILibWebRTC_GetUserObject(void *stunModule, char* localUsername);
@@ -122,6 +138,8 @@ void ILibSCTP_Resume(void* module);
 void ILibSCTP_SetCallbacks(void* StunModule, ILibSCTP_OnConnect onconnect, ILibSCTP_OnData ondata, ILibSCTP_OnSendOK onsendok);
 ILibTransport_DoneState ILibSCTP_Send(void* module, unsigned short streamId, char* data, int datalen);
 ILibTransport_DoneState ILibSCTP_SendEx(void* module, unsigned short streamId, char* data, int datalen, int dataType);
+// Bytes this session is holding back. A session relayed over TURN also counts the whole backlog of the TURN client, which is shared
+// by every relayed session, so the sum over several sessions counts that backlog more than once
 int ILibSCTP_GetPendingBytesToSend(void* module);
 void ILibSCTP_Close(void* module);
 
@@ -146,11 +164,17 @@ typedef void(*ILibTURN_OnCreatePermissionHandler)(ILibTURN_ClientModule turnModu
 typedef void(*ILibTURN_OnDataIndicationHandler)(ILibTURN_ClientModule turnModule, struct sockaddr_in6* remotePeer, char* buffer, int offset, int length);
 typedef void(*ILibTURN_OnCreateChannelBindingHandler)(ILibTURN_ClientModule turnModule, unsigned short channelNumber, int success, void* user);
 typedef void(*ILibTURN_OnChannelDataHandler)(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length);
+typedef void(*ILibTURN_OnSendOKHandler)(ILibTURN_ClientModule turnModule);
 typedef enum 
 {
 	ILibTURN_TransportTypes_UDP = 17,
 	ILibTURN_TransportTypes_TCP = 6 
 }ILibTURN_TransportTypes;
+typedef enum
+{
+	ILibTURN_SendQueuePolicy_TAIL_DROP = 0,		// A full queue refuses new packets
+	ILibTURN_SendQueuePolicy_DROP_OLDEST = 1	// A full queue discards from the front to make room
+}ILibTURN_SendQueuePolicies;
 
 ILibTURN_ClientModule ILibTURN_CreateTurnClient(void* chain, ILibTURN_OnConnectTurnHandler OnConnectTurn, ILibTURN_OnAllocateHandler OnAllocate, ILibTURN_OnDataIndicationHandler OnData, ILibTURN_OnChannelDataHandler OnChannelData);
 void ILibTURN_SetTag(ILibTURN_ClientModule clientModule, void *tag);
@@ -164,5 +188,15 @@ enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule tu
 void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned short channelNumber, struct sockaddr_in6* remotePeer, ILibTURN_OnCreateChannelBindingHandler result, void* user);
 enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length);
 int ILibTURN_IsConnectedToServer(ILibTURN_ClientModule clientModule);
+// Bytes the TCP socket hasn't written yet, plus the bytes waiting in the send queue
 unsigned int ILibTURN_GetPendingBytesToSend(ILibTURN_ClientModule turnModule);
+// Running byte counts: 'accepted' is everything sent or queued so far, 'sent' how much of that has left the queue and the TCP socket (either may be NULL)
+void ILibTURN_GetSendPositions(ILibTURN_ClientModule turnModule, unsigned long long *accepted, unsigned long long *sent);
+// Packets sent while the TCP socket is above its high watermark wait in a queue of up to 'limit' bytes (0 for the default), instead of piling up in the socket
+void ILibTURN_SetSendQueue(ILibTURN_ClientModule turnModule, int limit, ILibTURN_SendQueuePolicies policy);
+// Called when the send queue has drained, after a send was queued, refused or only partly written
+void ILibTURN_SetSendOK(ILibTURN_ClientModule turnModule, ILibTURN_OnSendOKHandler OnSendOK);
+unsigned int ILibTURN_GetSendQueueDropCount(ILibTURN_ClientModule turnModule);
+// Sets the send queue of the WebRTC module's TURN client. Data channels relayed over it report backpressure while the queue is filling, and get OnSendOK once it drains
+void ILibWebRTC_SetTurnSendQueue(void* stunModule, int limit, ILibTURN_SendQueuePolicies policy);
 
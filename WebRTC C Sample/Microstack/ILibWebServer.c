@@ -41,12 +41,21 @@ limitations under the License.
 
 #ifndef MICROSTACK_NOTLS
 #include <openssl/sha.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
 #include "../core/utils.h"
 #else
 #include "sha1.h"
 #endif
 #include "ILibRemoteLogging.h"
 
+#ifdef MICROSTACK_SENDFILE
+#include <sys/stat.h>
+#endif
+#if defined(_POSIX) && !defined(__APPLE__)
+#include <sched.h>
+#endif
+
 #define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 #define WEBSOCKET_FIN		0x08000
 #define WEBSOCKET_RSV1		0x04000
@@ -58,6 +67,9 @@ limitations under the License.
 
 #define WEBSOCKET_MAX_OUTPUT_FRAMESIZE 4096
 
+#define ILibWebServer_StreamFile_BlockSize 65536			// Read size when a file has to be streamed through user space (TLS)
+#define ILibWebServer_StreamFile_MaxSegment 0x40000000		// Largest single sendfile() segment, larger files are sent as several chunks
+
 #define WEBSOCKET_OPCODE_FRAMECONT		0x0
 #define WEBSOCKET_OPCODE_TEXTFRAME		0x1
 #define WEBSOCKET_OPCODE_BINARYFRAME	0x2
@@ -92,6 +104,46 @@ struct ILibWebServer_VirDir_Data
 	void *user;
 };
 
+#ifdef MICROSTACK_SENDFILE
+// The part of a file that is still to be queued with sendfile(). Segments are queued as the send limit allows.
+struct ILibWebServer_SendFileState
+{
+	int fd;				// Ours until the last segment is queued, that segment hands it to the socket
+	int chunked;
+	off_t offset;
+	off_t remaining;
+};
+
+// Private method that drops the sendfile() state of a session. Queued segments refer to the descriptor,
+// so this is only called once they were all queued, or the socket is closed and dropped them.
+void ILibWebServer_StreamFile_FreeSendFile(struct ILibWebServer_Session *session)
+{
+	struct ILibWebServer_SendFileState *state = (struct ILibWebServer_SendFileState*)session->Reserved_SendFile;
+
+	if (state == NULL) return;
+	session->Reserved_SendFile = NULL;
+	if (state->fd >= 0) { close(state->fd); }
+	free(state);
+}
+#endif
+
+#ifndef MICROSTACK_NOTLS
+typedef struct ILibWebServer_TicketKey
+{
+	unsigned char Name[16];
+	unsigned char AESKey[16];
+	unsigned char HMACKey[16];
+}ILibWebServer_TicketKey;
+
+// The session ticket keys of an SSL_CTX. They are shared by every ILibWebServer using that SSL_CTX, such as the members of an ILibWebServer_Group.
+typedef struct ILibWebServer_TicketKeys
+{
+	int RefCount;						// Number of servers that enabled session tickets on the SSL_CTX
+	long long Rotated;					// Uptime of the last rotation. Each server runs a rotation timer, the first one that is due rotates.
+	ILibWebServer_TicketKey Keys[2];	// [0] issues new tickets, [1] is the previous key, still accepted so tickets survive a rotation
+}ILibWebServer_TicketKeys;
+#endif
+
 typedef struct ILibWebServer_StateModule
 {
 	void(*PreSelect)(void* object, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime);
@@ -107,10 +159,157 @@ typedef struct ILibWebServer_StateModule
 	void *VirtualDirectoryTable;
 
 	int DigestAuth_NonceDuration;
+	int AutoCork;		// Non-zero to cork new sessions while OnReceive runs, see ILibWebServer_SetAutoCork
 
 	void(*OnSession)(struct ILibWebServer_Session *SessionToken, void *User);
+
+#ifndef MICROSTACK_NOTLS
+	SSL_CTX *ssl_ctx;
+	int TicketKeyRotation;					// Seconds between ticket key changes, zero if we are not managing the ticket keys
+	ILibWebServer_TicketKeys *TicketKeys;	// The keys of ssl_ctx, NULL if we are not managing the ticket keys
+	ILibAsyncSocket_TLSHandshakeStats TLSStats;
+#endif
 }ILibWebServer_StateModule;
 
+// A set of ILibWebServers sharing a port through SO_REUSEPORT, each on its own chain and thread
+struct ILibWebServer_GroupMember
+{
+	struct ILibWebServer_Group *Group;
+	void *Chain;
+	ILibWebServer_ServerToken Server;
+	int Index;
+};
+struct ILibWebServer_Group
+{
+	int Count;
+	int Flags;
+	int Started;
+	unsigned short PortNumber;
+	sem_t Exited;	// Posted by each thread of the group, when its chain exits
+	struct ILibWebServer_GroupMember *Members;
+};
+
+#ifndef MICROSTACK_NOTLS
+static int ILibWebServer_TicketKeyIndex = -1;	// SSL_CTX ex_data slot that points to the ILibWebServer_TicketKeys of the SSL_CTX
+static sem_t ILibWebServer_TicketKeyLock;		// Guards the ticket keys of every SSL_CTX, servers on different chains use them
+
+//
+// Internal method that creates a new session ticket key, and keeps the current one around as the previous key. Caller holds ILibWebServer_TicketKeyLock.
+//
+// <param name="module">The ILibWebServer</param>
+void ILibWebServer_TicketKey_Rotate(struct ILibWebServer_StateModule *module)
+{
+	ILibWebServer_TicketKey *keys = module->TicketKeys->Keys;
+
+	memcpy(&(keys[1]), &(keys[0]), sizeof(ILibWebServer_TicketKey));
+	if (RAND_bytes((unsigned char*)&(keys[0]), sizeof(ILibWebServer_TicketKey)) != 1)
+	{
+		// Without a good key we must not issue tickets, the previous key will be dropped at the next rotation
+		memcpy(&(keys[0]), &(keys[1]), sizeof(ILibWebServer_TicketKey));
+		ILibRemoteLogging_printf(ILibChainGetLogger(module->Chain), ILibRemoteLogging_Modules_Microstack_Web, ILibRemoteLogging_Flags_VerbosityLevel_1, "WebServer: Session ticket key rotation failed");
+	}
+	module->TicketKeys->Rotated = ILibGetUptime();
+}
+
+//
+// Internal timed callback to rotate the session ticket keys
+//
+void ILibWebServer_TicketKey_RotateSink(void *object)
+{
+	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+
+	// Other servers sharing the SSL_CTX run their own timers, only rotate if none of them just did
+	sem_wait(&ILibWebServer_TicketKeyLock);
+	if (ILibGetUptime() - module->TicketKeys->Rotated >= (long long)module->TicketKeyRotation * 500) { ILibWebServer_TicketKey_Rotate(module); }
+	sem_post(&ILibWebServer_TicketKeyLock);
+	ILibLifeTime_Add(module->LifeTime, module, module->TicketKeyRotation, &ILibWebServer_TicketKey_RotateSink, NULL);
+}
+
+//
+// Session ticket callback dispatched by OpenSSL, to encrypt a new ticket (enc = 1) or to find the key of a ticket presented by a client (enc = 0)
+//
+// Returns -1 on error, 0 if the ticket key is unknown (full handshake), 1 to accept the ticket, 2 to accept it and issue a new one
+int ILibWebServer_TicketKey_Callback(SSL *s, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+{
+	ILibWebServer_TicketKeys *keys;
+	int i, RetVal = 0;
+
+	sem_wait(&ILibWebServer_TicketKeyLock);
+	if ((keys = (ILibWebServer_TicketKeys*)SSL_CTX_get_ex_data(SSL_get_SSL_CTX(s), ILibWebServer_TicketKeyIndex)) == NULL)
+	{
+		RetVal = enc != 0 ? -1 : 0;
+	}
+	else if (enc != 0)
+	{
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) != 1)
+		{
+			RetVal = -1;
+		}
+		else
+		{
+			memcpy(name, keys->Keys[0].Name, sizeof(keys->Keys[0].Name));
+			EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, keys->Keys[0].AESKey, iv);
+			HMAC_Init_ex(hctx, keys->Keys[0].HMACKey, sizeof(keys->Keys[0].HMACKey), EVP_sha256(), NULL);
+			RetVal = 1;
+		}
+	}
+	else
+	{
+		for (i = 0; i < 2; ++i)
+		{
+			if (memcmp(name, keys->Keys[i].Name, sizeof(keys->Keys[i].Name)) == 0)
+			{
+				HMAC_Init_ex(hctx, keys->Keys[i].HMACKey, sizeof(keys->Keys[i].HMACKey), EVP_sha256(), NULL);
+				EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, keys->Keys[i].AESKey, iv);
+				RetVal = i == 0 ? 1 : 2;
+				break;
+			}
+		}
+	}
+	sem_post(&ILibWebServer_TicketKeyLock);
+	return(RetVal);
+}
+
+//
+// Internal method that makes a server use the ticket keys of its SSL_CTX, the first server to do so creates them
+//
+void ILibWebServer_TicketKey_Attach(struct ILibWebServer_StateModule *module)
+{
+	sem_wait(&ILibWebServer_TicketKeyLock);
+	module->TicketKeys = (ILibWebServer_TicketKeys*)SSL_CTX_get_ex_data(module->ssl_ctx, ILibWebServer_TicketKeyIndex);
+	if (module->TicketKeys == NULL)
+	{
+		if ((module->TicketKeys = (ILibWebServer_TicketKeys*)malloc(sizeof(ILibWebServer_TicketKeys))) == NULL) ILIBCRITICALEXIT(254);
+		memset(module->TicketKeys, 0, sizeof(ILibWebServer_TicketKeys));
+
+		// Start with two fresh keys, so nothing matches the previous key yet
+		ILibWebServer_TicketKey_Rotate(module);
+		ILibWebServer_TicketKey_Rotate(module);
+		SSL_CTX_set_ex_data(module->ssl_ctx, ILibWebServer_TicketKeyIndex, module->TicketKeys);
+		SSL_CTX_set_tlsext_ticket_key_cb(module->ssl_ctx, &ILibWebServer_TicketKey_Callback);
+	}
+	++module->TicketKeys->RefCount;
+	sem_post(&ILibWebServer_TicketKeyLock);
+}
+
+//
+// Internal method that releases the ticket keys of a server. The last server using an SSL_CTX hands ticket encryption back to OpenSSL, as the SSL_CTX may outlive us.
+//
+void ILibWebServer_TicketKey_Detach(struct ILibWebServer_StateModule *module)
+{
+	sem_wait(&ILibWebServer_TicketKeyLock);
+	if (--module->TicketKeys->RefCount == 0)
+	{
+		SSL_CTX_set_tlsext_ticket_key_cb(module->ssl_ctx, NULL);
+		SSL_CTX_set_ex_data(module->ssl_ctx, ILibWebServer_TicketKeyIndex, NULL);
+		OPENSSL_cleanse(module->TicketKeys, sizeof(ILibWebServer_TicketKeys));
+		free(module->TicketKeys);
+	}
+	module->TicketKeys = NULL;
+	sem_post(&ILibWebServer_TicketKeyLock);
+}
+#endif
+
 unsigned int ILibWebServer_Session_GetPendingBytesToSend(struct ILibWebServer_Session *session)
 {
 	return(ILibAsyncServerSocket_GetPendingBytesToSend(session->Reserved1, session->Reserved2));
@@ -184,6 +383,9 @@ void ILibWebServer_Destroy(void *object)
 		ILibHashTree_DestroyEnumerator(en);
 		ILibDestroyHashTree(s->VirtualDirectoryTable);
 	}
+#ifndef MICROSTACK_NOTLS
+	if (s->TicketKeys != NULL) { ILibWebServer_TicketKey_Detach(s); }
+#endif
 }
 //
 // Internal method dispatched from the underlying WebClient engine
@@ -449,6 +651,10 @@ void ILibWebServer_OnConnect(void *AsyncServerSocketModule, void *ConnectionToke
 	ws->Reserved3 = ILibCreateWebClientEx(&ILibWebServer_OnResponse, ConnectionToken, wsm, ws);
 	ws->User = wsm->User;
 	*user = ws;
+#ifndef MICROSTACK_NOTLS
+	// For TLS sessions, this is only called once the handshake is done
+	ILibAsyncSocket_TLSHandshakeStats_Add(&(wsm->TLSStats), ConnectionToken);
+#endif
 #if defined(MAX_HTTP_PACKET_SIZE)
 	ILibAsyncSocket_SetMaximumBufferSize(ConnectionToken, MAX_HTTP_PACKET_SIZE, &ILibWebServer_OnBufferSizeExceeded, ws);
 #endif	
@@ -458,6 +664,11 @@ void ILibWebServer_OnConnect(void *AsyncServerSocketModule, void *ConnectionToke
 	//
 	ILibAsyncServerSocket_SetReAllocateNotificationCallback(AsyncServerSocketModule, ConnectionToken, &ILibWebServer_OnBufferReAllocated);
 
+	//
+	// Responses written from OnReceive (headers, body, chunk markers) are flushed together when it returns
+	//
+	if (wsm->AutoCork != 0) { ILibAsyncSocket_SetAutoCork(ConnectionToken, 1); }
+
 	//
 	// Add a timed callback, because if we don't receive a request within a specified
 	// amount of time, we want to close the socket, so we don't waste resources
@@ -513,6 +724,11 @@ void ILibWebServer_OnDisconnect(void *AsyncServerSocketModule, void *ConnectionT
 
 	SESSION_TRACK(ws, "OnDisconnect");
 
+#ifdef MICROSTACK_SENDFILE
+	// The socket dropped whatever segments were still queued, so the file can be closed
+	ILibWebServer_StreamFile_FreeSendFile(ws);
+#endif
+
 	if (ws->Reserved_WebSocket_Request != NULL && ws->OnReceive != NULL)
 	{
 		int tmp_ptr = 0;
@@ -884,15 +1100,85 @@ void ILibWebServer_OnSendOK(void *AsyncServerSocketModule, void *ConnectionToken
 void ILibWebServer_SetTLS(ILibWebServer_ServerToken object, void *ssl_ctx, int enableTLSDetect)
 {
 	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+	module->ssl_ctx = (SSL_CTX*)ssl_ctx;
 	ILibAsyncServerSocket_SetSSL_CTX(module->ServerSocket, ssl_ctx, enableTLSDetect);
 }
 #else
 void ILibWebServer_SetTLS(ILibWebServer_ServerToken object, void *ssl_ctx)
 {
 	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+	module->ssl_ctx = (SSL_CTX*)ssl_ctx;
 	ILibAsyncServerSocket_SetSSL_CTX(module->ServerSocket, ssl_ctx);
 }
 #endif
+
+// Enables kernel TLS offload on the sessions of this server, falls back silently if the kernel can't do it
+int ILibWebServer_SetKernelTLS(ILibWebServer_ServerToken object, int enable)
+{
+	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+	return(ILibAsyncServerSocket_SetKernelTLS(module->ServerSocket, enable));
+}
+
+/*! \fn ILibWebServer_SetTLSSessionResumption(ILibWebServer_ServerToken object, int cacheSize, int ticketKeyRotation)
+\brief Configures how returning TLS clients can skip the full handshake
+\par
+Clients can resume a session either by session ID, which requires a server side cache entry, or with a session ticket (RFC 5077),
+which is encrypted with a key only the server knows. The ticket keys are generated here and replaced every \a ticketKeyRotation seconds.
+Tickets issued with the previous key are still accepted, and renewed, so a ticket is valid for at least one rotation period.
+Must be called after \a ILibWebServer_SetTLS. Note that this sets the session ID context of the SSL_CTX, and changes its session timeout.
+\param object The ILibWebServer to configure
+\param cacheSize The maximum number of sessions in the server side cache. Zero disables the cache.
+\param ticketKeyRotation The lifetime of a ticket key in seconds. Zero disables session tickets.
+\returns Zero if TLS is not set on this server
+*/
+int ILibWebServer_SetTLSSessionResumption(ILibWebServer_ServerToken object, int cacheSize, int ticketKeyRotation)
+{
+	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+	if (module->ssl_ctx == NULL) return(0);
+
+	if (cacheSize > 0)
+	{
+		SSL_CTX_set_session_cache_mode(module->ssl_ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(module->ssl_ctx, cacheSize);
+	}
+	else
+	{
+		SSL_CTX_set_session_cache_mode(module->ssl_ctx, SSL_SESS_CACHE_OFF);
+	}
+	SSL_CTX_set_session_id_context(module->ssl_ctx, (const unsigned char*)"ILibWebServer", 13);
+
+	ILibLifeTime_Remove(module->LifeTime, module);
+	if (ticketKeyRotation > 0)
+	{
+		if (module->TicketKeys == NULL) { ILibWebServer_TicketKey_Attach(module); }
+		module->TicketKeyRotation = ticketKeyRotation;
+
+		// A ticket is good for up to two rotations, the cache entry and the ticket lifetime hint follow that
+		SSL_CTX_set_timeout(module->ssl_ctx, 2 * ticketKeyRotation);
+		SSL_CTX_clear_options(module->ssl_ctx, SSL_OP_NO_TICKET);
+		ILibLifeTime_Add(module->LifeTime, module, ticketKeyRotation, &ILibWebServer_TicketKey_RotateSink, NULL);
+	}
+	else
+	{
+		if (module->TicketKeys != NULL) { ILibWebServer_TicketKey_Detach(module); }
+		module->TicketKeyRotation = 0;
+
+		// Other servers sharing the SSL_CTX may still issue tickets
+		if (SSL_CTX_get_ex_data(module->ssl_ctx, ILibWebServer_TicketKeyIndex) == NULL) { SSL_CTX_set_options(module->ssl_ctx, SSL_OP_NO_TICKET); }
+	}
+	return(1);
+}
+
+/*! \fn ILibWebServer_GetTLSHandshakeStats(ILibWebServer_ServerToken object, ILibAsyncSocket_TLSHandshakeStats *stats)
+\brief Fetches the number and duration of the full and resumed TLS handshakes done by this server
+\param object The ILibWebServer to query
+\param[out] stats The running totals
+*/
+void ILibWebServer_GetTLSHandshakeStats(ILibWebServer_ServerToken object, ILibAsyncSocket_TLSHandshakeStats *stats)
+{
+	struct ILibWebServer_StateModule *module = (struct ILibWebServer_StateModule*)object;
+	memcpy(stats, &(module->TLSStats), sizeof(ILibAsyncSocket_TLSHandshakeStats));
+}
 #endif
 
 /*! \fn ILibWebServer_Create(void *Chain, int MaxConnections, int PortNumber,ILibWebServer_Session_OnSession OnSession, void *User)
@@ -904,12 +1190,29 @@ void ILibWebServer_SetTLS(ILibWebServer_ServerToken object, void *ssl_ctx)
 \param User User state object to pass to OnSession
 */
 ILibWebServer_ServerToken ILibWebServer_CreateEx(void *Chain, int MaxConnections, unsigned short PortNumber, int loopbackFlag, ILibWebServer_Session_OnSession OnSession, void *User)
+{
+	return(ILibWebServer_CreateEx2(Chain, MaxConnections, PortNumber, loopbackFlag, 0, OnSession, User));
+}
+
+//
+// Internal constructor, that can also make the listening socket part of an SO_REUSEPORT group
+//
+ILibWebServer_ServerToken ILibWebServer_CreateEx2(void *Chain, int MaxConnections, unsigned short PortNumber, int loopbackFlag, int reusePort, ILibWebServer_Session_OnSession OnSession, void *User)
 {
 	struct ILibWebServer_StateModule *RetVal = (struct ILibWebServer_StateModule*)malloc(sizeof(struct ILibWebServer_StateModule));
 
 	if (RetVal == NULL) { PRINTERROR(); return NULL; }
 	memset(RetVal, 0, sizeof(struct ILibWebServer_StateModule));
 	RetVal->Destroy = &ILibWebServer_Destroy;
+
+#ifndef MICROSTACK_NOTLS
+	// Servers are created before their chains are started, so the first one can set up the ticket key state shared by all of them
+	if (ILibWebServer_TicketKeyIndex < 0)
+	{
+		sem_init(&ILibWebServer_TicketKeyLock, 0, 1);
+		ILibWebServer_TicketKeyIndex = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+	}
+#endif
 	RetVal->Chain = Chain;
 	RetVal->OnSession = OnSession;
 	RetVal->DigestAuth_NonceDuration = DIGEST_AUTHENTICATION_NONCE_DEFAULT_DURATION_MINUTES;
@@ -917,12 +1220,13 @@ ILibWebServer_ServerToken ILibWebServer_CreateEx(void *Chain, int MaxConnections
 	//
 	// Create the underling ILibAsyncServerSocket
 	//
-	RetVal->ServerSocket = ILibCreateAsyncServerSocketModule(
+	RetVal->ServerSocket = ILibCreateAsyncServerSocketModuleEx(
 		Chain,
 		MaxConnections,
 		PortNumber,
 		INITIAL_BUFFER_SIZE,
 		loopbackFlag,
+		reusePort,
 		&ILibWebServer_OnConnect,			// OnConnect
 		&ILibWebServer_OnDisconnect,		// OnDisconnect
 		&ILibWebServer_OnReceive,			// OnReceive
@@ -953,6 +1257,228 @@ unsigned short ILibWebServer_GetPortNumber(ILibWebServer_ServerToken WebServerTo
 	return ILibAsyncServerSocket_GetPortNumber(WSM->ServerSocket);
 }
 
+/*! \fn ILibWebServer_Group_Create(int count, int MaxConnections, unsigned short PortNumber, int loopbackFlag, int flags, ILibWebServer_Session_OnSession OnSession, void *User)
+\brief Creates a group of ILibWebServers listening on the same port, each on its own chain and thread
+\par
+Every server has its own SO_REUSEPORT listening socket, and the kernel spreads the incoming connections across them,
+so the group scales with the number of cores. Configure the group, and register the virtual directories with
+\a ILibWebServer_Group_RegisterVirtualDirectory, before calling \a ILibWebServer_Group_Start.
+<B>Note:</B> \a OnSession and the virtual directory handlers are called concurrently, from every thread of the group.
+\param count The number of servers (and threads), 0 for one per CPU
+\param MaxConnections The maximum number of simultaneous connections of each server
+\param PortNumber The Port number to listen to (0 = Random)
+\param loopbackFlag 0 to bind to ANY, 1 to bind to IPv6 loopback first, 2 to bind to IPv4 loopback first
+\param flags \a ILibWebServer_Group_Flags_CPU_AFFINITY to pin each thread to a CPU, and steer each connection to the thread of the CPU that received it
+\param OnSession Function Pointer to dispatch on when new Sessions are established
+\param User User state object to pass to OnSession
+\returns The server group, or NULL if SO_REUSEPORT is not supported, or the port could not be bound
+*/
+ILibWebServer_GroupToken ILibWebServer_Group_Create(int count, int MaxConnections, unsigned short PortNumber, int loopbackFlag, int flags, ILibWebServer_Session_OnSession OnSession, void *User)
+{
+	struct ILibWebServer_Group *RetVal;
+	int i;
+
+	if (count <= 0)
+	{
+#if defined(_POSIX)
+		count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (count <= 0) count = 1;
+	}
+
+	if ((RetVal = (struct ILibWebServer_Group*)malloc(sizeof(struct ILibWebServer_Group))) == NULL) ILIBCRITICALEXIT(254);
+	memset(RetVal, 0, sizeof(struct ILibWebServer_Group));
+	if ((RetVal->Members = (struct ILibWebServer_GroupMember*)malloc(count * sizeof(struct ILibWebServer_GroupMember))) == NULL) ILIBCRITICALEXIT(254);
+	memset(RetVal->Members, 0, count * sizeof(struct ILibWebServer_GroupMember));
+	RetVal->Count = count;
+	RetVal->Flags = flags;
+	sem_init(&(RetVal->Exited), 0, 0);
+
+	for (i = 0; i < count; ++i)
+	{
+		RetVal->Members[i].Group = RetVal;
+		RetVal->Members[i].Index = i;
+		RetVal->Members[i].Chain = ILibCreateChain();
+		RetVal->Members[i].Server = ILibWebServer_CreateEx2(RetVal->Members[i].Chain, MaxConnections, PortNumber, loopbackFlag, 1, OnSession, User);
+		if (RetVal->Members[i].Server == NULL)
+		{
+			// Only the chains are destroyed, the servers are modules of their chain
+			for (; i >= 0; --i) { ILibChain_DestroyEx(RetVal->Members[i].Chain); }
+			sem_destroy(&(RetVal->Exited));
+			free(RetVal->Members);
+			free(RetVal);
+			return(NULL);
+		}
+
+		// A random port is picked by the first server, the others join it
+		if (i == 0) { PortNumber = RetVal->PortNumber = ILibWebServer_GetPortNumber(RetVal->Members[0].Server); }
+
+		// Join the SO_REUSEPORT group now, so the listeners are in the same order as the threads
+		ILibAsyncServerSocket_Listen(((struct ILibWebServer_StateModule*)RetVal->Members[i].Server)->ServerSocket);
+	}
+
+	if ((flags & ILibWebServer_Group_Flags_CPU_AFFINITY) != 0)
+	{
+		ILibAsyncServerSocket_SetReusePortSteering(((struct ILibWebServer_StateModule*)RetVal->Members[0].Server)->ServerSocket, count);
+	}
+	return(RetVal);
+}
+
+//
+// Internal method that runs the chain of a group member, on its own thread
+//
+// <param name="obj">The ILibWebServer_GroupMember</param>
+void* ILibWebServer_Group_Run(void *obj)
+{
+	struct ILibWebServer_GroupMember *member = (struct ILibWebServer_GroupMember*)obj;
+
+#if defined(_POSIX) && !defined(__APPLE__) && defined(CPU_SET)
+	if ((member->Group->Flags & ILibWebServer_Group_Flags_CPU_AFFINITY) != 0)
+	{
+		cpu_set_t cpus;
+		int cpuCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+		// A group can have more members than there are CPUs, those share the CPUs from the start again
+		if (cpuCount <= 0) cpuCount = 1;
+		CPU_ZERO(&cpus);
+		CPU_SET(member->Index % cpuCount, &cpus);
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	}
+#endif
+
+	ILibStartChain(member->Chain);
+	sem_post(&(member->Group->Exited));
+	return(NULL);
+}
+
+/*! \fn ILibWebServer_Group_Start(ILibWebServer_GroupToken group)
+\brief Starts the chain of every server of the group, each on a new thread
+\param group The group to start
+*/
+void ILibWebServer_Group_Start(ILibWebServer_GroupToken group)
+{
+	struct ILibWebServer_Group *g = (struct ILibWebServer_Group*)group;
+	int i;
+
+	if (g->Started != 0) return;
+	g->Started = 1;
+	for (i = 0; i < g->Count; ++i)
+	{
+		ILibSpawnNormalThread((voidfp)&ILibWebServer_Group_Run, &(g->Members[i]));
+	}
+}
+
+/*! \fn ILibWebServer_Group_Stop(ILibWebServer_GroupToken group)
+\brief Stops every chain of the group, waits for their threads to exit, and frees the group
+\par
+<B>Do NOT</B> call this from one of the threads of the group.
+\param group The group to stop
+*/
+void ILibWebServer_Group_Stop(ILibWebServer_GroupToken group)
+{
+	struct ILibWebServer_Group *g = (struct ILibWebServer_Group*)group;
+	int i;
+
+	for (i = 0; i < g->Count; ++i)
+	{
+		if (g->Started != 0) { ILibStopChain(g->Members[i].Chain); } else { ILibChain_DestroyEx(g->Members[i].Chain); }
+	}
+	if (g->Started != 0)
+	{
+		for (i = 0; i < g->Count; ++i) { sem_wait(&(g->Exited)); }
+	}
+	sem_destroy(&(g->Exited));
+	free(g->Members);
+	free(g);
+}
+
+/*! \fn ILibWebServer_Group_GetCount(ILibWebServer_GroupToken group)
+\brief Returns the number of servers in the group
+*/
+int ILibWebServer_Group_GetCount(ILibWebServer_GroupToken group)
+{
+	return(((struct ILibWebServer_Group*)group)->Count);
+}
+
+/*! \fn ILibWebServer_Group_GetServer(ILibWebServer_GroupToken group, int index)
+\brief Returns one of the servers of the group, for instance to configure TLS on it
+\param group The group to query
+\param index The index of the server, from 0 to \a ILibWebServer_Group_GetCount - 1
+\returns The ILibWebServer
+*/
+ILibWebServer_ServerToken ILibWebServer_Group_GetServer(ILibWebServer_GroupToken group, int index)
+{
+	struct ILibWebServer_Group *g = (struct ILibWebServer_Group*)group;
+	return((index >= 0 && index < g->Count) ? g->Members[index].Server : NULL);
+}
+
+/*! \fn ILibWebServer_Group_GetChain(ILibWebServer_GroupToken group, int index)
+\brief Returns the chain running one of the servers of the group
+\param group The group to query
+\param index The index of the server, from 0 to \a ILibWebServer_Group_GetCount - 1
+\returns The chain
+*/
+void *ILibWebServer_Group_GetChain(ILibWebServer_GroupToken group, int index)
+{
+	struct ILibWebServer_Group *g = (struct ILibWebServer_Group*)group;
+	return((index >= 0 && index < g->Count) ? g->Members[index].Chain : NULL);
+}
+
+/*! \fn ILibWebServer_Group_GetPortNumber(ILibWebServer_GroupToken group)
+\brief Returns the port number shared by the servers of the group
+*/
+unsigned short ILibWebServer_Group_GetPortNumber(ILibWebServer_GroupToken group)
+{
+	return(((struct ILibWebServer_Group*)group)->PortNumber);
+}
+
+/*! \fn ILibWebServer_Group_RegisterVirtualDirectory(ILibWebServer_GroupToken group, char *vd, int vdLength, ILibWebServer_VirtualDirectory OnVirtualDirectory, void *user)
+\brief Registers a Virtual Directory with every server of the group. This must be done before \a ILibWebServer_Group_Start.
+\param group The group to register with
+\param vd The virtual directory path
+\param vdLength The length of the path
+\param OnVirtualDirectory The Virtual Directory handler
+\param user User state info to pass on
+\returns 0 if successful, nonzero otherwise
+*/
+int ILibWebServer_Group_RegisterVirtualDirectory(ILibWebServer_GroupToken group, char *vd, int vdLength, ILibWebServer_VirtualDirectory OnVirtualDirectory, void *user)
+{
+	struct ILibWebServer_Group *g = (struct ILibWebServer_Group*)group;
+	int i, RetVal = 0;
+
+	if (g->Started != 0) return(1);
+	for (i = 0; i < g->Count; ++i)
+	{
+		RetVal |= ILibWebServer_RegisterVirtualDirectory(g->Members[i].Server, vd, vdLength, OnVirtualDirectory, user);
+	}
+	return(RetVal);
+}
+
+/*! \fn ILibWebServer_SetFastOpen(ILibWebServer_ServerToken WebServerToken, int queueLength)
+\brief Enables TCP Fast Open on the listening socket, see \a ILibAsyncServerSocket_SetFastOpen
+\param WebServerToken The ILibWebServer to configure
+\param queueLength The maximum number of pending Fast Open requests, zero to disable
+\returns Non-zero if Fast Open was set
+*/
+int ILibWebServer_SetFastOpen(ILibWebServer_ServerToken WebServerToken, int queueLength)
+{
+	struct ILibWebServer_StateModule *WSM = (struct ILibWebServer_StateModule*) WebServerToken;
+	return(ILibAsyncServerSocket_SetFastOpen(WSM->ServerSocket, queueLength));
+}
+
+/*! \fn ILibWebServer_SetAutoCork(ILibWebServer_ServerToken WebServerToken, int enable)
+\brief Corks new sessions while \a ILibWebServer_Session_OnReceive runs, so the headers, body and chunk markers it writes are sent together when it returns
+\par
+This is off by default. It only applies to sessions accepted after the call, see \a ILibAsyncSocket_SetAutoCork
+\param WebServerToken The ILibWebServer to configure
+\param enable Non-zero to enable
+*/
+void ILibWebServer_SetAutoCork(ILibWebServer_ServerToken WebServerToken, int enable)
+{
+	struct ILibWebServer_StateModule *WSM = (struct ILibWebServer_StateModule*) WebServerToken;
+	WSM->AutoCork = enable != 0 ? 1 : 0;
+}
+
 void ILibWebServer_Digest_CalculateNonce(struct ILibWebServer_Session *session, long long expiration, char* buffer)
 {
 	char temp[33];
@@ -1305,60 +1831,32 @@ int ILibWebServer_WebSocket_CreateHeader(char* header, unsigned short FLAGS, uns
 
 enum ILibWebServer_Status ILibWebServer_WebSocket_Send(struct ILibWebServer_Session *session, char* buffer, int bufferLen, ILibWebServer_WebSocket_DataTypes bufferType, enum ILibAsyncSocket_MemoryOwnership userFree, ILibWebServer_WebSocket_FragmentFlags fragmentStatus)
 {
-	char header[4];
-	int headerLen;
-	enum ILibWebServer_Status RetVal = ILibWebServer_INVALID_SESSION;
+	char *frame;
+	int i = 0, len, frameLen = 0, fragmenting, complete;
+	enum ILibWebServer_Status RetVal;
 
-	if (bufferLen > WEBSOCKET_MAX_OUTPUT_FRAMESIZE)
+	// Buffers larger than WEBSOCKET_MAX_OUTPUT_FRAMESIZE are split into fragments. All frames go out as one block,
+	// so a send limit takes or refuses the whole message, instead of leaving a fragmented message unfinished.
+	if ((frame = (char*)malloc(bufferLen + 4 * (bufferLen / WEBSOCKET_MAX_OUTPUT_FRAMESIZE + 1))) == NULL) ILIBCRITICALEXIT(254);
+	sem_wait(&(session->Reserved11)); // We need to do this, because we need to be able to correctly interleave sends
+	fragmenting = session->Reserved15;
+	do
 	{
-		int i = 0;
-		RetVal = ILibWebServer_ALL_DATA_SENT;
-
-		while (i < bufferLen)
-		{
-			RetVal = ILibWebServer_WebSocket_Send(session, buffer + i, bufferLen - i > WEBSOCKET_MAX_OUTPUT_FRAMESIZE ? WEBSOCKET_MAX_OUTPUT_FRAMESIZE : bufferLen - i, bufferType, ILibAsyncSocket_MemoryOwnership_USER, (i + (bufferLen - i > WEBSOCKET_MAX_OUTPUT_FRAMESIZE ? WEBSOCKET_MAX_OUTPUT_FRAMESIZE : bufferLen - i) < bufferLen) ? ILibWebServer_WebSocket_FragmentFlag_Incomplete : fragmentStatus);
-			i += (bufferLen - i > WEBSOCKET_MAX_OUTPUT_FRAMESIZE ? WEBSOCKET_MAX_OUTPUT_FRAMESIZE : bufferLen - i);
-		}
+		len = bufferLen - i > WEBSOCKET_MAX_OUTPUT_FRAMESIZE ? WEBSOCKET_MAX_OUTPUT_FRAMESIZE : bufferLen - i;
+		complete = (i + len == bufferLen && fragmentStatus == ILibWebServer_WebSocket_FragmentFlag_Complete) ? 1 : 0;
 
-		if (userFree == ILibAsyncSocket_MemoryOwnership_CHAIN) { free(buffer); }
-		return(RetVal);
+		// A self contained frame, or the start of a fragment, carries the data type. Everything after that is a continuation.
+		frameLen += ILibWebServer_WebSocket_CreateHeader(frame + frameLen, complete != 0 ? WEBSOCKET_FIN : 0, fragmenting == 0 ? (unsigned short)bufferType : WEBSOCKET_OPCODE_FRAMECONT, len);
+		fragmenting = complete != 0 ? 0 : 1;
+		memcpy(frame + frameLen, buffer + i, len);
+		frameLen += len;
+		i += len;
 	}
+	while (i < bufferLen);
+	if (userFree == ILibAsyncSocket_MemoryOwnership_CHAIN) { free(buffer); }
 
-	if (fragmentStatus == ILibWebServer_WebSocket_FragmentFlag_Complete)
-	{
-		if (session->Reserved15 == 0)
-		{
-			// This is a self contained fragment
-			headerLen = ILibWebServer_WebSocket_CreateHeader(header, WEBSOCKET_FIN, (unsigned short)bufferType, bufferLen);
-		}
-		else
-		{
-			// Termination of an ongoing Fragment
-			session->Reserved15 = 0;
-			headerLen = ILibWebServer_WebSocket_CreateHeader(header, WEBSOCKET_FIN, WEBSOCKET_OPCODE_FRAMECONT, bufferLen);
-		}
-	}
-	else
-	{
-		if (session->Reserved15 == 0)
-		{
-			// Start a new fragment
-			session->Reserved15 = 1;
-			headerLen = ILibWebServer_WebSocket_CreateHeader(header, 0, (unsigned short)bufferType, bufferLen);
-		}
-		else
-		{
-			// Continuation of an ongoing fragment
-			headerLen = ILibWebServer_WebSocket_CreateHeader(header, 0, WEBSOCKET_OPCODE_FRAMECONT, bufferLen);
-		}
-	}
-
-	sem_wait(&(session->Reserved11)); // We need to do this, because we need to be able to correctly interleave sends
-	RetVal = (enum ILibWebServer_Status)ILibAsyncServerSocket_Send(session->Reserved1, session->Reserved2, header, headerLen, ILibAsyncSocket_MemoryOwnership_USER);
-	if (bufferLen > 0)
-	{
-		RetVal = (enum ILibWebServer_Status)ILibAsyncServerSocket_Send(session->Reserved1, session->Reserved2, buffer, bufferLen, userFree);
-	}
+	RetVal = (enum ILibWebServer_Status)ILibAsyncServerSocket_Send(session->Reserved1, session->Reserved2, frame, frameLen, ILibAsyncSocket_MemoryOwnership_CHAIN);
+	if (RetVal != ILibWebServer_SEND_LIMIT_EXCEEDED) { session->Reserved15 = fragmenting; }
 	sem_post(&(session->Reserved11));
 	return(RetVal);
 }
@@ -1384,7 +1882,12 @@ enum ILibWebServer_Status ILibWebServer_Send_Raw(struct ILibWebServer_Session *s
 
 	session->Reserved4 = done;
 	RetVal = (enum ILibWebServer_Status)ILibAsyncServerSocket_Send(session->Reserved1, session->Reserved2, buffer, bufferSize, userFree);
-	if (RetVal == ILibWebServer_ALL_DATA_SENT && done != 0)
+	if (RetVal == ILibWebServer_SEND_LIMIT_EXCEEDED)
+	{
+		// Nothing was queued, so the request is not answered yet
+		session->Reserved4 = 0;
+	}
+	else if (RetVal == ILibWebServer_ALL_DATA_SENT && done != 0)
 	{
 		// Completed Send
 		RetVal = ILibWebServer_RequestAnswered(session);
@@ -1670,6 +2173,15 @@ enum ILibWebServer_Status ILibWebServer_StreamBody(struct ILibWebServer_Session
 		//
 		if (bufferSize > 0)
 		{
+			//
+			// The chunk header, data and CRLF (and the terminating chunk, if this is the end) are queued as a whole, or not at all
+			//
+			if (ILibAsyncSocket_WouldExceedSendLimit(session->Reserved2, bufferSize + (done == ILibWebServer_DoneFlag_Done ? 21 : 16)) != 0)
+			{
+				if (userFree == ILibAsyncSocket_MemoryOwnership_CHAIN) { free(buffer); }
+				return(ILibWebServer_SEND_LIMIT_EXCEEDED);
+			}
+
 			//
 			// Calculate the length of the body in hex, and create the chunk header
 			//
@@ -1868,6 +2380,9 @@ void ILibWebServer_Release(struct ILibWebServer_Session *session)
 		if (session->Reserved_DigestTable != NULL) { ILibDestroyHashTree(session->Reserved_DigestTable); }
 		if (session->Reserved17 != NULL)	{ free(session->Reserved17); }
 		if (session->Reserved_WebSocket_Request != NULL) { ILibDestructPacket((struct packetheader*)session->Reserved_WebSocket_Request); }
+#ifdef MICROSTACK_SENDFILE
+		ILibWebServer_StreamFile_FreeSendFile(session);
+#endif
 		free(session);
 	}
 }
@@ -1901,6 +2416,61 @@ __inline void ILibWebServer_Resume(struct ILibWebServer_Session *session)
 {
 	ILibWebClient_Resume(session->Reserved3);
 }
+// Internal method dispatched from the underlying ILibAsyncServerSocket engine, when the pending data crosses a watermark
+void ILibWebServer_OnWatermark(void *AsyncServerSocketModule, void *ConnectionToken, int aboveHighWatermark, unsigned int pendingBytes, void *user)
+{
+	struct ILibWebServer_Session *session = (struct ILibWebServer_Session*)user;
+
+	UNREFERENCED_PARAMETER(AsyncServerSocketModule);
+	UNREFERENCED_PARAMETER(ConnectionToken);
+
+	if (session != NULL && session->Reserved_OnWatermark != NULL) session->Reserved_OnWatermark(session, aboveHighWatermark, pendingBytes);
+}
+/*! \fn void ILibWebServer_Session_SetWatermarks(struct ILibWebServer_Session *session, unsigned int highWatermark, unsigned int lowWatermark, ILibWebServer_Session_OnWatermark OnWatermark)
+\brief Sets the watermarks on the data pending to be sent on a session, see \a ILibAsyncSocket_SetWatermarks
+\par
+Use this to throttle a producer, such as a stream or a WebSocket feed, before the send queue grows without bound:
+stop producing when \a OnWatermark reports the high watermark, and resume when it reports the low watermark.
+A high watermark crossed by a WebSocket send is reported while that send holds the session lock, so the handler must not send on the session, or AddRef/Release it.
+\param session The ILibWebServer_Session to configure
+\param highWatermark Number of pending bytes that triggers the high watermark, zero to disable
+\param lowWatermark Number of pending bytes that triggers the low watermark
+\param OnWatermark The handler to trigger
+*/
+void ILibWebServer_Session_SetWatermarks(struct ILibWebServer_Session *session, unsigned int highWatermark, unsigned int lowWatermark, ILibWebServer_Session_OnWatermark OnWatermark)
+{
+	session->Reserved_OnWatermark = OnWatermark;
+	ILibAsyncServerSocket_SetWatermarks(session->Reserved1, session->Reserved2, highWatermark, lowWatermark, OnWatermark != NULL ? (ILibAsyncServerSocket_OnWatermark)&ILibWebServer_OnWatermark : NULL);
+}
+/*! \fn void ILibWebServer_Session_SetSendLimit(struct ILibWebServer_Session *session, unsigned int limit)
+\brief Sets a hard cap on the data pending to be sent on a session
+\par
+Sends past the cap fail with \a ILibWebServer_SEND_LIMIT_EXCEEDED, see \a ILibAsyncSocket_SetSendLimit
+\param session The ILibWebServer_Session to configure
+\param limit The maximum number of pending bytes, zero for no limit
+*/
+void ILibWebServer_Session_SetSendLimit(struct ILibWebServer_Session *session, unsigned int limit)
+{
+	ILibAsyncServerSocket_SetSendLimit(session->Reserved1, session->Reserved2, limit);
+}
+/*! \fn void ILibWebServer_Cork(struct ILibWebServer_Session *session)
+\brief Holds back writes on the session, so that subsequent responses are coalesced until \a ILibWebServer_Uncork is called
+\par
+If \a ILibWebServer_SetAutoCork is enabled, writes made from within \a ILibWebServer_Session_OnReceive are already corked for the duration of the handler.
+\param session The ILibWebServer_Session to cork
+*/
+void ILibWebServer_Cork(struct ILibWebServer_Session *session)
+{
+	ILibAsyncSocket_Cork(session->Reserved2);
+}
+/*! \fn void ILibWebServer_Uncork(struct ILibWebServer_Session *session)
+\brief Flushes the writes held back since \a ILibWebServer_Cork
+\param session The ILibWebServer_Session to uncork
+*/
+void ILibWebServer_Uncork(struct ILibWebServer_Session *session)
+{
+	ILibAsyncSocket_Uncork(session->Reserved2);
+}
 /*! \fn void ILibWebServer_OverrideReceiveHandler(struct ILibWebServer_Session *session, ILibWebServer_Session_OnReceive OnReceive)
 \brief Overrides the Receive handler, so that the passed in handler will get called whenever data is received.
 \param session The ILibWebServer_Session to hijack.
@@ -1924,28 +2494,126 @@ return ILibAsyncServerSocket_FakeConnect(wsm->ServerSocket, cd);
 void ILibWebServer_StreamFileSendOK(struct ILibWebServer_Session *sender)
 {
 	FILE* pfile;
+	char* buffer;
 	size_t len;
 	int status = 0;
 
 	pfile = (FILE*)sender->User3;
-	while ((len = fread(ILibScratchPad, 1, sizeof(ILibScratchPad), pfile)) != 0)
+	if (pfile == NULL) return;
+
+	// Read in large blocks, and hand them over to the chain, so nothing has to be copied again if the socket can't take it all.
+	// With TLS this also lets OpenSSL fill whole records.
+	do
 	{
-		status = ILibWebServer_StreamBody(sender, ILibScratchPad, (int)len, ILibAsyncSocket_MemoryOwnership_USER, ILibWebServer_DoneFlag_NotDone);
-		if (status != ILibWebServer_ALL_DATA_SENT || len < sizeof(ILibScratchPad)) break;
+		// Leave the block in the file until the send limit can take all of it, and the terminating chunk after it
+		if (ILibAsyncSocket_WouldExceedSendLimit(sender->Reserved2, ILibWebServer_StreamFile_BlockSize + 21) != 0) return;
+		if ((buffer = (char*)malloc(ILibWebServer_StreamFile_BlockSize)) == NULL) ILIBCRITICALEXIT(254);
+		if ((len = fread(buffer, 1, ILibWebServer_StreamFile_BlockSize, pfile)) == 0) { free(buffer); break; }
+		status = ILibWebServer_StreamBody(sender, buffer, (int)len, ILibAsyncSocket_MemoryOwnership_CHAIN, ILibWebServer_DoneFlag_NotDone);
 	}
+	while (status == ILibWebServer_ALL_DATA_SENT && len == ILibWebServer_StreamFile_BlockSize);
 
-	if (len < sizeof(ILibScratchPad) || status < 0)
+	if (len < ILibWebServer_StreamFile_BlockSize || status < 0)
 	{
 		// Finished sending the file or got a send error, close the session
+		sender->OnSendOK = NULL;
+		sender->User3 = NULL;
 		ILibWebServer_StreamBody(sender, NULL, 0, ILibAsyncSocket_MemoryOwnership_STATIC, ILibWebServer_DoneFlag_Done);
 		fclose(pfile);
 	}
 }
 
+#ifdef MICROSTACK_SENDFILE
+// Private method that queues the rest of a file with sendfile(), as far as the send limit allows. It is also
+// the session's OnSendOK handler, so whatever the limit held back is queued as the socket drains.
+void ILibWebServer_StreamFile_SendFileOK(struct ILibWebServer_Session *sender)
+{
+	struct ILibWebServer_SendFileState *state = (struct ILibWebServer_SendFileState*)sender->Reserved_SendFile;
+	enum ILibWebServer_Status status = ILibWebServer_ALL_DATA_SENT;
+	char *hex;
+	int len;
+
+	if (state == NULL) return;
+	while (state->remaining > 0)
+	{
+		len = state->remaining > ILibWebServer_StreamFile_MaxSegment ? ILibWebServer_StreamFile_MaxSegment : (int)state->remaining;
+
+		// The chunk header, segment and CRLF are queued as a whole, or not at all
+		if (ILibAsyncSocket_WouldExceedSendLimit(sender->Reserved2, state->chunked != 0 ? len + 16 : len) != 0) return;
+		state->remaining -= len;
+
+		if (state->chunked != 0)
+		{
+			if ((hex = (char*)malloc(16)) == NULL) ILIBCRITICALEXIT(254);
+			status = ILibWebServer_Send_Raw(sender, hex, snprintf(hex, 16, "%X\r\n", len), ILibAsyncSocket_MemoryOwnership_CHAIN, ILibWebServer_DoneFlag_NotDone);
+			if (status < 0) break;
+		}
+
+		// The last segment hands the descriptor to the socket, which closes it when the segment is sent or dropped
+		status = (enum ILibWebServer_Status)ILibAsyncSocket_SendFile(sender->Reserved2, state->fd, state->offset, len, state->remaining == 0 ? ILibAsyncSocket_MemoryOwnership_CHAIN : ILibAsyncSocket_MemoryOwnership_STATIC);
+		if (state->remaining == 0) { state->fd = -1; }
+		if (status < 0) break;
+		if (state->chunked != 0 && (status = ILibWebServer_Send_Raw(sender, "\r\n", 2, ILibAsyncSocket_MemoryOwnership_STATIC, ILibWebServer_DoneFlag_NotDone)) < 0) break;
+		state->offset += len;
+	}
+
+	if (status < 0)
+	{
+		// Part of the body may already be queued, so the response can't be terminated cleanly. Disconnecting drops
+		// the queued segments, and OnDisconnect closes the descriptor they refer to.
+		ILibWebServer_DisconnectSession(sender);
+		return;
+	}
+
+	// Finish the response once the file went out, for HTTP/1.0 that closes the connection
+	if (ILibAsyncSocket_GetPendingBytesToSend(sender->Reserved2) > 0) return;
+	sender->OnSendOK = NULL;
+	ILibWebServer_StreamFile_FreeSendFile(sender);
+	ILibWebServer_StreamBody(sender, NULL, 0, ILibAsyncSocket_MemoryOwnership_STATIC, ILibWebServer_DoneFlag_Done);
+}
+
+// Private method that sends the rest of a file on a non-TLS (or kernel TLS) session with sendfile(), as the socket becomes writable.
+// Returns non-zero if the file can't be sent this way, and must be streamed through the buffers.
+int ILibWebServer_StreamFile_SendFile(struct ILibWebServer_Session *session, FILE* pfile)
+{
+	struct ILibWebServer_SendFileState *state;
+	struct packetheader *hdr;
+	struct stat st;
+	off_t offset;
+	int fd;
+
+	if (session == NULL || session->SessionInterrupted != 0 || session->Reserved_WebSocket_Request != NULL || session->Reserved_SendFile != NULL) return 1;
+	#ifndef MICROSTACK_NOTLS
+	if (ILibAsyncSocket_IsUsingTls(session->Reserved2) != 0 && ILibAsyncSocket_IsKernelTLS(session->Reserved2) == 0) return 1;
+	#endif
+	if ((hdr = ILibWebClient_GetHeaderFromDataObject(session->Reserved3)) == NULL) return 1;
+	if (fstat(fileno(pfile), &st) != 0 || !S_ISREG(st.st_mode) || (offset = ftello(pfile)) < 0) return 1;
+
+	// Keep our own descriptor, until the last segment hands it to the socket
+	if ((fd = dup(fileno(pfile))) < 0) return 1;
+	fclose(pfile);
+
+	if ((state = (struct ILibWebServer_SendFileState*)malloc(sizeof(struct ILibWebServer_SendFileState))) == NULL) ILIBCRITICALEXIT(254);
+	state->fd = fd;
+	state->chunked = (hdr->VersionLength == 3 && memcmp(hdr->Version, "1.0", 3) == 0) ? 0 : 1;
+	state->offset = offset;
+	state->remaining = st.st_size > offset ? st.st_size - offset : 0;
+
+	session->User3 = NULL;
+	session->Reserved_SendFile = state;
+	session->OnSendOK = ILibWebServer_StreamFile_SendFileOK;
+	ILibWebServer_StreamFile_SendFileOK(session);
+	return 0;
+}
+#endif
+
 // Streams a file to the web session asynchronously, closes the session when done.
-// Caller must supply a valid file handle.
+// Caller must supply a valid file handle. Regular files on non-TLS or kTLS sessions are sent with sendfile() when available.
 void ILibWebServer_StreamFile(struct ILibWebServer_Session *session, FILE* pfile)
 {
+#ifdef MICROSTACK_SENDFILE
+	if (ILibWebServer_StreamFile_SendFile(session, pfile) == 0) return;
+#endif
 	session->OnSendOK = ILibWebServer_StreamFileSendOK;
 	session->User3 = (void*)pfile;
 	ILibWebServer_StreamFileSendOK(session);
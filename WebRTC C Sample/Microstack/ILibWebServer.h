@@ -65,11 +65,16 @@ enum ILibWebServer_Status
 	ILibWebServer_SEND_RESULTED_IN_DISCONNECT		= -2,	/*!< A send operation resulted in the socket being closed */
 	ILibWebServer_INVALID_SESSION					= -3,	/*!< The specified ILibWebServer_Session was invalid */
 	ILibWebServer_TRIED_TO_SEND_ON_CLOSED_SOCKET	= -4,	/*!< A send operation was attmepted on a closed socket */
+	ILibWebServer_SEND_LIMIT_EXCEEDED				= -5,	/*!< The data was not queued, because the session's send limit would be exceeded */
 };
 /*! \typedef ILibWebServer_ServerToken
 	\brief The handle for an ILibWebServer module
 */
 typedef void* ILibWebServer_ServerToken;
+/*! \typedef ILibWebServer_GroupToken
+	\brief The handle for a group of ILibWebServers sharing a port, see \a ILibWebServer_Group_Create
+*/
+typedef void* ILibWebServer_GroupToken;
 
 struct ILibWebServer_Session;
 
@@ -99,6 +104,13 @@ typedef void (*ILibWebServer_Session_OnDisconnect)(struct ILibWebServer_Session
 	\param sender The \a ILibWebServer_Session that has completed sending all of the pending data
 */
 typedef	void (*ILibWebServer_Session_OnSendOK)(struct ILibWebServer_Session *sender);
+/*! \typedef ILibWebServer_Session_OnWatermark
+	\brief Handler for when the pending data of a session crosses one of the watermarks set with \a ILibWebServer_Session_SetWatermarks
+	\param sender The \a ILibWebServer_Session whos pending data crossed a watermark
+	\param aboveHighWatermark Non-zero if the high watermark was reached, and the producer should hold off. Zero if the data drained to the low watermark.
+	\param pendingBytes The number of bytes pending to be sent
+*/
+typedef	void (*ILibWebServer_Session_OnWatermark)(struct ILibWebServer_Session *sender, int aboveHighWatermark, unsigned int pendingBytes);
 
 /*! \struct ILibWebServer_Session
 	\brief A structure representing the state of an HTTP Session
@@ -172,6 +184,8 @@ typedef struct ILibWebServer_Session
 	char  Reserved22;	// WebSocketCloseFrameSent
 	void* Reserved_DigestTable;
 	void* Reserved_WebSocket_Request;
+	ILibWebServer_Session_OnWatermark Reserved_OnWatermark;
+	void* Reserved_SendFile;	// File being queued with sendfile(), see ILibWebServer_StreamFile
 
 	char *buffer;
 	int bufferLength;
@@ -208,6 +222,9 @@ void ILibWebServer_SetTLS(ILibWebServer_ServerToken object, void *ssl_ctx, int e
 #else
 void ILibWebServer_SetTLS(ILibWebServer_ServerToken object, void *ssl_ctx);
 #endif
+int ILibWebServer_SetKernelTLS(ILibWebServer_ServerToken object, int enable);
+int ILibWebServer_SetTLSSessionResumption(ILibWebServer_ServerToken object, int cacheSize, int ticketKeyRotation);
+void ILibWebServer_GetTLSHandshakeStats(ILibWebServer_ServerToken object, ILibAsyncSocket_TLSHandshakeStats *stats);
 #endif
 
 void ILibWebServer_SetTag(ILibWebServer_ServerToken WebServerToken, void *Tag);
@@ -215,6 +232,18 @@ void *ILibWebServer_GetTag(ILibWebServer_ServerToken WebServerToken);
 
 ILibWebServer_ServerToken ILibWebServer_CreateEx(void *Chain, int MaxConnections, unsigned short PortNumber, int loopbackFlag, ILibWebServer_Session_OnSession OnSession, void *User);
 #define ILibWebServer_Create(Chain, MaxConnections, PortNumber, OnSession, User) ILibWebServer_CreateEx(Chain, MaxConnections, PortNumber, INADDR_ANY, OnSession, User)
+ILibWebServer_ServerToken ILibWebServer_CreateEx2(void *Chain, int MaxConnections, unsigned short PortNumber, int loopbackFlag, int reusePort, ILibWebServer_Session_OnSession OnSession, void *User);
+
+#define ILibWebServer_Group_Flags_NONE			0x00
+#define ILibWebServer_Group_Flags_CPU_AFFINITY	0x01	// Pin thread N to CPU N (modulo the CPU count), and steer connections to the thread of the CPU that received them
+ILibWebServer_GroupToken ILibWebServer_Group_Create(int count, int MaxConnections, unsigned short PortNumber, int loopbackFlag, int flags, ILibWebServer_Session_OnSession OnSession, void *User);
+int ILibWebServer_Group_RegisterVirtualDirectory(ILibWebServer_GroupToken group, char *vd, int vdLength, ILibWebServer_VirtualDirectory OnVirtualDirectory, void *user);
+void ILibWebServer_Group_Start(ILibWebServer_GroupToken group);
+void ILibWebServer_Group_Stop(ILibWebServer_GroupToken group);
+int ILibWebServer_Group_GetCount(ILibWebServer_GroupToken group);
+ILibWebServer_ServerToken ILibWebServer_Group_GetServer(ILibWebServer_GroupToken group, int index);
+void *ILibWebServer_Group_GetChain(ILibWebServer_GroupToken group, int index);
+unsigned short ILibWebServer_Group_GetPortNumber(ILibWebServer_GroupToken group);
 
 int ILibWebServer_RegisterVirtualDirectory(ILibWebServer_ServerToken WebServerToken, char *vd, int vdLength, ILibWebServer_VirtualDirectory OnVirtualDirectory, void *user);
 int ILibWebServer_UnRegisterVirtualDirectory(ILibWebServer_ServerToken WebServerToken, char *vd, int vdLength);
@@ -259,6 +288,8 @@ unsigned int ILibWebServer_Session_GetPendingBytesToSend(struct ILibWebServer_Se
 #define ILibWebServer_Session_ResetTotalBytesSent(session) ILibAsyncServerSocket_ResetTotalBytesSent(session->Reserved1,session->Reserved2)
 
 unsigned short ILibWebServer_GetPortNumber(ILibWebServer_ServerToken WebServerToken);
+int ILibWebServer_SetFastOpen(ILibWebServer_ServerToken WebServerToken, int queueLength);
+void ILibWebServer_SetAutoCork(ILibWebServer_ServerToken WebServerToken, int enable);
 int ILibWebServer_GetLocalInterface(struct ILibWebServer_Session *session, struct sockaddr *localAddress);
 int ILibWebServer_GetRemoteInterface(struct ILibWebServer_Session *session, struct sockaddr *remoteAddress);
 
@@ -271,6 +302,10 @@ void ILibWebServer_DisconnectSession(struct ILibWebServer_Session *session);
 
 void ILibWebServer_Pause(struct ILibWebServer_Session *session);
 void ILibWebServer_Resume(struct ILibWebServer_Session *session);
+void ILibWebServer_Session_SetWatermarks(struct ILibWebServer_Session *session, unsigned int highWatermark, unsigned int lowWatermark, ILibWebServer_Session_OnWatermark OnWatermark);
+void ILibWebServer_Session_SetSendLimit(struct ILibWebServer_Session *session, unsigned int limit);
+void ILibWebServer_Cork(struct ILibWebServer_Session *session);
+void ILibWebServer_Uncork(struct ILibWebServer_Session *session);
 
 void ILibWebServer_OverrideReceiveHandler(struct ILibWebServer_Session *session, ILibWebServer_Session_OnReceive OnReceive);
 
@@ -37,6 +37,7 @@ limitations under the License.
 
 #define ILibWrapper_WebRTC_ConnectionFactory_ConnectionBucketSize 16	// *MUST* be a power of 2
 #define ILibWrapper_WebRTC_Connection_DataChannelsBucketSize 16			// *MUST* be a power of 2
+#define ILibWrapper_WebRTC_StunCacheDefaultTTL 120						// Seconds. RFC 4787 NATs keep an idle UDP mapping for at least 2 minutes
 
 #define INET_SOCKADDR_LENGTH(x) ((x==AF_INET6?sizeof(struct sockaddr_in6):sizeof(struct sockaddr_in)))
 #define INET_SOCKADDR_PORT(x) (x->sa_family==AF_INET6?(unsigned short)(((struct sockaddr_in6*)x)->sin6_port):(unsigned short)(((struct sockaddr_in*)x)->sin_port))
@@ -68,6 +69,23 @@ typedef struct
 	int mTurnServerUsernameLen;
 	char* mTurnServerPassword;
 	int mTurnServerPasswordLen;
+
+	// Server reflexive discovery is shared by every connection on the factory. mStunWaiting holds the connections waiting
+	// on a result, and its lock also guards the cache fields
+	char** mStunServerList;
+	char* mStunServerFlags;
+	int mStunServerListLength;
+	int mStunServerIndex;
+	int mStunDiscovering;
+	int mStunDiscoveringMapping;	// The discovery in flight is a NAT behavior discovery
+	int mStunCacheTTL;
+	int mStunCacheValid;
+	int mStunCacheUsed;
+	long long mStunCacheExpiration;
+	unsigned int mStunCacheInterfaces;
+	ILibStun_Results mStunCacheResult;
+	struct sockaddr_in6 mStunCachePublicIP;
+	ILibLinkedList mStunWaiting;
 }ILibWrapper_WebRTC_ConnectionFactoryStruct;
 
 typedef struct
@@ -78,11 +96,11 @@ typedef struct
 	char** stunServerList;
 	char* stunServerFlags;
 	int stunServerListLength;
-	int stunIndex;
+	int stunMappingDetection;		// Waiting on a NAT behavior discovery, not just the server reflexive candidate
 	int isConnected;
 
 	int id;
-	char localUsername[9];
+	char localUsername[ILibStun_UsernameLength + 1];
 	char localPassword[33];
 
 	char *remoteUsername;
@@ -107,6 +125,8 @@ typedef struct
 
 // Prototypes:
 int ILibWrapper_WebRTC_PerformStun(ILibWrapper_WebRTC_ConnectionStruct *connection);
+int ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory, int MappingDetection);
+unsigned int ILibWrapper_WebRTC_ConnectionFactory_InterfaceHash();
 
 ILibTransport_DoneState ILibWrapper_ILibTransport_SendSink(void *transport, char* buffer, int bufferLength, ILibTransport_MemoryOwnership ownership, ILibTransport_DoneState done)
 {
@@ -162,6 +182,50 @@ unsigned short ILibWrapper_GetNextStreamId(ILibWrapper_WebRTC_ConnectionStruct *
 	return(id);
 }
 
+// Decodes an SDP candidate ("candidate:..." or "a=candidate:...") into a 6 byte block candidate (IPv4 address, port). Only UDP candidates for component 1 are used.
+// candidateData may point into candidate. If priority is not NULL, it is set to the candidate's priority. Returns 0 on success
+int ILibWrapper_CandidateToBlock(char* candidate, int candidateLen, char* candidateData, unsigned int *priority)
+{
+	struct parser_result *pr;
+	struct parser_result_field *f;
+	char address[16];
+	char port[6];
+	struct in_addr addr;
+	unsigned long candidatePriority;
+	unsigned short portNumber;
+	int i, retVal = 1;
+
+	pr = ILibParseString(candidate, 0, candidateLen, " ", 1);
+	// foundation component transport priority address port typ type ...
+	if (pr->NumResults >= 6)
+	{
+		f = pr->FirstResult->NextResult;
+		if (f->datalength == 1 && f->data[0] == '1' && f->NextResult->datalength == 3 && strncasecmp(f->NextResult->data, "UDP", 3) == 0)
+		{
+			if (priority != NULL) { *priority = ILibGetULong(f->NextResult->NextResult->data, f->NextResult->NextResult->datalength, &candidatePriority) == 0 ? (unsigned int)candidatePriority : 0; }
+			f = f->NextResult->NextResult->NextResult;
+			if (f->datalength < (int)sizeof(address) && f->NextResult->datalength > 0 && f->NextResult->datalength < (int)sizeof(port))
+			{
+				memcpy(address, f->data, f->datalength);
+				address[f->datalength] = 0;
+				memcpy(port, f->NextResult->data, f->NextResult->datalength);
+				port[f->NextResult->datalength] = 0;
+				for (i = 0; port[i] != 0 && port[i] >= '0' && port[i] <= '9'; ++i);
+				if (port[i] == 0 && ILibInet_pton(AF_INET, address, &addr) > 0)
+				{
+					memcpy(candidateData, &addr, 4);
+					// candidateData is usually a line of the SDP being decoded in place, so it has no particular alignment
+					portNumber = htons((unsigned short)atoi(port));
+					memcpy(candidateData + 4, &portNumber, 2);
+					retVal = 0;
+				}
+			}
+		}
+	}
+	ILibDestructParserResults(pr);
+	return(retVal);
+}
+
 int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username, char **password, char **block)
 {
 	struct parser_result *pr;
@@ -175,6 +239,9 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 	int dtlsHashLen = 0;
 	int candidatecount = 0;
 	int BlockFlags = 0;
+	unsigned int priority;
+	char **sorted;
+	int i, j;
 	*isActive = 0;
 	*username = NULL;
 	*password = NULL;
@@ -198,6 +265,10 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 		{
 			*isActive = 1;
 		}
+		else if(strcmp(f->data, "a=ice-lite")==0)
+		{
+			BlockFlags |= ILibWebRTC_SDP_Flags_ICE_LITE;
+		}
 
 		if(f->datalength > 12 && strncmp(f->data, "a=ice-ufrag:", 12)==0) {*username = f->data + 12;} 
 		if(f->datalength > 10 && strncmp(f->data, "a=ice-pwd:", 10)==0) {*password = f->data + 10;} 
@@ -209,49 +280,19 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 			dtlshash = tmp;
 		}
 
-		if(f->datalength > 12 && strncmp(f->data, "a=candidate:", 12)==0)
+		if(f->datalength > 12 && strncmp(f->data, "a=candidate:", 12)==0 && ILibWrapper_CandidateToBlock(f->data, f->datalength, f->data, &priority)==0)
         {
-			struct parser_result* pr2 = ILibParseString(f->data, 0, f->datalength, " ", 1);
-
-			if(pr2->FirstResult->NextResult->datalength == 1 && pr2->FirstResult->NextResult->data[0] == '1' && pr2->FirstResult->NextResult->NextResult->datalength == 3 && strncasecmp(pr2->FirstResult->NextResult->NextResult->data, "UDP", 3)==0)
-			//if(pr2->FirstResult->NextResult->NextResult->datalength == 3 && strncasecmp(pr2->FirstResult->NextResult->NextResult->data, "UDP", 3)==0)
-			{
-				char* candidateData;
-				struct parser_result *pr3;
-				char *tmp = pr2->FirstResult->NextResult->NextResult->NextResult->NextResult->NextResult->data;
-				unsigned short port;
-
-				tmp[pr2->FirstResult->NextResult->NextResult->NextResult->NextResult->NextResult->datalength] = 0;
-				port = atoi(tmp);
-				
-				pr3 = ILibParseString(pr2->FirstResult->NextResult->NextResult->NextResult->NextResult->data, 0, pr2->FirstResult->NextResult->NextResult->NextResult->NextResult->datalength, ".", 1);					
-				if (pr3->NumResults == 4)
-				{
-					candidateData = pr3->FirstResult->data;
-					pr3->FirstResult->data[pr3->FirstResult->datalength] = 0;
-					candidateData[0] = (char)atoi(pr3->FirstResult->data);
-					pr3->FirstResult->NextResult->data[pr3->FirstResult->NextResult->datalength] = 0;
-					candidateData[1] = (char)atoi(pr3->FirstResult->NextResult->data);
-					pr3->FirstResult->NextResult->NextResult->data[pr3->FirstResult->NextResult->NextResult->datalength] = 0;
-					candidateData[2] = (char)atoi(pr3->FirstResult->NextResult->NextResult->data);
-					pr3->FirstResult->NextResult->NextResult->NextResult->data[pr3->FirstResult->NextResult->NextResult->NextResult->datalength] = 0;
-					candidateData[3] = (char)atoi(pr3->FirstResult->NextResult->NextResult->NextResult->data);
-
-					((unsigned short*)candidateData)[2] = htons(port);
-					candidateData[6] = 0;
-
-					ILibPushStack(&candidates, candidateData);
-					++candidatecount;
-				}
-				ILibDestructParserResults(pr3);
-			}
-
-			ILibDestructParserResults(pr2);
+			// The candidate was decoded in place. The block has no room for the priority, so it's kept after the candidate, to order the block with.
+			// f->data + 6 has no particular alignment, so it's copied rather than stored through an int pointer
+			memcpy(f->data + 6, &priority, sizeof(priority));
+			ILibPushStack(&candidates, f->data);
+			++candidatecount;
         }
 		f = f->NextResult;
     }
 
-	if (*username == NULL || *password == NULL || dtlshash == NULL || candidatecount == 0)
+	// With Trickle ICE, the candidates can come after the offer, see ILibWrapper_WebRTC_Connection_AddRemoteCandidate
+	if (*username == NULL || *password == NULL || dtlshash == NULL)
     {
 		*block = NULL;
 		return(0);
@@ -285,11 +326,29 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 
 	(*block)[ptr] = (char)candidatecount;
 	ptr += 1;
-	while(ILibPeekStack(&candidates)!=NULL)
+
+	// The candidates go in the block highest priority first, as the ICE checklist derives the pair priorities from their order
+	if((sorted = (char**)malloc((candidatecount + 1) * sizeof(char*)))==NULL){ILIBCRITICALEXIT(254);}
+	for(i = candidatecount - 1; i >= 0; --i) {sorted[i] = (char*)ILibPopStack(&candidates);}
+	for(i = 1; i < candidatecount; ++i)
 	{
-		memcpy(*block+ptr, ILibPopStack(&candidates), 6);
+		char *tmp = sorted[i];
+		unsigned int tmpPriority, otherPriority;
+		memcpy(&tmpPriority, tmp + 6, sizeof(tmpPriority));
+		for(j = i - 1; j >= 0; --j)
+		{
+			memcpy(&otherPriority, sorted[j] + 6, sizeof(otherPriority));
+			if(otherPriority >= tmpPriority) {break;}
+			sorted[j + 1] = sorted[j];
+		}
+		sorted[j + 1] = tmp;
+	}
+	for(i = 0; i < candidatecount; ++i)
+	{
+		memcpy(*block+ptr, sorted[i], 6);
 		ptr += 6;
 	}
+	free(sorted);
 
 	ILibDestructParserResults(pr);
 	free(lines);
@@ -299,7 +358,7 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 
 int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char** password, char **sdp, char* serverReflexiveCandidateAddress, unsigned short serverReflexiveCandidatePort)
 {
-	char* sdpTemplate1 = "v=0\r\no=MeshAgent %u 0 IN IP4 0.0.0.0\r\ns=SIP Call\r\nt=0 0\r\na=ice-ufrag:%s\r\na=ice-pwd:%s\r\na=fingerprint:sha-256 %s\r\nm=application 1 DTLS/SCTP 5000\r\nc=IN IP4 0.0.0.0\r\na=sctpmap:5000 webrtc-datachannel 16\r\na=setup:%s\r\n";
+	char* sdpTemplate1 = "v=0\r\no=MeshAgent %u 0 IN IP4 0.0.0.0\r\ns=SIP Call\r\nt=0 0\r\n%sa=ice-ufrag:%s\r\na=ice-pwd:%s\r\na=fingerprint:sha-256 %s\r\nm=application 1 DTLS/SCTP 5000\r\nc=IN IP4 0.0.0.0\r\na=sctpmap:5000 webrtc-datachannel 16\r\na=setup:%s\r\n";
 	char* sdpTemplateRelay = "a=candidate:%d %d UDP %d %s %d typ relay raddr %u.%u.%u.%u %d\r\n";
 	char* sdpTemplateLocalCand = "a=candidate:%d %d UDP %d %u.%u.%u.%u %u typ host\r\n";
 	char* sdpTemplateSrflxCand = "a=candidate:%d %d UDP %d %s %u typ srflx raddr %u.%u.%u.%u rport %u\r\n";
@@ -351,7 +410,7 @@ int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char**
 
 
 	// Build the sdp
-	sdpLen = 2 + strlen(sdpTemplate1) + usernamelen + passwordlen + 7 + (dtlshashlen*3) + 7 + (2 *   (candidatecount * (12 + 21 + strlen(sdpTemplateLocalCand)))  );
+	sdpLen = 2 + strlen(sdpTemplate1) + 12 + usernamelen + passwordlen + 7 + (dtlshashlen*3) + 7 + (2 *   (candidatecount * (12 + 21 + strlen(sdpTemplateLocalCand)))  );
 	if(serverReflexiveCandidateAddress!=NULL)
 	{
 		sdpLen += (2* (12 + 21 + strlen(sdpTemplateSrflxCand)));
@@ -365,7 +424,7 @@ int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char**
 
 	util_random(4, junk);
 
-	x = snprintf(*sdp, sdpLen, sdpTemplate1, ((unsigned int*)junk)[0]%1000000, *username, *password, dtlshash, isActive==0?"passive":"actpass");
+	x = snprintf(*sdp, sdpLen, sdpTemplate1, ((unsigned int*)junk)[0]%1000000, (blockflags & ILibWebRTC_SDP_Flags_ICE_LITE) == ILibWebRTC_SDP_Flags_ICE_LITE ? "a=ice-lite\r\n" : "", *username, *password, dtlshash, isActive==0?"passive":"actpass");
 
 	for(c = 1; c <= 2; ++c)
 	{
@@ -447,8 +506,16 @@ void ILibWrapper_WebRTC_ConnectionFactory_OnDestroy(void *obj)
 {
 	ILibWrapper_WebRTC_ConnectionFactoryStruct *cfs = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)obj;
 
+	int i;
+
 	ILibSparseArray_DestroyEx(cfs->Connections, ILibWrapper_WebRTC_ConnectionFactory_OnDestroyEx, cfs);
 	ILibWrapper_WebRTC_UnInitializeCrypto((ILibWrapper_WebRTC_ConnectionFactoryStruct*)obj);
+
+	// The discovery timers don't need to be removed, as the Chain is going away
+	for(i=0;i<cfs->mStunServerListLength;++i) {free(cfs->mStunServerList[i]);}
+	if(cfs->mStunServerList!=NULL) {free(cfs->mStunServerList);}
+	if(cfs->mStunServerFlags!=NULL) {free(cfs->mStunServerFlags);}
+	ILibLinkedList_Destroy(cfs->mStunWaiting);
 }
 
 void ILibWrapper_WebRTC_Connection_DestroyConnectionEx(ILibSparseArray sender, int index, void *value, void *user)
@@ -478,18 +545,17 @@ void ILibWrapper_WebRTC_Connection_DestroyConnection(ILibWrapper_WebRTC_Connecti
 		{
 			if(obj->offerBlock!=NULL && obj->offerBlockLen>0)
 			{
-				// Clear the ICE State for the local Offer
-				ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_CharToSlot(obj->offerBlock[7]));
-			}
-			if(obj->remoteOfferBlock!=NULL && obj->remoteOfferBlockLen>0)
-			{
-				// Clear the ICE State for the remote Offer
-				ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_CharToSlot(obj->remoteOfferBlock[7]));
+				// Clear our ICE State. offerBlock carries our username whether we generated the offer or answered it,
+				// the remote block only has the peer's username, which says nothing about our slots
+				ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_UsernameToSlot(obj->offerBlock + 7));
 			}
 		}
 	}
 
 	ILibWebRTC_SetUserObject(obj->mFactory->mStunModule, obj->localUsername, NULL);
+	ILibLinkedList_Lock(obj->mFactory->mStunWaiting);
+	ILibLinkedList_Remove_ByData(obj->mFactory->mStunWaiting, obj);
+	ILibLinkedList_UnLock(obj->mFactory->mStunWaiting);
 
 	if(obj->stunServerList!=NULL && obj->stunServerListLength>0)
 	{
@@ -539,13 +605,9 @@ void ILibWrapper_WebRTC_Connection_Disconnect(ILibWrapper_WebRTC_Connection conn
 
 		if(obj->offerBlock!=NULL && obj->offerBlockLen>0)
 		{
-			// Clear the ICE State for the local Offer
-			ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_CharToSlot(obj->offerBlock[7]));
-		}
-		if(obj->remoteOfferBlock!=NULL && obj->remoteOfferBlockLen>0)
-		{
-			// Clear the ICE State for the remote Offer
-			ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_CharToSlot(obj->remoteOfferBlock[7]));
+			// Clear our ICE State. offerBlock carries our username whether we generated the offer or answered it,
+			// the remote block only has the peer's username, which says nothing about our slots
+			ILibStun_ClearIceState(obj->mFactory->mStunModule, ILibStun_UsernameToSlot(obj->offerBlock + 7));
 		}
 
 		if(obj->OnConnected!=NULL) {obj->OnConnected(connection, 0);}
@@ -553,38 +615,169 @@ void ILibWrapper_WebRTC_Connection_Disconnect(ILibWrapper_WebRTC_Connection conn
 	}
 }
 
+// Answers the connections waiting on a discovery that produced result. A NAT behavior result only answers those that asked for one, and
+// a plain discovery only those that didn't. No_NAT and Unknown are the final word for both
+void ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory, ILibStun_Results result, struct sockaddr_in6 *publicIP)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection;
+	struct sockaddr_in6 candidate;
+	int hasCandidate, mapping;
+	void *node;
+
+	mapping = (result == ILibStun_Results_Public_Interface ? 0 : (result == ILibStun_Results_Unknown || result == ILibStun_Results_No_NAT ? -1 : 1));
+	hasCandidate = publicIP != NULL && mapping >= 0;
+	if(hasCandidate != 0) {memcpy(&candidate, publicIP, sizeof(struct sockaddr_in6));}
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	node = ILibLinkedList_GetNode_Head(factory->mStunWaiting);
+	while(node!=NULL)
+	{
+		connection = (ILibWrapper_WebRTC_ConnectionStruct*)ILibLinkedList_GetDataFromNode(node);
+		if(mapping >= 0 && connection->stunMappingDetection != mapping)
+		{
+			node = ILibLinkedList_GetNextNode(node);
+			continue;
+		}
+		ILibLinkedList_Remove(node);
+
+		// The callback may destroy the connection, or start another discovery, so don't hold the lock. Start over afterwards
+		ILibLinkedList_UnLock(factory->mStunWaiting);
+		if(connection->OnCandidates!=NULL) {connection->OnCandidates(connection, hasCandidate != 0 ? &candidate : NULL);}
+		ILibLinkedList_Lock(factory->mStunWaiting);
+		node = ILibLinkedList_GetNode_Head(factory->mStunWaiting);
+	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+}
+
+// Starts a discovery for the connections still waiting, if none is running. Those that asked for NAT behavior discovery may have
+// joined a plain discovery, or the other way around, and weren't answered by it
+void ILibWrapper_WebRTC_ConnectionFactory_StartWaitingStun(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory)
+{
+	void *node;
+	int start = 0, mapping = 0;
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	if(factory->mStunDiscovering == 0 && factory->mStunServerListLength > 0 && (node = ILibLinkedList_GetNode_Head(factory->mStunWaiting))!=NULL)
+	{
+		mapping = ((ILibWrapper_WebRTC_ConnectionStruct*)ILibLinkedList_GetDataFromNode(node))->stunMappingDetection;
+		factory->mStunDiscovering = 1;
+		factory->mStunDiscoveringMapping = mapping;
+		memset(factory->mStunServerFlags, 0, factory->mStunServerListLength);
+		start = 1;
+	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+
+	if(start != 0 && ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(factory, mapping)!=0)
+	{
+		// None of the STUN Servers resolved
+		ILibLinkedList_Lock(factory->mStunWaiting);
+		factory->mStunDiscovering = 0;
+		factory->mStunCacheValid = 0;
+		ILibLinkedList_UnLock(factory->mStunWaiting);
+		ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(factory, ILibStun_Results_Unknown, NULL);
+	}
+}
+
+void ILibWrapper_WebRTC_ConnectionFactory_OnStunWaiting(void *object)
+{
+	ILibWrapper_WebRTC_ConnectionFactory_StartWaitingStun((ILibWrapper_WebRTC_ConnectionFactoryStruct*)object - 3);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_OnStunCached(void *object)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *factory = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)object - 1;
+	ILibStun_Results result = ILibStun_Results_Unknown;
+	struct sockaddr_in6 publicIP;
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	if(factory->mStunCacheValid != 0)
+	{
+		result = factory->mStunCacheResult;
+		memcpy(&publicIP, &(factory->mStunCachePublicIP), sizeof(struct sockaddr_in6));
+	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+
+	// The cache may have been invalidated since this was scheduled, then whoever is left needs a discovery
+	if(result != ILibStun_Results_Unknown) {ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(factory, result, &publicIP);}
+	ILibWrapper_WebRTC_ConnectionFactory_StartWaitingStun(factory);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_OnStunRefresh(void *object)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *factory = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)object - 2;
+	int refresh = 0;
+
+	// Only refresh a cache that was used since it was filled, so an idle factory doesn't keep sending to the STUN servers
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	if(factory->mStunCacheUsed != 0 && factory->mStunDiscovering == 0 && factory->mStunServerListLength > 0)
+	{
+		factory->mStunCacheUsed = 0;
+		factory->mStunDiscovering = 1;
+		factory->mStunDiscoveringMapping = 0;
+		memset(factory->mStunServerFlags, 0, factory->mStunServerListLength);
+		refresh = 1;
+	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+
+	if(refresh != 0 && ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(factory, 0)!=0)
+	{
+		// None of the STUN Servers resolved
+		ILibLinkedList_Lock(factory->mStunWaiting);
+		factory->mStunDiscovering = 0;
+		factory->mStunCacheValid = 0;
+		ILibLinkedList_UnLock(factory->mStunWaiting);
+		ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(factory, ILibStun_Results_Unknown, NULL);
+	}
+}
+
 void ILibWrapper_WebRTC_OnStunResult(void* StunModule, ILibStun_Results Result, struct sockaddr_in* PublicIP, void *user)
 {
-	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)user;
-	connection->stunServerFlags[connection->stunIndex] = 1;
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *factory = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)user;
+	struct sockaddr_in6 publicIP;
+	int ttl;
 
-	switch(Result)
+	if(Result == ILibStun_Results_Unknown)
 	{
-		case ILibStun_Results_Unknown:
-			// The STUN Server we used is no good, so try with a different server
-			connection->stunServerFlags[connection->stunIndex] = 2;
-			if(ILibWrapper_WebRTC_PerformStun(connection)!=0 && connection->OnCandidates!=NULL)
-			{
-				// No more STUN servers to try, so give up
-				connection->OnCandidates(connection, NULL);
-			}
-			break;
-		case ILibStun_Results_Public_Interface:
-			if(connection->OnCandidates!=NULL)
-			{
-				connection->OnCandidates(connection, (struct sockaddr_in6*)PublicIP);
-			}
-			break;
-		case ILibStun_Results_No_NAT:
-			// Don't need to do anything if there was no NAT, as the local candidates will be good enough
-			if(connection->OnCandidates!=NULL)
-			{
-				connection->OnCandidates(connection, NULL);
-			}
-			break;
-		default:
-			break;
+		// The STUN Server we used is no good, so try with a different server
+		factory->mStunServerFlags[factory->mStunServerIndex] = 2;
+		if(ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(factory, factory->mStunDiscoveringMapping)==0) {return;}
 	}
+	else
+	{
+		factory->mStunServerFlags[factory->mStunServerIndex] = 1;
+	}
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	factory->mStunDiscovering = 0;
+	ttl = factory->mStunCacheTTL;
+	if(Result == ILibStun_Results_Unknown || ttl <= 0)
+	{
+		// No more STUN servers to try, or caching is disabled
+		factory->mStunCacheValid = 0;
+	}
+	else
+	{
+		factory->mStunCacheValid = 1;
+		factory->mStunCacheResult = Result;
+		factory->mStunCacheExpiration = ILibGetUptime() + (long long)ttl * 1000;
+		factory->mStunCacheInterfaces = ILibWrapper_WebRTC_ConnectionFactory_InterfaceHash();
+		memset(&(factory->mStunCachePublicIP), 0, sizeof(struct sockaddr_in6));
+		if(PublicIP!=NULL) {memcpy(&(factory->mStunCachePublicIP), PublicIP, INET_SOCKADDR_LENGTH(PublicIP->sin_family));}
+	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+	memset(&publicIP, 0, sizeof(struct sockaddr_in6));
+	if(PublicIP!=NULL) {memcpy(&publicIP, PublicIP, INET_SOCKADDR_LENGTH(PublicIP->sin_family));}
+
+	if(Result != ILibStun_Results_Unknown && ttl > 0)
+	{
+		// Refresh ahead of the expiration, so offers never have to wait on a STUN round trip
+		ILibLifeTime_Remove(ILibGetBaseTimer(factory->mChain), factory + 2);
+		ILibLifeTime_AddEx(ILibGetBaseTimer(factory->mChain), factory + 2, ttl * 750, ILibWrapper_WebRTC_ConnectionFactory_OnStunRefresh, NULL);
+	}
+
+	ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(factory, Result, PublicIP != NULL ? &publicIP : NULL);
+
+	// Anyone left needs the other kind of discovery. The STUN client marks itself complete after this returns, so start it from the Chain
+	ILibLifeTime_Remove(ILibGetBaseTimer(factory->mChain), factory + 3);
+	ILibLifeTime_AddEx(ILibGetBaseTimer(factory->mChain), factory + 3, 0, ILibWrapper_WebRTC_ConnectionFactory_OnStunWaiting, NULL);
 }
 
 int ILibWrapper_WebRTC_Connection_IsConnected(ILibWrapper_WebRTC_Connection connection)
@@ -706,6 +899,11 @@ int ILibWrapper_WebRTC_ConnectionFactory_Bucketizer(int index)
 }
 
 ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_CreateConnectionFactory(void* chain, unsigned short localPort)
+{
+	return(ILibWrapper_WebRTC_ConnectionFactory_CreateConnectionFactoryEx(chain, localPort, 0));
+}
+
+ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_CreateConnectionFactoryEx(void* chain, unsigned short localPort, int reusePort)
 {
 	ILibWrapper_WebRTC_ConnectionFactoryStruct *retVal = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)malloc(sizeof(ILibWrapper_WebRTC_ConnectionFactoryStruct));
 	if(retVal==NULL){ILIBCRITICALEXIT(254);}
@@ -716,17 +914,29 @@ ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_Create
 	retVal->Destroy = &ILibWrapper_WebRTC_ConnectionFactory_OnDestroy;
 	ILibWrapper_WebRTC_InitializeCrypto(retVal);
 
-	retVal->mStunModule = ILibStunClient_Start(chain, localPort, &ILibWrapper_WebRTC_OnStunResult);
+	retVal->mStunModule = ILibStunClient_StartEx(chain, localPort, &ILibWrapper_WebRTC_OnStunResult, reusePort);
 	ILibStunClient_SetOptions(retVal->mStunModule, retVal->ctx, retVal->tlsServerCertThumbprint);
 	ILibSCTP_SetCallbacks(retVal->mStunModule, &ILibWrapper_WebRTC_OnConnectSink, &ILibWrapper_WebRTC_OnDataSink, &ILibWrapper_WebRTC_OnSendOKSink);
 	ILibWebRTC_SetCallbacks(retVal->mStunModule, &ILibWrapper_WebRTC_OnDataChannel, &ILibWrapper_WebRTC_OnDataChannelClosed, &ILibWrapper_WebRTC_OnDataChannelAck, &ILibWrapper_WebRTC_OnOfferUpdated);
 	
 	retVal->Connections = ILibSparseArray_Create(ILibWrapper_WebRTC_ConnectionFactory_ConnectionBucketSize, &ILibWrapper_WebRTC_ConnectionFactory_Bucketizer);
 	retVal->mChain = chain;
+	retVal->mStunWaiting = ILibLinkedList_Create();
+	retVal->mStunCacheTTL = ILibWrapper_WebRTC_StunCacheDefaultTTL;
 
 	return(retVal); 
 }
 
+int ILibWrapper_WebRTC_ConnectionFactory_JoinShards(ILibWrapper_WebRTC_ConnectionFactory *factories, int count)
+{
+	void *stunModules[ILibStun_MaxShards];
+	int i;
+
+	if (count < 1 || count > ILibStun_MaxShards) return 1;
+	for (i = 0; i < count; ++i) { stunModules[i] = ((ILibWrapper_WebRTC_ConnectionFactoryStruct*)factories[i])->mStunModule; }
+	return(ILibStunClient_JoinShards(stunModules, count));
+}
+
 int ILibWrapper_WebRTC_Connection_DataChannelBucketizer(int index)
 {
 	return(index & (ILibWrapper_WebRTC_Connection_DataChannelsBucketSize - 1));
@@ -775,7 +985,45 @@ void ILibWrapper_WebRTC_Connection_SetStunServers(ILibWrapper_WebRTC_Connection
 	}
 }
 
-int ILibWrapper_WebRTC_PerformStunEx(ILibWrapper_WebRTC_ConnectionStruct *connection, int MappingDetection)
+// Fingerprint of the local IPv4 interfaces, so the cached server reflexive candidate is dropped when they change
+unsigned int ILibWrapper_WebRTC_ConnectionFactory_InterfaceHash()
+{
+	struct sockaddr_in *addresses = NULL;
+	int i, count = ILibGetLocalIPv4AddressList(&addresses, 0);
+	unsigned int retVal = (unsigned int)count;
+
+	for(i=0;i<count;++i)
+	{
+		retVal = ((retVal << 5) | (retVal >> 27)) ^ (unsigned int)addresses[i].sin_addr.s_addr;
+	}
+	if(addresses!=NULL) {free(addresses);}
+	return(retVal);
+}
+
+// Non zero if the cached discovery result can be used. Called with mStunWaiting locked
+int ILibWrapper_WebRTC_ConnectionFactory_IsStunCacheFresh(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory)
+{
+	if(factory->mStunCacheValid == 0) {return(0);}
+	if(factory->mStunCacheTTL <= 0 || ILibGetUptime() >= factory->mStunCacheExpiration || ILibWrapper_WebRTC_ConnectionFactory_InterfaceHash() != factory->mStunCacheInterfaces)
+	{
+		factory->mStunCacheValid = 0;
+	}
+	return(factory->mStunCacheValid);
+}
+
+// Copies the cached server reflexive candidate, if it's fresh. Returns non zero if there is one
+int ILibWrapper_WebRTC_ConnectionFactory_GetCachedCandidate(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory, struct sockaddr_in6 *candidate)
+{
+	int retVal;
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	retVal = ILibWrapper_WebRTC_ConnectionFactory_IsStunCacheFresh(factory) != 0 && factory->mStunCacheResult == ILibStun_Results_Public_Interface;
+	if(retVal != 0) {memcpy(candidate, &(factory->mStunCachePublicIP), sizeof(struct sockaddr_in6));}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+	return(retVal);
+}
+
+int ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory, int MappingDetection)
 {
 	int i,delimiter;
 	struct sockaddr_in6 stunServer;
@@ -783,58 +1031,102 @@ int ILibWrapper_WebRTC_PerformStunEx(ILibWrapper_WebRTC_ConnectionStruct *connec
 	char temp[255];
 	char *host;
 
-	if(connection->stunServerListLength > 0)
+	for(i=0;i<factory->mStunServerListLength;++i)
 	{
-		for(i=0;i<connection->stunServerListLength;++i)
-		{
-			if(connection->stunServerFlags[i] > 1) {continue;} // 0 = Unknown, 1 = Success, 2 = ERROR
+		if(factory->mStunServerFlags[i] > 1) {continue;} // 0 = Unknown, 1 = Success, 2 = ERROR
 
-			delimiter = ILibString_IndexOf(connection->stunServerList[i], strlen(connection->stunServerList[i]), ":", 1);
-			if(delimiter>0) 
-			{
-				memcpy(temp,connection->stunServerList[i], delimiter);
-				temp[delimiter] = 0;
-				host = temp;
-				port = atoi(connection->stunServerList[i] + delimiter + 1);
-			}
-			else
+		delimiter = ILibString_IndexOf(factory->mStunServerList[i], strlen(factory->mStunServerList[i]), ":", 1);
+		if(delimiter>0) 
+		{
+			memcpy(temp,factory->mStunServerList[i], delimiter);
+			temp[delimiter] = 0;
+			host = temp;
+			port = atoi(factory->mStunServerList[i] + delimiter + 1);
+		}
+		else
+		{
+			host = factory->mStunServerList[i];
+			port = 3478;
+		}
+		if(ILibResolve(host, "http", &stunServer)==0 && stunServer.sin6_family == AF_INET)
+		{
+			// The STUN client only does IPv4, and would never answer for anything else
+			((struct sockaddr_in*)&stunServer)->sin_port = htons(port);
+			factory->mStunServerIndex = i;
+			if(MappingDetection == 0)
 			{
-				host = connection->stunServerList[i];
-				port = 3478;
-			}
-			if(ILibResolve(host, "http", &stunServer)==0)
-			{
-				switch(stunServer.sin6_family)
-				{
-					case AF_INET:
-						((struct sockaddr_in*)&stunServer)->sin_port = htons(port);
-						break;
-					case AF_INET6:
-						stunServer.sin6_port = htons(port);
-						break;
-				}
-				connection->stunIndex = i;
-				if(MappingDetection == 0)
-				{
-					ILibStunClient_PerformStun(connection->mFactory->mStunModule, (struct sockaddr_in*)&stunServer, connection);
-				}
-				else
-				{
-					ILibStunClient_PerformNATBehaviorDiscovery(connection->mFactory->mStunModule, (struct sockaddr_in*)&stunServer, connection);
-				}
-				break;
+				ILibStunClient_PerformStun(factory->mStunModule, (struct sockaddr_in*)&stunServer, factory);
 			}
 			else
 			{
-				connection->stunServerFlags[i] = 2; // Could not resolve, so skip, and use another server
+				ILibStunClient_PerformNATBehaviorDiscovery(factory->mStunModule, (struct sockaddr_in*)&stunServer, factory);
 			}
+			break;
+		}
+		else
+		{
+			factory->mStunServerFlags[i] = 2; // Could not resolve, so skip, and use another server
 		}
-		return(i<connection->stunServerListLength?0:1);
 	}
-	else
+	return(i<factory->mStunServerListLength?0:1);
+}
+
+// Queues the connection for the factory's server reflexive discovery result. A fresh cached result is delivered right away (on the
+// Chain thread), otherwise a discovery is started with the connection's STUN servers, unless one is already running. A NAT behavior
+// discovery is never answered from the cache, and waits for the running discovery to finish if that is a plain one.
+// Returns non zero if the connection has no STUN servers
+int ILibWrapper_WebRTC_PerformStunEx(ILibWrapper_WebRTC_ConnectionStruct *connection, int MappingDetection)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *factory = connection->mFactory;
+	int i, start = 0;
+
+	if(connection->stunServerListLength <= 0) {return(1);}
+
+	ILibLinkedList_Lock(factory->mStunWaiting);
+	ILibLinkedList_Remove_ByData(factory->mStunWaiting, connection);
+	ILibLinkedList_AddTail(factory->mStunWaiting, connection);
+	connection->stunMappingDetection = MappingDetection != 0 ? 1 : 0;
+	if(MappingDetection == 0 && ILibWrapper_WebRTC_ConnectionFactory_IsStunCacheFresh(factory) != 0 && (factory->mStunCacheResult == ILibStun_Results_Public_Interface || factory->mStunCacheResult == ILibStun_Results_No_NAT))
+	{
+		factory->mStunCacheUsed = 1;
+		ILibLifeTime_AddEx(ILibGetBaseTimer(factory->mChain), factory + 1, 0, ILibWrapper_WebRTC_ConnectionFactory_OnStunCached, NULL);
+
+		// The Chain has other timers pending, so adding this one doesn't wake it up
+		if(ILibIsRunningOnChainThread(factory->mChain) == 0) {ILibForceUnBlockChain(factory->mChain);}
+	}
+	else if(factory->mStunDiscovering == 0)
 	{
-		return(1);
+		// Discover with this connection's STUN servers
+		for(i=0;i<factory->mStunServerListLength;++i) {free(factory->mStunServerList[i]);}
+		if(factory->mStunServerList!=NULL) {free(factory->mStunServerList);}
+		if(factory->mStunServerFlags!=NULL) {free(factory->mStunServerFlags);}
+
+		if((factory->mStunServerList = (char**)malloc(connection->stunServerListLength * sizeof(char*)))==NULL){ILIBCRITICALEXIT(254);}
+		if((factory->mStunServerFlags = (char*)malloc(connection->stunServerListLength))==NULL){ILIBCRITICALEXIT(254);}
+		memset(factory->mStunServerFlags, 0, connection->stunServerListLength);
+		factory->mStunServerListLength = connection->stunServerListLength;
+		for(i=0;i<connection->stunServerListLength;++i)
+		{
+			int sz = strlen(connection->stunServerList[i]);
+			if((factory->mStunServerList[i] = (char*)malloc(sz+1))==NULL){ILIBCRITICALEXIT(254);}
+			memcpy(factory->mStunServerList[i], connection->stunServerList[i], sz+1);
+		}
+		factory->mStunDiscovering = 1;
+		factory->mStunDiscoveringMapping = connection->stunMappingDetection;
+		start = 1;
 	}
+	ILibLinkedList_UnLock(factory->mStunWaiting);
+
+	if(start != 0 && ILibWrapper_WebRTC_ConnectionFactory_PerformStunEx(factory, MappingDetection)!=0)
+	{
+		// None of the STUN Servers resolved, so answer everyone that was waiting
+		ILibLinkedList_Lock(factory->mStunWaiting);
+		factory->mStunDiscovering = 0;
+		factory->mStunCacheValid = 0;
+		ILibLinkedList_UnLock(factory->mStunWaiting);
+		ILibWrapper_WebRTC_ConnectionFactory_FlushStunWaiting(factory, ILibStun_Results_Unknown, NULL);
+	}
+	return(0);
 }
 int ILibWrapper_WebRTC_PerformStun(ILibWrapper_WebRTC_ConnectionStruct *connection)
 {
@@ -854,6 +1146,8 @@ char* ILibWrapper_WebRTC_Connection_SetOffer(ILibWrapper_WebRTC_Connection conne
 	char* sdp;
 	int isActive;
 	char *un,*up;
+	struct sockaddr_in6 candidate;
+	char address[255];
 
 	if(obj->remoteOfferBlock!=NULL) {free(obj->remoteOfferBlock);}
 	if(obj->offerBlock!=NULL) {free(obj->offerBlock);}
@@ -863,8 +1157,17 @@ char* ILibWrapper_WebRTC_Connection_SetOffer(ILibWrapper_WebRTC_Connection conne
 	offer[offerLen] = 0;
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->mFactory->mChain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "[ILibWrapperWebRTC] Set ICE/Offer: <br/>%s", offer);
 
-	obj->offerBlockLen = ILibStun_SetIceOffer2(obj->mFactory->mStunModule, obj->remoteOfferBlock, obj->remoteOfferBlockLen, obj->offerBlock != NULL ? obj->localUsername : NULL, obj->offerBlock != NULL ? 8 : 0, obj->offerBlock != NULL ? obj->localPassword : NULL, obj->offerBlock != NULL ? 32 : 0, &obj->offerBlock);
-	ILibWrapper_BlockToSDP(obj->offerBlock, obj->offerBlockLen, obj->isOfferInitiator, &un, &up, &sdp);
+	obj->offerBlockLen = ILibStun_SetIceOffer2(obj->mFactory->mStunModule, obj->remoteOfferBlock, obj->remoteOfferBlockLen, obj->offerBlock != NULL ? obj->localUsername : NULL, obj->offerBlock != NULL ? ILibStun_UsernameLength : 0, obj->offerBlock != NULL ? obj->localPassword : NULL, obj->offerBlock != NULL ? 32 : 0, &obj->offerBlock);
+	if(onCandidates != NULL && ILibWrapper_WebRTC_ConnectionFactory_GetCachedCandidate(obj->mFactory, &candidate) != 0)
+	{
+		// A recent discovery result is cached, so the answer can carry the server reflexive candidate right away
+		ILibInet_ntop2((struct sockaddr*)&candidate, address, 255);
+		ILibWrapper_BlockToSDPEx(obj->offerBlock, obj->offerBlockLen, &un, &up, &sdp, address, ntohs(candidate.sin6_port));
+	}
+	else
+	{
+		ILibWrapper_BlockToSDP(obj->offerBlock, obj->offerBlockLen, obj->isOfferInitiator, &un, &up, &sdp);
+	}
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->mFactory->mChain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "[ILibWrapperWebRTC] Return ICE/Response: <br/>%s", sdp);
 
@@ -912,9 +1215,20 @@ char* ILibWrapper_WebRTC_Connection_GenerateOffer(ILibWrapper_WebRTC_Connection
 	int offerLen = ILibStun_GenerateIceOffer(obj->mFactory->mStunModule, &offer, obj->localUsername, obj->localPassword);
 	char *sdp;
 	char* username,*password;
+	struct sockaddr_in6 candidate;
+	char address[255];
 
 	obj->isOfferInitiator = 1;
-	ILibWrapper_BlockToSDP(offer, offerLen, obj->isOfferInitiator, &username, &password, &sdp);
+	if(onCandidates != NULL && ILibWrapper_WebRTC_ConnectionFactory_GetCachedCandidate(obj->mFactory, &candidate) != 0)
+	{
+		// A recent discovery result is cached, so the offer can carry the server reflexive candidate right away
+		ILibInet_ntop2((struct sockaddr*)&candidate, address, 255);
+		ILibWrapper_BlockToSDPEx(offer, offerLen, &username, &password, &sdp, address, ntohs(candidate.sin6_port));
+	}
+	else
+	{
+		ILibWrapper_BlockToSDP(offer, offerLen, obj->isOfferInitiator, &username, &password, &sdp);
+	}
 
 	free(username);
 	free(password);
@@ -960,6 +1274,48 @@ char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP(ILibWr
 	return(sdp);
 }
 
+char* ILibWrapper_WebRTC_Connection_ServerReflexiveCandidateToSDP(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) connection;
+	char* candidateTemplate = "candidate:%d 1 UDP %d %s %u typ srflx raddr %u.%u.%u.%u rport %u";
+	char address[255];
+	char* candidates;
+	char* line;
+	int usernamelen, passwordlen, dtlshashlen, candidatecount, lineLen;
+
+	if (obj->offerBlock == NULL || candidate == NULL) { return(NULL); }
+
+	// The related address is our first host candidate, the same one ILibWrapper_BlockToSDPEx uses
+	usernamelen = (int)obj->offerBlock[6];
+	passwordlen = (int)obj->offerBlock[7 + usernamelen];
+	dtlshashlen = (int)obj->offerBlock[8 + usernamelen + passwordlen];
+	candidatecount = (int)obj->offerBlock[9 + usernamelen + passwordlen + dtlshashlen];
+	candidates = obj->offerBlock + 10 + usernamelen + passwordlen + dtlshashlen;
+	if (candidatecount == 0) { return(NULL); }
+
+	ILibInet_ntop2((struct sockaddr*)candidate, address, 255);
+	lineLen = (int)strlen(candidateTemplate) + (int)strlen(address) + 64;
+	if ((line = (char*)malloc(lineLen)) == NULL) { ILIBCRITICALEXIT(254); }
+	snprintf(line, lineLen, candidateTemplate, candidatecount, 2128609535 - candidatecount, address, ntohs(candidate->sin6_port), (unsigned char)candidates[0], (unsigned char)candidates[1], (unsigned char)candidates[2], (unsigned char)candidates[3], ntohs(((unsigned short*)(candidates + 4))[0]));
+	return(line);
+}
+
+int ILibWrapper_WebRTC_Connection_AddRemoteCandidate(ILibWrapper_WebRTC_Connection connection, char* candidate, int candidateLen)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) connection;
+	struct sockaddr_in6 remote;
+	char candidateData[6];
+
+	if (ILibWrapper_CandidateToBlock(candidate, candidateLen, candidateData, NULL) != 0) { return(1); }
+
+	memset(&remote, 0, sizeof(struct sockaddr_in6));
+	((struct sockaddr_in*)&remote)->sin_family = AF_INET;
+	memcpy(&(((struct sockaddr_in*)&remote)->sin_addr.s_addr), candidateData, 4);
+	memcpy(&(((struct sockaddr_in*)&remote)->sin_port), candidateData + 4, 2);
+
+	return(ILibStun_AddIceCandidate(obj->mFactory->mStunModule, obj->localUsername, &remote));
+}
+
 void ILibWrapper_WebRTC_Connection_Pause(ILibWrapper_WebRTC_Connection connection)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *cs = (ILibWrapper_WebRTC_ConnectionStruct*)connection;
@@ -1045,6 +1401,45 @@ void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServer(ILibWrapper_WebRTC_Conne
 		ILibWebRTC_SetTurnServer(cf->mStunModule, turnServer, username, usernameLength, password, passwordLength, turnSetting);
 	}
 }
+void ILibWrapper_WebRTC_ConnectionFactory_SetTurnSendQueue(ILibWrapper_WebRTC_ConnectionFactory factory, int limit, ILibTURN_SendQueuePolicies policy)
+{
+	ILibWebRTC_SetTurnSendQueue(((ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory)->mStunModule, limit, policy);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetIceLite(ILibWrapper_WebRTC_ConnectionFactory factory, int enabled)
+{
+	ILibWebRTC_SetIceLite(((ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory)->mStunModule, enabled);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetStunCacheTTL(ILibWrapper_WebRTC_ConnectionFactory factory, int seconds)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *obj = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+
+	ILibLinkedList_Lock(obj->mStunWaiting);
+	obj->mStunCacheTTL = seconds;
+	if(seconds <= 0) {obj->mStunCacheValid = 0;}
+	ILibLinkedList_UnLock(obj->mStunWaiting);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_InvalidateStunCache(ILibWrapper_WebRTC_ConnectionFactory factory)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *obj = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+
+	ILibLinkedList_Lock(obj->mStunWaiting);
+	obj->mStunCacheValid = 0;
+	ILibLinkedList_UnLock(obj->mStunWaiting);
+}
+ILibStun_Results ILibWrapper_WebRTC_ConnectionFactory_GetStunResult(ILibWrapper_WebRTC_ConnectionFactory factory, struct sockaddr_in6 *publicIP)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *obj = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibStun_Results retVal = ILibStun_Results_Unknown;
+
+	ILibLinkedList_Lock(obj->mStunWaiting);
+	if(ILibWrapper_WebRTC_ConnectionFactory_IsStunCacheFresh(obj) != 0)
+	{
+		retVal = obj->mStunCacheResult;
+		if(publicIP != NULL) {memcpy(publicIP, &(obj->mStunCachePublicIP), sizeof(struct sockaddr_in6));}
+	}
+	ILibLinkedList_UnLock(obj->mStunWaiting);
+	return(retVal);
+}
 void ILibWrapper_WebRTC_Connection_SetUserData(ILibWrapper_WebRTC_Connection connection, void *user1, void *user2, void *user3)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*)connection;
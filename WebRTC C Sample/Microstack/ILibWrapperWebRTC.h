@@ -67,9 +67,32 @@ typedef void(*ILibWrapper_WebRTC_Connection_Debug_OnEvent)(ILibWrapper_WebRTC_Co
 // Creates a Factory object that can create WebRTC Connection objects.
 ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_CreateConnectionFactory(void* chain, unsigned short localPort);
 
+// Creates a Factory that can share localPort with Factories on other chains (SO_REUSEPORT), so connections can be spread across threads/cores
+ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_CreateConnectionFactoryEx(void* chain, unsigned short localPort, int reusePort);
+
+// Groups Factories created with reusePort on the same port, so each peer is handled by the Factory that created its connection. Call before starting the chains. Returns 0 on success
+int ILibWrapper_WebRTC_ConnectionFactory_JoinShards(ILibWrapper_WebRTC_ConnectionFactory *factories, int count);
+
 // Sets the TURN server to use for all WebRTC connections
 void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServer(ILibWrapper_WebRTC_ConnectionFactory factory, struct sockaddr_in6* turnServer, char* username, int usernameLength, char* password, int passwordLength, ILibWebRTC_TURN_ConnectFlags turnSetting);
 
+// Bounds the queue that holds relayed packets while the TURN TCP connection is backed up (limit in bytes, 0 for the default of about two SCTP windows).
+// While it's filling, data channel sends return ILibTransport_DoneState_INCOMPLETE and the connection's OnSendOK follows once it drains
+void ILibWrapper_WebRTC_ConnectionFactory_SetTurnSendQueue(ILibWrapper_WebRTC_ConnectionFactory factory, int limit, ILibTURN_SendQueuePolicies policy);
+
+// Makes every connection from this Factory ICE-lite (a=ice-lite): only answers the peer's connectivity checks, for Factories bound to a public address. Call before creating connections
+void ILibWrapper_WebRTC_ConnectionFactory_SetIceLite(ILibWrapper_WebRTC_ConnectionFactory factory, int enabled);
+
+// Server reflexive discovery is shared by the connections of a Factory, and the result is cached for this many seconds (default 120), and refreshed
+// in the background while it's in use, so offers can carry the server reflexive candidate right away. 0 disables the cache
+void ILibWrapper_WebRTC_ConnectionFactory_SetStunCacheTTL(ILibWrapper_WebRTC_ConnectionFactory factory, int seconds);
+
+// Drops the cached server reflexive candidate, ie: when the OS reports a network change. (Changes to the local IPv4 addresses are also detected when the cache is read)
+void ILibWrapper_WebRTC_ConnectionFactory_InvalidateStunCache(ILibWrapper_WebRTC_ConnectionFactory factory);
+
+// Returns the cached discovery result (ILibStun_Results_Unknown if there isn't a fresh one), and copies the public address into publicIP if it's not NULL
+ILibStun_Results ILibWrapper_WebRTC_ConnectionFactory_GetStunResult(ILibWrapper_WebRTC_ConnectionFactory factory, struct sockaddr_in6 *publicIP);
+
 // Creates an unconnected WebRTC Connection 
 ILibWrapper_WebRTC_Connection ILibWrapper_WebRTC_ConnectionFactory_CreateConnection(ILibWrapper_WebRTC_ConnectionFactory factory, ILibWrapper_WebRTC_Connection_OnConnect OnConnectHandler, ILibWrapper_WebRTC_Connection_OnDataChannel OnDataChannelHandler, ILibWrapper_WebRTC_Connection_OnSendOK OnConnectionSendOK);
 
@@ -117,6 +140,13 @@ char* ILibWrapper_WebRTC_Connection_SetOffer(ILibWrapper_WebRTC_Connection conne
 // Generate an udpated SDP offer containing the candidate specified
 char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate);
 
+// Trickle ICE: The offers above are returned right away with the host candidates, and onCandidates is called with each server reflexive candidate
+// as it is discovered (NULL when there are no more). This formats one for the peer as an SDP candidate line ("candidate:..."). Must be freed
+char* ILibWrapper_WebRTC_Connection_ServerReflexiveCandidateToSDP(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate);
+
+// Trickle ICE: Adds a candidate the peer sent after its offer/answer ("candidate:..." or "a=candidate:..."), and starts checking it. Returns 0 on success
+int ILibWrapper_WebRTC_Connection_AddRemoteCandidate(ILibWrapper_WebRTC_Connection connection, char* candidate, int candidateLen);
+
 // Stop reading inbound data
 void ILibWrapper_WebRTC_Connection_Pause(ILibWrapper_WebRTC_Connection connection); 
 